@@ -0,0 +1,709 @@
+#include "../jesenrpc.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Not assert(): the calls must still run in NDEBUG (Release) builds. */
+#define EXPECT_OK(expr)                                                        \
+  do {                                                                         \
+    if ((expr) != JESENRPC_ERR_NONE) {                                         \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #expr);        \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define BENCH_ITERATIONS 200000
+
+static size_t g_alloc_count = 0;
+
+#ifdef JESENRPC_BENCH_COUNT_ALLOCS
+/* Linked with -Wl,--wrap so every allocation made by jesenrpc and jesen is
+ * routed through these counters. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+  ++g_alloc_count;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  ++g_alloc_count;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  ++g_alloc_count;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) { __real_free(ptr); }
+#endif
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* bytes is the payload size handled per operation, or 0 when throughput is
+ * meaningless (e.g. method lookup). */
+static void report(const char *name, size_t iterations, double elapsed_ns,
+                   size_t bytes, size_t allocs) {
+  double ns_per_op = elapsed_ns / (double)iterations;
+  char throughput[32] = "-";
+  if (bytes > 0) {
+    snprintf(throughput, sizeof throughput, "%.1f MB/s",
+             (double)bytes * 1e3 / ns_per_op);
+  }
+#ifdef JESENRPC_BENCH_COUNT_ALLOCS
+  printf("%-40s %10.1f ns/op %14s %8.2f allocs/op\n", name, ns_per_op,
+         throughput, (double)allocs / (double)iterations);
+#else
+  (void)allocs;
+  printf("%-40s %10.1f ns/op %14s %15s\n", name, ns_per_op, throughput,
+         "allocs/op n/a");
+#endif
+}
+
+/* Deterministic corpus. Every payload is generated from fixed values so runs
+ * are comparable across machines and library versions. */
+
+#define BENCH_BATCH_MAX 256
+
+static jesenrpc_request_t *corpus_request(size_t index) {
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_number(&id, (int64_t)index + 1));
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create_with_id("subtract", &id, &req));
+  jesen_node_t *params = NULL;
+  EXPECT_OK(jesen_array_create(&params));
+  EXPECT_OK(jesen_array_add_int32(params, (int32_t)(index * 7 % 100)));
+  EXPECT_OK(jesen_array_add_int32(params, 23));
+  EXPECT_OK(jesenrpc_request_set_params(req, params));
+  return req;
+}
+
+/* Every fourth response is an error so batches mix both shapes. */
+static jesenrpc_response_t *corpus_response(size_t index) {
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_number(&id, (int64_t)index + 1));
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create_with_id(&id, &resp));
+  if (index % 4 == 3) {
+    jesenrpc_error_object_t *err_obj = NULL;
+    EXPECT_OK(jesenrpc_error_object_create(
+        JESENRPC_JSONRPC_ERROR_INVALID_PARAMS, "Invalid params", &err_obj));
+    EXPECT_OK(jesenrpc_response_set_error(resp, err_obj));
+  } else {
+    jesen_node_t *result = NULL;
+    EXPECT_OK(jesen_object_create(&result));
+    EXPECT_OK(jesen_object_add_int32(result, "value", (int32_t)index));
+    EXPECT_OK(jesenrpc_response_set_result(resp, result));
+  }
+  return resp;
+}
+
+static void bench_request_serialize(const char *name, bool with_params) {
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_number(&id, 42));
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create_with_id("subtract", &id, &req));
+  if (with_params) {
+    jesen_node_t *params = NULL;
+    EXPECT_OK(jesen_array_create(&params));
+    EXPECT_OK(jesen_array_add_int32(params, 42));
+    EXPECT_OK(jesen_array_add_int32(params, 23));
+    EXPECT_OK(jesenrpc_request_set_params(req, params));
+  }
+
+  char buf[256];
+  size_t len = 0;
+  EXPECT_OK(jesenrpc_request_serialize_len(req, buf, sizeof buf, &len));
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    EXPECT_OK(jesenrpc_request_serialize(req, buf, sizeof buf));
+  }
+  double elapsed = now_ns() - start;
+  report(name, BENCH_ITERATIONS, elapsed, len, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_request_destroy(req));
+}
+
+static void bench_response_serialize(const char *name, bool with_error) {
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_string(&id, "req-0001", 8));
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create_with_id(&id, &resp));
+  EXPECT_OK(jesenrpc_id_destroy(&id));
+  if (with_error) {
+    jesenrpc_error_object_t *err_obj = NULL;
+    EXPECT_OK(jesenrpc_error_object_create(
+        JESENRPC_JSONRPC_ERROR_METHOD_NOT_FOUND, "Method not found", &err_obj));
+    EXPECT_OK(jesenrpc_response_set_error(resp, err_obj));
+  } else {
+    jesen_node_t *result = NULL;
+    EXPECT_OK(jesen_object_create(&result));
+    EXPECT_OK(jesen_object_add_int32(result, "value", 19));
+    EXPECT_OK(jesenrpc_response_set_result(resp, result));
+  }
+
+  char buf[256];
+  size_t len = 0;
+  EXPECT_OK(jesenrpc_response_serialize_len(resp, buf, sizeof buf, &len));
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    EXPECT_OK(jesenrpc_response_serialize(resp, buf, sizeof buf));
+  }
+  double elapsed = now_ns() - start;
+  report(name, BENCH_ITERATIONS, elapsed, len, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+}
+
+/* A cached result spliced in as text versus the same result as a tree. */
+static void bench_response_serialize_raw(const char *name) {
+  static const char cached[] = "{\"value\":19}";
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_string(&id, "req-0001", 8));
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create_with_id(&id, &resp));
+  EXPECT_OK(jesenrpc_id_destroy(&id));
+  EXPECT_OK(
+      jesenrpc_response_set_result_raw(resp, cached, sizeof cached - 1));
+
+  char buf[256];
+  size_t len = 0;
+  EXPECT_OK(jesenrpc_response_serialize_len(resp, buf, sizeof buf, &len));
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    EXPECT_OK(jesenrpc_response_serialize(resp, buf, sizeof buf));
+  }
+  double elapsed = now_ns() - start;
+  report(name, BENCH_ITERATIONS, elapsed, len, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+}
+
+#define BENCH_LARGE_RESULT_LEN (64 * 1024)
+
+/* A 64 KiB pre-encoded result, copied into one buffer or handed out as a
+ * separate segment. */
+static void bench_response_serialize_large(const char *name, bool use_iov) {
+  static char result[BENCH_LARGE_RESULT_LEN];
+  result[0] = '"';
+  memset(result + 1, 'x', sizeof result - 2);
+  result[sizeof result - 1] = '"';
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create(1, &resp));
+  EXPECT_OK(jesenrpc_response_set_result_raw(resp, result, sizeof result));
+
+  jesenrpc_buf_t buf;
+  EXPECT_OK(jesenrpc_buf_init(&buf));
+  jesenrpc_iovec_t iov[3];
+  size_t iov_count = 0;
+  size_t len = 0;
+  size_t iterations = BENCH_ITERATIONS / 10;
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (use_iov) {
+      EXPECT_OK(
+          jesenrpc_response_serialize_iov(resp, &buf, iov, 3, &iov_count));
+    } else {
+      EXPECT_OK(jesenrpc_buf_clear(&buf));
+      EXPECT_OK(jesenrpc_response_serialize_to_buf(resp, &buf));
+    }
+  }
+  double elapsed = now_ns() - start;
+  if (use_iov) {
+    for (size_t i = 0; i < iov_count; ++i) {
+      len += iov[i].iov_len;
+    }
+  } else {
+    len = buf.len;
+  }
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_buf_destroy(&buf));
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+}
+
+static void bench_request_parse(const char *name, jesenrpc_arena_t *arena,
+                                uint32_t flags) {
+  static const char payload[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":\"req-0001\",\"method\":\"subtract\","
+      "\"params\":[42,23]}";
+  jesenrpc_parse_options_t opts = {0};
+  opts.arena = arena;
+  opts.flags = flags;
+  char buf[sizeof payload];
+  size_t len = sizeof payload - 1;
+
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    memcpy(buf, payload, sizeof payload);
+    jesenrpc_request_t *req = NULL;
+    EXPECT_OK(jesenrpc_request_parse_ex(buf, sizeof payload - 1, &opts, &req));
+    if (arena) {
+      EXPECT_OK(jesenrpc_arena_reset(arena));
+    } else {
+      EXPECT_OK(jesenrpc_request_destroy(req));
+    }
+  }
+  double elapsed = now_ns() - start;
+  report(name, BENCH_ITERATIONS, elapsed, len, g_alloc_count - allocs_before);
+}
+
+#define BENCH_MAX_METHODS 512
+
+static jesenrpc_err_t bench_noop_handler(const jesenrpc_request_t *request,
+                                         jesenrpc_response_t *response,
+                                         void *user_data) {
+  (void)request;
+  (void)response;
+  (void)user_data;
+  return JESENRPC_ERR_NONE;
+}
+
+/* Compares the frozen perfect-hash table against the strcmp chain users
+ * otherwise write. Queries walk all names in a scattered order, so the
+ * linear scan pays its average cost of method_count / 2 compares. */
+static void bench_method_lookup(size_t method_count) {
+  static char names[BENCH_MAX_METHODS][32];
+  assert(method_count <= BENCH_MAX_METHODS);
+  jesenrpc_dispatcher_t dispatcher;
+  EXPECT_OK(jesenrpc_dispatcher_init(&dispatcher));
+  for (size_t i = 0; i < method_count; ++i) {
+    snprintf(names[i], sizeof names[i], "service.method_%zu", i);
+    EXPECT_OK(jesenrpc_dispatcher_register(&dispatcher, names[i],
+                                           bench_noop_handler, names[i]));
+  }
+  EXPECT_OK(jesenrpc_dispatcher_freeze(&dispatcher));
+
+  char name[64];
+  size_t sink = 0;
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    const char *query = names[(i * 7919) % method_count];
+    void *user_data = NULL;
+    jesenrpc_dispatcher_lookup(&dispatcher, query, NULL, &user_data);
+    sink += (size_t)user_data;
+  }
+  double elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "method_lookup/perfect_hash/%zu", method_count);
+  report(name, BENCH_ITERATIONS, elapsed, 0, g_alloc_count - allocs_before);
+
+  allocs_before = g_alloc_count;
+  start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    const char *query = names[(i * 7919) % method_count];
+    for (size_t m = 0; m < method_count; ++m) {
+      if (strcmp(names[m], query) == 0) {
+        sink += (size_t)names[m];
+        break;
+      }
+    }
+  }
+  elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "method_lookup/linear/%zu", method_count);
+  report(name, BENCH_ITERATIONS, elapsed, 0, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+  if (sink == 0) {
+    printf("unexpected empty lookup result\n");
+  }
+}
+
+static void bench_response_parse(const char *name, bool with_error) {
+  static const char result_payload[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":\"req-0001\",\"result\":{\"value\":19}}";
+  static const char error_payload[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":\"req-0001\",\"error\":{\"code\":-32601,"
+      "\"message\":\"Method not found\",\"data\":{\"method\":\"subtract\"}}}";
+  const char *payload = with_error ? error_payload : result_payload;
+  size_t len = strlen(payload);
+  char buf[sizeof error_payload];
+
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    memcpy(buf, payload, len + 1);
+    jesenrpc_response_t *resp = NULL;
+    EXPECT_OK(jesenrpc_response_parse(buf, len, &resp));
+    EXPECT_OK(jesenrpc_response_destroy(resp));
+  }
+  double elapsed = now_ns() - start;
+  report(name, BENCH_ITERATIONS, elapsed, len, g_alloc_count - allocs_before);
+}
+
+/* Large batches run fewer iterations so every case takes similar time. */
+static size_t batch_iterations(size_t batch_size) {
+  size_t iterations = BENCH_ITERATIONS / batch_size;
+  return iterations < 200 ? 200 : iterations;
+}
+
+static void bench_request_batch(size_t batch_size) {
+  jesenrpc_request_t *requests[BENCH_BATCH_MAX];
+  assert(batch_size <= BENCH_BATCH_MAX);
+  for (size_t i = 0; i < batch_size; ++i) {
+    requests[i] = corpus_request(i);
+  }
+  size_t len = 0;
+  EXPECT_OK(jesenrpc_request_batch_serialize_len(requests, batch_size, NULL, 0,
+                                                 &len));
+  char *payload = (char *)malloc(len + 1);
+  char *buf = (char *)malloc(len + 1);
+  assert(payload && buf);
+  EXPECT_OK(jesenrpc_request_batch_serialize(requests, batch_size, payload,
+                                             len + 1));
+
+  char name[64];
+  size_t iterations = batch_iterations(batch_size);
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    EXPECT_OK(jesenrpc_request_batch_serialize(requests, batch_size, buf,
+                                               len + 1));
+  }
+  double elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "request_batch_serialize/%zu", batch_size);
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  allocs_before = g_alloc_count;
+  start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    memcpy(buf, payload, len + 1);
+    jesenrpc_request_batch_t batch;
+    EXPECT_OK(jesenrpc_request_batch_parse(buf, len, &batch));
+    EXPECT_OK(jesenrpc_request_batch_destroy(&batch));
+  }
+  elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "request_batch_parse/%zu", batch_size);
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  for (size_t i = 0; i < batch_size; ++i) {
+    EXPECT_OK(jesenrpc_request_destroy(requests[i]));
+  }
+  free(buf);
+  free(payload);
+}
+
+static void bench_response_batch(size_t batch_size) {
+  jesenrpc_response_t *responses[BENCH_BATCH_MAX];
+  assert(batch_size <= BENCH_BATCH_MAX);
+  for (size_t i = 0; i < batch_size; ++i) {
+    responses[i] = corpus_response(i);
+  }
+  size_t len = 0;
+  EXPECT_OK(jesenrpc_response_batch_serialize_len(responses, batch_size, NULL,
+                                                  0, &len));
+  char *payload = (char *)malloc(len + 1);
+  char *buf = (char *)malloc(len + 1);
+  assert(payload && buf);
+  EXPECT_OK(jesenrpc_response_batch_serialize(responses, batch_size, payload,
+                                              len + 1));
+
+  char name[64];
+  size_t iterations = batch_iterations(batch_size);
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    EXPECT_OK(jesenrpc_response_batch_serialize(responses, batch_size, buf,
+                                                len + 1));
+  }
+  double elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "response_batch_serialize/%zu", batch_size);
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  allocs_before = g_alloc_count;
+  start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    memcpy(buf, payload, len + 1);
+    jesenrpc_response_batch_t batch;
+    EXPECT_OK(jesenrpc_response_batch_parse(buf, len, &batch));
+    EXPECT_OK(jesenrpc_response_batch_destroy(&batch));
+  }
+  elapsed = now_ns() - start;
+  snprintf(name, sizeof name, "response_batch_parse/%zu", batch_size);
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  for (size_t i = 0; i < batch_size; ++i) {
+    EXPECT_OK(jesenrpc_response_destroy(responses[i]));
+  }
+  free(buf);
+  free(payload);
+}
+
+static void bench_peek_kind(const char *name, size_t batch_size,
+                            jesenrpc_message_kind_t expected) {
+  jesenrpc_buf_t payload;
+  EXPECT_OK(jesenrpc_buf_init(&payload));
+  jesenrpc_request_t *requests[BENCH_BATCH_MAX];
+  assert(batch_size <= BENCH_BATCH_MAX);
+  for (size_t i = 0; i < batch_size; ++i) {
+    requests[i] = corpus_request(i);
+  }
+  if (expected == JESENRPC_MESSAGE_RESPONSE_SINGLE) {
+    jesenrpc_response_t *resp = corpus_response(3);
+    EXPECT_OK(jesenrpc_response_serialize_to_buf(resp, &payload));
+    EXPECT_OK(jesenrpc_response_destroy(resp));
+  } else if (expected == JESENRPC_MESSAGE_REQUEST_BATCH) {
+    EXPECT_OK(jesenrpc_request_batch_serialize_to_buf(requests, batch_size,
+                                                      &payload));
+  } else {
+    EXPECT_OK(jesenrpc_request_serialize_to_buf(requests[0], &payload));
+  }
+  size_t len = payload.len;
+  char *buf = (char *)malloc(len + 1);
+  assert(buf);
+
+  size_t iterations = batch_iterations(batch_size);
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    memcpy(buf, payload.data, len + 1);
+    jesenrpc_message_kind_t kind = JESENRPC_MESSAGE_UNKNOWN;
+    EXPECT_OK(jesenrpc_message_peek_kind(buf, len, &kind));
+    if (kind != expected) {
+      fprintf(stderr, "%s: unexpected kind %d\n", name, (int)kind);
+      abort();
+    }
+  }
+  double elapsed = now_ns() - start;
+  report(name, iterations, elapsed, len, g_alloc_count - allocs_before);
+
+  for (size_t i = 0; i < batch_size; ++i) {
+    EXPECT_OK(jesenrpc_request_destroy(requests[i]));
+  }
+  free(buf);
+  EXPECT_OK(jesenrpc_buf_destroy(&payload));
+}
+
+/* Replays a capture of BENCH_ITERATIONS lines, alternating requests and
+ * responses, in one pass over the buffer like a mapped file would be. */
+static void bench_ndjson_replay(const char *name, jesenrpc_arena_t *arena,
+                                uint32_t flags) {
+  jesenrpc_buf_t capture;
+  EXPECT_OK(jesenrpc_buf_init(&capture));
+  for (size_t i = 0; i < 64; ++i) {
+    if (i % 2 == 0) {
+      jesenrpc_request_t *req = corpus_request(i);
+      EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &capture));
+      EXPECT_OK(jesenrpc_request_destroy(req));
+    } else {
+      jesenrpc_response_t *resp = corpus_response(i);
+      EXPECT_OK(jesenrpc_response_serialize_to_buf(resp, &capture));
+      EXPECT_OK(jesenrpc_response_destroy(resp));
+    }
+    EXPECT_OK(jesenrpc_buf_reserve(&capture, capture.len + 2));
+    capture.data[capture.len++] = '\n';
+    capture.data[capture.len] = '\0';
+  }
+  size_t len = capture.len * (BENCH_ITERATIONS / 64);
+  char *replay = (char *)malloc(len + 1);
+  assert(replay);
+  for (size_t off = 0; off < len; off += capture.len) {
+    memcpy(replay + off, capture.data, capture.len);
+  }
+  replay[len] = '\0';
+  jesenrpc_parse_options_t opts = {0};
+  opts.arena = arena;
+  opts.flags = flags;
+
+  size_t messages = 0;
+  size_t offset = 0;
+  size_t allocs_before = g_alloc_count;
+  double start = now_ns();
+  for (;;) {
+    jesenrpc_message_t msg;
+    EXPECT_OK(jesenrpc_ndjson_parse_next(replay, len, &offset, &opts, &msg));
+    if (msg.kind == JESENRPC_MESSAGE_UNKNOWN) {
+      break;
+    }
+    ++messages;
+    if (arena) {
+      EXPECT_OK(jesenrpc_arena_reset(arena));
+    } else {
+      EXPECT_OK(jesenrpc_message_destroy(&msg));
+    }
+  }
+  double elapsed = now_ns() - start;
+  report(name, messages, elapsed, len / messages,
+         g_alloc_count - allocs_before);
+
+  free(replay);
+  EXPECT_OK(jesenrpc_buf_destroy(&capture));
+}
+
+static void bench_count_completion(const jesenrpc_response_t *response,
+                                   void *user_data) {
+  (void)response;
+  ++*(size_t *)user_data;
+}
+
+/* One track plus one complete per op with in_flight calls outstanding. The
+ * first round warms the pool, so later rounds should not allocate. With
+ * timeouts, every call gets a deadline up to 30000 ticks out; a quarter of
+ * them are left to expire through jesenrpc_client_advance(). */
+static void bench_client_track_complete(size_t in_flight, bool timeouts) {
+  jesenrpc_client_t client;
+  EXPECT_OK(jesenrpc_client_init(&client, 0));
+  jesenrpc_response_t resp = {.jsonrpc = JESENRPC_JSONRPC_VERSION};
+  resp.id.kind = JESENRPC_ID_NUMBER;
+  size_t completed = 0;
+  size_t rounds = BENCH_ITERATIONS * 5 / in_flight + 1;
+
+  size_t allocs_before = 0;
+  double start = 0;
+  for (size_t round = 0; round <= rounds; ++round) {
+    if (round == 1) {
+      allocs_before = g_alloc_count;
+      start = now_ns();
+    }
+    int64_t first = (int64_t)(round * in_flight) + 1;
+    for (size_t i = 0; i < in_flight; ++i) {
+      jesenrpc_id_t id;
+      EXPECT_OK(jesenrpc_client_next_id(&client, &id));
+      if (timeouts) {
+        EXPECT_OK(jesenrpc_client_track_timeout(
+            &client, &id, (i * 7919) % 30000 + 1, bench_count_completion,
+            &completed));
+      } else {
+        EXPECT_OK(jesenrpc_client_track(&client, &id, bench_count_completion,
+                                        &completed));
+      }
+    }
+    for (size_t i = 0; i < in_flight; ++i) {
+      if (timeouts && i % 4 == 0) {
+        continue;
+      }
+      resp.id.value.number = first + (int64_t)((i * 7919) % in_flight);
+      EXPECT_OK(jesenrpc_client_complete(&client, &resp));
+    }
+    if (timeouts) {
+      EXPECT_OK(jesenrpc_client_advance(&client, client.now + 30001, NULL));
+    }
+  }
+  double elapsed = now_ns() - start;
+  char name[64];
+  snprintf(name, sizeof name, "client_track_complete/%s%zu",
+           timeouts ? "timeout/" : "", in_flight);
+  report(name, rounds * in_flight, elapsed, 0, g_alloc_count - allocs_before);
+
+  EXPECT_OK(jesenrpc_client_destroy(&client));
+  if (completed != (rounds + 1) * in_flight) {
+    fprintf(stderr, "%s: lost completions\n", name);
+    abort();
+  }
+}
+
+/* One op creates and destroys a request, its response and an error object,
+ * with live triples kept alive in a ring so frees lag allocations. A ring
+ * larger than the per-thread pool caches spills into the shared depot. */
+static void bench_struct_churn(size_t live) {
+  jesenrpc_request_t **requests =
+      (jesenrpc_request_t **)calloc(live, sizeof(*requests));
+  jesenrpc_response_t **responses =
+      (jesenrpc_response_t **)calloc(live, sizeof(*responses));
+  if (!requests || !responses) {
+    abort();
+  }
+  jesenrpc_id_t id = {.kind = JESENRPC_ID_NUMBER};
+  size_t iterations = BENCH_ITERATIONS * 5;
+
+  size_t allocs_before = 0;
+  double start = 0;
+  for (size_t i = 0; i < iterations + live; ++i) {
+    if (i == live) {
+      allocs_before = g_alloc_count;
+      start = now_ns();
+    }
+    size_t slot = i % live;
+    if (requests[slot]) {
+      EXPECT_OK(jesenrpc_response_destroy(responses[slot]));
+      EXPECT_OK(jesenrpc_request_destroy(requests[slot]));
+    }
+    id.value.number = (int64_t)i;
+    EXPECT_OK(jesenrpc_request_create_with_id("churn", &id, &requests[slot]));
+    EXPECT_OK(
+        jesenrpc_response_create_for_request(requests[slot], &responses[slot]));
+    jesenrpc_error_object_t *error = NULL;
+    EXPECT_OK(jesenrpc_error_object_create(-32000, "busy", &error));
+    EXPECT_OK(jesenrpc_response_set_error(responses[slot], error));
+  }
+  double elapsed = now_ns() - start;
+  char name[64];
+  snprintf(name, sizeof name, "struct_churn/live_%zu", live);
+  report(name, iterations, elapsed, 0, g_alloc_count - allocs_before);
+
+  for (size_t slot = 0; slot < live; ++slot) {
+    EXPECT_OK(jesenrpc_response_destroy(responses[slot]));
+    EXPECT_OK(jesenrpc_request_destroy(requests[slot]));
+  }
+  free(requests);
+  free(responses);
+}
+
+int main(void) {
+  bench_request_serialize("request_serialize/notification_envelope", false);
+  bench_request_serialize("request_serialize/with_params", true);
+  bench_response_serialize("response_serialize/result", false);
+  bench_response_serialize("response_serialize/error", true);
+  bench_response_serialize_raw("response_serialize/raw_result");
+  bench_response_serialize_large("response_serialize/64k_raw/to_buf", false);
+  bench_response_serialize_large("response_serialize/64k_raw/iov", true);
+
+  bench_request_parse("request_parse/heap", NULL, 0);
+  bench_request_parse("request_parse/in_situ", NULL, JESENRPC_PARSE_IN_SITU);
+  jesenrpc_arena_t arena;
+  EXPECT_OK(jesenrpc_arena_init(&arena, 0));
+  bench_request_parse("request_parse/lazy_params", NULL,
+                      JESENRPC_PARSE_LAZY_PARAMS);
+  bench_request_parse("request_parse/arena", &arena, 0);
+  bench_request_parse("request_parse/arena_in_situ", &arena,
+                      JESENRPC_PARSE_IN_SITU);
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+
+  bench_response_parse("response_parse/result", false);
+  bench_response_parse("response_parse/error", true);
+
+  static const size_t batch_sizes[] = {1, 16, BENCH_BATCH_MAX};
+  for (size_t i = 0; i < sizeof batch_sizes / sizeof batch_sizes[0]; ++i) {
+    bench_request_batch(batch_sizes[i]);
+    bench_response_batch(batch_sizes[i]);
+  }
+
+  bench_peek_kind("peek_kind/request", 1, JESENRPC_MESSAGE_REQUEST_SINGLE);
+  bench_peek_kind("peek_kind/response", 1, JESENRPC_MESSAGE_RESPONSE_SINGLE);
+  bench_peek_kind("peek_kind/request_batch/256", BENCH_BATCH_MAX,
+                  JESENRPC_MESSAGE_REQUEST_BATCH);
+
+  EXPECT_OK(jesenrpc_arena_init(&arena, 0));
+  bench_ndjson_replay("ndjson_replay/heap", NULL, 0);
+  bench_ndjson_replay("ndjson_replay/arena_in_situ", &arena,
+                      JESENRPC_PARSE_IN_SITU);
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+
+  bench_method_lookup(16);
+  bench_method_lookup(300);
+
+  bench_client_track_complete(1000, false);
+  bench_client_track_complete(100000, false);
+  bench_client_track_complete(1000, true);
+  bench_client_track_complete(100000, true);
+
+  bench_struct_churn(1);
+  bench_struct_churn(4096);
+  return 0;
+}
@@ -0,0 +1,176 @@
+/* Loopback throughput of the socket server backends. The server runs on its
+ * own thread; the main thread keeps a window of pipelined pings outstanding on
+ * every connection and counts replies. */
+#include "../jesenrpc_server.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Not assert(): the calls must still run in NDEBUG (Release) builds. */
+#define EXPECT_OK(expr)                                                        \
+  do {                                                                         \
+    if ((expr) != JESENRPC_ERR_NONE) {                                         \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #expr);        \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define BENCH_REQUESTS 400000
+#define BENCH_MAX_CONNECTIONS 64
+
+static const char PING[] =
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"ping\"}\n";
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static jesenrpc_err_t ping_handler(const jesenrpc_request_t *request,
+                                   jesenrpc_response_t *response,
+                                   void *user_data) {
+  (void)request;
+  (void)user_data;
+  if (!response) {
+    return JESENRPC_ERR_NONE;
+  }
+  return jesenrpc_response_set_result_raw(response, "\"pong\"", 6);
+}
+
+static void *serve(void *server) {
+  EXPECT_OK(jesenrpc_server_run((jesenrpc_server_t *)server));
+  return NULL;
+}
+
+static int connect_loopback(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("connect");
+    abort();
+  }
+  return fd;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      perror("send");
+      abort();
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+/* Reads until count replies (newlines) have arrived. */
+static void recv_replies(int fd, size_t count) {
+  char buf[64 * 1024];
+  while (count > 0) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      perror("recv");
+      abort();
+    }
+    for (ssize_t i = 0; i < n; ++i) {
+      count -= buf[i] == '\n';
+    }
+  }
+}
+
+static void bench_backend(const jesenrpc_dispatcher_t *dispatcher,
+                          jesenrpc_server_backend_t backend, const char *name,
+                          size_t connections, size_t depth) {
+  jesenrpc_server_options_t options = {.backend = backend};
+  jesenrpc_server_t *server = NULL;
+  jesenrpc_err_t err = jesenrpc_server_create(dispatcher, &options, &server);
+  if (err == JESENRPC_ERR_IO) {
+    printf("%-40s %s\n", name, "unavailable");
+    return;
+  }
+  EXPECT_OK(err);
+  uint16_t port = 0;
+  EXPECT_OK(jesenrpc_server_listen_tcp(server, "127.0.0.1", 0, &port));
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, serve, server) != 0) {
+    abort();
+  }
+
+  int fds[BENCH_MAX_CONNECTIONS];
+  for (size_t c = 0; c < connections; ++c) {
+    fds[c] = connect_loopback(port);
+  }
+  size_t window_len = depth * (sizeof(PING) - 1);
+  char *window = (char *)malloc(window_len);
+  for (size_t i = 0; i < depth; ++i) {
+    memcpy(window + i * (sizeof(PING) - 1), PING, sizeof(PING) - 1);
+  }
+
+  size_t rounds = BENCH_REQUESTS / (connections * depth);
+  double start = now_ns();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t c = 0; c < connections; ++c) {
+      send_all(fds[c], window, window_len);
+    }
+    for (size_t c = 0; c < connections; ++c) {
+      recv_replies(fds[c], depth);
+    }
+  }
+  double elapsed = now_ns() - start;
+  size_t requests = rounds * connections * depth;
+  printf("%-40s %10.0f req/s %10.1f ns/req\n", name,
+         (double)requests * 1e9 / elapsed, elapsed / (double)requests);
+
+  free(window);
+  for (size_t c = 0; c < connections; ++c) {
+    close(fds[c]);
+  }
+  EXPECT_OK(jesenrpc_server_stop(server));
+  pthread_join(thread, NULL);
+  EXPECT_OK(jesenrpc_server_destroy(server));
+}
+
+int main(void) {
+  jesenrpc_dispatcher_t dispatcher;
+  EXPECT_OK(jesenrpc_dispatcher_init(&dispatcher));
+  EXPECT_OK(
+      jesenrpc_dispatcher_register(&dispatcher, "ping", ping_handler, NULL));
+  EXPECT_OK(jesenrpc_dispatcher_freeze(&dispatcher));
+
+  static const struct {
+    size_t connections;
+    size_t depth;
+  } shapes[] = {{1, 1}, {1, 64}, {16, 16}, {64, 4}};
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "epoll/%zu conns x %zu deep",
+             shapes[i].connections, shapes[i].depth);
+    bench_backend(&dispatcher, JESENRPC_SERVER_BACKEND_EPOLL, name,
+                  shapes[i].connections, shapes[i].depth);
+    snprintf(name, sizeof(name), "io_uring/%zu conns x %zu deep",
+             shapes[i].connections, shapes[i].depth);
+    bench_backend(&dispatcher, JESENRPC_SERVER_BACKEND_IO_URING, name,
+                  shapes[i].connections, shapes[i].depth);
+  }
+
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+  return 0;
+}
@@ -4,11 +4,682 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef JESENRPC_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef JESENRPC_ENABLE_STATS
+#include <time.h>
+#endif
+
+#ifdef JESENRPC_HAVE_SDT
+#include <sys/sdt.h>
+#endif
+
+#if defined(JESENRPC_ENABLE_POOLS) && defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+/* Only used by the optional features that need GCC or Clang. */
+#define JRPC_THREAD_LOCAL __thread
+
+/* Statistics. Each thread counts into a block of its own, found through a
+ * thread-local pointer, so the hot path is a flag test and a few plain
+ * increments. Only the owning thread writes a block; relaxed atomic accesses
+ * let snapshots read it concurrently without tearing. Blocks are never
+ * freed: one released by an exiting thread is claimed by the next new thread,
+ * which keeps counting on top of its totals. The latency histograms live in
+ * the same blocks, keyed by method name. */
+
+#ifdef JESENRPC_ENABLE_STATS
+
+#define JRPC_CACHE_LINE ((size_t)64)
+
+/* Distinct method names timed per thread; later ones share the entry for
+ * no method. A power of two. */
+#define JRPC_LATENCY_METHODS 64
+#define JRPC_LATENCY_NAME_MAX 64 /* Longer names are truncated. */
+
+typedef struct jrpc_latency_entry {
+  char name[JRPC_LATENCY_NAME_MAX];
+  jesenrpc_histogram_t stages[JESENRPC_LATENCY_STAGES];
+} jrpc_latency_entry_t;
+
+typedef struct jrpc_stats_block {
+  jesenrpc_stats_t stats;
+  struct jrpc_stats_block *next; /* Every block ever created. */
+  int owned;                     /* Claimed by a live thread. */
+  /* Open-addressed by name hash. Only the owner adds entries. */
+  jrpc_latency_entry_t *methods[JRPC_LATENCY_METHODS];
+  jrpc_latency_entry_t none; /* Batches, responses and overflow. */
+} jrpc_stats_block_t;
+
+static int jrpc_stats_on;
+static int jrpc_latency_on;
+static jrpc_stats_block_t *jrpc_stats_blocks;
+static JRPC_THREAD_LOCAL jrpc_stats_block_t *jrpc_stats_mine;
+
+#ifdef JESENRPC_HAVE_PTHREADS
+static pthread_once_t jrpc_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t jrpc_stats_key;
+
+static void jrpc_stats_release(void *block) {
+  __atomic_store_n(&((jrpc_stats_block_t *)block)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void jrpc_stats_key_create(void) {
+  pthread_key_create(&jrpc_stats_key, jrpc_stats_release);
+}
+#endif
+
+static jrpc_stats_block_t *jrpc_stats_claim(void) {
+  jrpc_stats_block_t *block =
+      __atomic_load_n(&jrpc_stats_blocks, __ATOMIC_ACQUIRE);
+  for (; block; block = block->next) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&block->owned, &expected, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (!block) {
+    /* Aligned to a cache line so neighbouring blocks never share one. Not
+     * counted as a library allocation, and never freed. */
+    char *raw = (char *)calloc(1, sizeof(*block) + JRPC_CACHE_LINE);
+    if (!raw) {
+      return NULL;
+    }
+    block = (jrpc_stats_block_t *)(void *)(
+        raw + JRPC_CACHE_LINE - (uintptr_t)raw % JRPC_CACHE_LINE);
+    block->owned = 1;
+    block->next = __atomic_load_n(&jrpc_stats_blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&jrpc_stats_blocks, &block->next,
+                                        block, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+  }
+#ifdef JESENRPC_HAVE_PTHREADS
+  pthread_once(&jrpc_stats_once, jrpc_stats_key_create);
+  pthread_setspecific(jrpc_stats_key, block);
+#endif
+  return block;
+}
+
+static jrpc_stats_block_t *jrpc_stats_block(void) {
+  if (!jrpc_stats_mine) {
+    jrpc_stats_mine = jrpc_stats_claim();
+  }
+  return jrpc_stats_mine;
+}
+
+/* The calling thread's counters, or NULL while counting is off. */
+static jesenrpc_stats_t *jrpc_stats(void) {
+  if (!__atomic_load_n(&jrpc_stats_on, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  jrpc_stats_block_t *block = jrpc_stats_block();
+  return block ? &block->stats : NULL;
+}
+
+static void jrpc_stats_add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+static size_t jrpc_stats_error_slot(jesenrpc_err_t err) {
+  return err > (JESENRPC_ERR_BASE) &&
+                 err < (JESENRPC_ERR_BASE) + JESENRPC_STATS_ERRORS
+             ? (size_t)(err - (JESENRPC_ERR_BASE))
+             : 0;
+}
+
+static void jrpc_stats_parsed(jesenrpc_message_kind_t kind, size_t len,
+                              jesenrpc_err_t err) {
+  jesenrpc_stats_t *stats = jrpc_stats();
+  if (!stats) {
+    return;
+  }
+  jrpc_stats_add(&stats->bytes_in, len);
+  if (err == JESENRPC_ERR_NONE) {
+    jrpc_stats_add(&stats->parsed[kind], 1);
+  } else {
+    jrpc_stats_add(&stats->parse_failures[jrpc_stats_error_slot(err)], 1);
+  }
+}
+
+static void jrpc_stats_serialized(jesenrpc_message_kind_t kind, size_t len) {
+  jesenrpc_stats_t *stats = jrpc_stats();
+  if (stats) {
+    jrpc_stats_add(&stats->serialized[kind], 1);
+    jrpc_stats_add(&stats->bytes_out, len);
+  }
+}
+
+static jesenrpc_err_t jrpc_stats_validated(jesenrpc_err_t err) {
+  jesenrpc_stats_t *stats = err != JESENRPC_ERR_NONE ? jrpc_stats() : NULL;
+  if (stats) {
+    jrpc_stats_add(&stats->validation_failures[jrpc_stats_error_slot(err)],
+                   1);
+  }
+  return err;
+}
+
+static void jrpc_stats_allocated(size_t size) {
+  jesenrpc_stats_t *stats = jrpc_stats();
+  if (stats) {
+    jrpc_stats_add(&stats->allocations, 1);
+    jrpc_stats_add(&stats->allocated_bytes, size);
+  }
+}
+
+static size_t jrpc_histogram_index(uint64_t value);
+
+/* A timestamp in nanoseconds, or 0 while timing is off. */
+static uint64_t jrpc_latency_start(void) {
+  if (!__atomic_load_n(&jrpc_latency_on, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static jrpc_latency_entry_t *jrpc_latency_entry(jrpc_stats_block_t *block,
+                                                const char *method) {
+  if (!method || !*method) {
+    return &block->none;
+  }
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t len = 0;
+  for (; method[len] && len < JRPC_LATENCY_NAME_MAX - 1; ++len) {
+    hash = (hash ^ (unsigned char)method[len]) * 0x100000001B3ULL;
+  }
+  for (size_t probe = 0; probe < JRPC_LATENCY_METHODS; ++probe) {
+    size_t slot = (size_t)(hash + probe) & (JRPC_LATENCY_METHODS - 1);
+    jrpc_latency_entry_t *entry = block->methods[slot];
+    if (!entry) {
+      /* Not counted as a library allocation, and never freed. */
+      entry = (jrpc_latency_entry_t *)calloc(1, sizeof(*entry));
+      if (!entry) {
+        return &block->none;
+      }
+      memcpy(entry->name, method, len);
+      __atomic_store_n(&block->methods[slot], entry, __ATOMIC_RELEASE);
+      return entry;
+    }
+    if (strncmp(entry->name, method, len) == 0 && entry->name[len] == '\0') {
+      return entry;
+    }
+  }
+  return &block->none;
+}
+
+static void jrpc_latency_add(jesenrpc_histogram_t *h, uint64_t value) {
+  uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (count == 0 || value < h->min) {
+    __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+  }
+  if (value > h->max) {
+    __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+  }
+  jrpc_stats_add(&h->buckets[jrpc_histogram_index(value)], 1);
+  jrpc_stats_add(&h->sum, value);
+  __atomic_store_n(&h->count, count + 1, __ATOMIC_RELAXED);
+}
+
+/* Records the time since started against method (NULL for none). */
+static jrpc_latency_entry_t *
+jrpc_latency_record(jesenrpc_latency_stage_t stage, const char *method,
+                    uint64_t started) {
+  jrpc_stats_block_t *block = started ? jrpc_stats_block() : NULL;
+  if (!block) {
+    return NULL;
+  }
+  jrpc_latency_entry_t *entry = jrpc_latency_entry(block, method);
+  uint64_t now = jrpc_latency_start();
+  jrpc_latency_add(&entry->stages[stage], now > started ? now - started : 0);
+  return entry;
+}
+
+static void jrpc_latency_parsed(const jesenrpc_message_t *message,
+                                uint64_t started) {
+  if (started) {
+    jrpc_latency_record(JESENRPC_LATENCY_PARSE,
+                        message->kind == JESENRPC_MESSAGE_REQUEST_SINGLE
+                            ? message->as.request->method_name
+                            : NULL,
+                        started);
+  }
+}
+
+/* Returns the name the call was charged to, for timing the serialization
+ * of its response. Entries are never freed, so the name outlives the
+ * dispatcher; NULL while timing is off. */
+static const char *jrpc_latency_dispatched(const char *method,
+                                           uint64_t started) {
+  jrpc_latency_entry_t *entry =
+      jrpc_latency_record(JESENRPC_LATENCY_DISPATCH, method, started);
+  return entry ? entry->name : NULL;
+}
+
+static void jrpc_latency_serialized(const char *method, uint64_t started) {
+  jrpc_latency_record(JESENRPC_LATENCY_SERIALIZE, method, started);
+}
+#else
+#define jrpc_stats_parsed(kind, len, err)                                      \
+  ((void)(kind), (void)(len), (void)(err))
+#define jrpc_stats_serialized(kind, len) ((void)(kind), (void)(len))
+#define jrpc_stats_validated(err) (err)
+#define jrpc_stats_allocated(size) ((void)(size))
+#define jrpc_latency_start() ((uint64_t)0)
+#define jrpc_latency_parsed(message, started) ((void)(started))
+#define jrpc_latency_dispatched(method, started)                               \
+  ((void)(method), (void)(started), (const char *)NULL)
+#define jrpc_latency_serialized(method, started)                               \
+  ((void)(method), (void)(started))
+#endif
+
+/* Hooks. The table pointer is the only thing tested on the hot path. */
+
+#ifdef JESENRPC_ENABLE_HOOKS
+static const jesenrpc_hooks_t *jrpc_hooks;
+
+static void jrpc_hook(bool exit, jesenrpc_hook_op_t op,
+                      jesenrpc_message_kind_t kind, const char *method,
+                      const jesenrpc_id_t *id, size_t bytes,
+                      jesenrpc_err_t err) {
+  void (*fn)(const jesenrpc_hook_event_t *, void *) =
+      exit ? jrpc_hooks->on_exit : jrpc_hooks->on_enter;
+  if (fn) {
+    jesenrpc_hook_event_t event = {op, kind, method, id, bytes, err};
+    fn(&event, jrpc_hooks->user_data);
+  }
+}
+
+#define JRPC_HOOK_ENTER(op, kind, method, id, bytes)                           \
+  do {                                                                         \
+    if (jrpc_hooks) {                                                          \
+      jrpc_hook(false, op, kind, method, id, bytes, JESENRPC_ERR_NONE);        \
+    }                                                                          \
+  } while (0)
+
+#define JRPC_HOOK_EXIT(op, kind, method, id, bytes, err)                       \
+  do {                                                                         \
+    if (jrpc_hooks) {                                                          \
+      jrpc_hook(true, op, kind, method, id, bytes, err);                       \
+    }                                                                          \
+  } while (0)
+#else
+#define JRPC_HOOK_ENTER(op, kind, method, id, bytes)                           \
+  ((void)(method), (void)(id))
+#define JRPC_HOOK_EXIT(op, kind, method, id, bytes, err)                       \
+  ((void)(method), (void)(id))
+#endif
+
+/* USDT probes (provider "jesenrpc"), for bpftrace and other tracers. Until a
+ * tracer attaches, each probe is a single nop. */
+
+#ifdef JESENRPC_HAVE_SDT
+#define JRPC_PROBE2(name, a, b) DTRACE_PROBE2(jesenrpc, name, a, b)
+#define JRPC_PROBE3(name, a, b, c) DTRACE_PROBE3(jesenrpc, name, a, b, c)
+#else
+#define JRPC_PROBE2(name, a, b) ((void)0)
+#define JRPC_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+/* Every allocation of the library goes through these. The *_from variants
+ * take the allocator of an arena or buffer; NULL there, and in
+ * jrpc_global_allocator, means the next level up: global, then libc. */
+
+static jesenrpc_allocator_t jrpc_custom_allocator;
+static const jesenrpc_allocator_t *jrpc_global_allocator;
+static unsigned jrpc_allocator_generation; /* Bumped on every switch. */
+
+static void *jrpc_malloc_from(const jesenrpc_allocator_t *allocator,
+                              size_t size) {
+  if (!allocator) {
+    allocator = jrpc_global_allocator;
+  }
+  void *ptr = allocator ? allocator->malloc_fn(size, allocator->context)
+                        : malloc(size);
+  if (ptr) {
+    jrpc_stats_allocated(size);
+  }
+  return ptr;
+}
+
+static void *jrpc_calloc_from(const jesenrpc_allocator_t *allocator,
+                              size_t count, size_t size) {
+  if (!allocator) {
+    allocator = jrpc_global_allocator;
+  }
+  void *ptr;
+  if (!allocator) {
+    ptr = calloc(count, size);
+  } else {
+    if (size != 0 && count > SIZE_MAX / size) {
+      return NULL;
+    }
+    ptr = allocator->malloc_fn(count * size, allocator->context);
+    if (ptr) {
+      memset(ptr, 0, count * size);
+    }
+  }
+  if (ptr) {
+    jrpc_stats_allocated(count * size);
+  }
+  return ptr;
+}
+
+static void *jrpc_realloc_from(const jesenrpc_allocator_t *allocator,
+                               void *ptr, size_t size) {
+  if (!allocator) {
+    allocator = jrpc_global_allocator;
+  }
+  void *grown = allocator ? allocator->realloc_fn(ptr, size, allocator->context)
+                          : realloc(ptr, size);
+  if (grown) {
+    jrpc_stats_allocated(size);
+  }
+  return grown;
+}
+
+static void jrpc_free_from(const jesenrpc_allocator_t *allocator, void *ptr) {
+  if (!allocator) {
+    allocator = jrpc_global_allocator;
+  }
+  if (!allocator) {
+    free(ptr);
+  } else if (ptr) {
+    allocator->free_fn(ptr, allocator->context);
+  }
+}
+
+static void *jrpc_malloc(size_t size) { return jrpc_malloc_from(NULL, size); }
+
+static void *jrpc_calloc(size_t count, size_t size) {
+  return jrpc_calloc_from(NULL, count, size);
+}
+
+static void *jrpc_realloc(void *ptr, size_t size) {
+  return jrpc_realloc_from(NULL, ptr, size);
+}
+
+static void jrpc_free(void *ptr) { jrpc_free_from(NULL, ptr); }
+
+/* Object pools for the fixed-size request, response and error structs, which
+ * come and go at the message rate. Each thread caches freed objects in two
+ * magazines per struct: a partly filled one it pops from and pushes to, and a
+ * full spare. Only swapping or exchanging whole magazines touches the shared
+ * depot, a short locked stack per struct, so objects freed on another
+ * thread than the one that created them (executor workers) still flow back.
+ * Magazines that do not fit in the depot go back to the allocator. Pooled
+ * memory comes from the global allocator; each magazine remembers which one,
+ * so after jesenrpc_set_allocator() magazines still held by other threads
+ * are freed through the allocator they were filled from, not the new one. */
+
+typedef enum {
+  JRPC_POOL_REQUEST,
+  JRPC_POOL_RESPONSE,
+  JRPC_POOL_ERROR,
+  JRPC_POOL_KINDS
+} jrpc_pool_kind_t;
+
+static const size_t jrpc_pool_sizes[JRPC_POOL_KINDS] = {
+    sizeof(jesenrpc_request_t), sizeof(jesenrpc_response_t),
+    sizeof(jesenrpc_error_object_t)};
+
+#ifdef JESENRPC_ENABLE_POOLS
+#define JRPC_POOL_MAGAZINE 32 /* Objects per magazine. */
+#define JRPC_POOL_DEPOT 16    /* Full magazines per struct in the depot. */
+
+/* Under AddressSanitizer, pooled objects stay poisoned past their link so a
+ * use after destroy is still reported. */
+#if defined(__SANITIZE_ADDRESS__)
+#define JRPC_POOL_POISON(ptr, size)                                            \
+  ASAN_POISON_MEMORY_REGION((char *)(ptr) + sizeof(jrpc_pool_object_t),        \
+                            (size) - sizeof(jrpc_pool_object_t))
+#define JRPC_POOL_UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION((ptr), (size))
+#else
+#define JRPC_POOL_POISON(ptr, size) ((void)0)
+#define JRPC_POOL_UNPOISON(ptr, size) ((void)0)
+#endif
+
+typedef struct jrpc_pool_object {
+  struct jrpc_pool_object *next;
+} jrpc_pool_object_t;
+
+typedef struct {
+  jrpc_pool_object_t *head;
+  size_t count;
+  /* Where the objects came from, stamped when the first one goes in. A zero
+   * allocator means libc. */
+  unsigned generation;
+  jesenrpc_allocator_t allocator;
+} jrpc_pool_magazine_t;
+
+typedef struct {
+  jrpc_pool_magazine_t loaded; /* Popped from and pushed to. */
+  jrpc_pool_magazine_t spare;  /* Full or empty. */
+} jrpc_pool_cache_t;
+
+/* A mutex, not a spinlock: a thread preempted while holding it must not
+ * leave executor workers burning CPU until it runs again. */
+typedef struct {
+#ifdef JESENRPC_HAVE_PTHREADS
+  pthread_mutex_t lock;
+#else
+  int lock;
+#endif
+  size_t count;
+  jrpc_pool_magazine_t magazines[JRPC_POOL_DEPOT];
+} jrpc_pool_depot_t;
+
+#ifdef JESENRPC_HAVE_PTHREADS
+static jrpc_pool_depot_t jrpc_pool_depots[JRPC_POOL_KINDS] = {
+    {.lock = PTHREAD_MUTEX_INITIALIZER},
+    {.lock = PTHREAD_MUTEX_INITIALIZER},
+    {.lock = PTHREAD_MUTEX_INITIALIZER}};
+#else
+static jrpc_pool_depot_t jrpc_pool_depots[JRPC_POOL_KINDS];
+#endif
+static JRPC_THREAD_LOCAL jrpc_pool_cache_t jrpc_pool_caches[JRPC_POOL_KINDS];
+
+static void jrpc_pool_lock(jrpc_pool_depot_t *depot) {
+#ifdef JESENRPC_HAVE_PTHREADS
+  pthread_mutex_lock(&depot->lock);
+#else
+  /* Without pthreads the library starts no threads of its own. */
+  while (__atomic_exchange_n(&depot->lock, 1, __ATOMIC_ACQUIRE)) {
+  }
+#endif
+}
+
+static void jrpc_pool_unlock(jrpc_pool_depot_t *depot) {
+#ifdef JESENRPC_HAVE_PTHREADS
+  pthread_mutex_unlock(&depot->lock);
+#else
+  __atomic_store_n(&depot->lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static void jrpc_pool_drain(jrpc_pool_magazine_t *magazine) {
+  const jesenrpc_allocator_t *allocator = &magazine->allocator;
+  while (magazine->head) {
+    jrpc_pool_object_t *next = magazine->head->next;
+    if (allocator->free_fn) {
+      allocator->free_fn(magazine->head, allocator->context);
+    } else {
+      free(magazine->head);
+    }
+    magazine->head = next;
+  }
+  magazine->count = 0;
+}
+
+static bool jrpc_pool_stale(const jrpc_pool_magazine_t *magazine) {
+  return magazine->count > 0 &&
+         magazine->generation != jrpc_allocator_generation;
+}
+
+/* Hands a magazine to the depot, or frees its objects if the depot is full.
+ * The magazine is left empty. */
+static void jrpc_pool_deposit(jrpc_pool_kind_t kind,
+                              jrpc_pool_magazine_t *magazine) {
+  if (magazine->count == 0) {
+    return;
+  }
+  jrpc_pool_depot_t *depot = &jrpc_pool_depots[kind];
+  bool stored = false;
+  jrpc_pool_lock(depot);
+  if (depot->count < JRPC_POOL_DEPOT) {
+    depot->magazines[depot->count++] = *magazine;
+    stored = true;
+  }
+  jrpc_pool_unlock(depot);
+  if (stored) {
+    magazine->head = NULL;
+    magazine->count = 0;
+  } else {
+    jrpc_pool_drain(magazine);
+  }
+}
+
+static bool jrpc_pool_withdraw(jrpc_pool_kind_t kind,
+                               jrpc_pool_magazine_t *magazine) {
+  jrpc_pool_depot_t *depot = &jrpc_pool_depots[kind];
+  bool found = false;
+  jrpc_pool_lock(depot);
+  if (depot->count > 0) {
+    *magazine = depot->magazines[--depot->count];
+    found = true;
+  }
+  jrpc_pool_unlock(depot);
+  return found;
+}
+
+/* Takes a magazine filled under the current allocator from the depot,
+ * freeing any left there by a thread that exited after a switch. */
+static bool jrpc_pool_withdraw_current(jrpc_pool_kind_t kind,
+                                       jrpc_pool_magazine_t *magazine) {
+  while (jrpc_pool_withdraw(kind, magazine)) {
+    if (!jrpc_pool_stale(magazine)) {
+      return true;
+    }
+    jrpc_pool_drain(magazine);
+  }
+  return false;
+}
+
+/* Frees what the calling thread cached before the allocator was switched. */
+static void jrpc_pool_refresh(jrpc_pool_cache_t *cache) {
+  if (jrpc_pool_stale(&cache->loaded)) {
+    jrpc_pool_drain(&cache->loaded);
+  }
+  if (jrpc_pool_stale(&cache->spare)) {
+    jrpc_pool_drain(&cache->spare);
+  }
+}
+
+#ifdef JESENRPC_HAVE_PTHREADS
+/* An exiting thread hands its cached objects to the depot. */
+static pthread_once_t jrpc_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t jrpc_pool_key;
+static JRPC_THREAD_LOCAL bool jrpc_pool_registered;
+
+static void jrpc_pool_release(void *unused) {
+  (void)unused;
+  for (int kind = 0; kind < JRPC_POOL_KINDS; ++kind) {
+    jrpc_pool_deposit((jrpc_pool_kind_t)kind, &jrpc_pool_caches[kind].loaded);
+    jrpc_pool_deposit((jrpc_pool_kind_t)kind, &jrpc_pool_caches[kind].spare);
+  }
+  jrpc_pool_registered = false;
+}
+
+static void jrpc_pool_key_create(void) {
+  pthread_key_create(&jrpc_pool_key, jrpc_pool_release);
+}
+#endif
+
+/* Returns a zeroed object, or NULL if out of memory. */
+static void *jrpc_pool_get(jrpc_pool_kind_t kind) {
+  jrpc_pool_cache_t *cache = &jrpc_pool_caches[kind];
+  jrpc_pool_refresh(cache);
+  if (!cache->loaded.head) {
+    if (cache->spare.head) {
+      jrpc_pool_magazine_t empty = cache->loaded;
+      cache->loaded = cache->spare;
+      cache->spare = empty;
+    } else if (!jrpc_pool_withdraw_current(kind, &cache->loaded)) {
+      return jrpc_calloc(1, jrpc_pool_sizes[kind]);
+    }
+  }
+  jrpc_pool_object_t *object = cache->loaded.head;
+  cache->loaded.head = object->next;
+  --cache->loaded.count;
+  JRPC_POOL_UNPOISON(object, jrpc_pool_sizes[kind]);
+  memset(object, 0, jrpc_pool_sizes[kind]);
+  return object;
+}
+
+static void jrpc_pool_put(jrpc_pool_kind_t kind, void *ptr) {
+  jrpc_pool_cache_t *cache = &jrpc_pool_caches[kind];
+  jrpc_pool_refresh(cache);
+  if (cache->loaded.count == JRPC_POOL_MAGAZINE) {
+    jrpc_pool_deposit(kind, &cache->spare);
+    cache->spare = cache->loaded;
+    cache->loaded.head = NULL;
+    cache->loaded.count = 0;
+  }
+#ifdef JESENRPC_HAVE_PTHREADS
+  if (!jrpc_pool_registered) {
+    pthread_once(&jrpc_pool_once, jrpc_pool_key_create);
+    pthread_setspecific(jrpc_pool_key, &jrpc_pool_registered);
+    jrpc_pool_registered = true;
+  }
+#endif
+  if (cache->loaded.count == 0) {
+    cache->loaded.generation = jrpc_allocator_generation;
+    cache->loaded.allocator = jrpc_global_allocator
+                                  ? *jrpc_global_allocator
+                                  : (jesenrpc_allocator_t){0};
+  }
+  jrpc_pool_object_t *object = (jrpc_pool_object_t *)ptr;
+  object->next = cache->loaded.head;
+  cache->loaded.head = object;
+  ++cache->loaded.count;
+  JRPC_POOL_POISON(object, jrpc_pool_sizes[kind]);
+}
+
+/* Frees the calling thread's cached objects and everything in the depot. */
+static void jrpc_pool_trim(void) {
+  for (int kind = 0; kind < JRPC_POOL_KINDS; ++kind) {
+    jrpc_pool_drain(&jrpc_pool_caches[kind].loaded);
+    jrpc_pool_drain(&jrpc_pool_caches[kind].spare);
+    jrpc_pool_magazine_t magazine;
+    while (jrpc_pool_withdraw((jrpc_pool_kind_t)kind, &magazine)) {
+      jrpc_pool_drain(&magazine);
+    }
+  }
+}
+#else
+static void *jrpc_pool_get(jrpc_pool_kind_t kind) {
+  return jrpc_calloc(1, jrpc_pool_sizes[kind]);
+}
+
+static void jrpc_pool_put(jrpc_pool_kind_t kind, void *ptr) {
+  (void)kind;
+  jrpc_free(ptr);
+}
+
+static void jrpc_pool_trim(void) {}
+#endif
+
 static jesenrpc_err_t jrpc_strdup(const char *src, size_t len, char **out) {
   if (!src || !out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  char *copy = (char *)calloc(len + 1, sizeof(char));
+  char *copy = (char *)jrpc_calloc(len + 1, sizeof(char));
   if (!copy) {
     return JESENRPC_ERR_ALLOC;
   }
@@ -22,8 +693,9 @@ static void jrpc_id_cleanup(jesenrpc_id_t *id) {
   if (!id) {
     return;
   }
-  if (id->kind == JESENRPC_ID_STRING && id->value.string.data) {
-    free(id->value.string.data);
+  if (id->kind == JESENRPC_ID_STRING && id->value.string.data &&
+      !id->value.string.borrowed) {
+    jrpc_free(id->value.string.data);
   }
   memset(id, 0, sizeof(*id));
 }
@@ -36,6 +708,7 @@ static jesenrpc_err_t jrpc_id_clone(const jesenrpc_id_t *src,
   jrpc_id_cleanup(dst);
   *dst = *src;
   if (src->kind == JESENRPC_ID_STRING && src->value.string.data) {
+    dst->value.string.borrowed = false;
     return jrpc_strdup(src->value.string.data, src->value.string.len,
                        &dst->value.string.data);
   }
@@ -47,1498 +720,5010 @@ static bool jrpc_doubles_equal(double a, double b) {
   return diff < 0.0000000001 && diff > -0.0000000001;
 }
 
-static jesenrpc_err_t jrpc_copy_string_value(const jesen_node_t *node,
-                                             size_t max_attempt, char **out_str,
-                                             size_t *out_len) {
-  if (!node || !out_str || max_attempt == 0) {
-    return JESENRPC_ERR_INVALID_ARGS;
+#define JRPC_ARENA_ALIGN ((size_t)16)
+#define JRPC_ARENA_DEFAULT_BLOCK_SIZE ((size_t)4096)
+#define JRPC_ALIGN_UP(n, a) (((n) + (a)-1) & ~((a)-1))
+
+struct jesenrpc_arena_block {
+  struct jesenrpc_arena_block *next;
+  size_t size; /* Usable bytes following the header. */
+  size_t used;
+};
+
+/* Objects whose jesen subtrees must be released when the arena is reset. */
+struct jesenrpc_arena_cleanup {
+  struct jesenrpc_arena_cleanup *next;
+  void (*release)(void *object);
+  void *object;
+};
+
+#define JRPC_ARENA_HEADER_SIZE                                                 \
+  JRPC_ALIGN_UP(sizeof(struct jesenrpc_arena_block), JRPC_ARENA_ALIGN)
+
+static char *jrpc_arena_block_data(struct jesenrpc_arena_block *block) {
+  return (char *)block + JRPC_ARENA_HEADER_SIZE;
+}
+
+/* Returns zeroed, aligned memory from the current block, starting a new block
+ * only when the current one is exhausted. */
+static void *jrpc_arena_alloc(jesenrpc_arena_t *arena, size_t size) {
+  size_t rounded = JRPC_ALIGN_UP(size, JRPC_ARENA_ALIGN);
+  if (rounded < size) {
+    return NULL;
+  }
+  struct jesenrpc_arena_block *block = arena->blocks;
+  if (!block || block->size - block->used < rounded) {
+    size_t usable = arena->block_size > rounded ? arena->block_size : rounded;
+    if (usable > SIZE_MAX - JRPC_ARENA_HEADER_SIZE) {
+      return NULL;
+    }
+    block = (struct jesenrpc_arena_block *)jrpc_malloc_from(
+        arena->allocator, JRPC_ARENA_HEADER_SIZE + usable);
+    if (!block) {
+      return NULL;
+    }
+    block->size = usable;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  char *ptr = jrpc_arena_block_data(block) + block->used;
+  block->used += rounded;
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+/* Gives back the tail of the most recent allocation. */
+static void jrpc_arena_shrink_last(jesenrpc_arena_t *arena, void *ptr,
+                                   size_t new_size) {
+  struct jesenrpc_arena_block *block = arena->blocks;
+  char *data = block ? jrpc_arena_block_data(block) : NULL;
+  if (!data || (char *)ptr < data || (char *)ptr >= data + block->used) {
+    return;
+  }
+  block->used = (size_t)((char *)ptr - data) +
+                JRPC_ALIGN_UP(new_size, JRPC_ARENA_ALIGN);
+}
+
+static jesenrpc_err_t jrpc_arena_defer(jesenrpc_arena_t *arena,
+                                       void (*release)(void *), void *object) {
+  struct jesenrpc_arena_cleanup *cleanup =
+      (struct jesenrpc_arena_cleanup *)jrpc_arena_alloc(arena,
+                                                        sizeof(*cleanup));
+  if (!cleanup) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  cleanup->release = release;
+  cleanup->object = object;
+  cleanup->next = arena->cleanups;
+  arena->cleanups = cleanup;
+  return JESENRPC_ERR_NONE;
+}
+
+/* Where parsed structures are allocated from. */
+typedef struct jrpc_parse_ctx {
+  jesenrpc_arena_t *arena; /* NULL for individual heap allocations. */
+  bool in_situ;            /* Strings are views into the input buffer. */
+  bool lazy_params;        /* Params stay raw slices of the input buffer. */
+} jrpc_parse_ctx_t;
+
+static jesenrpc_err_t jrpc_parse_ctx_init(const jesenrpc_parse_options_t *opts,
+                                          jrpc_parse_ctx_t *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+  if (opts) {
+    if (opts->flags &
+        ~(uint32_t)(JESENRPC_PARSE_IN_SITU | JESENRPC_PARSE_LAZY_PARAMS)) {
+      return JESENRPC_ERR_INVALID_ARGS;
+    }
+    ctx->arena = opts->arena;
+    ctx->in_situ = (opts->flags & JESENRPC_PARSE_IN_SITU) != 0;
+    ctx->lazy_params = (opts->flags & JESENRPC_PARSE_LAZY_PARAMS) != 0;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static void *jrpc_ctx_calloc(const jrpc_parse_ctx_t *ctx, size_t count,
+                             size_t size) {
+  if (!ctx->arena) {
+    return jrpc_calloc(count, size);
+  }
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  return jrpc_arena_alloc(ctx->arena, count * size);
+}
+
+static void *jrpc_ctx_object(const jrpc_parse_ctx_t *ctx,
+                             jrpc_pool_kind_t kind) {
+  if (!ctx->arena) {
+    return jrpc_pool_get(kind);
+  }
+  return jrpc_arena_alloc(ctx->arena, jrpc_pool_sizes[kind]);
+}
+
+/* Releases everything an object owns. Memory that came from an arena stays
+ * with the arena; only the detached jesen subtrees are destroyed. */
+static void jrpc_error_object_discard(jesenrpc_error_object_t *error) {
+  if (error->data) {
+    jesen_destroy(error->data);
+    error->data = NULL;
+  }
+  if (!error->borrowed) {
+    jrpc_free(error->message);
+  }
+  if (!error->arena) {
+    jrpc_pool_put(JRPC_POOL_ERROR, error);
+  }
+}
+
+static void jrpc_request_discard(jesenrpc_request_t *request) {
+  if (request->params) {
+    jesen_destroy(request->params);
+    request->params = NULL;
+  }
+  jrpc_id_cleanup(&request->id);
+  if (!request->borrowed) {
+    jrpc_free(request->method_name);
+  }
+  if (!request->arena) {
+    jrpc_pool_put(JRPC_POOL_REQUEST, request);
+  }
+}
+
+static void jrpc_response_discard(jesenrpc_response_t *response) {
+  if (response->result) {
+    jesen_destroy(response->result);
+    response->result = NULL;
+  }
+  if (response->error) {
+    jrpc_error_object_discard(response->error);
+    response->error = NULL;
+  }
+  jrpc_id_cleanup(&response->id);
+  if (!response->arena) {
+    jrpc_pool_put(JRPC_POOL_RESPONSE, response);
+  }
+}
+
+static void jrpc_request_release(void *object) {
+  jrpc_request_discard((jesenrpc_request_t *)object);
+}
+
+static void jrpc_response_release(void *object) {
+  jrpc_response_discard((jesenrpc_response_t *)object);
+}
+
+static jesenrpc_err_t jrpc_buf_grow(jesenrpc_buf_t *buf, size_t min_cap) {
+  if (buf->cap >= min_cap) {
+    return JESENRPC_ERR_NONE;
   }
+  size_t new_cap = buf->cap ? buf->cap : 256;
+  while (new_cap < min_cap) {
+    if (new_cap > SIZE_MAX / 2) {
+      new_cap = min_cap;
+      break;
+    }
+    new_cap *= 2;
+  }
+  char *data = (char *)jrpc_realloc_from(buf->allocator, buf->data, new_cap);
+  if (!data) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  buf->data = data;
+  buf->cap = new_cap;
+  return JESENRPC_ERR_NONE;
+}
 
-  size_t buf_size = 64;
-  while (buf_size <= max_attempt) {
-    char *buf = (char *)calloc(buf_size, sizeof(char));
-    if (!buf) {
+/* jesen reports a too-small output buffer as JESEN_ERR_INVALID_ARGS. Given a
+ * node and a non-empty buffer that is the only cause, so keep growing until
+ * the tree fits or memory runs out. Every attempt is a full pass over the
+ * tree: start from the room the buffer already has, which a warm buffer
+ * makes the first attempt succeed, and grow fourfold. */
+static jesenrpc_err_t jrpc_buf_serialize_node_at(jesenrpc_buf_t *buf,
+                                                 size_t offset,
+                                                 const jesen_node_t *node,
+                                                 size_t *out_len) {
+  if (!node) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  size_t want = 64;
+  for (;;) {
+    if (want > SIZE_MAX - offset) {
       return JESENRPC_ERR_ALLOC;
     }
-    size_t len = 0;
-    jesen_err_t err = jesen_value_get_string(node, buf, buf_size, &len);
+    jesenrpc_err_t err = jrpc_buf_grow(buf, offset + want);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    size_t avail = buf->cap - offset;
+    err = jesen_serialize(node, buf->data + offset, avail);
     if (err == JESEN_ERR_NONE) {
-      *out_str = buf;
-      if (out_len) {
-        *out_len = len;
-      }
+      *out_len = strnlen(buf->data + offset, avail);
       return JESENRPC_ERR_NONE;
     }
-    free(buf);
-    if (err == JESEN_ERR_INVALID_VALUE_TYPE) {
-      return err;
+    if (err != JESEN_ERR_INVALID_ARGS || avail > SIZE_MAX / 4) {
+      return err == JESEN_ERR_INVALID_ARGS ? JESENRPC_ERR_ALLOC : err;
     }
-    if (err != JESEN_ERR_INVALID_ARGS) {
-      return err;
+    want = avail * 4;
+  }
+}
+
+/* Appends serialized output either to a fixed caller buffer or to a growable
+ * jesenrpc_buf_t. A fixed buffer that runs out of room switches to counting so
+ * the caller still learns the exact length it would have needed. */
+typedef struct jrpc_writer {
+  char *buf;            /* Destination buffer. */
+  size_t cap;           /* Capacity of buf, including the terminator. */
+  size_t len;           /* Bytes produced, including any past cap. */
+  bool overflow;        /* Set once a fixed buffer ran out of room. */
+  jesenrpc_buf_t *grow; /* Growable target, or NULL for a fixed buffer. */
+  jesenrpc_buf_t scratch; /* Measures subtrees that did not fit. */
+  /* Scatter/gather output: large raw values become their own segments
+   * instead of being copied into grow. Until the writer completes, the
+   * buffered segments (even indices) hold only their length. */
+  jesenrpc_iovec_t *iov;
+  size_t iov_cap;
+  size_t iov_count; /* Segments produced, including any past iov_cap. */
+  size_t run_start; /* Offset in grow where the current buffered run began. */
+  bool gather;      /* Scatter/gather output; counted by complete_iov. */
+  /* Statistics: the outermost value written, the method of a single
+   * request, the method its serialization is timed under (also that of a
+   * dispatched response), and when writing began (0 while timing is off). */
+  jesenrpc_message_kind_t kind;
+  const char *method;
+  const char *timed;
+  const jesenrpc_id_t *id;
+  uint64_t started;
+} jrpc_writer_t;
+
+static void jrpc_writer_init(jrpc_writer_t *w, char *buf, size_t cap) {
+  memset(w, 0, sizeof(*w));
+  w->buf = buf;
+  w->cap = buf ? cap : 0;
+  w->started = jrpc_latency_start();
+}
+
+static void jrpc_writer_init_buf(jrpc_writer_t *w, jesenrpc_buf_t *buf) {
+  memset(w, 0, sizeof(*w));
+  w->grow = buf;
+  w->buf = buf->data;
+  w->cap = buf->cap;
+  w->len = buf->len;
+  w->started = jrpc_latency_start();
+}
+
+/* Notes the outermost message the writer is about to write. */
+static void jrpc_writer_begin(jrpc_writer_t *w, jesenrpc_message_kind_t kind,
+                              const char *method, const char *timed,
+                              const jesenrpc_id_t *id) {
+  if (w->kind == JESENRPC_MESSAGE_UNKNOWN) {
+    w->kind = kind;
+    w->method = method;
+    w->timed = timed;
+    w->id = id;
+    JRPC_HOOK_ENTER(JESENRPC_HOOK_SERIALIZE, kind, method, id, 0);
+  }
+}
+
+/* Reports the end of a message started with jrpc_writer_begin(). counted is
+ * false for size queries, which do not produce output. */
+static void jrpc_writer_end(const jrpc_writer_t *w, jesenrpc_err_t err,
+                            size_t len, bool counted) {
+  if (w->kind == JESENRPC_MESSAGE_UNKNOWN) {
+    return;
+  }
+  if (err == JESENRPC_ERR_NONE && counted) {
+    jrpc_stats_serialized(w->kind, len);
+    jrpc_latency_serialized(w->timed, w->started);
+    JRPC_PROBE3(serialized, (int)w->kind, w->method, len);
+  }
+  JRPC_HOOK_EXIT(JESENRPC_HOOK_SERIALIZE, w->kind, w->method, w->id,
+                 err == JESENRPC_ERR_NONE ? len : 0, err);
+}
+
+static void jrpc_writer_release(jrpc_writer_t *w) {
+  jesenrpc_buf_destroy(&w->scratch);
+}
+
+/* Makes room for len more bytes plus a terminator. Returns false when the
+ * bytes should only be counted. */
+static bool jrpc_writer_reserve(jrpc_writer_t *w, size_t len) {
+  if (w->overflow) {
+    return false;
+  }
+  if (w->len < w->cap && len < w->cap - w->len) {
+    return true;
+  }
+  if (w->grow &&
+      jrpc_buf_grow(w->grow, w->len + len + 1) == JESENRPC_ERR_NONE) {
+    w->buf = w->grow->data;
+    w->cap = w->grow->cap;
+    return true;
+  }
+  w->overflow = true;
+  return false;
+}
+
+static void jrpc_writer_append(jrpc_writer_t *w, const char *data, size_t len) {
+  if (jrpc_writer_reserve(w, len)) {
+    memcpy(w->buf + w->len, data, len);
+  }
+  w->len += len;
+}
+
+static void jrpc_writer_append_char(jrpc_writer_t *w, char c) {
+  if (jrpc_writer_reserve(w, 1)) {
+    w->buf[w->len] = c;
+  }
+  w->len += 1;
+}
+
+#define JRPC_WRITER_APPEND_LITERAL(w, lit)                                     \
+  jrpc_writer_append((w), (lit), sizeof(lit) - 1)
+
+/* Raw values shorter than this are copied even in scatter/gather mode; an
+ * extra segment costs the kernel more than copying a few cache lines. */
+#define JRPC_IOV_MIN_REF_LEN 256
+
+static void jrpc_writer_push_iov(jrpc_writer_t *w, const char *base,
+                                 size_t len) {
+  if (w->iov_count < w->iov_cap) {
+    w->iov[w->iov_count].iov_base = (void *)base;
+    w->iov[w->iov_count].iov_len = len;
+  }
+  ++w->iov_count;
+}
+
+static void jrpc_writer_append_raw(jrpc_writer_t *w,
+                                   const jesenrpc_raw_json_t *raw) {
+  if (!w->iov || raw->len < JRPC_IOV_MIN_REF_LEN) {
+    jrpc_writer_append(w, raw->data, raw->len);
+    return;
+  }
+  jrpc_writer_push_iov(w, NULL, w->len - w->run_start);
+  jrpc_writer_push_iov(w, raw->data, raw->len);
+  w->run_start = w->len;
+}
+
+static const char jrpc_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Formats two digits per division so 64-bit IDs take at most ten steps. */
+static void jrpc_writer_append_int64(jrpc_writer_t *w, int64_t value) {
+  char out[20]; /* "-9223372036854775808" */
+  char *p = out + sizeof(out);
+  /* Negate in unsigned space so INT64_MIN does not overflow. */
+  uint64_t mag = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+  while (mag >= 100) {
+    const char *pair = &jrpc_digit_pairs[(mag % 100) * 2];
+    mag /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (mag >= 10) {
+    const char *pair = &jrpc_digit_pairs[mag * 2];
+    *--p = pair[1];
+    *--p = pair[0];
+  } else {
+    *--p = (char)('0' + mag);
+  }
+  if (value < 0) {
+    *--p = '-';
+  }
+  jrpc_writer_append(w, p, (size_t)(out + sizeof(out) - p));
+}
+
+static void jrpc_writer_append_string(jrpc_writer_t *w, const char *str,
+                                      size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  jrpc_writer_append_char(w, '"');
+  size_t run_start = 0;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)str[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
     }
-    buf_size *= 2;
+    jrpc_writer_append(w, str + run_start, i - run_start);
+    run_start = i + 1;
+    switch (c) {
+    case '"':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\\"");
+      break;
+    case '\\':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\\\");
+      break;
+    case '\b':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\b");
+      break;
+    case '\f':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\f");
+      break;
+    case '\n':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\n");
+      break;
+    case '\r':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\r");
+      break;
+    case '\t':
+      JRPC_WRITER_APPEND_LITERAL(w, "\\t");
+      break;
+    default: {
+      char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F]};
+      jrpc_writer_append(w, esc, sizeof(esc));
+      break;
+    }
+    }
+  }
+  jrpc_writer_append(w, str + run_start, len - run_start);
+  jrpc_writer_append_char(w, '"');
+}
+
+/* Only the params/result/data subtrees go through jesen; everything else in
+ * the envelope is written directly so no temporary nodes are allocated. */
+static jesenrpc_err_t jrpc_writer_append_node(jrpc_writer_t *w,
+                                              const jesen_node_t *node) {
+  size_t node_len = 0;
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+  if (w->grow) {
+    if (w->overflow) {
+      return JESENRPC_ERR_ALLOC;
+    }
+    err = jrpc_buf_serialize_node_at(w->grow, w->len, node, &node_len);
+    w->buf = w->grow->data;
+    w->cap = w->grow->cap;
+    if (err == JESENRPC_ERR_NONE) {
+      w->len += node_len;
+    }
+    return err;
+  }
+
+  if (!w->overflow && w->len < w->cap && w->cap - w->len >= 2) {
+    char *dst = w->buf + w->len;
+    size_t avail = w->cap - w->len;
+    err = jesen_serialize(node, dst, avail);
+    if (err == JESEN_ERR_NONE) {
+      w->len += strnlen(dst, avail);
+      return JESENRPC_ERR_NONE;
+    }
+    if (err != JESEN_ERR_INVALID_ARGS) {
+      return err;
+    }
+  }
+
+  w->overflow = true;
+  err = jrpc_buf_serialize_node_at(&w->scratch, 0, node, &node_len);
+  if (err == JESENRPC_ERR_NONE) {
+    w->len += node_len;
+  }
+  return err;
+}
+
+/* Terminates the output. Returns JESENRPC_ERR_BUFFER_TOO_SMALL when a fixed
+ * buffer overflowed; w->len then holds the required length. */
+static jesenrpc_err_t jrpc_writer_finish(jrpc_writer_t *w) {
+  if (w->grow) {
+    if (w->overflow || !jrpc_writer_reserve(w, 0)) {
+      return JESENRPC_ERR_ALLOC;
+    }
+    w->buf[w->len] = '\0';
+    w->grow->len = w->len;
+    return JESENRPC_ERR_NONE;
+  }
+  if (w->overflow || w->len >= w->cap) {
+    return JESENRPC_ERR_BUFFER_TOO_SMALL;
+  }
+  w->buf[w->len] = '\0';
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_write_id(jrpc_writer_t *w, const jesenrpc_id_t *id) {
+  switch (id->kind) {
+  case JESENRPC_ID_NONE:
+    return JESENRPC_ERR_NONE;
+  case JESENRPC_ID_NULL:
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"id\":null");
+    return JESENRPC_ERR_NONE;
+  case JESENRPC_ID_STRING:
+    if (!id->value.string.data) {
+      return JESENRPC_ERR_INVALID_ARGS;
+    }
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"id\":");
+    jrpc_writer_append_string(w, id->value.string.data, id->value.string.len);
+    return JESENRPC_ERR_NONE;
+  case JESENRPC_ID_NUMBER:
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"id\":");
+    jrpc_writer_append_int64(w, id->value.number);
+    return JESENRPC_ERR_NONE;
+  default:
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+}
+
+static jesenrpc_err_t jrpc_write_request(jrpc_writer_t *w,
+                                         const jesenrpc_request_t *request) {
+  const char *method = request ? request->method_name : NULL;
+  jrpc_writer_begin(w, JESENRPC_MESSAGE_REQUEST_SINGLE, method, method,
+                    request ? &request->id : NULL);
+  jesenrpc_err_t err = jesenrpc_request_validate(request);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  JRPC_WRITER_APPEND_LITERAL(w,
+                             "{\"jsonrpc\":\"" JESENRPC_JSONRPC_VERSION "\"");
+  err = jrpc_write_id(w, &request->id);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  JRPC_WRITER_APPEND_LITERAL(w, ",\"method\":");
+  jrpc_writer_append_string(w, request->method_name,
+                            strlen(request->method_name));
+  if (request->params) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"params\":");
+    err = jrpc_writer_append_node(w, request->params);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  } else if (request->raw_params.data) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"params\":");
+    jrpc_writer_append_raw(w, &request->raw_params);
+  }
+  jrpc_writer_append_char(w, '}');
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t
+jrpc_write_error_object(jrpc_writer_t *w,
+                        const jesenrpc_error_object_t *error) {
+  jesenrpc_err_t err = jesenrpc_error_object_validate(error);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  JRPC_WRITER_APPEND_LITERAL(w, "{\"code\":");
+  jrpc_writer_append_int64(w, error->code);
+  JRPC_WRITER_APPEND_LITERAL(w, ",\"message\":");
+  jrpc_writer_append_string(w, error->message, strlen(error->message));
+  if (error->data) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"data\":");
+    err = jrpc_writer_append_node(w, error->data);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  } else if (error->raw_data.data) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"data\":");
+    jrpc_writer_append_raw(w, &error->raw_data);
+  }
+  jrpc_writer_append_char(w, '}');
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_write_response(jrpc_writer_t *w,
+                                          const jesenrpc_response_t *response) {
+  jrpc_writer_begin(w, JESENRPC_MESSAGE_RESPONSE_SINGLE, NULL,
+                    response ? response->latency_method : NULL,
+                    response ? &response->id : NULL);
+  jesenrpc_err_t err = jesenrpc_response_validate(response);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  JRPC_WRITER_APPEND_LITERAL(w,
+                             "{\"jsonrpc\":\"" JESENRPC_JSONRPC_VERSION "\"");
+  err = jrpc_write_id(w, &response->id);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (response->result) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"result\":");
+    err = jrpc_writer_append_node(w, response->result);
+  } else if (response->raw_result.data) {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"result\":");
+    jrpc_writer_append_raw(w, &response->raw_result);
+  } else {
+    JRPC_WRITER_APPEND_LITERAL(w, ",\"error\":");
+    err = jrpc_write_error_object(w, response->error);
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  jrpc_writer_append_char(w, '}');
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t
+jrpc_write_request_batch(jrpc_writer_t *w, jesenrpc_request_t *const *requests,
+                         size_t request_count) {
+  jrpc_writer_begin(w, JESENRPC_MESSAGE_REQUEST_BATCH, NULL, NULL, NULL);
+  jrpc_writer_append_char(w, '[');
+  for (size_t i = 0; i < request_count; ++i) {
+    if (i > 0) {
+      jrpc_writer_append_char(w, ',');
+    }
+    jesenrpc_err_t err = jrpc_write_request(w, requests[i]);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  }
+  jrpc_writer_append_char(w, ']');
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t
+jrpc_write_response_batch(jrpc_writer_t *w,
+                          jesenrpc_response_t *const *responses,
+                          size_t response_count) {
+  jrpc_writer_begin(w, JESENRPC_MESSAGE_RESPONSE_BATCH, NULL, NULL, NULL);
+  jrpc_writer_append_char(w, '[');
+  for (size_t i = 0; i < response_count; ++i) {
+    if (i > 0) {
+      jrpc_writer_append_char(w, ',');
+    }
+    jesenrpc_err_t err = jrpc_write_response(w, responses[i]);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  }
+  jrpc_writer_append_char(w, ']');
+  return JESENRPC_ERR_NONE;
+}
+
+/* Shared tail of the fixed-buffer serializers: finish, report the produced or
+ * required length and release any measuring scratch space. */
+static jesenrpc_err_t jrpc_writer_complete(jrpc_writer_t *w, jesenrpc_err_t err,
+                                           size_t *out_len) {
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_writer_finish(w);
+  }
+  bool size_query = err == JESENRPC_ERR_BUFFER_TOO_SMALL && !w->buf;
+  if (size_query) {
+    err = JESENRPC_ERR_NONE;
+  }
+  jrpc_writer_end(w, err, w->len, !size_query);
+  if (out_len && (err == JESENRPC_ERR_NONE ||
+                  err == JESENRPC_ERR_BUFFER_TOO_SMALL)) {
+    *out_len = w->len;
+  }
+  jrpc_writer_release(w);
+  return err;
+}
+
+/* The original serializers predate JESENRPC_ERR_BUFFER_TOO_SMALL and keep
+ * reporting a short buffer as invalid arguments. */
+static jesenrpc_err_t jrpc_legacy_serialize_err(jesenrpc_err_t err) {
+  return err == JESENRPC_ERR_BUFFER_TOO_SMALL ? JESENRPC_ERR_INVALID_ARGS : err;
+}
+
+static jesenrpc_err_t jrpc_writer_complete_buf(jrpc_writer_t *w,
+                                               jesenrpc_err_t err,
+                                               size_t start_len) {
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_writer_finish(w);
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    w->grow->len = start_len;
+    if (w->grow->data && start_len < w->grow->cap) {
+      w->grow->data[start_len] = '\0';
+    }
+  }
+  if (!w->gather) {
+    jrpc_writer_end(w, err, w->len - start_len, true);
+  }
+  jrpc_writer_release(w);
+  return err;
+}
+
+static void jrpc_writer_init_iov(jrpc_writer_t *w, jesenrpc_buf_t *scratch,
+                                 jesenrpc_iovec_t *iov, size_t iov_cap) {
+  scratch->len = 0;
+  jrpc_writer_init_buf(w, scratch);
+  w->iov = iov;
+  w->iov_cap = iov ? iov_cap : 0;
+  w->gather = true;
+}
+
+/* Closes the last buffered run and, once the scratch buffer can no longer
+ * move, points the buffered segments into it. */
+static jesenrpc_err_t jrpc_writer_complete_iov(jrpc_writer_t *w,
+                                               jesenrpc_err_t err,
+                                               size_t *out_iov_count) {
+  if (err == JESENRPC_ERR_NONE) {
+    jrpc_writer_push_iov(w, NULL, w->len - w->run_start);
+  }
+  jesenrpc_buf_t *scratch = w->grow;
+  err = jrpc_writer_complete_buf(w, err, 0);
+  if (err == JESENRPC_ERR_NONE && w->iov_count > w->iov_cap) {
+    err = JESENRPC_ERR_BUFFER_TOO_SMALL;
+  }
+  size_t total = 0;
+  if (err == JESENRPC_ERR_NONE) {
+    size_t offset = 0;
+    for (size_t i = 0; i < w->iov_count; ++i) {
+      if (i % 2 == 0) {
+        w->iov[i].iov_base = scratch->data + offset;
+        offset += w->iov[i].iov_len;
+      }
+      total += w->iov[i].iov_len;
+    }
+  }
+  jrpc_writer_end(w, err, total, true);
+  if (out_iov_count &&
+      (err == JESENRPC_ERR_NONE || err == JESENRPC_ERR_BUFFER_TOO_SMALL)) {
+    *out_iov_count = w->iov_count;
+  }
+  return err;
+}
+
+/* Parsing scans the envelope directly instead of building a jesen tree for
+ * the whole message. Only params/result/data values are handed to
+ * jesen_parse(). Numeric IDs are read from their source text so 64-bit values
+ * survive exactly. Method names, string IDs and error messages are copied, or
+ * with JESENRPC_PARSE_IN_SITU unescaped in place and NUL-terminated inside the
+ * caller's buffer. */
+
+#define JRPC_SCAN_MAX_DEPTH 512
+#define JRPC_ERROR_MESSAGE_MAX_LEN 4096
+
+/* A scanned JSON value: [start, end) covers the whole token, including the
+ * quotes of strings. kind is the value's first character. */
+typedef struct jrpc_span {
+  size_t start;
+  size_t end;
+  char kind;
+  bool escaped; /* String contains escape sequences. */
+  bool present;
+} jrpc_span_t;
+
+typedef struct jrpc_scanner {
+  char *buf;
+  size_t len;
+  size_t pos;
+} jrpc_scanner_t;
+
+enum {
+  JRPC_KEY_JSONRPC,
+  JRPC_KEY_ID,
+  JRPC_KEY_METHOD,
+  JRPC_KEY_PARAMS,
+  JRPC_KEY_RESULT,
+  JRPC_KEY_ERROR,
+  JRPC_KEY_COUNT
+};
+
+static const char *const jrpc_envelope_keys[JRPC_KEY_COUNT] = {
+    "jsonrpc", "id", "method", "params", "result", "error"};
+
+enum {
+  JRPC_ERROR_KEY_CODE,
+  JRPC_ERROR_KEY_MESSAGE,
+  JRPC_ERROR_KEY_DATA,
+  JRPC_ERROR_KEY_COUNT
+};
+
+static const char *const jrpc_error_keys[JRPC_ERROR_KEY_COUNT] = {
+    "code", "message", "data"};
+
+static void jrpc_scan_skip_ws(jrpc_scanner_t *s) {
+  while (s->pos < s->len) {
+    char c = s->buf[s->pos];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+      break;
+    }
+    ++s->pos;
+  }
+}
+
+static bool jrpc_scan_consume(jrpc_scanner_t *s, char c) {
+  jrpc_scan_skip_ws(s);
+  if (s->pos < s->len && s->buf[s->pos] == c) {
+    ++s->pos;
+    return true;
+  }
+  return false;
+}
+
+static int jrpc_hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static jesenrpc_err_t jrpc_scan_string(jrpc_scanner_t *s, jrpc_span_t *span) {
+  size_t i = s->pos + 1;
+  bool escaped = false;
+  while (i < s->len) {
+    unsigned char c = (unsigned char)s->buf[i];
+    if (c == '"') {
+      span->start = s->pos;
+      span->end = i + 1;
+      span->kind = '"';
+      span->escaped = escaped;
+      s->pos = i + 1;
+      return JESENRPC_ERR_NONE;
+    }
+    if (c < 0x20) {
+      return JESENRPC_ERR_PARSE;
+    }
+    if (c != '\\') {
+      ++i;
+      continue;
+    }
+    escaped = true;
+    if (i + 1 >= s->len) {
+      return JESENRPC_ERR_PARSE;
+    }
+    switch (s->buf[i + 1]) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      i += 2;
+      break;
+    case 'u':
+      if (s->len - i < 6) {
+        return JESENRPC_ERR_PARSE;
+      }
+      for (size_t h = 2; h < 6; ++h) {
+        if (jrpc_hex_value(s->buf[i + h]) < 0) {
+          return JESENRPC_ERR_PARSE;
+        }
+      }
+      i += 6;
+      break;
+    default:
+      return JESENRPC_ERR_PARSE;
+    }
+  }
+  return JESENRPC_ERR_PARSE;
+}
+
+static bool jrpc_scan_digits(jrpc_scanner_t *s) {
+  size_t start = s->pos;
+  while (s->pos < s->len && s->buf[s->pos] >= '0' && s->buf[s->pos] <= '9') {
+    ++s->pos;
+  }
+  return s->pos > start;
+}
+
+static jesenrpc_err_t jrpc_scan_number(jrpc_scanner_t *s) {
+  if (s->buf[s->pos] == '-') {
+    ++s->pos;
+  }
+  if (s->pos < s->len && s->buf[s->pos] == '0') {
+    ++s->pos;
+  } else if (!jrpc_scan_digits(s)) {
+    return JESENRPC_ERR_PARSE;
+  }
+  if (s->pos < s->len && s->buf[s->pos] == '.') {
+    ++s->pos;
+    if (!jrpc_scan_digits(s)) {
+      return JESENRPC_ERR_PARSE;
+    }
+  }
+  if (s->pos < s->len && (s->buf[s->pos] == 'e' || s->buf[s->pos] == 'E')) {
+    ++s->pos;
+    if (s->pos < s->len && (s->buf[s->pos] == '+' || s->buf[s->pos] == '-')) {
+      ++s->pos;
+    }
+    if (!jrpc_scan_digits(s)) {
+      return JESENRPC_ERR_PARSE;
+    }
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_literal(jrpc_scanner_t *s, const char *lit,
+                                        size_t lit_len) {
+  if (s->len - s->pos < lit_len ||
+      memcmp(s->buf + s->pos, lit, lit_len) != 0) {
+    return JESENRPC_ERR_PARSE;
+  }
+  s->pos += lit_len;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_value(jrpc_scanner_t *s, int depth,
+                                      jrpc_span_t *span);
+
+static jesenrpc_err_t jrpc_scan_container(jrpc_scanner_t *s, int depth) {
+  if (depth >= JRPC_SCAN_MAX_DEPTH) {
+    return JESENRPC_ERR_PARSE;
+  }
+  char open = s->buf[s->pos++];
+  char close = open == '{' ? '}' : ']';
+  if (jrpc_scan_consume(s, close)) {
+    return JESENRPC_ERR_NONE;
+  }
+  for (;;) {
+    jrpc_span_t span;
+    jesenrpc_err_t err;
+    if (open == '{') {
+      jrpc_scan_skip_ws(s);
+      if (s->pos >= s->len || s->buf[s->pos] != '"') {
+        return JESENRPC_ERR_PARSE;
+      }
+      err = jrpc_scan_string(s, &span);
+      if (err != JESENRPC_ERR_NONE) {
+        return err;
+      }
+      if (!jrpc_scan_consume(s, ':')) {
+        return JESENRPC_ERR_PARSE;
+      }
+    }
+    err = jrpc_scan_value(s, depth + 1, &span);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    if (jrpc_scan_consume(s, ',')) {
+      continue;
+    }
+    return jrpc_scan_consume(s, close) ? JESENRPC_ERR_NONE : JESENRPC_ERR_PARSE;
+  }
+}
+
+static jesenrpc_err_t jrpc_scan_value(jrpc_scanner_t *s, int depth,
+                                      jrpc_span_t *span) {
+  jrpc_scan_skip_ws(s);
+  if (s->pos >= s->len) {
+    return JESENRPC_ERR_PARSE;
+  }
+  size_t start = s->pos;
+  char c = s->buf[start];
+  jesenrpc_err_t err;
+  switch (c) {
+  case '"':
+    return jrpc_scan_string(s, span);
+  case '{':
+  case '[':
+    err = jrpc_scan_container(s, depth);
+    break;
+  case 't':
+    err = jrpc_scan_literal(s, "true", 4);
+    break;
+  case 'f':
+    err = jrpc_scan_literal(s, "false", 5);
+    break;
+  case 'n':
+    err = jrpc_scan_literal(s, "null", 4);
+    break;
+  default:
+    if (c != '-' && (c < '0' || c > '9')) {
+      return JESENRPC_ERR_PARSE;
+    }
+    err = jrpc_scan_number(s);
+    break;
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  span->start = start;
+  span->end = s->pos;
+  span->kind = c;
+  span->escaped = false;
+  return JESENRPC_ERR_NONE;
+}
+
+static void jrpc_utf8_append(char *dst, size_t *len, uint32_t cp) {
+  if (cp < 0x80) {
+    dst[(*len)++] = (char)cp;
+  } else if (cp < 0x800) {
+    dst[(*len)++] = (char)(0xC0 | (cp >> 6));
+    dst[(*len)++] = (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    dst[(*len)++] = (char)(0xE0 | (cp >> 12));
+    dst[(*len)++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[(*len)++] = (char)(0x80 | (cp & 0x3F));
+  } else {
+    dst[(*len)++] = (char)(0xF0 | (cp >> 18));
+    dst[(*len)++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    dst[(*len)++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[(*len)++] = (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+static uint32_t jrpc_read_hex4(const char *p) {
+  return (uint32_t)((jrpc_hex_value(p[0]) << 12) | (jrpc_hex_value(p[1]) << 8) |
+                    (jrpc_hex_value(p[2]) << 4) | jrpc_hex_value(p[3]));
+}
+
+/* Decodes the escapes of an already validated string body. The output is never
+ * longer than the input, so dst may alias src. */
+static size_t jrpc_unescape(const char *src, size_t len, char *dst) {
+  size_t out = 0;
+  size_t i = 0;
+  while (i < len) {
+    char c = src[i];
+    if (c != '\\') {
+      dst[out++] = c;
+      ++i;
+      continue;
+    }
+    char e = src[i + 1];
+    i += 2;
+    switch (e) {
+    case 'b':
+      dst[out++] = '\b';
+      break;
+    case 'f':
+      dst[out++] = '\f';
+      break;
+    case 'n':
+      dst[out++] = '\n';
+      break;
+    case 'r':
+      dst[out++] = '\r';
+      break;
+    case 't':
+      dst[out++] = '\t';
+      break;
+    case 'u': {
+      uint32_t cp = jrpc_read_hex4(src + i);
+      i += 4;
+      if (cp >= 0xD800 && cp <= 0xDBFF && len - i >= 6 && src[i] == '\\' &&
+          src[i + 1] == 'u') {
+        uint32_t low = jrpc_read_hex4(src + i + 2);
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          i += 6;
+        }
+      }
+      if (cp >= 0xD800 && cp <= 0xDFFF) {
+        cp = 0xFFFD; /* Unpaired surrogate. */
+      }
+      jrpc_utf8_append(dst, &out, cp);
+      break;
+    }
+    default: /* '"', '\\' and '/' stand for themselves. */
+      dst[out++] = e;
+      break;
+    }
+  }
+  return out;
+}
+
+static bool jrpc_span_equals(const jrpc_scanner_t *s, const jrpc_span_t *span,
+                             const char *str) {
+  const char *body = s->buf + span->start + 1;
+  size_t body_len = span->end - span->start - 2;
+  size_t str_len = strlen(str);
+  if (!span->escaped) {
+    return body_len == str_len && memcmp(body, str, str_len) == 0;
+  }
+  char decoded[64];
+  if (body_len > sizeof(decoded)) {
+    return false; /* Far longer than any key or version we compare against. */
+  }
+  size_t decoded_len = jrpc_unescape(body, body_len, decoded);
+  return decoded_len == str_len && memcmp(decoded, str, str_len) == 0;
+}
+
+/* Produces the decoded C string for a string value. In situ it is unescaped
+ * in place and NUL-terminated over its closing quote; otherwise it is decoded
+ * into a copy from the heap or the arena. */
+static jesenrpc_err_t jrpc_scan_take_string(const jrpc_parse_ctx_t *ctx,
+                                            jrpc_scanner_t *s,
+                                            const jrpc_span_t *span,
+                                            size_t max_len, char **out,
+                                            size_t *out_len) {
+  char *body = s->buf + span->start + 1;
+  size_t len = span->end - span->start - 2;
+  if (!span->escaped && len > max_len) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  char *dst = body;
+  if (!ctx->in_situ) {
+    dst = (char *)jrpc_ctx_calloc(ctx, len + 1, sizeof(char));
+    if (!dst) {
+      return JESENRPC_ERR_ALLOC;
+    }
+  }
+  if (span->escaped) {
+    len = jrpc_unescape(body, len, dst);
+  } else if (dst != body) {
+    memcpy(dst, body, len);
+  }
+  if (len > max_len) {
+    if (!ctx->in_situ && !ctx->arena) {
+      jrpc_free(dst);
+    }
+    return JESENRPC_ERR_VALIDATION;
+  }
+  dst[len] = '\0';
+  if (!ctx->in_situ && ctx->arena) {
+    jrpc_arena_shrink_last(ctx->arena, dst, len + 1);
+  }
+  *out = dst;
+  *out_len = len;
+  return JESENRPC_ERR_NONE;
+}
+
+/* Scans an object and records the first occurrence of each wanted key. */
+static jesenrpc_err_t jrpc_scan_members(jrpc_scanner_t *s,
+                                        const char *const *keys,
+                                        size_t key_count, jrpc_span_t *spans) {
+  memset(spans, 0, key_count * sizeof(*spans));
+  if (!jrpc_scan_consume(s, '{')) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (jrpc_scan_consume(s, '}')) {
+    return JESENRPC_ERR_NONE;
+  }
+  for (;;) {
+    jrpc_span_t key;
+    jrpc_span_t value;
+    jrpc_scan_skip_ws(s);
+    if (s->pos >= s->len || s->buf[s->pos] != '"') {
+      return JESENRPC_ERR_PARSE;
+    }
+    jesenrpc_err_t err = jrpc_scan_string(s, &key);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    if (!jrpc_scan_consume(s, ':')) {
+      return JESENRPC_ERR_PARSE;
+    }
+    err = jrpc_scan_value(s, 1, &value);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    for (size_t k = 0; k < key_count; ++k) {
+      if (!spans[k].present && jrpc_span_equals(s, &key, keys[k])) {
+        spans[k] = value;
+        spans[k].present = true;
+        break;
+      }
+    }
+    if (jrpc_scan_consume(s, ',')) {
+      continue;
+    }
+    return jrpc_scan_consume(s, '}') ? JESENRPC_ERR_NONE : JESENRPC_ERR_PARSE;
+  }
+}
+
+static jesenrpc_err_t jrpc_scan_parse_node(jrpc_scanner_t *s,
+                                           const jrpc_span_t *span,
+                                           jesen_node_t **out) {
+  return jesen_parse(s->buf + span->start, span->end - span->start, out);
+}
+
+static jesenrpc_err_t jrpc_scan_int64(const jrpc_scanner_t *s,
+                                      const jrpc_span_t *span, int64_t *out) {
+  const char *p = s->buf + span->start;
+  size_t len = span->end - span->start;
+  bool negative = p[0] == '-';
+  size_t i = negative ? 1 : 0;
+  uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+  uint64_t value = 0;
+  for (; i < len && p[i] >= '0' && p[i] <= '9'; ++i) {
+    uint64_t digit = (uint64_t)(p[i] - '0');
+    if (value > (limit - digit) / 10) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+    value = value * 10 + digit;
+  }
+  if (i == len) {
+    *out = negative ? (int64_t)(0 - value) : (int64_t)value;
+    return JESENRPC_ERR_NONE;
+  }
+
+  /* Fraction or exponent: accept only values that are exact integers. */
+  char tmp[64];
+  if (len >= sizeof(tmp)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  memcpy(tmp, p, len);
+  tmp[len] = '\0';
+  double val = strtod(tmp, NULL);
+  if (val >= (double)INT64_MAX || val < (double)INT64_MIN) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  int64_t as_int = (int64_t)val;
+  if (!jrpc_doubles_equal((double)as_int, val)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  *out = as_int;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_id(const jrpc_parse_ctx_t *ctx,
+                                   jrpc_scanner_t *s, const jrpc_span_t *span,
+                                   jesenrpc_id_t *out_id) {
+  if (span->kind == 'n') {
+    return jesenrpc_id_set_null(out_id);
+  }
+  if (span->kind == '"') {
+    char *data = NULL;
+    size_t len = 0;
+    jesenrpc_err_t err =
+        jrpc_scan_take_string(ctx, s, span, SIZE_MAX - 1, &data, &len);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    jrpc_id_cleanup(out_id);
+    out_id->kind = JESENRPC_ID_STRING;
+    out_id->value.string.data = data;
+    out_id->value.string.len = len;
+    out_id->value.string.borrowed = ctx->in_situ || ctx->arena != NULL;
+    return JESENRPC_ERR_NONE;
+  }
+  if (span->kind == '-' || (span->kind >= '0' && span->kind <= '9')) {
+    int64_t value = 0;
+    jesenrpc_err_t err = jrpc_scan_int64(s, span, &value);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    return jesenrpc_id_set_number(out_id, value);
+  }
+  return JESENRPC_ERR_VALIDATION;
+}
+
+static jesenrpc_err_t jrpc_scan_check_version(const jrpc_scanner_t *s,
+                                              const jrpc_span_t *spans) {
+  const jrpc_span_t *version = &spans[JRPC_KEY_JSONRPC];
+  if (!version->present || version->kind != '"' ||
+      !jrpc_span_equals(s, version, JESENRPC_JSONRPC_VERSION)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_build_request(const jrpc_parse_ctx_t *ctx,
+                                              jrpc_scanner_t *s,
+                                              const jrpc_span_t *spans,
+                                              jesenrpc_request_t **out) {
+  jesenrpc_err_t err = jrpc_scan_check_version(s, spans);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  const jrpc_span_t *method = &spans[JRPC_KEY_METHOD];
+  const jrpc_span_t *params = &spans[JRPC_KEY_PARAMS];
+  if (!method->present || method->kind != '"') {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (params->present && params->kind != '{' && params->kind != '[') {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  jesenrpc_request_t *req =
+      (jesenrpc_request_t *)jrpc_ctx_object(ctx, JRPC_POOL_REQUEST);
+  if (!req) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  req->jsonrpc = JESENRPC_JSONRPC_VERSION;
+  req->id.kind = JESENRPC_ID_NONE;
+  req->arena = ctx->arena;
+  req->borrowed = ctx->in_situ || ctx->arena != NULL;
+
+  size_t method_len = 0;
+  err = jrpc_scan_take_string(ctx, s, method, JESENRPC_METHOD_NAME_MAX_LEN,
+                              &req->method_name, &method_len);
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_request_discard(req);
+    return err;
+  }
+
+  if (spans[JRPC_KEY_ID].present) {
+    err = jrpc_scan_id(ctx, s, &spans[JRPC_KEY_ID], &req->id);
+    if (err != JESENRPC_ERR_NONE) {
+      jrpc_request_discard(req);
+      return err;
+    }
+  }
+
+  if (params->present && ctx->lazy_params) {
+    /* Already scanned as a well-formed value by jrpc_scan_members(). */
+    req->raw_params.data = s->buf + params->start;
+    req->raw_params.len = params->end - params->start;
+  } else if (params->present) {
+    err = jrpc_scan_parse_node(s, params, &req->params);
+    if (err != JESEN_ERR_NONE) {
+      jrpc_request_discard(req);
+      return err;
+    }
+  }
+
+  if (ctx->arena) {
+    err = jrpc_arena_defer(ctx->arena, jrpc_request_release, req);
+    if (err != JESENRPC_ERR_NONE) {
+      jrpc_request_discard(req);
+      return err;
+    }
+  }
+
+  *out = req;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_build_error(const jrpc_parse_ctx_t *ctx,
+                                            jrpc_scanner_t *s,
+                                            const jrpc_span_t *span,
+                                            jesenrpc_error_object_t **out) {
+  if (span->kind != '{') {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  jrpc_scanner_t sub = {s->buf, span->end, span->start};
+  jrpc_span_t spans[JRPC_ERROR_KEY_COUNT];
+  jesenrpc_err_t err =
+      jrpc_scan_members(&sub, jrpc_error_keys, JRPC_ERROR_KEY_COUNT, spans);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  const jrpc_span_t *code = &spans[JRPC_ERROR_KEY_CODE];
+  const jrpc_span_t *message = &spans[JRPC_ERROR_KEY_MESSAGE];
+  if (!code->present || (code->kind != '-' && (code->kind < '0' ||
+                                               code->kind > '9'))) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  int64_t code_value = 0;
+  err = jrpc_scan_int64(&sub, code, &code_value);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (code_value < INT32_MIN || code_value > INT32_MAX) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (!message->present || message->kind != '"') {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  jesenrpc_error_object_t *err_obj =
+      (jesenrpc_error_object_t *)jrpc_ctx_object(ctx, JRPC_POOL_ERROR);
+  if (!err_obj) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  err_obj->code = (int32_t)code_value;
+  err_obj->arena = ctx->arena;
+  err_obj->borrowed = ctx->in_situ || ctx->arena != NULL;
+
+  size_t message_len = 0;
+  err = jrpc_scan_take_string(ctx, &sub, message, JRPC_ERROR_MESSAGE_MAX_LEN,
+                              &err_obj->message, &message_len);
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_error_object_discard(err_obj);
+    return err;
+  }
+
+  if (spans[JRPC_ERROR_KEY_DATA].present) {
+    err = jrpc_scan_parse_node(&sub, &spans[JRPC_ERROR_KEY_DATA],
+                               &err_obj->data);
+    if (err != JESEN_ERR_NONE) {
+      jrpc_error_object_discard(err_obj);
+      return err;
+    }
+  }
+
+  *out = err_obj;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_build_response(const jrpc_parse_ctx_t *ctx,
+                                               jrpc_scanner_t *s,
+                                               const jrpc_span_t *spans,
+                                               jesenrpc_response_t **out) {
+  jesenrpc_err_t err = jrpc_scan_check_version(s, spans);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  bool has_result = spans[JRPC_KEY_RESULT].present;
+  bool has_error = spans[JRPC_KEY_ERROR].present;
+  if (!spans[JRPC_KEY_ID].present || has_result == has_error) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  jesenrpc_response_t *resp =
+      (jesenrpc_response_t *)jrpc_ctx_object(ctx, JRPC_POOL_RESPONSE);
+  if (!resp) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  resp->jsonrpc = JESENRPC_JSONRPC_VERSION;
+  resp->arena = ctx->arena;
+
+  err = jrpc_scan_id(ctx, s, &spans[JRPC_KEY_ID], &resp->id);
+  if (err == JESENRPC_ERR_NONE) {
+    if (has_result) {
+      err = jrpc_scan_parse_node(s, &spans[JRPC_KEY_RESULT], &resp->result);
+    } else {
+      err = jrpc_scan_build_error(ctx, s, &spans[JRPC_KEY_ERROR],
+                                  &resp->error);
+    }
+  }
+  if (err == JESENRPC_ERR_NONE && ctx->arena) {
+    err = jrpc_arena_defer(ctx->arena, jrpc_response_release, resp);
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_response_discard(resp);
+    return err;
+  }
+
+  *out = resp;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_kind(const jrpc_span_t *spans, bool in_batch,
+                                     jesenrpc_message_kind_t *out_kind) {
+  bool has_method = spans[JRPC_KEY_METHOD].present;
+  bool has_reply =
+      spans[JRPC_KEY_RESULT].present || spans[JRPC_KEY_ERROR].present;
+  if (has_method && !has_reply) {
+    *out_kind = in_batch ? JESENRPC_MESSAGE_REQUEST_BATCH
+                         : JESENRPC_MESSAGE_REQUEST_SINGLE;
+    return JESENRPC_ERR_NONE;
+  }
+  if (!has_method && has_reply) {
+    *out_kind = in_batch ? JESENRPC_MESSAGE_RESPONSE_BATCH
+                         : JESENRPC_MESSAGE_RESPONSE_SINGLE;
+    return JESENRPC_ERR_NONE;
+  }
+  return JESENRPC_ERR_VALIDATION;
+}
+
+/* Classifies an envelope by its first method, result or error key. Members
+ * before it are skipped without being materialized; everything after it is
+ * never looked at, so the cost depends on the envelope layout rather than on
+ * the size of params or result. */
+static jesenrpc_err_t jrpc_peek_envelope(jrpc_scanner_t *s, bool in_batch,
+                                         jesenrpc_message_kind_t *out_kind) {
+  if (!jrpc_scan_consume(s, '{')) {
+    return s->pos < s->len ? JESENRPC_ERR_VALIDATION : JESENRPC_ERR_PARSE;
+  }
+  if (jrpc_scan_consume(s, '}')) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  for (;;) {
+    jrpc_span_t key;
+    jrpc_span_t value;
+    jrpc_scan_skip_ws(s);
+    if (s->pos >= s->len || s->buf[s->pos] != '"') {
+      return JESENRPC_ERR_PARSE;
+    }
+    jesenrpc_err_t err = jrpc_scan_string(s, &key);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    if (!jrpc_scan_consume(s, ':')) {
+      return JESENRPC_ERR_PARSE;
+    }
+    if (jrpc_span_equals(s, &key, "method")) {
+      *out_kind = in_batch ? JESENRPC_MESSAGE_REQUEST_BATCH
+                           : JESENRPC_MESSAGE_REQUEST_SINGLE;
+      return JESENRPC_ERR_NONE;
+    }
+    if (jrpc_span_equals(s, &key, "result") ||
+        jrpc_span_equals(s, &key, "error")) {
+      *out_kind = in_batch ? JESENRPC_MESSAGE_RESPONSE_BATCH
+                           : JESENRPC_MESSAGE_RESPONSE_SINGLE;
+      return JESENRPC_ERR_NONE;
+    }
+    err = jrpc_scan_value(s, 1, &value);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    if (jrpc_scan_consume(s, ',')) {
+      continue;
+    }
+    return jrpc_scan_consume(s, '}') ? JESENRPC_ERR_VALIDATION
+                                     : JESENRPC_ERR_PARSE;
+  }
+}
+
+static jesenrpc_err_t jrpc_scan_finish(jrpc_scanner_t *s) {
+  jrpc_scan_skip_ws(s);
+  return s->pos == s->len ? JESENRPC_ERR_NONE : JESENRPC_ERR_PARSE;
+}
+
+/* Checks that json holds exactly one well-formed value, so splicing it into
+ * an envelope cannot produce broken output. out_kind, if given, receives the
+ * value's first character. */
+static jesenrpc_err_t jrpc_check_raw_json(const char *json, size_t json_len,
+                                          char *out_kind) {
+  /* The scanner only reads; its buffer is non-const for the in-situ path. */
+  jrpc_scanner_t s = {(char *)json, json_len, 0};
+  jrpc_span_t span;
+  jesenrpc_err_t err = jrpc_scan_value(&s, 0, &span);
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_scan_finish(&s);
+  }
+  if (err == JESENRPC_ERR_NONE && out_kind) {
+    *out_kind = span.kind;
+  }
+  return err;
+}
+
+/* Grows a batch items array; arena arrays are copied since they cannot be
+ * resized in place. Returns NULL on allocation failure. */
+static void *jrpc_ctx_grow_array(const jrpc_parse_ctx_t *ctx, void *items,
+                                 size_t elem_size, size_t count,
+                                 size_t *capacity) {
+  size_t new_cap = *capacity ? *capacity * 2 : 8;
+  if (new_cap > SIZE_MAX / elem_size) {
+    return NULL;
+  }
+  void *grown;
+  if (ctx->arena) {
+    grown = jrpc_arena_alloc(ctx->arena, new_cap * elem_size);
+    if (grown && count > 0) {
+      memcpy(grown, items, count * elem_size);
+    }
+  } else {
+    grown = jrpc_realloc(items, new_cap * elem_size);
+  }
+  if (grown) {
+    *capacity = new_cap;
+  }
+  return grown;
+}
+
+/* Parses batch elements of a known kind. The scanner is positioned after the
+ * opening bracket; first holds the already scanned first element. */
+static jesenrpc_err_t jrpc_scan_request_batch(const jrpc_parse_ctx_t *ctx,
+                                              jrpc_scanner_t *s,
+                                              jrpc_span_t *first,
+                                              jesenrpc_request_batch_t *out) {
+  jesenrpc_request_t **items = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  jrpc_span_t spans[JRPC_KEY_COUNT];
+  jrpc_span_t *current = first;
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+
+  for (;;) {
+    if (!current) {
+      err = jrpc_scan_members(s, jrpc_envelope_keys, JRPC_KEY_COUNT, spans);
+      if (err != JESENRPC_ERR_NONE) {
+        break;
+      }
+      current = spans;
+    }
+    if (count == capacity) {
+      void *grown =
+          jrpc_ctx_grow_array(ctx, items, sizeof(*items), count, &capacity);
+      if (!grown) {
+        err = JESENRPC_ERR_ALLOC;
+        break;
+      }
+      items = (jesenrpc_request_t **)grown;
+    }
+    err = jrpc_scan_build_request(ctx, s, current, &items[count]);
+    if (err != JESENRPC_ERR_NONE) {
+      break;
+    }
+    ++count;
+    current = NULL;
+    if (jrpc_scan_consume(s, ',')) {
+      continue;
+    }
+    err = jrpc_scan_consume(s, ']') ? JESENRPC_ERR_NONE : JESENRPC_ERR_PARSE;
+    break;
+  }
+
+  if (err != JESENRPC_ERR_NONE) {
+    for (size_t i = 0; i < count; ++i) {
+      jesenrpc_request_destroy(items[i]);
+    }
+    if (!ctx->arena) {
+      jrpc_free(items);
+    }
+    return err;
+  }
+  out->items = items;
+  out->count = count;
+  out->arena = ctx->arena;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_scan_response_batch(const jrpc_parse_ctx_t *ctx,
+                                               jrpc_scanner_t *s,
+                                               jrpc_span_t *first,
+                                               jesenrpc_response_batch_t *out) {
+  jesenrpc_response_t **items = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  jrpc_span_t spans[JRPC_KEY_COUNT];
+  jrpc_span_t *current = first;
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+
+  for (;;) {
+    if (!current) {
+      err = jrpc_scan_members(s, jrpc_envelope_keys, JRPC_KEY_COUNT, spans);
+      if (err != JESENRPC_ERR_NONE) {
+        break;
+      }
+      current = spans;
+    }
+    if (count == capacity) {
+      void *grown =
+          jrpc_ctx_grow_array(ctx, items, sizeof(*items), count, &capacity);
+      if (!grown) {
+        err = JESENRPC_ERR_ALLOC;
+        break;
+      }
+      items = (jesenrpc_response_t **)grown;
+    }
+    err = jrpc_scan_build_response(ctx, s, current, &items[count]);
+    if (err != JESENRPC_ERR_NONE) {
+      break;
+    }
+    ++count;
+    current = NULL;
+    if (jrpc_scan_consume(s, ',')) {
+      continue;
+    }
+    err = jrpc_scan_consume(s, ']') ? JESENRPC_ERR_NONE : JESENRPC_ERR_PARSE;
+    break;
+  }
+
+  if (err != JESENRPC_ERR_NONE) {
+    for (size_t i = 0; i < count; ++i) {
+      jesenrpc_response_destroy(items[i]);
+    }
+    if (!ctx->arena) {
+      jrpc_free(items);
+    }
+    return err;
+  }
+  out->items = items;
+  out->count = count;
+  out->arena = ctx->arena;
+  return JESENRPC_ERR_NONE;
+}
+
+/* Entry point for every parse. expected is the kind the caller asked
+ * for, or JESENRPC_MESSAGE_UNKNOWN to accept any shape. Single and batch
+ * outputs are only written for the matching kind. */
+static jesenrpc_err_t jrpc_scan_message(const jrpc_parse_ctx_t *ctx,
+                                        char *buf, size_t buf_len,
+                                        jesenrpc_message_kind_t expected,
+                                        jesenrpc_message_t *out) {
+  jrpc_scanner_t s = {buf, buf_len, 0};
+  jrpc_span_t first[JRPC_KEY_COUNT];
+  jesenrpc_message_kind_t kind = JESENRPC_MESSAGE_UNKNOWN;
+  jesenrpc_err_t err;
+
+  bool is_batch = jrpc_scan_consume(&s, '[');
+  if (is_batch && jrpc_scan_consume(&s, ']')) {
+    /* The batch parsers accept an empty array; message parsing does not. */
+    if (expected != JESENRPC_MESSAGE_REQUEST_BATCH &&
+        expected != JESENRPC_MESSAGE_RESPONSE_BATCH) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+    out->kind = expected;
+    return jrpc_scan_finish(&s);
+  }
+
+  err = jrpc_scan_members(&s, jrpc_envelope_keys, JRPC_KEY_COUNT, first);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (expected == JESENRPC_MESSAGE_UNKNOWN) {
+    err = jrpc_scan_kind(first, is_batch, &kind);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  } else {
+    kind = expected;
+    bool expect_batch = expected == JESENRPC_MESSAGE_REQUEST_BATCH ||
+                        expected == JESENRPC_MESSAGE_RESPONSE_BATCH;
+    if (expect_batch != is_batch) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+  }
+
+  switch (kind) {
+  case JESENRPC_MESSAGE_REQUEST_SINGLE:
+    err = jrpc_scan_build_request(ctx, &s, first, &out->as.request);
+    if (err == JESENRPC_ERR_NONE && jrpc_scan_finish(&s) != JESENRPC_ERR_NONE) {
+      jesenrpc_request_destroy(out->as.request);
+      err = JESENRPC_ERR_PARSE;
+    }
+    break;
+  case JESENRPC_MESSAGE_RESPONSE_SINGLE:
+    err = jrpc_scan_build_response(ctx, &s, first, &out->as.response);
+    if (err == JESENRPC_ERR_NONE && jrpc_scan_finish(&s) != JESENRPC_ERR_NONE) {
+      jesenrpc_response_destroy(out->as.response);
+      err = JESENRPC_ERR_PARSE;
+    }
+    break;
+  case JESENRPC_MESSAGE_REQUEST_BATCH:
+    err = jrpc_scan_request_batch(ctx, &s, first, &out->as.request_batch);
+    if (err == JESENRPC_ERR_NONE && jrpc_scan_finish(&s) != JESENRPC_ERR_NONE) {
+      jesenrpc_request_batch_destroy(&out->as.request_batch);
+      err = JESENRPC_ERR_PARSE;
+    }
+    break;
+  case JESENRPC_MESSAGE_RESPONSE_BATCH:
+    err = jrpc_scan_response_batch(ctx, &s, first, &out->as.response_batch);
+    if (err == JESENRPC_ERR_NONE && jrpc_scan_finish(&s) != JESENRPC_ERR_NONE) {
+      jesenrpc_response_batch_destroy(&out->as.response_batch);
+      err = JESENRPC_ERR_PARSE;
+    }
+    break;
+  default:
+    err = JESENRPC_ERR_VALIDATION;
+    break;
+  }
+  if (err == JESENRPC_ERR_NONE) {
+    out->kind = kind;
+  }
+  return err;
+}
+
+static jesenrpc_err_t jrpc_parse_message(const jrpc_parse_ctx_t *ctx,
+                                         char *buf, size_t buf_len,
+                                         jesenrpc_message_kind_t expected,
+                                         jesenrpc_message_t *out) {
+  JRPC_HOOK_ENTER(JESENRPC_HOOK_PARSE, expected, NULL, NULL, buf_len);
+  uint64_t started = jrpc_latency_start();
+  jesenrpc_err_t err = jrpc_scan_message(ctx, buf, buf_len, expected, out);
+  jrpc_stats_parsed(out->kind, buf_len, err);
+  if (err != JESENRPC_ERR_NONE) {
+    JRPC_HOOK_EXIT(JESENRPC_HOOK_PARSE, JESENRPC_MESSAGE_UNKNOWN, NULL, NULL,
+                   buf_len, err);
+    return err;
+  }
+  jrpc_latency_parsed(out, started);
+  const jesenrpc_request_t *request =
+      out->kind == JESENRPC_MESSAGE_REQUEST_SINGLE ? out->as.request : NULL;
+  const jesenrpc_id_t *id =
+      request ? &request->id
+      : out->kind == JESENRPC_MESSAGE_RESPONSE_SINGLE ? &out->as.response->id
+                                                      : NULL;
+  const char *method = request ? request->method_name : NULL;
+  JRPC_PROBE3(parsed, (int)out->kind, method, buf_len);
+  JRPC_HOOK_EXIT(JESENRPC_HOOK_PARSE, out->kind, method, id, buf_len, err);
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_buf_init(jesenrpc_buf_t *buf) {
+  return jesenrpc_buf_init_ex(buf, NULL);
+}
+
+jesenrpc_err_t jesenrpc_buf_init_ex(jesenrpc_buf_t *buf,
+                                    const jesenrpc_allocator_t *allocator) {
+  if (!buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  memset(buf, 0, sizeof(*buf));
+  buf->allocator = allocator;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_buf_reserve(jesenrpc_buf_t *buf, size_t capacity) {
+  if (!buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_buf_grow(buf, capacity);
+}
+
+jesenrpc_err_t jesenrpc_buf_clear(jesenrpc_buf_t *buf) {
+  if (!buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  buf->len = 0;
+  if (buf->data) {
+    buf->data[0] = '\0';
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_buf_destroy(jesenrpc_buf_t *buf) {
+  if (!buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_free_from(buf->allocator, buf->data);
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_arena_init(jesenrpc_arena_t *arena, size_t block_size) {
+  return jesenrpc_arena_init_ex(arena, block_size, NULL);
+}
+
+jesenrpc_err_t jesenrpc_arena_init_ex(jesenrpc_arena_t *arena,
+                                      size_t block_size,
+                                      const jesenrpc_allocator_t *allocator) {
+  if (!arena) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  memset(arena, 0, sizeof(*arena));
+  arena->block_size = block_size ? block_size : JRPC_ARENA_DEFAULT_BLOCK_SIZE;
+  arena->allocator = allocator;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_set_allocator(const jesenrpc_allocator_t *allocator) {
+  if (allocator && (!allocator->malloc_fn || !allocator->realloc_fn ||
+                    !allocator->free_fn)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  /* Pooled objects belong to the outgoing allocator. Other threads free
+   * their cached ones through it once they notice the new generation. */
+  jrpc_pool_trim();
+  ++jrpc_allocator_generation;
+  if (!allocator) {
+    jrpc_global_allocator = NULL;
+    return JESENRPC_ERR_NONE;
+  }
+  jrpc_custom_allocator = *allocator;
+  jrpc_global_allocator = &jrpc_custom_allocator;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_pool_trim(void) {
+  jrpc_pool_trim();
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_arena_reset(jesenrpc_arena_t *arena) {
+  if (!arena) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  struct jesenrpc_arena_cleanup *cleanup = arena->cleanups;
+  arena->cleanups = NULL;
+  while (cleanup) {
+    struct jesenrpc_arena_cleanup *next = cleanup->next;
+    cleanup->release(cleanup->object);
+    cleanup = next;
+  }
+
+  struct jesenrpc_arena_block *block = arena->blocks;
+  if (!block) {
+    return JESENRPC_ERR_NONE;
+  }
+  if (!block->next) {
+    block->used = 0;
+    return JESENRPC_ERR_NONE;
+  }
+
+  /* The last message spilled into several blocks: replace them with one block
+   * large enough for all of it, so a warm arena stops allocating. */
+  size_t total = 0;
+  while (block) {
+    struct jesenrpc_arena_block *next = block->next;
+    total += block->size;
+    jrpc_free_from(arena->allocator, block);
+    block = next;
+  }
+  arena->blocks = NULL;
+  if (total > arena->block_size) {
+    block = (struct jesenrpc_arena_block *)jrpc_malloc_from(
+        arena->allocator, JRPC_ARENA_HEADER_SIZE + total);
+    if (block) {
+      block->next = NULL;
+      block->size = total;
+      block->used = 0;
+      arena->blocks = block;
+    }
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_arena_destroy(jesenrpc_arena_t *arena) {
+  jesenrpc_err_t err = jesenrpc_arena_reset(arena);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  jrpc_free_from(arena->allocator, arena->blocks);
+  memset(arena, 0, sizeof(*arena));
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_id_set_number(jesenrpc_id_t *id, int64_t value) {
+  if (!id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_id_cleanup(id);
+  id->kind = JESENRPC_ID_NUMBER;
+  id->value.number = value;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_id_set_string(jesenrpc_id_t *id, const char *value,
+                                      size_t value_len) {
+  if (!id || !value) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_id_cleanup(id);
+  id->kind = JESENRPC_ID_STRING;
+  id->value.string.len = value_len;
+  return jrpc_strdup(value, value_len, &id->value.string.data);
+}
+
+jesenrpc_err_t jesenrpc_id_set_null(jesenrpc_id_t *id) {
+  if (!id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_id_cleanup(id);
+  id->kind = JESENRPC_ID_NULL;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_id_set_notification(jesenrpc_id_t *id) {
+  if (!id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_id_cleanup(id);
+  id->kind = JESENRPC_ID_NONE;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_id_destroy(jesenrpc_id_t *id) {
+  if (!id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_id_cleanup(id);
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_create(const char *method_name,
+                                       jesenrpc_request_t **request) {
+  if (!method_name || !request) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  size_t len = strnlen(method_name, JESENRPC_METHOD_NAME_MAX_LEN + 1);
+  if (len == 0 || len > JESENRPC_METHOD_NAME_MAX_LEN) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  jesenrpc_request_t *req =
+      (jesenrpc_request_t *)jrpc_pool_get(JRPC_POOL_REQUEST);
+  if (!req) {
+    return JESENRPC_ERR_ALLOC;
+  }
+
+  req->jsonrpc = JESENRPC_JSONRPC_VERSION;
+  req->id.kind = JESENRPC_ID_NONE;
+  req->params = NULL;
+
+  jesenrpc_err_t err = jrpc_strdup(method_name, len, &req->method_name);
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_pool_put(JRPC_POOL_REQUEST, req);
+    return err;
+  }
+
+  *request = req;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_create_with_id(const char *method_name,
+                                               const jesenrpc_id_t *id,
+                                               jesenrpc_request_t **request) {
+  jesenrpc_err_t err = jesenrpc_request_create(method_name, request);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  err = jesenrpc_request_set_id(*request, id);
+  if (err != JESENRPC_ERR_NONE) {
+    jesenrpc_request_destroy(*request);
+    *request = NULL;
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_request_set_id(jesenrpc_request_t *request,
+                                       const jesenrpc_id_t *id) {
+  if (!request || !id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_id_clone(id, &request->id);
+}
+
+jesenrpc_err_t jesenrpc_request_set_params(jesenrpc_request_t *request,
+                                           jesen_node_t *params) {
+  if (!request) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  bool is_array = false;
+  bool is_object = false;
+  if (params) {
+    jesen_err_t err = jesen_value_is_array(params, &is_array);
+    if (err == JESEN_ERR_NONE) {
+      err = jesen_value_is_object(params, &is_object);
+    }
+    if (err != JESEN_ERR_NONE) {
+      return err;
+    }
+    if (!is_array && !is_object) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+  }
+
+  if (request->params) {
+    jesen_destroy(request->params);
+  }
+  request->params = params;
+  request->raw_params.data = NULL;
+  request->raw_params.len = 0;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_get_params(const jesenrpc_request_t *request,
+                                           jesen_node_t **out_params) {
+  if (!request || !out_params) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jesen_node_t *params = __atomic_load_n(&request->params, __ATOMIC_ACQUIRE);
+  if (!params && request->raw_params.data) {
+    /* jesen_parse() may write to its input, and raw_params must keep the
+     * original bytes for forwarding and for other threads, so parse a
+     * private copy. */
+    char *copy = NULL;
+    jesenrpc_err_t err =
+        jrpc_strdup(request->raw_params.data, request->raw_params.len, &copy);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    err = jesen_parse(copy, request->raw_params.len, &params);
+    jrpc_free(copy);
+    if (err != JESEN_ERR_NONE) {
+      return err;
+    }
+    /* Handlers share a request through const pointers, possibly on several
+     * executor workers. Requests are never defined const, so the tree is
+     * cached through a cast, and the first one published wins. */
+    jesen_node_t **slot = &((jesenrpc_request_t *)request)->params;
+    jesen_node_t *cached = NULL;
+    if (!__atomic_compare_exchange_n(slot, &cached, params, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      jesen_destroy(params);
+      params = cached;
+    }
+  }
+  *out_params = params;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_set_params_raw(jesenrpc_request_t *request,
+                                               const char *json,
+                                               size_t json_len) {
+  if (!request || !json) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  char kind = 0;
+  jesenrpc_err_t err = jrpc_check_raw_json(json, json_len, &kind);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (kind != '{' && kind != '[') {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (request->params) {
+    jesen_destroy(request->params);
+    request->params = NULL;
+  }
+  request->raw_params.data = json;
+  request->raw_params.len = json_len;
+  return JESENRPC_ERR_NONE;
+}
+
+bool jesenrpc_request_is_notification(const jesenrpc_request_t *request) {
+  if (!request) {
+    return false;
+  }
+  return request->id.kind == JESENRPC_ID_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_serialize(const jesenrpc_request_t *request,
+                                          char *out_buf, size_t out_buf_len) {
+  if (!out_buf || out_buf_len == 0) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_legacy_serialize_err(
+      jesenrpc_request_serialize_len(request, out_buf, out_buf_len, NULL));
+}
+
+jesenrpc_err_t jesenrpc_request_serialize_len(const jesenrpc_request_t *request,
+                                              char *out_buf, size_t out_buf_len,
+                                              size_t *out_len) {
+  if (!request || (!out_buf && out_buf_len > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init(&w, out_buf, out_buf_len);
+  return jrpc_writer_complete(&w, jrpc_write_request(&w, request), out_len);
+}
+
+jesenrpc_err_t
+jesenrpc_request_serialize_to_buf(const jesenrpc_request_t *request,
+                                  jesenrpc_buf_t *buf) {
+  if (!request || !buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_buf(&w, buf);
+  return jrpc_writer_complete_buf(&w, jrpc_write_request(&w, request),
+                                  buf->len);
+}
+
+jesenrpc_err_t
+jesenrpc_request_serialize_iov(const jesenrpc_request_t *request,
+                               jesenrpc_buf_t *scratch, jesenrpc_iovec_t *iov,
+                               size_t iov_cap, size_t *out_iov_count) {
+  if (!request || !scratch || (!iov && iov_cap > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_iov(&w, scratch, iov, iov_cap);
+  return jrpc_writer_complete_iov(&w, jrpc_write_request(&w, request),
+                                  out_iov_count);
+}
+
+/* The validate functions count their failures; the checks behind them do
+ * not, so a response failing on its error object is counted once. */
+
+static jesenrpc_err_t jrpc_request_check(const jesenrpc_request_t *request) {
+  if (!request || !request->method_name) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  if (!request->jsonrpc ||
+      strcmp(request->jsonrpc, JESENRPC_JSONRPC_VERSION) != 0) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  size_t len = strlen(request->method_name);
+  if (len == 0 || len > JESENRPC_METHOD_NAME_MAX_LEN) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  if (request->params) {
+    bool is_array = false;
+    bool is_object = false;
+    jesen_err_t err = jesen_value_is_array(request->params, &is_array);
+    if (err == JESEN_ERR_NONE) {
+      err = jesen_value_is_object(request->params, &is_object);
+    }
+    if (err != JESEN_ERR_NONE) {
+      return err;
+    }
+    if (!is_array && !is_object) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+  }
+
+  if (request->id.kind == JESENRPC_ID_STRING &&
+      (!request->id.value.string.data || request->id.value.string.len == 0)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_request_validate(const jesenrpc_request_t *request) {
+  const char *method = request ? request->method_name : NULL;
+  const jesenrpc_id_t *id = request ? &request->id : NULL;
+  JRPC_HOOK_ENTER(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_REQUEST_SINGLE,
+                  method, id, 0);
+  jesenrpc_err_t err = jrpc_stats_validated(jrpc_request_check(request));
+  if (err != JESENRPC_ERR_NONE) {
+    JRPC_PROBE2(validation__failed, (int)JESENRPC_MESSAGE_REQUEST_SINGLE,
+                (int)err);
+  }
+  JRPC_HOOK_EXIT(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_REQUEST_SINGLE,
+                 method, id, 0, err);
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_request_parse(char *buf, size_t buf_len,
+                                      jesenrpc_request_t **out) {
+  return jesenrpc_request_parse_ex(buf, buf_len, NULL, out);
+}
+
+jesenrpc_err_t
+jesenrpc_request_parse_ex(char *buf, size_t buf_len,
+                          const jesenrpc_parse_options_t *options,
+                          jesenrpc_request_t **out) {
+  if (!buf || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  jrpc_parse_ctx_t ctx;
+  jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  jesenrpc_message_t msg = {0};
+  err = jrpc_parse_message(&ctx, buf, buf_len,
+                           JESENRPC_MESSAGE_REQUEST_SINGLE, &msg);
+  if (err == JESENRPC_ERR_NONE) {
+    *out = msg.as.request;
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_request_destroy(jesenrpc_request_t *request) {
+  if (!request) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (request->arena) {
+    return JESENRPC_ERR_NONE; /* Released by jesenrpc_arena_reset(). */
+  }
+  jrpc_request_discard(request);
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t
+jesenrpc_response_create_for_request(const jesenrpc_request_t *request,
+                                     jesenrpc_response_t **response) {
+  if (!request || !response) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (request->id.kind == JESENRPC_ID_NONE) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  return jesenrpc_response_create_with_id(&request->id, response);
+}
+
+jesenrpc_err_t
+jesenrpc_response_create_with_id(const jesenrpc_id_t *id,
+                                 jesenrpc_response_t **response) {
+  if (!id || !response) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  jesenrpc_response_t *resp =
+      (jesenrpc_response_t *)jrpc_pool_get(JRPC_POOL_RESPONSE);
+  if (!resp) {
+    return JESENRPC_ERR_ALLOC;
+  }
+
+  resp->jsonrpc = JESENRPC_JSONRPC_VERSION;
+  resp->result = NULL;
+  resp->error = NULL;
+  resp->id.kind = JESENRPC_ID_NONE;
+
+  jesenrpc_err_t err = jrpc_id_clone(id, &resp->id);
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_pool_put(JRPC_POOL_RESPONSE, resp);
+    return err;
+  }
+
+  *response = resp;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_response_create(int32_t request_id,
+                                        jesenrpc_response_t **response) {
+  jesenrpc_id_t id = {.kind = JESENRPC_ID_NUMBER, .value.number = request_id};
+  return jesenrpc_response_create_with_id(&id, response);
+}
+
+jesenrpc_err_t jesenrpc_response_set_result(jesenrpc_response_t *response,
+                                            jesen_node_t *result) {
+  if (!response || !result) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (response->error || response->result || response->raw_result.data) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  response->result = result;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_response_set_result_raw(jesenrpc_response_t *response,
+                                                const char *json,
+                                                size_t json_len) {
+  if (!response || !json) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (response->error || response->result || response->raw_result.data) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jesenrpc_err_t err = jrpc_check_raw_json(json, json_len, NULL);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  response->raw_result.data = json;
+  response->raw_result.len = json_len;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_response_set_error(jesenrpc_response_t *response,
+                                           jesenrpc_error_object_t *error) {
+  if (!response || !error) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (response->result || response->raw_result.data || response->error) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  response->error = error;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_response_serialize(const jesenrpc_response_t *response,
+                                           char *out_buf, size_t out_buf_len) {
+  if (!out_buf || out_buf_len == 0) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_legacy_serialize_err(
+      jesenrpc_response_serialize_len(response, out_buf, out_buf_len, NULL));
+}
+
+jesenrpc_err_t
+jesenrpc_response_serialize_len(const jesenrpc_response_t *response,
+                                char *out_buf, size_t out_buf_len,
+                                size_t *out_len) {
+  if (!response || (!out_buf && out_buf_len > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init(&w, out_buf, out_buf_len);
+  return jrpc_writer_complete(&w, jrpc_write_response(&w, response), out_len);
+}
+
+jesenrpc_err_t
+jesenrpc_response_serialize_to_buf(const jesenrpc_response_t *response,
+                                   jesenrpc_buf_t *buf) {
+  if (!response || !buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_buf(&w, buf);
+  return jrpc_writer_complete_buf(&w, jrpc_write_response(&w, response),
+                                  buf->len);
+}
+
+jesenrpc_err_t
+jesenrpc_response_serialize_iov(const jesenrpc_response_t *response,
+                                jesenrpc_buf_t *scratch, jesenrpc_iovec_t *iov,
+                                size_t iov_cap, size_t *out_iov_count) {
+  if (!response || !scratch || (!iov && iov_cap > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_iov(&w, scratch, iov, iov_cap);
+  return jrpc_writer_complete_iov(&w, jrpc_write_response(&w, response),
+                                  out_iov_count);
+}
+
+static jesenrpc_err_t
+jrpc_error_object_check(const jesenrpc_error_object_t *error);
+
+static jesenrpc_err_t jrpc_response_check(const jesenrpc_response_t *response) {
+  if (!response) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (!response->jsonrpc ||
+      strcmp(response->jsonrpc, JESENRPC_JSONRPC_VERSION) != 0) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (response->id.kind == JESENRPC_ID_NONE) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (response->id.kind == JESENRPC_ID_STRING &&
+      (!response->id.value.string.data || response->id.value.string.len == 0)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  bool has_result = response->result || response->raw_result.data;
+  bool has_error = response->error != NULL;
+  if ((has_result && has_error) || (!has_result && !has_error)) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  if (has_error) {
+    return jrpc_error_object_check(response->error);
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_response_validate(const jesenrpc_response_t *response) {
+  const jesenrpc_id_t *id = response ? &response->id : NULL;
+  JRPC_HOOK_ENTER(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_RESPONSE_SINGLE,
+                  NULL, id, 0);
+  jesenrpc_err_t err = jrpc_stats_validated(jrpc_response_check(response));
+  if (err != JESENRPC_ERR_NONE) {
+    JRPC_PROBE2(validation__failed, (int)JESENRPC_MESSAGE_RESPONSE_SINGLE,
+                (int)err);
+  }
+  JRPC_HOOK_EXIT(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_RESPONSE_SINGLE,
+                 NULL, id, 0, err);
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_response_parse(char *buf, size_t buf_len,
+                                       jesenrpc_response_t **out) {
+  return jesenrpc_response_parse_ex(buf, buf_len, NULL, out);
+}
+
+jesenrpc_err_t
+jesenrpc_response_parse_ex(char *buf, size_t buf_len,
+                           const jesenrpc_parse_options_t *options,
+                           jesenrpc_response_t **out) {
+  if (!buf || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  jrpc_parse_ctx_t ctx;
+  jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  jesenrpc_message_t msg = {0};
+  err = jrpc_parse_message(&ctx, buf, buf_len,
+                           JESENRPC_MESSAGE_RESPONSE_SINGLE, &msg);
+  if (err == JESENRPC_ERR_NONE) {
+    *out = msg.as.response;
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_response_destroy(jesenrpc_response_t *response) {
+  if (!response) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (response->arena) {
+    return JESENRPC_ERR_NONE; /* Released by jesenrpc_arena_reset(). */
+  }
+  jrpc_response_discard(response);
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_error_object_create(int32_t code, const char *message,
+                                            jesenrpc_error_object_t **error) {
+  if (!message || !error) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  size_t len = strlen(message);
+  if (len == 0) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  jesenrpc_error_object_t *err_obj =
+      (jesenrpc_error_object_t *)jrpc_pool_get(JRPC_POOL_ERROR);
+  if (!err_obj) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  err_obj->code = code;
+  err_obj->data = NULL;
+
+  jesenrpc_err_t err = jrpc_strdup(message, len, &err_obj->message);
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_pool_put(JRPC_POOL_ERROR, err_obj);
+    return err;
+  }
+
+  *error = err_obj;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_error_object_set_data(jesenrpc_error_object_t *error,
+                                              jesen_node_t *data) {
+  if (!error) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (error->data && error->data != data) {
+    jesen_destroy(error->data);
+  }
+  error->data = data;
+  error->raw_data.data = NULL;
+  error->raw_data.len = 0;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t
+jesenrpc_error_object_set_data_raw(jesenrpc_error_object_t *error,
+                                   const char *json, size_t json_len) {
+  if (!error || !json) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jesenrpc_err_t err = jrpc_check_raw_json(json, json_len, NULL);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (error->data) {
+    jesen_destroy(error->data);
+    error->data = NULL;
+  }
+  error->raw_data.data = json;
+  error->raw_data.len = json_len;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t
+jrpc_error_object_check(const jesenrpc_error_object_t *error) {
+  if (!error || !error->message) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (strlen(error->message) == 0) {
+    return JESENRPC_ERR_VALIDATION;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t
+jesenrpc_error_object_validate(const jesenrpc_error_object_t *error) {
+  JRPC_HOOK_ENTER(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_UNKNOWN, NULL, NULL,
+                  0);
+  jesenrpc_err_t err = jrpc_stats_validated(jrpc_error_object_check(error));
+  if (err != JESENRPC_ERR_NONE) {
+    JRPC_PROBE2(validation__failed, (int)JESENRPC_MESSAGE_UNKNOWN, (int)err);
+  }
+  JRPC_HOOK_EXIT(JESENRPC_HOOK_VALIDATE, JESENRPC_MESSAGE_UNKNOWN, NULL, NULL,
+                 0, err);
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_error_object_destroy(jesenrpc_error_object_t *error) {
+  if (!error) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (error->arena) {
+    return JESENRPC_ERR_NONE; /* Released by jesenrpc_arena_reset(). */
+  }
+  jrpc_error_object_discard(error);
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t
+jesenrpc_request_batch_serialize(jesenrpc_request_t *const *requests,
+                                 size_t request_count, char *out_buf,
+                                 size_t out_buf_len) {
+  if (!out_buf || out_buf_len == 0) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_legacy_serialize_err(jesenrpc_request_batch_serialize_len(
+      requests, request_count, out_buf, out_buf_len, NULL));
+}
+
+jesenrpc_err_t
+jesenrpc_request_batch_serialize_len(jesenrpc_request_t *const *requests,
+                                     size_t request_count, char *out_buf,
+                                     size_t out_buf_len, size_t *out_len) {
+  if (!requests || (!out_buf && out_buf_len > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init(&w, out_buf, out_buf_len);
+  return jrpc_writer_complete(
+      &w, jrpc_write_request_batch(&w, requests, request_count), out_len);
+}
+
+jesenrpc_err_t
+jesenrpc_request_batch_serialize_to_buf(jesenrpc_request_t *const *requests,
+                                        size_t request_count,
+                                        jesenrpc_buf_t *buf) {
+  if (!requests || !buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_buf(&w, buf);
+  return jrpc_writer_complete_buf(
+      &w, jrpc_write_request_batch(&w, requests, request_count), buf->len);
+}
+
+jesenrpc_err_t
+jesenrpc_response_batch_serialize(jesenrpc_response_t *const *responses,
+                                  size_t response_count, char *out_buf,
+                                  size_t out_buf_len) {
+  if (!out_buf || out_buf_len == 0) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  return jrpc_legacy_serialize_err(jesenrpc_response_batch_serialize_len(
+      responses, response_count, out_buf, out_buf_len, NULL));
+}
+
+jesenrpc_err_t
+jesenrpc_response_batch_serialize_len(jesenrpc_response_t *const *responses,
+                                      size_t response_count, char *out_buf,
+                                      size_t out_buf_len, size_t *out_len) {
+  if (!responses || (!out_buf && out_buf_len > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init(&w, out_buf, out_buf_len);
+  return jrpc_writer_complete(
+      &w, jrpc_write_response_batch(&w, responses, response_count), out_len);
+}
+
+jesenrpc_err_t
+jesenrpc_response_batch_serialize_to_buf(jesenrpc_response_t *const *responses,
+                                         size_t response_count,
+                                         jesenrpc_buf_t *buf) {
+  if (!responses || !buf) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_buf(&w, buf);
+  return jrpc_writer_complete_buf(
+      &w, jrpc_write_response_batch(&w, responses, response_count), buf->len);
+}
+
+jesenrpc_err_t jesenrpc_response_batch_serialize_iov(
+    jesenrpc_response_t *const *responses, size_t response_count,
+    jesenrpc_buf_t *scratch, jesenrpc_iovec_t *iov, size_t iov_cap,
+    size_t *out_iov_count) {
+  if (!responses || !scratch || (!iov && iov_cap > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jrpc_writer_t w;
+  jrpc_writer_init_iov(&w, scratch, iov, iov_cap);
+  return jrpc_writer_complete_iov(
+      &w, jrpc_write_response_batch(&w, responses, response_count),
+      out_iov_count);
+}
+
+jesenrpc_err_t jesenrpc_request_batch_parse(char *buf, size_t buf_len,
+                                            jesenrpc_request_batch_t *out) {
+  return jesenrpc_request_batch_parse_ex(buf, buf_len, NULL, out);
+}
+
+jesenrpc_err_t
+jesenrpc_request_batch_parse_ex(char *buf, size_t buf_len,
+                             const jesenrpc_parse_options_t *options,
+                             jesenrpc_request_batch_t *out) {
+  if (!buf || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  out->items = NULL;
+  out->count = 0;
+  out->arena = NULL;
+
+  jrpc_parse_ctx_t ctx;
+  jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  jesenrpc_message_t msg = {0};
+  err = jrpc_parse_message(&ctx, buf, buf_len,
+                           JESENRPC_MESSAGE_REQUEST_BATCH, &msg);
+  if (err == JESENRPC_ERR_NONE) {
+    *out = msg.as.request_batch;
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_response_batch_parse(char *buf, size_t buf_len,
+                                             jesenrpc_response_batch_t *out) {
+  return jesenrpc_response_batch_parse_ex(buf, buf_len, NULL, out);
+}
+
+jesenrpc_err_t
+jesenrpc_response_batch_parse_ex(char *buf, size_t buf_len,
+                             const jesenrpc_parse_options_t *options,
+                             jesenrpc_response_batch_t *out) {
+  if (!buf || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+
+  out->items = NULL;
+  out->count = 0;
+  out->arena = NULL;
+
+  jrpc_parse_ctx_t ctx;
+  jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
   }
 
-  return JESENRPC_ERR_INVALID_ARGS;
+  jesenrpc_message_t msg = {0};
+  err = jrpc_parse_message(&ctx, buf, buf_len,
+                           JESENRPC_MESSAGE_RESPONSE_BATCH, &msg);
+  if (err == JESENRPC_ERR_NONE) {
+    *out = msg.as.response_batch;
+  }
+  return err;
 }
 
-static jesenrpc_err_t
-jrpc_read_object_string_with_limit(const jesen_node_t *object, const char *key,
-                                   size_t max_len, char **out) {
-  if (!object || !key || !out) {
+jesenrpc_err_t jesenrpc_request_batch_destroy(jesenrpc_request_batch_t *batch) {
+  if (!batch) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  size_t buf_len = max_len + 1;
-  char *tmp = (char *)calloc(buf_len, sizeof(char));
-  if (!tmp) {
-    return JESENRPC_ERR_ALLOC;
-  }
-  size_t str_len = 0;
-  jesen_err_t err =
-      jesen_object_get_string(object, key, tmp, buf_len, &str_len);
-  if (err != JESEN_ERR_NONE) {
-    free(tmp);
-    return err == JESEN_ERR_INVALID_ARGS ? JESENRPC_ERR_VALIDATION : err;
+  if (batch->items && !batch->arena) {
+    for (size_t i = 0; i < batch->count; ++i) {
+      jesenrpc_request_destroy(batch->items[i]);
+    }
+    jrpc_free(batch->items);
   }
-  *out = tmp;
-  (void)str_len;
+  batch->items = NULL;
+  batch->count = 0;
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_add_id_to_object(jesen_node_t *object,
-                                            const jesenrpc_id_t *id) {
-  if (!object || !id) {
+jesenrpc_err_t
+jesenrpc_response_batch_destroy(jesenrpc_response_batch_t *batch) {
+  if (!batch) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  switch (id->kind) {
-  case JESENRPC_ID_NONE:
-    return JESENRPC_ERR_NONE;
-  case JESENRPC_ID_NULL:
-    return jesen_object_add_null(object, "id");
-  case JESENRPC_ID_STRING:
-    if (!id->value.string.data) {
-      return JESENRPC_ERR_INVALID_ARGS;
-    }
-    return jesen_object_add_string(object, "id", id->value.string.data,
-                                   id->value.string.len);
-  case JESENRPC_ID_NUMBER: {
-    int64_t num = id->value.number;
-    if (num >= INT32_MIN && num <= INT32_MAX) {
-      return jesen_object_add_int32(object, "id", (int32_t)num);
+  if (batch->items && !batch->arena) {
+    for (size_t i = 0; i < batch->count; ++i) {
+      jesenrpc_response_destroy(batch->items[i]);
     }
-    return jesen_object_add_double(object, "id", (double)num);
-  }
-  default:
-    return JESENRPC_ERR_INVALID_ARGS;
+    jrpc_free(batch->items);
   }
+  batch->items = NULL;
+  batch->count = 0;
+  return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_build_request_node(const jesenrpc_request_t *request,
-                                              jesen_node_t **out) {
-  if (!request || !out) {
+jesenrpc_err_t jesenrpc_message_peek_kind(char *buf, size_t buf_len,
+                                          jesenrpc_message_kind_t *kind) {
+  if (!buf || !kind) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  jesenrpc_err_t err = jesenrpc_request_validate(request);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  jrpc_scanner_t s = {buf, buf_len, 0};
+  bool is_batch = jrpc_scan_consume(&s, '[');
+  if (is_batch && jrpc_scan_consume(&s, ']')) {
+    return JESENRPC_ERR_VALIDATION;
   }
+  return jrpc_peek_envelope(&s, is_batch, kind);
+}
 
-  jesen_node_t *root = NULL;
-  err = jesen_object_create(&root);
-  if (err != JESEN_ERR_NONE) {
-    return err;
-  }
+jesenrpc_err_t jesenrpc_message_parse(char *buf, size_t buf_len,
+                                      jesenrpc_message_t *out) {
+  return jesenrpc_message_parse_ex(buf, buf_len, NULL, out);
+}
 
-  err = jesen_object_add_string(root, "jsonrpc", JESENRPC_JSONRPC_VERSION,
-                                JESENRPC_JSONRPC_VERSION_LEN);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(root);
-    return err;
+jesenrpc_err_t
+jesenrpc_message_parse_ex(char *buf, size_t buf_len,
+                          const jesenrpc_parse_options_t *options,
+                          jesenrpc_message_t *out) {
+  if (!buf || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  err = jrpc_add_id_to_object(root, &request->id);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(root);
-    return err;
-  }
+  memset(out, 0, sizeof(*out));
+  out->kind = JESENRPC_MESSAGE_UNKNOWN;
 
-  size_t method_len = strlen(request->method_name);
-  err =
-      jesen_object_add_string(root, "method", request->method_name, method_len);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(root);
+  jrpc_parse_ctx_t ctx;
+  jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+  if (err != JESENRPC_ERR_NONE) {
     return err;
   }
 
-  bool has_params = request->params != NULL;
-  if (has_params) {
-    err = jesen_node_assign_to(root, "params", request->params);
-    if (err != JESEN_ERR_NONE) {
-      jesen_destroy(root);
-      return err;
-    }
+  err = jrpc_parse_message(&ctx, buf, buf_len, JESENRPC_MESSAGE_UNKNOWN, out);
+  if (err != JESENRPC_ERR_NONE) {
+    memset(out, 0, sizeof(*out));
+    out->kind = JESENRPC_MESSAGE_UNKNOWN;
   }
-
-  *out = root;
-
-  return JESENRPC_ERR_NONE;
+  return err;
 }
 
-static jesenrpc_err_t
-jrpc_build_error_node(const jesenrpc_error_object_t *error,
-                      jesen_node_t **out_error_node) {
-  if (!error || !out_error_node) {
+jesenrpc_err_t jesenrpc_message_destroy(jesenrpc_message_t *message) {
+  if (!message) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  jesenrpc_err_t err = jesenrpc_error_object_validate(error);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+  switch (message->kind) {
+  case JESENRPC_MESSAGE_REQUEST_SINGLE:
+    err = jesenrpc_request_destroy(message->as.request);
+    break;
+  case JESENRPC_MESSAGE_REQUEST_BATCH:
+    err = jesenrpc_request_batch_destroy(&message->as.request_batch);
+    break;
+  case JESENRPC_MESSAGE_RESPONSE_SINGLE:
+    err = jesenrpc_response_destroy(message->as.response);
+    break;
+  case JESENRPC_MESSAGE_RESPONSE_BATCH:
+    err = jesenrpc_response_batch_destroy(&message->as.response_batch);
+    break;
+  default:
+    return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  jesen_node_t *err_obj = NULL;
-  err = jesen_object_create(&err_obj);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+  if (err == JESENRPC_ERR_NONE) {
+    memset(message, 0, sizeof(*message));
+    message->kind = JESENRPC_MESSAGE_UNKNOWN;
   }
 
-  err = jesen_object_add_int32(err_obj, "code", error->code);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(err_obj);
-    return err;
-  }
+  return err;
+}
 
-  size_t msg_len = strlen(error->message);
-  err = jesen_object_add_string(err_obj, "message", error->message, msg_len);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(err_obj);
-    return err;
-  }
+/* Stream decoder. Only the bytes that delimit values are interpreted here;
+ * each complete value is then parsed in one go by jesenrpc_message_parse_ex().
+ * scan_pos and the nesting state persist across calls, so bytes are never
+ * rescanned when a value spans several chunks. */
 
-  bool has_data = error->data != NULL;
-  if (has_data) {
-    err = jesen_node_assign_to(err_obj, "data", error->data);
-    if (err != JESEN_ERR_NONE) {
-      jesen_destroy(err_obj);
+jesenrpc_err_t
+jesenrpc_stream_decoder_init(jesenrpc_stream_decoder_t *decoder,
+                             const jesenrpc_parse_options_t *options,
+                             size_t max_message_len) {
+  if (!decoder) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  memset(decoder, 0, sizeof(*decoder));
+  if (options) {
+    jrpc_parse_ctx_t ctx;
+    jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+    if (err != JESENRPC_ERR_NONE) {
       return err;
     }
+    decoder->options = *options;
   }
-
-  *out_error_node = err_obj;
-
+  decoder->max_message_len = max_message_len;
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t
-jrpc_build_response_node(const jesenrpc_response_t *response,
-                         jesen_node_t **out_node) {
-  if (!response || !out_node) {
+jesenrpc_err_t jesenrpc_stream_decoder_feed(jesenrpc_stream_decoder_t *decoder,
+                                            const char *data, size_t len) {
+  if (!decoder || (!data && len > 0)) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  jesenrpc_err_t err = jesenrpc_response_validate(response);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  /* Drop consumed bytes, keeping only the value still being received. */
+  jesenrpc_buf_t *buf = &decoder->buf;
+  size_t keep_from = decoder->depth > 0 ? decoder->value_start
+                                        : decoder->scan_pos;
+  if (keep_from > 0) {
+    memmove(buf->data, buf->data + keep_from, buf->len - keep_from);
+    buf->len -= keep_from;
+    decoder->scan_pos -= keep_from;
+    decoder->value_start = decoder->depth > 0
+                               ? decoder->value_start - keep_from
+                               : decoder->scan_pos;
   }
 
-  jesen_node_t *root = NULL;
-  err = jesen_object_create(&root);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+  if (len > SIZE_MAX - buf->len - 1) {
+    return JESENRPC_ERR_ALLOC;
   }
-
-  err = jesen_object_add_string(root, "jsonrpc", JESENRPC_JSONRPC_VERSION,
-                                JESENRPC_JSONRPC_VERSION_LEN);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(root);
+  jesenrpc_err_t err = jrpc_buf_grow(buf, buf->len + len + 1);
+  if (err != JESENRPC_ERR_NONE) {
     return err;
   }
+  if (len > 0) {
+    memcpy(buf->data + buf->len, data, len);
+  }
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+  return JESENRPC_ERR_NONE;
+}
 
-  err = jrpc_add_id_to_object(root, &response->id);
-  if (err != JESEN_ERR_NONE) {
-    jesen_destroy(root);
-    return err;
+jesenrpc_err_t jesenrpc_stream_decoder_next(jesenrpc_stream_decoder_t *decoder,
+                                            jesenrpc_message_t *out) {
+  if (!decoder || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(out, 0, sizeof(*out));
+  out->kind = JESENRPC_MESSAGE_UNKNOWN;
 
-  bool has_result = response->result != NULL;
-  bool has_error = response->error != NULL;
-  if (has_result) {
-    err = jesen_node_assign_to(root, "result", response->result);
-    if (err != JESEN_ERR_NONE) {
-      jesen_node_detach(response->result);
-      jesen_destroy(root);
-      return err;
-    }
-  } else if (has_error) {
-    jesen_node_t *error_node = NULL;
-    err = jrpc_build_error_node(response->error, &error_node);
-    if (err != JESEN_ERR_NONE) {
-      jesen_destroy(root);
-      return err;
+  char *data = decoder->buf.data;
+  size_t len = decoder->buf.len;
+  size_t pos = decoder->scan_pos;
+  size_t limit = decoder->max_message_len;
+
+  while (pos < len) {
+    if (decoder->depth == 0) {
+      char c = data[pos];
+      if (c == '{' || c == '[') {
+        decoder->value_start = pos++;
+        decoder->depth = 1;
+        continue;
+      }
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        ++pos;
+        continue;
+      }
+      /* Stray bytes between messages: resynchronize at the next value. */
+      while (pos < len && data[pos] != '{' && data[pos] != '[') {
+        ++pos;
+      }
+      decoder->scan_pos = pos;
+      decoder->value_start = pos;
+      return JESENRPC_ERR_PARSE;
     }
-    err = jesen_node_assign_to(root, "error", error_node);
-    if (err != JESEN_ERR_NONE) {
-      if (response->error->data) {
-        jesen_node_detach(response->error->data);
+
+    if (decoder->in_string) {
+      /* Skip string contents in a tight loop; only quotes and backslashes
+       * matter. */
+      while (pos < len) {
+        char c = data[pos++];
+        if (decoder->escape) {
+          decoder->escape = false;
+        } else if (c == '\\') {
+          decoder->escape = true;
+        } else if (c == '"') {
+          decoder->in_string = false;
+          break;
+        }
+      }
+    } else {
+      char c = data[pos++];
+      if (c == '"') {
+        decoder->in_string = true;
+      } else if (c == '{' || c == '[') {
+        ++decoder->depth;
+      } else if ((c == '}' || c == ']') && --decoder->depth == 0) {
+        size_t start = decoder->value_start;
+        bool discarded = decoder->discarding;
+        decoder->discarding = false;
+        decoder->scan_pos = pos;
+        decoder->value_start = pos;
+        if (discarded) {
+          continue;
+        }
+        if (limit != 0 && pos - start > limit) {
+          return JESENRPC_ERR_VALIDATION;
+        }
+        return jesenrpc_message_parse_ex(data + start, pos - start,
+                                         &decoder->options, out);
       }
-      jesen_destroy(error_node);
-      jesen_destroy(root);
-      return err;
     }
-  }
 
-  *out_node = root;
+    if (limit != 0 && decoder->depth > 0 && !decoder->discarding &&
+        pos - decoder->value_start > limit) {
+      /* Keep tracking the value so the stream stays in sync, but stop
+       * buffering it. */
+      decoder->discarding = true;
+      decoder->scan_pos = pos;
+      decoder->value_start = pos;
+      return JESENRPC_ERR_VALIDATION;
+    }
+  }
 
+  decoder->scan_pos = pos;
+  if (decoder->discarding) {
+    decoder->value_start = pos;
+  }
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_serialize_node(jesen_node_t *node, char *out_buf,
-                                          size_t out_buf_len) {
-  if (!node || !out_buf || out_buf_len == 0) {
+jesenrpc_err_t
+jesenrpc_stream_decoder_reset(jesenrpc_stream_decoder_t *decoder) {
+  if (!decoder) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  jesen_err_t err = jesen_serialize(node, out_buf, out_buf_len);
-  return err;
+  decoder->buf.len = 0;
+  decoder->value_start = 0;
+  decoder->scan_pos = 0;
+  decoder->depth = 0;
+  decoder->in_string = false;
+  decoder->escape = false;
+  decoder->discarding = false;
+  return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_parse_id(const jesen_node_t *id_node,
-                                    jesenrpc_id_t *out_id) {
-  if (!id_node || !out_id) {
+jesenrpc_err_t
+jesenrpc_stream_decoder_destroy(jesenrpc_stream_decoder_t *decoder) {
+  if (!decoder) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  jesenrpc_buf_destroy(&decoder->buf);
+  memset(decoder, 0, sizeof(*decoder));
+  return JESENRPC_ERR_NONE;
+}
 
-  bool is_null = false;
-  bool is_string = false;
-  bool is_number = false;
-  jesen_err_t err = jesen_value_is_null(id_node, &is_null);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+/* Content-Length framing. Header lines are handled one at a time as their
+ * newline arrives; only the Content-Length value is kept, so the bytes of
+ * earlier lines can be dropped on the next feed. The body is parsed in place
+ * once all of it is buffered. */
+
+#define JRPC_FRAME_PREFIX "Content-Length: "
+#define JRPC_FRAME_DIGITS 10
+/* Header blocks longer than this are garbage, not headers. */
+#define JRPC_FRAME_MAX_HEADER_LEN 8192
+
+static bool jrpc_frame_is_ows(char c) { return c == ' ' || c == '\t'; }
+
+/* Records one header line, excluding its line terminator. */
+static void jrpc_frame_header_line(jesenrpc_frame_decoder_t *decoder,
+                                   const char *line, size_t len) {
+  static const char name[] = "content-length";
+  size_t name_len = sizeof(name) - 1;
+  const char *colon = (const char *)memchr(line, ':', len);
+  if (!colon) {
+    decoder->bad_header = true;
+    return;
   }
-  err = jesen_value_is_string(id_node, &is_string);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+  if ((size_t)(colon - line) != name_len) {
+    return; /* Some other header. */
   }
-  err = jesen_value_is_double(id_node, &is_number);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+  for (size_t i = 0; i < name_len; ++i) {
+    char c = line[i];
+    if (c >= 'A' && c <= 'Z') {
+      c = (char)(c - 'A' + 'a');
+    }
+    if (c != name[i]) {
+      return;
+    }
   }
 
-  if (is_null) {
-    return jesenrpc_id_set_null(out_id);
+  const char *p = colon + 1;
+  const char *end = line + len;
+  while (p < end && jrpc_frame_is_ows(*p)) {
+    ++p;
   }
-  if (is_string) {
-    char *id_str = NULL;
-    size_t len = 0;
-    err = jrpc_copy_string_value(id_node, 8192, &id_str, &len);
-    if (err != JESEN_ERR_NONE) {
-      return err;
+  size_t value = 0;
+  const char *digits = p;
+  while (p < end && *p >= '0' && *p <= '9') {
+    size_t digit = (size_t)(*p++ - '0');
+    if (value > (SIZE_MAX - digit) / 10) {
+      decoder->bad_header = true;
+      return;
     }
-    jrpc_id_cleanup(out_id);
-    out_id->kind = JESENRPC_ID_STRING;
-    out_id->value.string.data = id_str;
-    out_id->value.string.len = len;
-    return JESENRPC_ERR_NONE;
+    value = value * 10 + digit;
   }
-  if (is_number) {
-    double val = 0.0;
-    err = jesen_value_get_double(id_node, &val);
-    if (err != JESEN_ERR_NONE) {
-      return err;
-    }
-    if (val > (double)INT64_MAX || val < (double)INT64_MIN) {
-      return JESENRPC_ERR_VALIDATION;
-    }
-    int64_t as_int = (int64_t)val;
-    if (!jrpc_doubles_equal((double)as_int, val)) {
-      return JESENRPC_ERR_VALIDATION;
-    }
-    return jesenrpc_id_set_number(out_id, as_int);
+  while (p < end && jrpc_frame_is_ows(*p)) {
+    ++p;
   }
+  if (p == digits || p != end ||
+      (decoder->have_length && decoder->body_len != value)) {
+    decoder->bad_header = true;
+    return;
+  }
+  decoder->have_length = true;
+  decoder->body_len = value;
+}
 
-  return JESENRPC_ERR_VALIDATION;
+/* Starts looking for the next header block at pos. */
+static void jrpc_frame_next_header(jesenrpc_frame_decoder_t *decoder,
+                                   size_t pos) {
+  decoder->line_start = pos;
+  decoder->scan_pos = pos;
+  decoder->header_len = 0;
+  decoder->body_len = 0;
+  decoder->have_length = false;
+  decoder->bad_header = false;
+  decoder->in_body = false;
 }
 
-static jesenrpc_err_t
-jrpc_parse_request_node(jesen_node_t *root, jesenrpc_request_t **out_request) {
-  if (!root || !out_request) {
+jesenrpc_err_t
+jesenrpc_frame_decoder_init(jesenrpc_frame_decoder_t *decoder,
+                            const jesenrpc_parse_options_t *options,
+                            size_t max_message_len) {
+  if (!decoder) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  bool is_object = false;
-  jesen_err_t err = jesen_value_is_object(root, &is_object);
-  if (err != JESEN_ERR_NONE) {
-    return err;
-  }
-  if (!is_object) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-
-  char *version = NULL;
-  err = jrpc_read_object_string_with_limit(
-      root, "jsonrpc", JESENRPC_JSONRPC_VERSION_LEN, &version);
-  if (err != JESEN_ERR_NONE) {
-    return err;
-  }
-  bool version_ok = strcmp(version, JESENRPC_JSONRPC_VERSION) == 0;
-  free(version);
-  if (!version_ok) {
-    return JESENRPC_ERR_VALIDATION;
+  memset(decoder, 0, sizeof(*decoder));
+  if (options) {
+    jrpc_parse_ctx_t ctx;
+    jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    decoder->options = *options;
   }
+  decoder->max_message_len = max_message_len;
+  return JESENRPC_ERR_NONE;
+}
 
-  char *method = NULL;
-  err = jrpc_read_object_string_with_limit(
-      root, "method", JESENRPC_METHOD_NAME_MAX_LEN, &method);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+jesenrpc_err_t jesenrpc_frame_decoder_feed(jesenrpc_frame_decoder_t *decoder,
+                                           const char *data, size_t len) {
+  if (!decoder || (!data && len > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
 
-  jesen_node_t *params_node = NULL;
-  err = jesen_node_find(root, "params", &params_node);
-  bool has_params = (err == JESEN_ERR_NONE);
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    free(method);
-    return err;
+  /* Drop consumed bytes, keeping only the partial line or body. */
+  jesenrpc_buf_t *buf = &decoder->buf;
+  size_t keep_from = decoder->in_body ? decoder->scan_pos
+                                      : decoder->line_start;
+  if (keep_from > 0) {
+    memmove(buf->data, buf->data + keep_from, buf->len - keep_from);
+    buf->len -= keep_from;
+    decoder->scan_pos -= keep_from;
+    decoder->line_start -= keep_from;
   }
 
-  jesen_node_t *id_node = NULL;
-  err = jesen_node_find(root, "id", &id_node);
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    free(method);
-    return err;
+  /* Oversized bodies are skipped as they arrive instead of being buffered. */
+  if (decoder->skip > 0 && buf->len == 0) {
+    size_t n = decoder->skip < len ? decoder->skip : len;
+    decoder->skip -= n;
+    data += n;
+    len -= n;
   }
 
-  jesenrpc_request_t *req = (jesenrpc_request_t *)calloc(1, sizeof(*req));
-  if (!req) {
-    free(method);
+  if (len > SIZE_MAX - buf->len - 1) {
     return JESENRPC_ERR_ALLOC;
   }
-
-  req->jsonrpc = JESENRPC_JSONRPC_VERSION;
-  req->method_name = method;
-  req->params = NULL;
-  req->id.kind = JESENRPC_ID_NONE;
-
-  if (has_params) {
-    bool params_is_object = false;
-    bool params_is_array = false;
-    err = jesen_value_is_object(params_node, &params_is_object);
-    if (err == JESEN_ERR_NONE) {
-      err = jesen_value_is_array(params_node, &params_is_array);
-    }
-    if (err != JESEN_ERR_NONE || (!params_is_object && !params_is_array)) {
-      jesenrpc_request_destroy(req);
-      return err != JESEN_ERR_NONE ? err : JESENRPC_ERR_VALIDATION;
-    }
-    err = jesen_node_detach(params_node);
-    if (err != JESEN_ERR_NONE) {
-      jesenrpc_request_destroy(req);
-      return err;
-    }
-    req->params = params_node;
+  jesenrpc_err_t err = jrpc_buf_grow(buf, buf->len + len + 1);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
   }
-
-  if (id_node) {
-    err = jrpc_parse_id(id_node, &req->id);
-    if (err != JESEN_ERR_NONE) {
-      jesenrpc_request_destroy(req);
-      return err;
-    }
+  if (len > 0) {
+    memcpy(buf->data + buf->len, data, len);
   }
-
-  *out_request = req;
+  buf->len += len;
+  buf->data[buf->len] = '\0';
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_parse_error_object(jesen_node_t *error_node,
-                                              jesenrpc_error_object_t **out) {
-  if (!error_node || !out) {
+jesenrpc_err_t jesenrpc_frame_decoder_next(jesenrpc_frame_decoder_t *decoder,
+                                           jesenrpc_message_t *out) {
+  if (!decoder || !out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(out, 0, sizeof(*out));
+  out->kind = JESENRPC_MESSAGE_UNKNOWN;
 
-  bool is_object = false;
-  jesen_err_t err = jesen_value_is_object(error_node, &is_object);
-  if (err != JESEN_ERR_NONE) {
-    return err;
-  }
-  if (!is_object) {
-    return JESENRPC_ERR_VALIDATION;
-  }
+  char *data = decoder->buf.data;
+  size_t len = decoder->buf.len;
+
+  while (!decoder->in_body) {
+    if (decoder->skip > 0) {
+      size_t n = len - decoder->scan_pos;
+      n = decoder->skip < n ? decoder->skip : n;
+      decoder->skip -= n;
+      jrpc_frame_next_header(decoder, decoder->scan_pos + n);
+      if (decoder->skip > 0) {
+        return JESENRPC_ERR_NONE;
+      }
+    }
 
-  int32_t code = 0;
-  err = jesen_object_get_int32(error_node, "code", &code);
-  if (err != JESEN_ERR_NONE) {
-    return err == JESEN_ERR_NOT_FOUND ? JESENRPC_ERR_VALIDATION : err;
-  }
+    size_t pos = decoder->scan_pos;
+    const char *nl =
+        pos < len ? (const char *)memchr(data + pos, '\n', len - pos) : NULL;
+    if (!nl) {
+      decoder->scan_pos = len;
+      if (decoder->header_len + (len - decoder->line_start) >
+          JRPC_FRAME_MAX_HEADER_LEN) {
+        jrpc_frame_next_header(decoder, len);
+        return JESENRPC_ERR_PARSE;
+      }
+      return JESENRPC_ERR_NONE;
+    }
 
-  char *message = NULL;
-  err =
-      jrpc_read_object_string_with_limit(error_node, "message", 4096, &message);
-  if (err != JESEN_ERR_NONE) {
-    return err;
-  }
+    size_t line_start = decoder->line_start;
+    size_t line_end = (size_t)(nl - data);
+    decoder->scan_pos = line_end + 1;
+    decoder->line_start = line_end + 1;
+    if (line_end > line_start && data[line_end - 1] == '\r') {
+      --line_end;
+    }
+    if (line_end > line_start) {
+      decoder->header_len += decoder->scan_pos - line_start;
+      if (decoder->header_len > JRPC_FRAME_MAX_HEADER_LEN) {
+        jrpc_frame_next_header(decoder, decoder->scan_pos);
+        return JESENRPC_ERR_PARSE;
+      }
+      jrpc_frame_header_line(decoder, data + line_start,
+                             line_end - line_start);
+      continue;
+    }
 
-  jesen_node_t *data_node = NULL;
-  err = jesen_node_find(error_node, "data", &data_node);
-  bool has_data = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    free(message);
-    return err;
+    /* An empty line ends the header block. */
+    if (decoder->header_len == 0) {
+      continue; /* Tolerate blank lines between frames. */
+    }
+    if (!decoder->have_length || decoder->bad_header) {
+      jrpc_frame_next_header(decoder, decoder->scan_pos);
+      return JESENRPC_ERR_PARSE;
+    }
+    size_t limit = decoder->max_message_len;
+    if (limit != 0 && decoder->body_len > limit) {
+      decoder->skip = decoder->body_len;
+      jrpc_frame_next_header(decoder, decoder->scan_pos);
+      return JESENRPC_ERR_VALIDATION;
+    }
+    decoder->in_body = true;
   }
 
-  jesenrpc_error_object_t *err_obj =
-      (jesenrpc_error_object_t *)calloc(1, sizeof(*err_obj));
-  if (!err_obj) {
-    free(message);
-    return JESENRPC_ERR_ALLOC;
+  size_t start = decoder->scan_pos;
+  size_t body_len = decoder->body_len;
+  if (len - start < body_len) {
+    return JESENRPC_ERR_NONE;
   }
+  jrpc_frame_next_header(decoder, start + body_len);
+  return jesenrpc_message_parse_ex(data + start, body_len, &decoder->options,
+                                   out);
+}
 
-  err_obj->code = code;
-  err_obj->message = message;
-  err_obj->data = NULL;
+jesenrpc_err_t
+jesenrpc_frame_decoder_reset(jesenrpc_frame_decoder_t *decoder) {
+  if (!decoder) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  decoder->buf.len = 0;
+  decoder->skip = 0;
+  jrpc_frame_next_header(decoder, 0);
+  return JESENRPC_ERR_NONE;
+}
 
-  if (has_data) {
-    err = jesen_node_detach(data_node);
-    if (err != JESEN_ERR_NONE) {
-      jesenrpc_error_object_destroy(err_obj);
-      return err;
-    }
-    err_obj->data = data_node;
+jesenrpc_err_t
+jesenrpc_frame_decoder_destroy(jesenrpc_frame_decoder_t *decoder) {
+  if (!decoder) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  *out = err_obj;
+  jesenrpc_buf_destroy(&decoder->buf);
+  memset(decoder, 0, sizeof(*decoder));
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_parse_response_node(jesen_node_t *root,
-                                               jesenrpc_response_t **out_resp) {
-  if (!root || !out_resp) {
+jesenrpc_err_t jesenrpc_frame_begin(jesenrpc_buf_t *buf, size_t *out_mark) {
+  if (!buf || !out_mark) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  bool is_object = false;
-  jesen_err_t err = jesen_value_is_object(root, &is_object);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+  if (buf->len > SIZE_MAX - JESENRPC_FRAME_HEADER_LEN - 1) {
+    return JESENRPC_ERR_ALLOC;
   }
-  if (!is_object) {
-    return JESENRPC_ERR_VALIDATION;
+  jesenrpc_err_t err =
+      jrpc_buf_grow(buf, buf->len + JESENRPC_FRAME_HEADER_LEN + 1);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
   }
+  *out_mark = buf->len;
+  buf->len += JESENRPC_FRAME_HEADER_LEN;
+  buf->data[buf->len] = '\0';
+  return JESENRPC_ERR_NONE;
+}
 
-  char *version = NULL;
-  err = jrpc_read_object_string_with_limit(
-      root, "jsonrpc", JESENRPC_JSONRPC_VERSION_LEN, &version);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+jesenrpc_err_t jesenrpc_frame_end(jesenrpc_buf_t *buf, size_t mark) {
+  if (!buf || !buf->data || mark > buf->len ||
+      buf->len - mark < JESENRPC_FRAME_HEADER_LEN) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-  bool version_ok = strcmp(version, JESENRPC_JSONRPC_VERSION) == 0;
-  free(version);
-  if (!version_ok) {
-    return JESENRPC_ERR_VALIDATION;
+  /* Zero padding keeps the header width fixed; Content-Length is 1*DIGIT,
+   * so leading zeros are valid. */
+  char digits[JRPC_FRAME_DIGITS];
+  size_t value = buf->len - mark - JESENRPC_FRAME_HEADER_LEN;
+  for (int i = JRPC_FRAME_DIGITS - 1; i >= 0; --i) {
+    digits[i] = (char)('0' + value % 10);
+    value /= 10;
   }
-
-  jesen_node_t *id_node = NULL;
-  err = jesen_node_find(root, "id", &id_node);
-  if (err != JESEN_ERR_NONE) {
-    return err == JESEN_ERR_NOT_FOUND ? JESENRPC_ERR_VALIDATION : err;
+  if (value != 0) {
+    return JESENRPC_ERR_VALIDATION;
   }
+  char *header = buf->data + mark;
+  size_t prefix_len = sizeof(JRPC_FRAME_PREFIX) - 1;
+  memcpy(header, JRPC_FRAME_PREFIX, prefix_len);
+  memcpy(header + prefix_len, digits, JRPC_FRAME_DIGITS);
+  memcpy(header + prefix_len + JRPC_FRAME_DIGITS, "\r\n\r\n", 4);
+  return JESENRPC_ERR_NONE;
+}
 
-  jesen_node_t *result_node = NULL;
-  err = jesen_node_find(root, "result", &result_node);
-  bool has_result = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    return err;
-  }
+/* NDJSON. A line feed cannot appear inside a valid JSON string, so lines are
+ * split with memchr(), which libc vectorizes, and each line is parsed where
+ * it lies. */
 
-  jesen_node_t *error_node = NULL;
-  err = jesen_node_find(root, "error", &error_node);
-  bool has_error = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    return err;
+static bool jrpc_ndjson_is_blank(const char *line, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+      return false;
+    }
   }
+  return true;
+}
 
-  if ((has_result && has_error) || (!has_result && !has_error)) {
-    return JESENRPC_ERR_VALIDATION;
+jesenrpc_err_t jesenrpc_ndjson_parse_next(
+    char *buf, size_t buf_len, size_t *offset,
+    const jesenrpc_parse_options_t *options, jesenrpc_message_t *out) {
+  if (!buf || !offset || !out || *offset > buf_len) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(out, 0, sizeof(*out));
+  out->kind = JESENRPC_MESSAGE_UNKNOWN;
 
-  jesenrpc_response_t *resp = (jesenrpc_response_t *)calloc(1, sizeof(*resp));
-  if (!resp) {
-    return JESENRPC_ERR_ALLOC;
+  size_t pos = *offset;
+  while (pos < buf_len) {
+    char *line = buf + pos;
+    char *nl = (char *)memchr(line, '\n', buf_len - pos);
+    size_t len = nl ? (size_t)(nl - line) : buf_len - pos;
+    pos += len + (nl ? 1 : 0);
+    if (!jrpc_ndjson_is_blank(line, len)) {
+      *offset = pos;
+      return jesenrpc_message_parse_ex(line, len, options, out);
+    }
   }
+  *offset = buf_len;
+  return JESENRPC_ERR_NONE;
+}
 
-  resp->jsonrpc = JESENRPC_JSONRPC_VERSION;
-  resp->result = NULL;
-  resp->error = NULL;
-
-  err = jrpc_parse_id(id_node, &resp->id);
-  if (err != JESEN_ERR_NONE) {
-    jesenrpc_response_destroy(resp);
-    return err;
+jesenrpc_err_t
+jesenrpc_ndjson_decoder_init(jesenrpc_ndjson_decoder_t *decoder,
+                             const jesenrpc_parse_options_t *options,
+                             size_t max_message_len) {
+  if (!decoder) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  if (has_result) {
-    err = jesen_node_detach(result_node);
-    if (err != JESEN_ERR_NONE) {
-      jesenrpc_response_destroy(resp);
-      return err;
-    }
-    resp->result = result_node;
-  } else {
-    err = jrpc_parse_error_object(error_node, &resp->error);
-    if (err != JESEN_ERR_NONE) {
-      jesenrpc_response_destroy(resp);
+  memset(decoder, 0, sizeof(*decoder));
+  if (options) {
+    jrpc_parse_ctx_t ctx;
+    jesenrpc_err_t err = jrpc_parse_ctx_init(options, &ctx);
+    if (err != JESENRPC_ERR_NONE) {
       return err;
     }
+    decoder->options = *options;
   }
-
-  *out_resp = resp;
+  decoder->max_message_len = max_message_len;
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t jrpc_parse_buffer_as_node(char *buf, size_t buf_len,
-                                                jesen_node_t **out) {
-  if (!buf || !out) {
+jesenrpc_err_t jesenrpc_ndjson_decoder_feed(jesenrpc_ndjson_decoder_t *decoder,
+                                            const char *data, size_t len) {
+  if (!decoder || (!data && len > 0)) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  return jesen_parse(buf, buf_len, out);
-}
 
-jesenrpc_err_t jesenrpc_id_set_number(jesenrpc_id_t *id, int64_t value) {
-  if (!id) {
-    return JESENRPC_ERR_INVALID_ARGS;
+  /* Drop consumed lines, keeping only the partial one. */
+  jesenrpc_buf_t *buf = &decoder->buf;
+  size_t keep_from = decoder->line_start;
+  if (keep_from > 0) {
+    memmove(buf->data, buf->data + keep_from, buf->len - keep_from);
+    buf->len -= keep_from;
+    decoder->scan_pos -= keep_from;
+    decoder->line_start = 0;
   }
-  jrpc_id_cleanup(id);
-  id->kind = JESENRPC_ID_NUMBER;
-  id->value.number = value;
+
+  if (len > SIZE_MAX - buf->len - 1) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  jesenrpc_err_t err = jrpc_buf_grow(buf, buf->len + len + 1);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (len > 0) {
+    memcpy(buf->data + buf->len, data, len);
+  }
+  buf->len += len;
+  buf->data[buf->len] = '\0';
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_id_set_string(jesenrpc_id_t *id, const char *value,
-                                      size_t value_len) {
-  if (!id || !value) {
+jesenrpc_err_t jesenrpc_ndjson_decoder_next(jesenrpc_ndjson_decoder_t *decoder,
+                                            jesenrpc_message_t *out) {
+  if (!decoder || !out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  jrpc_id_cleanup(id);
-  id->kind = JESENRPC_ID_STRING;
-  id->value.string.len = value_len;
-  return jrpc_strdup(value, value_len, &id->value.string.data);
-}
+  memset(out, 0, sizeof(*out));
+  out->kind = JESENRPC_MESSAGE_UNKNOWN;
 
-jesenrpc_err_t jesenrpc_id_set_null(jesenrpc_id_t *id) {
-  if (!id) {
-    return JESENRPC_ERR_INVALID_ARGS;
+  char *data = decoder->buf.data;
+  size_t len = decoder->buf.len;
+  size_t limit = decoder->max_message_len;
+
+  while (decoder->scan_pos < len) {
+    size_t pos = decoder->scan_pos;
+    char *nl = (char *)memchr(data + pos, '\n', len - pos);
+    if (!nl) {
+      /* Bytes before scan_pos hold no line feed; they are never rescanned. */
+      decoder->scan_pos = len;
+      if (decoder->discarding) {
+        decoder->line_start = len;
+      } else if (limit != 0 && len - decoder->line_start > limit) {
+        /* Stop buffering the line, but keep looking for its end. */
+        decoder->discarding = true;
+        decoder->line_start = len;
+        return JESENRPC_ERR_VALIDATION;
+      }
+      break;
+    }
+
+    size_t start = decoder->line_start;
+    size_t end = (size_t)(nl - data);
+    decoder->scan_pos = end + 1;
+    decoder->line_start = end + 1;
+    if (decoder->discarding) {
+      decoder->discarding = false;
+      continue;
+    }
+    if (limit != 0 && end - start > limit) {
+      return JESENRPC_ERR_VALIDATION;
+    }
+    if (!jrpc_ndjson_is_blank(data + start, end - start)) {
+      return jesenrpc_message_parse_ex(data + start, end - start,
+                                       &decoder->options, out);
+    }
   }
-  jrpc_id_cleanup(id);
-  id->kind = JESENRPC_ID_NULL;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_id_set_notification(jesenrpc_id_t *id) {
-  if (!id) {
+jesenrpc_err_t
+jesenrpc_ndjson_decoder_reset(jesenrpc_ndjson_decoder_t *decoder) {
+  if (!decoder) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  jrpc_id_cleanup(id);
-  id->kind = JESENRPC_ID_NONE;
+  decoder->buf.len = 0;
+  decoder->line_start = 0;
+  decoder->scan_pos = 0;
+  decoder->discarding = false;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_id_destroy(jesenrpc_id_t *id) {
-  if (!id) {
+jesenrpc_err_t
+jesenrpc_ndjson_decoder_destroy(jesenrpc_ndjson_decoder_t *decoder) {
+  if (!decoder) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  jrpc_id_cleanup(id);
+  jesenrpc_buf_destroy(&decoder->buf);
+  memset(decoder, 0, sizeof(*decoder));
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_request_create(const char *method_name,
-                                       jesenrpc_request_t **request) {
-  if (!method_name || !request) {
-    return JESENRPC_ERR_INVALID_ARGS;
-  }
+/* Dispatcher. freeze() builds a hash-and-displace perfect hash: every name is
+ * hashed once, the hash picks a bucket, and each bucket stores the
+ * displacement that maps all of its names to distinct free slots. */
+
+#define JRPC_DISPATCH_MAX_DISPLACE ((uint32_t)1 << 20)
+#define JRPC_DISPATCH_SEED_ATTEMPTS 8
+#define JRPC_DISPATCH_EMPTY_SLOT UINT32_MAX
+
+struct jesenrpc_dispatcher_entry {
+  char *name;
+  jesenrpc_method_handler_t handler;
+  void *user_data;
+  uint64_t hash;
+};
+
+static uint64_t jrpc_mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
 
-  size_t len = strnlen(method_name, JESENRPC_METHOD_NAME_MAX_LEN + 1);
-  if (len == 0 || len > JESENRPC_METHOD_NAME_MAX_LEN) {
-    return JESENRPC_ERR_INVALID_ARGS;
+static uint64_t jrpc_hash_name(const char *name, uint64_t seed) {
+  uint64_t h = 0xCBF29CE484222325ULL ^ seed;
+  for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+    h ^= *p;
+    h *= 0x100000001B3ULL;
   }
+  return jrpc_mix64(h);
+}
 
-  jesenrpc_request_t *req = (jesenrpc_request_t *)calloc(1, sizeof(*req));
-  if (!req) {
-    return JESENRPC_ERR_ALLOC;
-  }
+static size_t jrpc_dispatch_bucket(const jesenrpc_dispatcher_t *d,
+                                   uint64_t hash) {
+  return (size_t)(((hash >> 32) * (uint64_t)d->bucket_count) >> 32);
+}
 
-  req->jsonrpc = JESENRPC_JSONRPC_VERSION;
-  req->id.kind = JESENRPC_ID_NONE;
-  req->params = NULL;
+static size_t jrpc_dispatch_slot(const jesenrpc_dispatcher_t *d, uint64_t hash,
+                                 uint32_t displace) {
+  return (size_t)jrpc_mix64(hash + displace * 0x9E3779B97F4A7C15ULL) &
+         d->slot_mask;
+}
 
-  jesenrpc_err_t err = jrpc_strdup(method_name, len, &req->method_name);
-  if (err != JESENRPC_ERR_NONE) {
-    free(req);
-    return err;
+jesenrpc_err_t jesenrpc_dispatcher_init(jesenrpc_dispatcher_t *dispatcher) {
+  if (!dispatcher) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  *request = req;
+  memset(dispatcher, 0, sizeof(*dispatcher));
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_request_create_with_id(const char *method_name,
-                                               const jesenrpc_id_t *id,
-                                               jesenrpc_request_t **request) {
-  jesenrpc_err_t err = jesenrpc_request_create(method_name, request);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
-  }
-  err = jesenrpc_request_set_id(*request, id);
-  if (err != JESENRPC_ERR_NONE) {
-    jesenrpc_request_destroy(*request);
-    *request = NULL;
+jesenrpc_err_t jesenrpc_dispatcher_register(jesenrpc_dispatcher_t *dispatcher,
+                                            const char *method_name,
+                                            jesenrpc_method_handler_t handler,
+                                            void *user_data) {
+  if (!dispatcher || !method_name || !handler || dispatcher->frozen) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-  return err;
-}
-
-jesenrpc_err_t jesenrpc_request_set_id(jesenrpc_request_t *request,
-                                       const jesenrpc_id_t *id) {
-  if (!request || !id) {
+  size_t len = strnlen(method_name, JESENRPC_METHOD_NAME_MAX_LEN + 1);
+  if (len == 0 || len > JESENRPC_METHOD_NAME_MAX_LEN) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  return jrpc_id_clone(id, &request->id);
-}
-
-jesenrpc_err_t jesenrpc_request_set_params(jesenrpc_request_t *request,
-                                           jesen_node_t *params) {
-  if (!request) {
+  if (dispatcher->count >= JRPC_DISPATCH_EMPTY_SLOT) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  bool is_array = false;
-  bool is_object = false;
-  if (params) {
-    jesen_err_t err = jesen_value_is_array(params, &is_array);
-    if (err == JESEN_ERR_NONE) {
-      err = jesen_value_is_object(params, &is_object);
-    }
-    if (err != JESEN_ERR_NONE) {
-      return err;
+  for (size_t i = 0; i < dispatcher->count; ++i) {
+    if (strcmp(dispatcher->entries[i].name, method_name) == 0) {
+      return JESENRPC_ERR_INVALID_ARGS;
     }
-    if (!is_array && !is_object) {
-      return JESENRPC_ERR_VALIDATION;
+  }
+
+  if (dispatcher->count == dispatcher->capacity) {
+    size_t new_cap = dispatcher->capacity ? dispatcher->capacity * 2 : 16;
+    struct jesenrpc_dispatcher_entry *grown =
+        (struct jesenrpc_dispatcher_entry *)jrpc_realloc(
+            dispatcher->entries, new_cap * sizeof(*grown));
+    if (!grown) {
+      return JESENRPC_ERR_ALLOC;
     }
+    dispatcher->entries = grown;
+    dispatcher->capacity = new_cap;
   }
 
-  if (request->params) {
-    jesen_destroy(request->params);
+  struct jesenrpc_dispatcher_entry *entry =
+      &dispatcher->entries[dispatcher->count];
+  jesenrpc_err_t err = jrpc_strdup(method_name, len, &entry->name);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
   }
-  request->params = params;
+  entry->handler = handler;
+  entry->user_data = user_data;
+  entry->hash = 0;
+  ++dispatcher->count;
   return JESENRPC_ERR_NONE;
 }
 
-bool jesenrpc_request_is_notification(const jesenrpc_request_t *request) {
-  if (!request) {
-    return false;
+/* Sort key for placing the largest buckets first. */
+typedef struct jrpc_bucket_ref {
+  uint32_t bucket;
+  uint32_t size;
+} jrpc_bucket_ref_t;
+
+static int jrpc_bucket_ref_compare(const void *a, const void *b) {
+  const jrpc_bucket_ref_t *ra = (const jrpc_bucket_ref_t *)a;
+  const jrpc_bucket_ref_t *rb = (const jrpc_bucket_ref_t *)b;
+  if (ra->size != rb->size) {
+    return ra->size > rb->size ? -1 : 1;
   }
-  return request->id.kind == JESENRPC_ID_NONE;
+  return ra->bucket < rb->bucket ? -1 : (ra->bucket > rb->bucket);
 }
 
-jesenrpc_err_t jesenrpc_request_serialize(const jesenrpc_request_t *request,
-                                          char *out_buf, size_t out_buf_len) {
-  jesen_node_t *node = NULL;
-  jesenrpc_err_t err = jrpc_build_request_node(request, &node);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
-  }
-  jesenrpc_err_t serialize_err =
-      jrpc_serialize_node(node, out_buf, out_buf_len);
-  if (request->params) {
-    jesen_node_detach(request->params);
+/* Tries to place every entry with the current seed and table size. members
+ * holds entry indices grouped by bucket, starting at starts[bucket]. */
+static bool jrpc_dispatch_place(jesenrpc_dispatcher_t *d,
+                                const jrpc_bucket_ref_t *order,
+                                const uint32_t *starts, const uint32_t *members,
+                                size_t *scratch) {
+  size_t slot_count = d->slot_mask + 1;
+  for (size_t i = 0; i < slot_count; ++i) {
+    d->slots[i] = JRPC_DISPATCH_EMPTY_SLOT;
+  }
+  memset(d->displace, 0, d->bucket_count * sizeof(*d->displace));
+
+  for (size_t o = 0; o < d->bucket_count && order[o].size > 0; ++o) {
+    uint32_t bucket = order[o].bucket;
+    const uint32_t *group = members + starts[bucket];
+    uint32_t size = order[o].size;
+    bool placed = false;
+    for (uint32_t disp = 0; disp < JRPC_DISPATCH_MAX_DISPLACE && !placed;
+         ++disp) {
+      placed = true;
+      for (uint32_t k = 0; k < size && placed; ++k) {
+        size_t slot = jrpc_dispatch_slot(d, d->entries[group[k]].hash, disp);
+        if (d->slots[slot] != JRPC_DISPATCH_EMPTY_SLOT) {
+          placed = false;
+          break;
+        }
+        for (uint32_t j = 0; j < k; ++j) {
+          if (scratch[j] == slot) {
+            placed = false;
+            break;
+          }
+        }
+        scratch[k] = slot;
+      }
+      if (placed) {
+        for (uint32_t k = 0; k < size; ++k) {
+          d->slots[scratch[k]] = group[k];
+        }
+        d->displace[bucket] = disp;
+      }
+    }
+    if (!placed) {
+      return false;
+    }
   }
-  jesen_destroy(node);
-  return serialize_err;
+  return true;
 }
 
-jesenrpc_err_t jesenrpc_request_validate(const jesenrpc_request_t *request) {
-  if (!request || !request->method_name) {
+jesenrpc_err_t jesenrpc_dispatcher_freeze(jesenrpc_dispatcher_t *dispatcher) {
+  if (!dispatcher || dispatcher->frozen) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  if (!request->jsonrpc ||
-      strcmp(request->jsonrpc, JESENRPC_JSONRPC_VERSION) != 0) {
-    return JESENRPC_ERR_VALIDATION;
+  size_t n = dispatcher->count;
+  if (n == 0) {
+    dispatcher->frozen = true;
+    return JESENRPC_ERR_NONE;
   }
 
-  size_t len = strlen(request->method_name);
-  if (len == 0 || len > JESENRPC_METHOD_NAME_MAX_LEN) {
-    return JESENRPC_ERR_VALIDATION;
+  size_t slot_count = 1;
+  while (slot_count < n + n / 4) {
+    slot_count <<= 1;
+  }
+  dispatcher->bucket_count = (n + 1) / 2;
+
+  uint32_t *starts =
+      (uint32_t *)jrpc_calloc(dispatcher->bucket_count + 1, sizeof(*starts));
+  uint32_t *members = (uint32_t *)jrpc_malloc(n * sizeof(*members));
+  jrpc_bucket_ref_t *order = (jrpc_bucket_ref_t *)jrpc_malloc(
+      dispatcher->bucket_count * sizeof(*order));
+  size_t *scratch = (size_t *)jrpc_malloc(n * sizeof(*scratch));
+  uint32_t *displace =
+      (uint32_t *)jrpc_malloc(dispatcher->bucket_count * sizeof(*displace));
+  if (!starts || !members || !order || !scratch || !displace) {
+    jrpc_free(starts);
+    jrpc_free(members);
+    jrpc_free(order);
+    jrpc_free(scratch);
+    jrpc_free(displace);
+    return JESENRPC_ERR_ALLOC;
   }
-
-  if (request->params) {
-    bool is_array = false;
-    bool is_object = false;
-    jesen_err_t err = jesen_value_is_array(request->params, &is_array);
-    if (err == JESEN_ERR_NONE) {
-      err = jesen_value_is_object(request->params, &is_object);
+  dispatcher->displace = displace;
+
+  /* Placement virtually always succeeds on the first seed; a sparser table
+   * is the fallback for pathological name sets. */
+  jesenrpc_err_t err = JESENRPC_ERR_VALIDATION;
+  bool built = false;
+  for (int grow = 0; grow < 4 && !built; ++grow, slot_count <<= 1) {
+    uint32_t *slots = (uint32_t *)jrpc_realloc(dispatcher->slots,
+                                               slot_count * sizeof(*slots));
+    if (!slots) {
+      err = JESENRPC_ERR_ALLOC;
+      break;
     }
-    if (err != JESEN_ERR_NONE) {
-      return err;
-    }
-    if (!is_array && !is_object) {
-      return JESENRPC_ERR_VALIDATION;
+    dispatcher->slots = slots;
+    dispatcher->slot_mask = slot_count - 1;
+
+    for (int attempt = 0; attempt < JRPC_DISPATCH_SEED_ATTEMPTS && !built;
+         ++attempt) {
+      dispatcher->hash_seed =
+          jrpc_mix64((uint64_t)(grow * JRPC_DISPATCH_SEED_ATTEMPTS + attempt));
+
+      /* Group entries by bucket (counting sort). */
+      memset(starts, 0, (dispatcher->bucket_count + 1) * sizeof(*starts));
+      for (size_t i = 0; i < n; ++i) {
+        struct jesenrpc_dispatcher_entry *entry = &dispatcher->entries[i];
+        entry->hash = jrpc_hash_name(entry->name, dispatcher->hash_seed);
+        ++starts[jrpc_dispatch_bucket(dispatcher, entry->hash) + 1];
+      }
+      for (size_t b = 0; b < dispatcher->bucket_count; ++b) {
+        order[b].bucket = (uint32_t)b;
+        order[b].size = starts[b + 1];
+        starts[b + 1] += starts[b];
+      }
+      /* displace doubles as the fill cursor; placing resets it. */
+      memset(displace, 0, dispatcher->bucket_count * sizeof(*displace));
+      for (size_t i = 0; i < n; ++i) {
+        size_t b =
+            jrpc_dispatch_bucket(dispatcher, dispatcher->entries[i].hash);
+        members[starts[b] + displace[b]++] = (uint32_t)i;
+      }
+
+      qsort(order, dispatcher->bucket_count, sizeof(*order),
+            jrpc_bucket_ref_compare);
+      built = jrpc_dispatch_place(dispatcher, order, starts, members, scratch);
     }
   }
 
-  if (request->id.kind == JESENRPC_ID_STRING &&
-      (!request->id.value.string.data || request->id.value.string.len == 0)) {
-    return JESENRPC_ERR_VALIDATION;
+  jrpc_free(starts);
+  jrpc_free(members);
+  jrpc_free(order);
+  jrpc_free(scratch);
+  if (!built) {
+    jrpc_free(dispatcher->slots);
+    jrpc_free(dispatcher->displace);
+    dispatcher->slots = NULL;
+    dispatcher->displace = NULL;
+    return err;
   }
-
+  dispatcher->frozen = true;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_request_parse(char *buf, size_t buf_len,
-                                      jesenrpc_request_t **out) {
-  if (!buf || !out) {
-    return JESENRPC_ERR_INVALID_ARGS;
+static const struct jesenrpc_dispatcher_entry *
+jrpc_dispatch_find(const jesenrpc_dispatcher_t *d, const char *method_name) {
+  if (d->count == 0) {
+    return NULL;
   }
-
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  uint64_t hash = jrpc_hash_name(method_name, d->hash_seed);
+  uint32_t displace = d->displace[jrpc_dispatch_bucket(d, hash)];
+  uint32_t index = d->slots[jrpc_dispatch_slot(d, hash, displace)];
+  if (index == JRPC_DISPATCH_EMPTY_SLOT) {
+    return NULL;
   }
-
-  err = jrpc_parse_request_node(root, out);
-  jesen_destroy(root);
-  return err;
+  const struct jesenrpc_dispatcher_entry *entry = &d->entries[index];
+  if (entry->hash != hash || strcmp(entry->name, method_name) != 0) {
+    return NULL;
+  }
+  return entry;
 }
 
-jesenrpc_err_t jesenrpc_request_destroy(jesenrpc_request_t *request) {
-  if (!request) {
-    return JESENRPC_ERR_INVALID_ARGS;
+bool jesenrpc_dispatcher_lookup(const jesenrpc_dispatcher_t *dispatcher,
+                                const char *method_name,
+                                jesenrpc_method_handler_t *out_handler,
+                                void **out_user_data) {
+  if (!dispatcher || !method_name || !dispatcher->frozen) {
+    return false;
   }
-
-  if (request->params) {
-    jesen_destroy(request->params);
+  const struct jesenrpc_dispatcher_entry *entry =
+      jrpc_dispatch_find(dispatcher, method_name);
+  if (!entry) {
+    return false;
   }
-  jrpc_id_cleanup(&request->id);
-  if (request->method_name) {
-    free(request->method_name);
+  if (out_handler) {
+    *out_handler = entry->handler;
   }
-  free(request);
-  return JESENRPC_ERR_NONE;
+  if (out_user_data) {
+    *out_user_data = entry->user_data;
+  }
+  return true;
 }
 
-jesenrpc_err_t
-jesenrpc_response_create_for_request(const jesenrpc_request_t *request,
-                                     jesenrpc_response_t **response) {
-  if (!request || !response) {
-    return JESENRPC_ERR_INVALID_ARGS;
+static jesenrpc_err_t jrpc_response_fail(jesenrpc_response_t *response,
+                                         int32_t code, const char *message) {
+  if (response->result) {
+    jesen_destroy(response->result);
+    response->result = NULL;
   }
-  if (request->id.kind == JESENRPC_ID_NONE) {
-    return JESENRPC_ERR_INVALID_ARGS;
+  response->raw_result.data = NULL;
+  response->raw_result.len = 0;
+  jesenrpc_error_object_t *error = NULL;
+  jesenrpc_err_t err = jesenrpc_error_object_create(code, message, &error);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
   }
-
-  return jesenrpc_response_create_with_id(&request->id, response);
+  return jesenrpc_response_set_error(response, error);
 }
 
-jesenrpc_err_t
-jesenrpc_response_create_with_id(const jesenrpc_id_t *id,
-                                 jesenrpc_response_t **response) {
-  if (!id || !response) {
+jesenrpc_err_t
+jesenrpc_dispatcher_dispatch(const jesenrpc_dispatcher_t *dispatcher,
+                             const jesenrpc_request_t *request,
+                             jesenrpc_response_t **out_response) {
+  if (!dispatcher || !request || !request->method_name || !out_response ||
+      !dispatcher->frozen) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  *out_response = NULL;
 
-  jesenrpc_response_t *resp = (jesenrpc_response_t *)calloc(1, sizeof(*resp));
-  if (!resp) {
-    return JESENRPC_ERR_ALLOC;
+  const struct jesenrpc_dispatcher_entry *entry =
+      jrpc_dispatch_find(dispatcher, request->method_name);
+  JRPC_PROBE3(dispatched, request->method_name, (int)(entry != NULL),
+              (int)(request->id.kind != JESENRPC_ID_NONE));
+  if (request->id.kind == JESENRPC_ID_NONE) {
+    /* Notifications never get a reply, not even for failures. */
+    if (entry) {
+      uint64_t started = jrpc_latency_start();
+      entry->handler(request, NULL, entry->user_data);
+      (void)jrpc_latency_dispatched(entry->name, started);
+    }
+    return JESENRPC_ERR_NONE;
   }
 
-  resp->jsonrpc = JESENRPC_JSONRPC_VERSION;
-  resp->result = NULL;
-  resp->error = NULL;
-  resp->id.kind = JESENRPC_ID_NONE;
+  jesenrpc_response_t *resp = NULL;
+  jesenrpc_err_t err = jesenrpc_response_create_for_request(request, &resp);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
 
-  jesenrpc_err_t err = jrpc_id_clone(id, &resp->id);
+  if (!entry) {
+    err = jrpc_response_fail(resp, JESENRPC_JSONRPC_ERROR_METHOD_NOT_FOUND,
+                             "Method not found");
+  } else {
+    uint64_t started = jrpc_latency_start();
+    jesenrpc_err_t handler_err =
+        entry->handler(request, resp, entry->user_data);
+    resp->latency_method = jrpc_latency_dispatched(entry->name, started);
+    bool has_result = resp->result || resp->raw_result.data;
+    if (!resp->error && (handler_err != JESENRPC_ERR_NONE || !has_result)) {
+      err = jrpc_response_fail(resp, JESENRPC_JSONRPC_ERROR_INTERNAL,
+                               "Internal error");
+    }
+  }
   if (err != JESENRPC_ERR_NONE) {
-    free(resp);
+    jesenrpc_response_destroy(resp);
     return err;
   }
 
-  *response = resp;
+  *out_response = resp;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_response_create(int32_t request_id,
-                                        jesenrpc_response_t **response) {
-  jesenrpc_id_t id = {.kind = JESENRPC_ID_NUMBER, .value.number = request_id};
-  return jesenrpc_response_create_with_id(&id, response);
-}
-
-jesenrpc_err_t jesenrpc_response_set_result(jesenrpc_response_t *response,
-                                            jesen_node_t *result) {
-  if (!response || !result) {
-    return JESENRPC_ERR_INVALID_ARGS;
-  }
-  if (response->error || response->result) {
-    return JESENRPC_ERR_INVALID_ARGS;
+/* Dispatches batch->items[begin, end) into the matching response slots;
+ * slots of notifications stay NULL. */
+static jesenrpc_err_t
+jrpc_dispatch_range(const jesenrpc_dispatcher_t *dispatcher,
+                    const jesenrpc_request_batch_t *batch, size_t begin,
+                    size_t end, jesenrpc_response_t **responses) {
+  for (size_t i = begin; i < end; ++i) {
+    jesenrpc_err_t err = jesenrpc_dispatcher_dispatch(
+        dispatcher, batch->items[i], &responses[i]);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
   }
-  response->result = result;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_response_set_error(jesenrpc_response_t *response,
-                                           jesenrpc_error_object_t *error) {
-  if (!response || !error) {
-    return JESENRPC_ERR_INVALID_ARGS;
+/* Turns per-item response slots into a response batch in request order,
+ * dropping the empty slots of notifications. Takes ownership of responses. */
+static jesenrpc_err_t jrpc_assemble_batch(jesenrpc_response_t **responses,
+                                          size_t count, jesenrpc_err_t err,
+                                          jesenrpc_response_batch_t *out) {
+  size_t kept = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!responses[i]) {
+      continue;
+    }
+    if (err != JESENRPC_ERR_NONE) {
+      jesenrpc_response_destroy(responses[i]);
+    } else {
+      responses[kept++] = responses[i];
+    }
   }
-  if (response->result || response->error) {
-    return JESENRPC_ERR_INVALID_ARGS;
+  if (err != JESENRPC_ERR_NONE || kept == 0) {
+    jrpc_free(responses);
+    responses = NULL;
   }
-  response->error = error;
-  return JESENRPC_ERR_NONE;
+  if (err == JESENRPC_ERR_NONE) {
+    out->items = responses;
+    out->count = kept;
+  }
+  return err;
 }
 
-jesenrpc_err_t jesenrpc_response_serialize(const jesenrpc_response_t *response,
-                                           char *out_buf, size_t out_buf_len) {
-  jesen_node_t *node = NULL;
-  jesenrpc_err_t err = jrpc_build_response_node(response, &node);
+/* An empty batch is answered with a single Invalid Request error. */
+static jesenrpc_err_t jrpc_reply_empty_batch(jesenrpc_message_t *out_reply) {
+  jesenrpc_id_t null_id = {.kind = JESENRPC_ID_NULL};
+  jesenrpc_response_t *resp = NULL;
+  jesenrpc_err_t err = jesenrpc_response_create_with_id(&null_id, &resp);
   if (err != JESENRPC_ERR_NONE) {
     return err;
   }
-  jesenrpc_err_t serialize_err =
-      jrpc_serialize_node(node, out_buf, out_buf_len);
-  if (response->result) {
-    jesen_node_detach(response->result);
-  } else if (response->error && response->error->data) {
-    jesen_node_detach(response->error->data);
-  }
-  jesen_destroy(node);
-  return serialize_err;
-}
-
-jesenrpc_err_t jesenrpc_response_validate(const jesenrpc_response_t *response) {
-  if (!response) {
-    return JESENRPC_ERR_INVALID_ARGS;
-  }
-  if (!response->jsonrpc ||
-      strcmp(response->jsonrpc, JESENRPC_JSONRPC_VERSION) != 0) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-  if (response->id.kind == JESENRPC_ID_NONE) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-  if (response->id.kind == JESENRPC_ID_STRING &&
-      (!response->id.value.string.data || response->id.value.string.len == 0)) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-  bool has_result = response->result != NULL;
-  bool has_error = response->error != NULL;
-  if ((has_result && has_error) || (!has_result && !has_error)) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-  if (has_error) {
-    return jesenrpc_error_object_validate(response->error);
+  err = jrpc_response_fail(resp, JESENRPC_JSONRPC_ERROR_INVALID_REQUEST,
+                           "Invalid Request");
+  if (err != JESENRPC_ERR_NONE) {
+    jesenrpc_response_destroy(resp);
+    return err;
   }
+  out_reply->kind = JESENRPC_MESSAGE_RESPONSE_SINGLE;
+  out_reply->as.response = resp;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_response_parse(char *buf, size_t buf_len,
-                                       jesenrpc_response_t **out) {
-  if (!buf || !out) {
-    return JESENRPC_ERR_INVALID_ARGS;
+/* Executor. Workers and the submitting thread claim chunks of the batch under
+ * one lock and write responses into per-item slots, so no ordering work is
+ * needed when the batch is reassembled. */
+
+#define JRPC_EXECUTOR_MIN_PARALLEL 8
+
+struct jesenrpc_executor {
+  size_t thread_count;
+#ifdef JESENRPC_HAVE_PTHREADS
+  pthread_t *threads;
+  pthread_mutex_t submit_lock; /* Serializes concurrent batch submissions. */
+  pthread_mutex_t lock;        /* Guards everything below. */
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  uint64_t generation;
+  bool stopping;
+  const jesenrpc_dispatcher_t *dispatcher;
+  const jesenrpc_request_batch_t *batch;
+  jesenrpc_response_t **responses;
+  size_t next_index;
+  size_t chunk;
+  size_t pending; /* Items not finished yet. */
+  jesenrpc_err_t error;
+#endif
+};
+
+#ifdef JESENRPC_HAVE_PTHREADS
+/* Runs chunks of the current batch until none are left. Called and returns
+ * with ex->lock held. */
+static void jrpc_executor_work(jesenrpc_executor_t *ex) {
+  while (ex->batch && ex->next_index < ex->batch->count) {
+    const jesenrpc_dispatcher_t *dispatcher = ex->dispatcher;
+    const jesenrpc_request_batch_t *batch = ex->batch;
+    jesenrpc_response_t **responses = ex->responses;
+    size_t begin = ex->next_index;
+    size_t end = begin + ex->chunk < batch->count ? begin + ex->chunk
+                                                  : batch->count;
+    ex->next_index = end;
+    pthread_mutex_unlock(&ex->lock);
+
+    jesenrpc_err_t err =
+        jrpc_dispatch_range(dispatcher, batch, begin, end, responses);
+
+    pthread_mutex_lock(&ex->lock);
+    if (err != JESENRPC_ERR_NONE && ex->error == JESENRPC_ERR_NONE) {
+      ex->error = err;
+    }
+    ex->pending -= end - begin;
+    if (ex->pending == 0) {
+      pthread_cond_broadcast(&ex->work_done);
+    }
   }
+}
 
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+static void *jrpc_executor_main(void *arg) {
+  jesenrpc_executor_t *ex = (jesenrpc_executor_t *)arg;
+  uint64_t seen = 0;
+  pthread_mutex_lock(&ex->lock);
+  for (;;) {
+    while (!ex->stopping && ex->generation == seen) {
+      pthread_cond_wait(&ex->work_ready, &ex->lock);
+    }
+    if (ex->stopping) {
+      break;
+    }
+    seen = ex->generation;
+    jrpc_executor_work(ex);
   }
+  pthread_mutex_unlock(&ex->lock);
+  return NULL;
+}
 
-  err = jrpc_parse_response_node(root, out);
-  jesen_destroy(root);
+static jesenrpc_err_t jrpc_executor_run(jesenrpc_executor_t *ex,
+                                        const jesenrpc_dispatcher_t *dispatcher,
+                                        const jesenrpc_request_batch_t *batch,
+                                        jesenrpc_response_t **responses) {
+  pthread_mutex_lock(&ex->submit_lock);
+  pthread_mutex_lock(&ex->lock);
+  ex->dispatcher = dispatcher;
+  ex->batch = batch;
+  ex->responses = responses;
+  ex->next_index = 0;
+  ex->pending = batch->count;
+  ex->error = JESENRPC_ERR_NONE;
+  /* About four chunks per participant balances uneven handler costs. */
+  ex->chunk = batch->count / ((ex->thread_count + 1) * 4);
+  if (ex->chunk == 0) {
+    ex->chunk = 1;
+  }
+  ++ex->generation;
+  pthread_cond_broadcast(&ex->work_ready);
+
+  jrpc_executor_work(ex);
+  while (ex->pending > 0) {
+    pthread_cond_wait(&ex->work_done, &ex->lock);
+  }
+
+  jesenrpc_err_t err = ex->error;
+  ex->dispatcher = NULL;
+  ex->batch = NULL;
+  ex->responses = NULL;
+  pthread_mutex_unlock(&ex->lock);
+  pthread_mutex_unlock(&ex->submit_lock);
   return err;
 }
 
-jesenrpc_err_t jesenrpc_response_destroy(jesenrpc_response_t *response) {
-  if (!response) {
+static void jrpc_executor_stop(jesenrpc_executor_t *ex) {
+  pthread_mutex_lock(&ex->lock);
+  ex->stopping = true;
+  pthread_cond_broadcast(&ex->work_ready);
+  pthread_mutex_unlock(&ex->lock);
+  for (size_t i = 0; i < ex->thread_count; ++i) {
+    pthread_join(ex->threads[i], NULL);
+  }
+  jrpc_free(ex->threads);
+  pthread_cond_destroy(&ex->work_done);
+  pthread_cond_destroy(&ex->work_ready);
+  pthread_mutex_destroy(&ex->lock);
+  pthread_mutex_destroy(&ex->submit_lock);
+}
+#endif
+
+jesenrpc_err_t jesenrpc_executor_create(size_t thread_count,
+                                        jesenrpc_executor_t **out_executor) {
+  if (!out_executor) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (response->result) {
-    jesen_destroy(response->result);
+  jesenrpc_executor_t *ex = (jesenrpc_executor_t *)jrpc_calloc(1, sizeof(*ex));
+  if (!ex) {
+    return JESENRPC_ERR_ALLOC;
   }
-  if (response->error) {
-    jesenrpc_error_object_destroy(response->error);
+
+#ifdef JESENRPC_HAVE_PTHREADS
+  if (thread_count > 0) {
+    ex->threads = (pthread_t *)jrpc_calloc(thread_count, sizeof(*ex->threads));
+    if (!ex->threads) {
+      jrpc_free(ex);
+      return JESENRPC_ERR_ALLOC;
+    }
   }
-  jrpc_id_cleanup(&response->id);
-  free(response);
+  pthread_mutex_init(&ex->submit_lock, NULL);
+  pthread_mutex_init(&ex->lock, NULL);
+  pthread_cond_init(&ex->work_ready, NULL);
+  pthread_cond_init(&ex->work_done, NULL);
+  for (size_t i = 0; i < thread_count; ++i) {
+    if (pthread_create(&ex->threads[i], NULL, jrpc_executor_main, ex) != 0) {
+      jrpc_executor_stop(ex);
+      jrpc_free(ex);
+      return JESENRPC_ERR_ALLOC;
+    }
+    ++ex->thread_count;
+  }
+#else
+  (void)thread_count; /* Built without threads: batches run inline. */
+#endif
+
+  *out_executor = ex;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_error_object_create(int32_t code, const char *message,
-                                            jesenrpc_error_object_t **error) {
-  if (!message || !error) {
+jesenrpc_err_t
+jesenrpc_executor_dispatch_batch(jesenrpc_executor_t *executor,
+                                 const jesenrpc_dispatcher_t *dispatcher,
+                                 const jesenrpc_request_batch_t *batch,
+                                 jesenrpc_response_batch_t *out) {
+  if (!executor || !dispatcher || !batch || !out || !dispatcher->frozen) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  size_t len = strlen(message);
-  if (len == 0) {
-    return JESENRPC_ERR_INVALID_ARGS;
+  out->items = NULL;
+  out->count = 0;
+  out->arena = NULL;
+  if (batch->count == 0) {
+    return JESENRPC_ERR_VALIDATION;
   }
 
-  jesenrpc_error_object_t *err_obj =
-      (jesenrpc_error_object_t *)calloc(1, sizeof(*err_obj));
-  if (!err_obj) {
+  jesenrpc_response_t **responses =
+      (jesenrpc_response_t **)jrpc_calloc(batch->count, sizeof(*responses));
+  if (!responses) {
     return JESENRPC_ERR_ALLOC;
   }
-  err_obj->code = code;
-  err_obj->data = NULL;
 
-  jesenrpc_err_t err = jrpc_strdup(message, len, &err_obj->message);
-  if (err != JESENRPC_ERR_NONE) {
-    free(err_obj);
-    return err;
+  jesenrpc_err_t err;
+#ifdef JESENRPC_HAVE_PTHREADS
+  if (executor->thread_count > 0 &&
+      batch->count >= JRPC_EXECUTOR_MIN_PARALLEL) {
+    err = jrpc_executor_run(executor, dispatcher, batch, responses);
+  } else {
+    err = jrpc_dispatch_range(dispatcher, batch, 0, batch->count, responses);
   }
+#else
+  err = jrpc_dispatch_range(dispatcher, batch, 0, batch->count, responses);
+#endif
+  return jrpc_assemble_batch(responses, batch->count, err, out);
+}
 
-  *error = err_obj;
+jesenrpc_err_t jesenrpc_executor_destroy(jesenrpc_executor_t *executor) {
+  if (!executor) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+#ifdef JESENRPC_HAVE_PTHREADS
+  jrpc_executor_stop(executor);
+#endif
+  jrpc_free(executor);
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_error_object_set_data(jesenrpc_error_object_t *error,
-                                              jesen_node_t *data) {
-  if (!error) {
+/* Shared by the sequential and the executor-backed message dispatch. */
+static jesenrpc_err_t
+jrpc_dispatch_message(jesenrpc_executor_t *executor,
+                      const jesenrpc_dispatcher_t *dispatcher,
+                      const jesenrpc_message_t *message,
+                      jesenrpc_message_t *out_reply) {
+  if (!dispatcher || !message || !out_reply) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (error->data && error->data != data) {
-    jesen_destroy(error->data);
+
+  memset(out_reply, 0, sizeof(*out_reply));
+  out_reply->kind = JESENRPC_MESSAGE_UNKNOWN;
+
+  switch (message->kind) {
+  case JESENRPC_MESSAGE_REQUEST_SINGLE: {
+    jesenrpc_response_t *resp = NULL;
+    jesenrpc_err_t err =
+        jesenrpc_dispatcher_dispatch(dispatcher, message->as.request, &resp);
+    if (err == JESENRPC_ERR_NONE && resp) {
+      out_reply->kind = JESENRPC_MESSAGE_RESPONSE_SINGLE;
+      out_reply->as.response = resp;
+    }
+    return err;
+  }
+  case JESENRPC_MESSAGE_REQUEST_BATCH: {
+    const jesenrpc_request_batch_t *batch = &message->as.request_batch;
+    if (batch->count == 0) {
+      return jrpc_reply_empty_batch(out_reply);
+    }
+    if (!dispatcher->frozen) {
+      return JESENRPC_ERR_INVALID_ARGS;
+    }
+    jesenrpc_response_batch_t *replies = &out_reply->as.response_batch;
+    jesenrpc_err_t err;
+    if (executor) {
+      err = jesenrpc_executor_dispatch_batch(executor, dispatcher, batch,
+                                             replies);
+    } else {
+      jesenrpc_response_t **responses =
+          (jesenrpc_response_t **)jrpc_calloc(batch->count, sizeof(*responses));
+      if (!responses) {
+        return JESENRPC_ERR_ALLOC;
+      }
+      err = jrpc_dispatch_range(dispatcher, batch, 0, batch->count, responses);
+      err = jrpc_assemble_batch(responses, batch->count, err, replies);
+    }
+    if (err == JESENRPC_ERR_NONE && replies->count > 0) {
+      out_reply->kind = JESENRPC_MESSAGE_RESPONSE_BATCH;
+    }
+    return err;
+  }
+  default:
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-  error->data = data;
-  return JESENRPC_ERR_NONE;
 }
 
 jesenrpc_err_t
-jesenrpc_error_object_validate(const jesenrpc_error_object_t *error) {
-  if (!error || !error->message) {
+jesenrpc_dispatcher_dispatch_message(const jesenrpc_dispatcher_t *dispatcher,
+                                     const jesenrpc_message_t *message,
+                                     jesenrpc_message_t *out_reply) {
+  return jrpc_dispatch_message(NULL, dispatcher, message, out_reply);
+}
+
+jesenrpc_err_t
+jesenrpc_executor_dispatch_message(jesenrpc_executor_t *executor,
+                                   const jesenrpc_dispatcher_t *dispatcher,
+                                   const jesenrpc_message_t *message,
+                                   jesenrpc_message_t *out_reply) {
+  if (!executor) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (strlen(error->message) == 0) {
-    return JESENRPC_ERR_VALIDATION;
-  }
-  return JESENRPC_ERR_NONE;
+  return jrpc_dispatch_message(executor, dispatcher, message, out_reply);
 }
 
-jesenrpc_err_t jesenrpc_error_object_destroy(jesenrpc_error_object_t *error) {
-  if (!error) {
+jesenrpc_err_t jesenrpc_dispatcher_destroy(jesenrpc_dispatcher_t *dispatcher) {
+  if (!dispatcher) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (error->message) {
-    free(error->message);
-  }
-  if (error->data) {
-    jesen_destroy(error->data);
+  for (size_t i = 0; i < dispatcher->count; ++i) {
+    jrpc_free(dispatcher->entries[i].name);
   }
-  free(error);
+  jrpc_free(dispatcher->entries);
+  jrpc_free(dispatcher->slots);
+  jrpc_free(dispatcher->displace);
+  memset(dispatcher, 0, sizeof(*dispatcher));
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t
-jrpc_parse_request_batch_from_node(jesen_node_t *root,
-                                   jesenrpc_request_batch_t *out) {
-  if (!root || !out) {
-    return JESENRPC_ERR_INVALID_ARGS;
-  }
+/* Client. Pending calls are records in a pool addressed by index, and the
+ * hash table maps IDs to those indices, so a record never moves while its
+ * call is pending. Each slot packs the upper half of the ID hash next to the
+ * record index, letting most probes skip the record entirely. Linear probing
+ * with backward-shift deletion keeps probe sequences short without
+ * tombstones.
+ *
+ * Timeouts live on a hierarchical timer wheel: JRPC_WHEEL_LEVELS levels of
+ * JRPC_WHEEL_SLOTS doubly linked lists threaded through the call records. A
+ * timer goes on the lowest level whose slot range still contains both the
+ * current time and its deadline, so insert and cancel are O(1). When a level
+ * wraps, the next level's due slot is cascaded down; deadlines beyond the
+ * top level wait on an overflow list. */
+
+#define JRPC_CLIENT_NO_CALL UINT32_MAX
+#define JRPC_CLIENT_MIN_SLOTS 16
+#define JRPC_WHEEL_BITS 6
+#define JRPC_WHEEL_SLOTS (1u << JRPC_WHEEL_BITS)
+#define JRPC_WHEEL_LEVELS 4
+#define JRPC_WHEEL_OVERFLOW (JRPC_WHEEL_LEVELS * JRPC_WHEEL_SLOTS)
+#define JRPC_WHEEL_HEADS (JRPC_WHEEL_OVERFLOW + 1)
+
+struct jesenrpc_client_call {
+  jesenrpc_id_t id; /* String bytes are borrowed from the caller. */
+  uint64_t hash;
+  jesenrpc_response_callback_t callback;
+  void *user_data;
+  uint32_t next_free;
+  uint64_t deadline;
+  uint32_t timer_head; /* Wheel list holding the call, or NO_CALL. */
+  uint32_t timer_prev;
+  uint32_t timer_next;
+};
+
+static bool jrpc_client_id_usable(const jesenrpc_id_t *id) {
+  if (id->kind == JESENRPC_ID_NUMBER) {
+    return true;
+  }
+  return id->kind == JESENRPC_ID_STRING && id->value.string.data &&
+         id->value.string.len > 0;
+}
 
-  out->items = NULL;
-  out->count = 0;
+static uint64_t jrpc_client_hash_id(const jesenrpc_id_t *id) {
+  if (id->kind == JESENRPC_ID_NUMBER) {
+    return jrpc_mix64((uint64_t)id->value.number);
+  }
+  uint64_t h = 0xCBF29CE484222325ULL;
+  const unsigned char *p = (const unsigned char *)id->value.string.data;
+  for (size_t i = 0; i < id->value.string.len; ++i) {
+    h ^= p[i];
+    h *= 0x100000001B3ULL;
+  }
+  return jrpc_mix64(h);
+}
 
-  bool is_array = false;
-  jesen_err_t err = jesen_value_is_array(root, &is_array);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+static bool jrpc_client_id_equal(const jesenrpc_id_t *a,
+                                 const jesenrpc_id_t *b) {
+  if (a->kind != b->kind) {
+    return false;
   }
-  if (!is_array) {
-    return JESENRPC_ERR_VALIDATION;
+  if (a->kind == JESENRPC_ID_NUMBER) {
+    return a->value.number == b->value.number;
   }
+  return a->value.string.len == b->value.string.len &&
+         memcmp(a->value.string.data, b->value.string.data,
+                a->value.string.len) == 0;
+}
 
-  size_t count = 0;
-  err = jesen_array_size(root, &count);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+/* 0 marks an empty slot; record indices are stored plus one. */
+static uint64_t jrpc_client_pack_slot(uint64_t hash, uint32_t call) {
+  return (hash & 0xFFFFFFFF00000000ULL) | ((uint64_t)call + 1);
+}
+
+static uint32_t jrpc_client_slot_call(uint64_t slot) {
+  return (uint32_t)slot - 1;
+}
+
+/* Returns true and the slot position if id is pending; otherwise false and
+ * the empty slot where it would be inserted. */
+static bool jrpc_client_find(const jesenrpc_client_t *client,
+                             const jesenrpc_id_t *id, uint64_t hash,
+                             size_t *out_pos) {
+  size_t pos = (size_t)hash & client->slot_mask;
+  for (;;) {
+    uint64_t slot = client->slots[pos];
+    if (slot == 0) {
+      *out_pos = pos;
+      return false;
+    }
+    if ((slot >> 32) == (hash >> 32) &&
+        jrpc_client_id_equal(&client->calls[jrpc_client_slot_call(slot)].id,
+                             id)) {
+      *out_pos = pos;
+      return true;
+    }
+    pos = (pos + 1) & client->slot_mask;
   }
+}
 
-  if (count == 0) {
-    return JESENRPC_ERR_NONE;
+static void jrpc_client_erase_slot(jesenrpc_client_t *client, size_t pos) {
+  size_t mask = client->slot_mask;
+  size_t hole = pos;
+  for (size_t next = (hole + 1) & mask;; next = (next + 1) & mask) {
+    uint64_t slot = client->slots[next];
+    if (slot == 0) {
+      break;
+    }
+    size_t home =
+        (size_t)client->calls[jrpc_client_slot_call(slot)].hash & mask;
+    /* Move the entry back unless its home lies between the hole and it. */
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      client->slots[hole] = slot;
+      hole = next;
+    }
   }
+  client->slots[hole] = 0;
+}
 
-  jesenrpc_request_t **items =
-      (jesenrpc_request_t **)calloc(count, sizeof(*items));
-  if (!items) {
+static jesenrpc_err_t jrpc_client_resize_slots(jesenrpc_client_t *client,
+                                               size_t slot_count) {
+  uint64_t *slots = (uint64_t *)jrpc_calloc(slot_count, sizeof(*slots));
+  if (!slots) {
     return JESENRPC_ERR_ALLOC;
   }
-
-  for (size_t i = 0; i < count; ++i) {
-    jesen_node_t *elem = NULL;
-    err = jesen_array_get_value(root, (uint32_t)i, &elem);
-    if (err != JESEN_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        jesenrpc_request_destroy(items[j]);
-      }
-      free(items);
-      return err;
+  size_t mask = slot_count - 1;
+  size_t old_count = client->slots ? client->slot_mask + 1 : 0;
+  for (size_t i = 0; i < old_count; ++i) {
+    uint64_t slot = client->slots[i];
+    if (slot == 0) {
+      continue;
     }
-    jesenrpc_request_t *req = NULL;
-    err = jrpc_parse_request_node(elem, &req);
-    if (err != JESENRPC_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        jesenrpc_request_destroy(items[j]);
-      }
-      free(items);
-      return err;
+    size_t pos = (size_t)client->calls[jrpc_client_slot_call(slot)].hash & mask;
+    while (slots[pos] != 0) {
+      pos = (pos + 1) & mask;
     }
-    items[i] = req;
+    slots[pos] = slot;
   }
+  jrpc_free(client->slots);
+  client->slots = slots;
+  client->slot_mask = mask;
+  return JESENRPC_ERR_NONE;
+}
 
-  out->items = items;
-  out->count = count;
+static jesenrpc_err_t jrpc_client_grow_calls(jesenrpc_client_t *client,
+                                             size_t capacity) {
+  if (capacity >= JRPC_CLIENT_NO_CALL ||
+      capacity > SIZE_MAX / sizeof(*client->calls)) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  struct jesenrpc_client_call *calls =
+      (struct jesenrpc_client_call *)jrpc_realloc(client->calls,
+                                                  capacity * sizeof(*calls));
+  if (!calls) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  /* Chain the new records so the lowest index is handed out first. */
+  for (size_t i = capacity; i-- > client->call_capacity;) {
+    calls[i].next_free = client->free_call;
+    client->free_call = (uint32_t)i;
+  }
+  client->calls = calls;
+  client->call_capacity = capacity;
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t
-jrpc_parse_response_batch_from_node(jesen_node_t *root,
-                                    jesenrpc_response_batch_t *out) {
-  if (!root || !out) {
-    return JESENRPC_ERR_INVALID_ARGS;
+static size_t jrpc_client_slots_for(size_t in_flight) {
+  size_t slots = JRPC_CLIENT_MIN_SLOTS;
+  /* Keep the load factor at or below one half. */
+  while (slots / 2 < in_flight && slots <= SIZE_MAX / 2) {
+    slots *= 2;
   }
+  return slots;
+}
 
-  out->items = NULL;
-  out->count = 0;
+static void jrpc_timer_link(jesenrpc_client_t *client, uint32_t index) {
+  struct jesenrpc_client_call *call = &client->calls[index];
+  uint64_t diff = call->deadline ^ client->now;
+  uint32_t head = JRPC_WHEEL_OVERFLOW;
+  for (unsigned level = 0; level < JRPC_WHEEL_LEVELS; ++level) {
+    unsigned shift = level * JRPC_WHEEL_BITS;
+    if ((diff >> (shift + JRPC_WHEEL_BITS)) == 0) {
+      head = level * JRPC_WHEEL_SLOTS +
+             (uint32_t)((call->deadline >> shift) & (JRPC_WHEEL_SLOTS - 1));
+      break;
+    }
+  }
+  uint32_t first = client->timer_heads[head];
+  call->timer_head = head;
+  call->timer_prev = JRPC_CLIENT_NO_CALL;
+  call->timer_next = first;
+  if (first != JRPC_CLIENT_NO_CALL) {
+    client->calls[first].timer_prev = index;
+  }
+  client->timer_heads[head] = index;
+}
 
-  bool is_array = false;
-  jesen_err_t err = jesen_value_is_array(root, &is_array);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+static void jrpc_timer_unlink(jesenrpc_client_t *client, uint32_t index) {
+  struct jesenrpc_client_call *call = &client->calls[index];
+  if (call->timer_head == JRPC_CLIENT_NO_CALL) {
+    return;
   }
-  if (!is_array) {
-    return JESENRPC_ERR_VALIDATION;
+  if (call->timer_prev != JRPC_CLIENT_NO_CALL) {
+    client->calls[call->timer_prev].timer_next = call->timer_next;
+  } else {
+    client->timer_heads[call->timer_head] = call->timer_next;
+  }
+  if (call->timer_next != JRPC_CLIENT_NO_CALL) {
+    client->calls[call->timer_next].timer_prev = call->timer_prev;
   }
+  call->timer_head = JRPC_CLIENT_NO_CALL;
+}
 
-  size_t count = 0;
-  err = jesen_array_size(root, &count);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+/* Re-files every timer in a wheel list relative to the current time. */
+static void jrpc_timer_cascade(jesenrpc_client_t *client, uint32_t head) {
+  uint32_t index = client->timer_heads[head];
+  client->timer_heads[head] = JRPC_CLIENT_NO_CALL;
+  while (index != JRPC_CLIENT_NO_CALL) {
+    uint32_t next = client->calls[index].timer_next;
+    jrpc_timer_link(client, index);
+    index = next;
   }
+}
 
-  if (count == 0) {
-    return JESENRPC_ERR_NONE;
+jesenrpc_err_t jesenrpc_client_init(jesenrpc_client_t *client,
+                                    size_t expected_in_flight) {
+  if (!client) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(client, 0, sizeof(*client));
+  client->free_call = JRPC_CLIENT_NO_CALL;
+  client->next_id = 1;
 
-  jesenrpc_response_t **items =
-      (jesenrpc_response_t **)calloc(count, sizeof(*items));
-  if (!items) {
+  client->timer_heads =
+      (uint32_t *)jrpc_malloc(JRPC_WHEEL_HEADS * sizeof(*client->timer_heads));
+  if (!client->timer_heads) {
     return JESENRPC_ERR_ALLOC;
   }
+  for (size_t i = 0; i < JRPC_WHEEL_HEADS; ++i) {
+    client->timer_heads[i] = JRPC_CLIENT_NO_CALL;
+  }
 
-  for (size_t i = 0; i < count; ++i) {
-    jesen_node_t *elem = NULL;
-    err = jesen_array_get_value(root, (uint32_t)i, &elem);
-    if (err != JESEN_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        jesenrpc_response_destroy(items[j]);
-      }
-      free(items);
+  size_t calls = expected_in_flight > 8 ? expected_in_flight : 8;
+  jesenrpc_err_t err = jrpc_client_grow_calls(client, calls);
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_client_resize_slots(client,
+                                   jrpc_client_slots_for(expected_in_flight));
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    jesenrpc_client_destroy(client);
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_client_next_id(jesenrpc_client_t *client,
+                                       jesenrpc_id_t *out_id) {
+  if (!client || !out_id) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  out_id->kind = JESENRPC_ID_NUMBER;
+  out_id->value.number = client->next_id++;
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_client_insert(jesenrpc_client_t *client,
+                                         const jesenrpc_id_t *id,
+                                         jesenrpc_response_callback_t callback,
+                                         void *user_data, uint32_t *out_index) {
+  if (!client || !client->slots || !id || !callback ||
+      !jrpc_client_id_usable(id)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jesenrpc_err_t err;
+  if (client->pending + 1 > (client->slot_mask + 1) / 2) {
+    err = jrpc_client_resize_slots(client, (client->slot_mask + 1) * 2);
+    if (err != JESENRPC_ERR_NONE) {
       return err;
     }
-    jesenrpc_response_t *resp = NULL;
-    err = jrpc_parse_response_node(elem, &resp);
+  }
+  uint64_t hash = jrpc_client_hash_id(id);
+  size_t pos = 0;
+  if (jrpc_client_find(client, id, hash, &pos)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (client->free_call == JRPC_CLIENT_NO_CALL) {
+    err = jrpc_client_grow_calls(client, client->call_capacity * 2);
     if (err != JESENRPC_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        jesenrpc_response_destroy(items[j]);
-      }
-      free(items);
       return err;
     }
-    items[i] = resp;
   }
 
-  out->items = items;
-  out->count = count;
+  uint32_t index = client->free_call;
+  struct jesenrpc_client_call *call = &client->calls[index];
+  client->free_call = call->next_free;
+  call->id = *id;
+  call->hash = hash;
+  call->callback = callback;
+  call->user_data = user_data;
+  call->timer_head = JRPC_CLIENT_NO_CALL;
+  client->slots[pos] = jrpc_client_pack_slot(hash, index);
+  ++client->pending;
+  *out_index = index;
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t
-jesenrpc_request_batch_serialize(jesenrpc_request_t *const *requests,
-                                 size_t request_count, char *out_buf,
-                                 size_t out_buf_len) {
-  if (!requests || (request_count > 0 && !out_buf)) {
-    return JESENRPC_ERR_INVALID_ARGS;
-  }
+jesenrpc_err_t jesenrpc_client_track(jesenrpc_client_t *client,
+                                     const jesenrpc_id_t *id,
+                                     jesenrpc_response_callback_t callback,
+                                     void *user_data) {
+  uint32_t index = 0;
+  return jrpc_client_insert(client, id, callback, user_data, &index);
+}
 
-  jesen_node_t *array = NULL;
-  jesen_err_t err = jesen_array_create(&array);
-  if (err != JESEN_ERR_NONE) {
+jesenrpc_err_t jesenrpc_client_track_timeout(
+    jesenrpc_client_t *client, const jesenrpc_id_t *id, uint64_t timeout,
+    jesenrpc_response_callback_t callback, void *user_data) {
+  uint32_t index = 0;
+  jesenrpc_err_t err =
+      jrpc_client_insert(client, id, callback, user_data, &index);
+  if (err != JESENRPC_ERR_NONE) {
     return err;
   }
-
-  for (size_t i = 0; i < request_count; ++i) {
-    jesen_node_t *node = NULL;
-    err = jrpc_build_request_node(requests[i], &node);
-    if (err != JESENRPC_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        if (requests[j] && requests[j]->params) {
-          jesen_node_detach(requests[j]->params);
-        }
-      }
-      jesen_destroy(array);
-      return err;
-    }
-    err = jesen_node_assign_to(array, "", node);
-    if (err != JESEN_ERR_NONE) {
-      if (requests[i] && requests[i]->params) {
-        jesen_node_detach(requests[i]->params);
-      }
-      jesen_destroy(node);
-      for (size_t j = 0; j < i; ++j) {
-        if (requests[j] && requests[j]->params) {
-          jesen_node_detach(requests[j]->params);
-        }
-      }
-      jesen_destroy(array);
-      return err;
-    }
+  /* The current tick's slot has already been processed. */
+  if (timeout == 0) {
+    timeout = 1;
   }
+  struct jesenrpc_client_call *call = &client->calls[index];
+  call->deadline =
+      timeout > UINT64_MAX - client->now ? UINT64_MAX : client->now + timeout;
+  jrpc_timer_link(client, index);
+  ++client->timers;
+  return JESENRPC_ERR_NONE;
+}
 
-  jesenrpc_err_t rpc_err = jrpc_serialize_node(array, out_buf, out_buf_len);
-  for (size_t i = 0; i < request_count; ++i) {
-    if (requests[i] && requests[i]->params) {
-      jesen_node_detach(requests[i]->params);
-    }
+/* Unlinks the call at a slot position and returns its record to the pool.
+ * The record's callback fields stay readable until the next track(). */
+static struct jesenrpc_client_call *
+jrpc_client_release(jesenrpc_client_t *client, size_t pos) {
+  uint32_t index = jrpc_client_slot_call(client->slots[pos]);
+  jrpc_client_erase_slot(client, pos);
+  struct jesenrpc_client_call *call = &client->calls[index];
+  if (call->timer_head != JRPC_CLIENT_NO_CALL) {
+    jrpc_timer_unlink(client, index);
+    --client->timers;
+  }
+  call->next_free = client->free_call;
+  client->free_call = index;
+  --client->pending;
+  return call;
+}
+
+static struct jesenrpc_client_call *
+jrpc_client_take(jesenrpc_client_t *client, const jesenrpc_id_t *id) {
+  if (!jrpc_client_id_usable(id)) {
+    return NULL;
+  }
+  size_t pos = 0;
+  if (!jrpc_client_find(client, id, jrpc_client_hash_id(id), &pos)) {
+    return NULL;
   }
-  jesen_destroy(array);
-  return rpc_err;
+  return jrpc_client_release(client, pos);
 }
 
-jesenrpc_err_t
-jesenrpc_response_batch_serialize(jesenrpc_response_t *const *responses,
-                                  size_t response_count, char *out_buf,
-                                  size_t out_buf_len) {
-  if (!responses || (response_count > 0 && !out_buf)) {
+jesenrpc_err_t jesenrpc_client_cancel(jesenrpc_client_t *client,
+                                      const jesenrpc_id_t *id) {
+  if (!client || !client->slots || !id) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  return jrpc_client_take(client, id) ? JESENRPC_ERR_NONE
+                                      : JESENRPC_ERR_VALIDATION;
+}
 
-  jesen_node_t *array = NULL;
-  jesen_err_t err = jesen_array_create(&array);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+jesenrpc_err_t jesenrpc_client_complete(jesenrpc_client_t *client,
+                                        const jesenrpc_response_t *response) {
+  if (!client || !client->slots || !response) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  struct jesenrpc_client_call *call = jrpc_client_take(client, &response->id);
+  if (!call) {
+    return JESENRPC_ERR_VALIDATION;
   }
+  /* Copy first: the callback may track calls that reuse the record. */
+  jesenrpc_response_callback_t callback = call->callback;
+  void *user_data = call->user_data;
+  callback(response, user_data);
+  return JESENRPC_ERR_NONE;
+}
 
-  for (size_t i = 0; i < response_count; ++i) {
-    jesen_node_t *node = NULL;
-    err = jrpc_build_response_node(responses[i], &node);
-    if (err != JESENRPC_ERR_NONE) {
-      for (size_t j = 0; j < i; ++j) {
-        if (!responses[j]) {
-          continue;
-        }
-        if (responses[j]->result) {
-          jesen_node_detach(responses[j]->result);
-        } else if (responses[j]->error && responses[j]->error->data) {
-          jesen_node_detach(responses[j]->error->data);
-        }
-      }
-      jesen_destroy(array);
-      return err;
-    }
-    err = jesen_node_assign_to(array, "", node);
-    if (err != JESEN_ERR_NONE) {
-      if (responses[i]) {
-        if (responses[i]->result) {
-          jesen_node_detach(responses[i]->result);
-        } else if (responses[i]->error && responses[i]->error->data) {
-          jesen_node_detach(responses[i]->error->data);
-        }
-      }
-      jesen_destroy(node);
-      for (size_t j = 0; j < i; ++j) {
-        if (!responses[j]) {
-          continue;
-        }
-        if (responses[j]->result) {
-          jesen_node_detach(responses[j]->result);
-        } else if (responses[j]->error && responses[j]->error->data) {
-          jesen_node_detach(responses[j]->error->data);
-        }
-      }
-      jesen_destroy(array);
+jesenrpc_err_t
+jesenrpc_client_complete_batch(jesenrpc_client_t *client,
+                               const jesenrpc_response_batch_t *batch,
+                               size_t *out_unmatched) {
+  if (!client || !batch || (!batch->items && batch->count > 0)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  size_t unmatched = 0;
+  for (size_t i = 0; i < batch->count; ++i) {
+    jesenrpc_err_t err = jesenrpc_client_complete(client, batch->items[i]);
+    if (err == JESENRPC_ERR_VALIDATION) {
+      ++unmatched;
+    } else if (err != JESENRPC_ERR_NONE) {
       return err;
     }
   }
+  if (out_unmatched) {
+    *out_unmatched = unmatched;
+  }
+  return JESENRPC_ERR_NONE;
+}
 
-  jesenrpc_err_t rpc_err = jrpc_serialize_node(array, out_buf, out_buf_len);
-  for (size_t i = 0; i < response_count; ++i) {
-    if (!responses[i]) {
-      continue;
-    }
-    if (responses[i]->result) {
-      jesen_node_detach(responses[i]->result);
-    } else if (responses[i]->error && responses[i]->error->data) {
-      jesen_node_detach(responses[i]->error->data);
-    }
+static void jrpc_client_expire(jesenrpc_client_t *client, uint32_t index) {
+  struct jesenrpc_client_call *call = &client->calls[index];
+  size_t pos = 0;
+  if (!jrpc_client_find(client, &call->id, call->hash, &pos)) {
+    jrpc_timer_unlink(client, index); /* Unreachable; keeps advance going. */
+    --client->timers;
+    return;
   }
-  jesen_destroy(array);
-  return rpc_err;
+  call = jrpc_client_release(client, pos);
+
+  static char timeout_message[] = "Request timed out";
+  jesenrpc_error_object_t error;
+  memset(&error, 0, sizeof(error));
+  error.code = JESENRPC_JSONRPC_ERROR_INTERNAL;
+  error.message = timeout_message;
+  error.borrowed = true;
+  jesenrpc_response_t response;
+  memset(&response, 0, sizeof(response));
+  response.jsonrpc = JESENRPC_JSONRPC_VERSION;
+  response.id = call->id;
+  response.error = &error;
+
+  jesenrpc_response_callback_t callback = call->callback;
+  void *user_data = call->user_data;
+  callback(&response, user_data);
 }
 
-jesenrpc_err_t jesenrpc_request_batch_parse(char *buf, size_t buf_len,
-                                            jesenrpc_request_batch_t *out) {
-  if (!buf || !out) {
+jesenrpc_err_t jesenrpc_client_advance(jesenrpc_client_t *client,
+                                       uint64_t now, size_t *out_expired) {
+  if (!client || !client->timer_heads) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  out->items = NULL;
-  out->count = 0;
-
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  size_t expired = 0;
+  while (client->now < now) {
+    if (client->timers == 0) {
+      client->now = now;
+      break;
+    }
+    uint64_t tick = ++client->now;
+    /* Cascade from the top so timers can fall through several levels in
+     * one tick, before the level 0 slot for this tick is expired. */
+    unsigned aligned = 0;
+    while (aligned < JRPC_WHEEL_LEVELS &&
+           (tick & (((uint64_t)1 << ((aligned + 1) * JRPC_WHEEL_BITS)) - 1)) ==
+               0) {
+      ++aligned;
+    }
+    if (aligned == JRPC_WHEEL_LEVELS) {
+      jrpc_timer_cascade(client, JRPC_WHEEL_OVERFLOW);
+    }
+    for (unsigned level = aligned; level > 0; --level) {
+      if (level == JRPC_WHEEL_LEVELS) {
+        continue;
+      }
+      uint32_t slot = (uint32_t)(tick >> (level * JRPC_WHEEL_BITS)) &
+                      (JRPC_WHEEL_SLOTS - 1);
+      jrpc_timer_cascade(client, level * JRPC_WHEEL_SLOTS + slot);
+    }
+    /* Callbacks may track or cancel calls; new deadlines are always after
+     * this tick, so they never land in the slot being drained. */
+    uint32_t head = (uint32_t)tick & (JRPC_WHEEL_SLOTS - 1);
+    while (client->timer_heads[head] != JRPC_CLIENT_NO_CALL) {
+      jrpc_client_expire(client, client->timer_heads[head]);
+      ++expired;
+    }
   }
-
-  err = jrpc_parse_request_batch_from_node(root, out);
-  jesen_destroy(root);
-  return err;
+  if (out_expired) {
+    *out_expired = expired;
+  }
+  return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_response_batch_parse(char *buf, size_t buf_len,
-                                             jesenrpc_response_batch_t *out) {
-  if (!buf || !out) {
+jesenrpc_err_t jesenrpc_client_destroy(jesenrpc_client_t *client) {
+  if (!client) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  jrpc_free(client->calls);
+  jrpc_free(client->slots);
+  jrpc_free(client->timer_heads);
+  memset(client, 0, sizeof(*client));
+  client->free_call = JRPC_CLIENT_NO_CALL;
+  return JESENRPC_ERR_NONE;
+}
 
-  out->items = NULL;
-  out->count = 0;
+/* Statistics */
 
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
-  }
+#define JRPC_STATS_COUNTERS (sizeof(jesenrpc_stats_t) / sizeof(uint64_t))
 
-  err = jrpc_parse_response_batch_from_node(root, out);
-  jesen_destroy(root);
-  return err;
+jesenrpc_err_t jesenrpc_stats_enable(bool enabled) {
+#ifdef JESENRPC_ENABLE_STATS
+  __atomic_store_n(&jrpc_stats_on, enabled ? 1 : 0, __ATOMIC_RELAXED);
+  return JESENRPC_ERR_NONE;
+#else
+  (void)enabled;
+  return JESENRPC_ERR_INVALID_ARGS;
+#endif
 }
 
-jesenrpc_err_t jesenrpc_request_batch_destroy(jesenrpc_request_batch_t *batch) {
-  if (!batch) {
+jesenrpc_err_t jesenrpc_stats_snapshot(jesenrpc_stats_t *out) {
+  if (!out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (batch->items) {
-    for (size_t i = 0; i < batch->count; ++i) {
-      jesenrpc_request_destroy(batch->items[i]);
+  memset(out, 0, sizeof(*out));
+#ifdef JESENRPC_ENABLE_STATS
+  uint64_t *total = (uint64_t *)(void *)out;
+  for (jrpc_stats_block_t *block =
+           __atomic_load_n(&jrpc_stats_blocks, __ATOMIC_ACQUIRE);
+       block; block = block->next) {
+    uint64_t *counters = (uint64_t *)(void *)&block->stats;
+    for (size_t i = 0; i < JRPC_STATS_COUNTERS; ++i) {
+      total[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
     }
-    free(batch->items);
   }
-  batch->items = NULL;
-  batch->count = 0;
+#endif
   return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t
-jesenrpc_response_batch_destroy(jesenrpc_response_batch_t *batch) {
-  if (!batch) {
+jesenrpc_err_t jesenrpc_stats_thread_snapshot(jesenrpc_stats_t *out) {
+  if (!out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (batch->items) {
-    for (size_t i = 0; i < batch->count; ++i) {
-      jesenrpc_response_destroy(batch->items[i]);
-    }
-    free(batch->items);
+  memset(out, 0, sizeof(*out));
+#ifdef JESENRPC_ENABLE_STATS
+  if (jrpc_stats_mine) {
+    *out = jrpc_stats_mine->stats;
   }
-  batch->items = NULL;
-  batch->count = 0;
+#endif
   return JESENRPC_ERR_NONE;
 }
 
-static jesenrpc_err_t
-jrpc_detect_message_kind_from_object(jesen_node_t *object, bool in_batch,
-                                     jesenrpc_message_kind_t *out_kind) {
-  if (!object || !out_kind) {
+jesenrpc_err_t jesenrpc_stats_merge(jesenrpc_stats_t *total,
+                                    const jesenrpc_stats_t *stats) {
+  if (!total || !stats) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  uint64_t *dst = (uint64_t *)(void *)total;
+  const uint64_t *src = (const uint64_t *)(const void *)stats;
+  for (size_t i = 0; i < JRPC_STATS_COUNTERS; ++i) {
+    dst[i] += src[i];
+  }
+  return JESENRPC_ERR_NONE;
+}
 
-  bool is_object = false;
-  jesen_err_t err = jesen_value_is_object(object, &is_object);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+jesenrpc_err_t jesenrpc_stats_diff(const jesenrpc_stats_t *later,
+                                   const jesenrpc_stats_t *earlier,
+                                   jesenrpc_stats_t *out) {
+  if (!later || !earlier || !out) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-  if (!is_object) {
-    return JESENRPC_ERR_VALIDATION;
+  const uint64_t *a = (const uint64_t *)(const void *)later;
+  const uint64_t *b = (const uint64_t *)(const void *)earlier;
+  uint64_t *dst = (uint64_t *)(void *)out;
+  for (size_t i = 0; i < JRPC_STATS_COUNTERS; ++i) {
+    dst[i] = a[i] - b[i];
   }
+  return JESENRPC_ERR_NONE;
+}
 
-  jesen_node_t *method_node = NULL;
-  err = jesen_node_find(object, "method", &method_node);
-  bool has_method = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    return err;
-  }
+/* Latency histograms */
 
-  jesen_node_t *result_node = NULL;
-  err = jesen_node_find(object, "result", &result_node);
-  bool has_result = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    return err;
+static size_t jrpc_histogram_index(uint64_t value) {
+  const uint64_t sub = (uint64_t)1 << JESENRPC_HISTOGRAM_SUB_BITS;
+  if (value < sub) {
+    return (size_t)value;
   }
-
-  jesen_node_t *error_node = NULL;
-  err = jesen_node_find(object, "error", &error_node);
-  bool has_error = err == JESEN_ERR_NONE;
-  if (err != JESEN_ERR_NONE && err != JESEN_ERR_NOT_FOUND) {
-    return err;
+  if (value >> JESENRPC_HISTOGRAM_MAX_BITS) {
+    value = ((uint64_t)1 << JESENRPC_HISTOGRAM_MAX_BITS) - 1;
   }
-
-  if (has_method) {
-    if (has_result || has_error) {
-      return JESENRPC_ERR_VALIDATION;
-    }
-    *out_kind = in_batch ? JESENRPC_MESSAGE_REQUEST_BATCH
-                         : JESENRPC_MESSAGE_REQUEST_SINGLE;
-    return JESENRPC_ERR_NONE;
+#if defined(__GNUC__)
+  unsigned top = 63u - (unsigned)__builtin_clzll(value);
+#else
+  unsigned top = JESENRPC_HISTOGRAM_SUB_BITS;
+  while (value >> (top + 1)) {
+    ++top;
   }
+#endif
+  unsigned shift = top - JESENRPC_HISTOGRAM_SUB_BITS;
+  return ((size_t)(shift + 1) << JESENRPC_HISTOGRAM_SUB_BITS) +
+         (size_t)((value >> shift) & (sub - 1));
+}
 
-  if (has_result || has_error) {
-    *out_kind = in_batch ? JESENRPC_MESSAGE_RESPONSE_BATCH
-                         : JESENRPC_MESSAGE_RESPONSE_SINGLE;
-    return JESENRPC_ERR_NONE;
+/* The largest value that lands in a bucket. */
+static uint64_t jrpc_histogram_highest(size_t index) {
+  const size_t sub = (size_t)1 << JESENRPC_HISTOGRAM_SUB_BITS;
+  if (index < sub) {
+    return index;
   }
-
-  return JESENRPC_ERR_VALIDATION;
+  unsigned shift = (unsigned)(index >> JESENRPC_HISTOGRAM_SUB_BITS) - 1;
+  uint64_t low = (uint64_t)(sub + (index & (sub - 1))) << shift;
+  return low + ((uint64_t)1 << shift) - 1;
 }
 
-static jesenrpc_err_t
-jrpc_detect_message_kind_from_node(jesen_node_t *root,
-                                   jesenrpc_message_kind_t *out_kind) {
-  if (!root || !out_kind) {
+jesenrpc_err_t jesenrpc_histogram_reset(jesenrpc_histogram_t *histogram) {
+  if (!histogram) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(histogram, 0, sizeof(*histogram));
+  return JESENRPC_ERR_NONE;
+}
 
-  bool is_array = false;
-  jesen_err_t err = jesen_value_is_array(root, &is_array);
-  if (err != JESEN_ERR_NONE) {
-    return err;
+jesenrpc_err_t jesenrpc_histogram_record(jesenrpc_histogram_t *histogram,
+                                         uint64_t value) {
+  if (!histogram) {
+    return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  if (is_array) {
-    size_t count = 0;
-    err = jesen_array_size(root, &count);
-    if (err != JESEN_ERR_NONE) {
-      return err;
-    }
-    if (count == 0) {
-      return JESENRPC_ERR_VALIDATION;
-    }
-    jesen_node_t *first = NULL;
-    err = jesen_array_get_value(root, 0, &first);
-    if (err != JESEN_ERR_NONE) {
-      return err;
-    }
-    return jrpc_detect_message_kind_from_object(first, true, out_kind);
+  if (histogram->count == 0 || value < histogram->min) {
+    histogram->min = value;
   }
-
-  return jrpc_detect_message_kind_from_object(root, false, out_kind);
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+  ++histogram->buckets[jrpc_histogram_index(value)];
+  histogram->sum += value;
+  ++histogram->count;
+  return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_message_peek_kind(char *buf, size_t buf_len,
-                                          jesenrpc_message_kind_t *kind) {
-  if (!buf || !kind) {
+jesenrpc_err_t jesenrpc_histogram_merge(jesenrpc_histogram_t *total,
+                                        const jesenrpc_histogram_t *histogram) {
+  if (!total || !histogram) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
-
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
+  if (histogram->count == 0) {
+    return JESENRPC_ERR_NONE;
   }
-
-  err = jrpc_detect_message_kind_from_node(root, kind);
-  jesen_destroy(root);
-  return err;
+  if (total->count == 0 || histogram->min < total->min) {
+    total->min = histogram->min;
+  }
+  if (histogram->max > total->max) {
+    total->max = histogram->max;
+  }
+  for (size_t i = 0; i < JESENRPC_HISTOGRAM_BUCKETS; ++i) {
+    total->buckets[i] += histogram->buckets[i];
+  }
+  total->sum += histogram->sum;
+  total->count += histogram->count;
+  return JESENRPC_ERR_NONE;
 }
 
-jesenrpc_err_t jesenrpc_message_parse(char *buf, size_t buf_len,
-                                      jesenrpc_message_t *out) {
-  if (!buf || !out) {
+jesenrpc_err_t
+jesenrpc_histogram_percentile(const jesenrpc_histogram_t *histogram,
+                              double percentile, uint64_t *out_value) {
+  if (!histogram || !out_value ||
+      !(percentile >= 0.0 && percentile <= 100.0)) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  *out_value = 0;
+  if (histogram->count == 0) {
+    return JESENRPC_ERR_NONE;
+  }
+  /* The rank of the value, rounded up and at least 1. */
+  double target = percentile / 100.0 * (double)histogram->count;
+  uint64_t rank = (uint64_t)target;
+  if ((double)rank < target || rank == 0) {
+    ++rank;
+  }
+  uint64_t seen = 0;
+  size_t i = 0;
+  for (; i + 1 < JESENRPC_HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  /* The top bucket also holds every larger value. */
+  uint64_t highest = jrpc_histogram_highest(i);
+  *out_value = i + 1 < JESENRPC_HISTOGRAM_BUCKETS && highest < histogram->max
+                   ? highest
+                   : histogram->max;
+  return JESENRPC_ERR_NONE;
+}
 
-  memset(out, 0, sizeof(*out));
-  out->kind = JESENRPC_MESSAGE_UNKNOWN;
+jesenrpc_err_t jesenrpc_latency_enable(bool enabled) {
+#ifdef JESENRPC_ENABLE_STATS
+  __atomic_store_n(&jrpc_latency_on, enabled ? 1 : 0, __ATOMIC_RELAXED);
+  return JESENRPC_ERR_NONE;
+#else
+  (void)enabled;
+  return JESENRPC_ERR_INVALID_ARGS;
+#endif
+}
 
-  jesen_node_t *root = NULL;
-  jesenrpc_err_t err = jrpc_parse_buffer_as_node(buf, buf_len, &root);
-  if (err != JESENRPC_ERR_NONE) {
-    return err;
-  }
+#ifdef JESENRPC_ENABLE_STATS
+static bool jrpc_latency_named(const jrpc_latency_entry_t *entry,
+                               const char *method) {
+  return !method ||
+         strncmp(entry->name, method, JRPC_LATENCY_NAME_MAX - 1) == 0;
+}
 
-  jesenrpc_message_kind_t kind = JESENRPC_MESSAGE_UNKNOWN;
-  err = jrpc_detect_message_kind_from_node(root, &kind);
-  if (err != JESENRPC_ERR_NONE) {
-    jesen_destroy(root);
-    return err;
+/* Adds a histogram that its owner may be updating. */
+static void jrpc_latency_merge_live(jesenrpc_histogram_t *total,
+                                    const jesenrpc_histogram_t *h) {
+  jesenrpc_histogram_t copy;
+  copy.count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  copy.sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+  copy.min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+  copy.max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < JESENRPC_HISTOGRAM_BUCKETS; ++i) {
+    copy.buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+  }
+  jesenrpc_histogram_merge(total, &copy);
+}
+
+/* Calls fn on each latency entry of every thread, stopping when it returns
+ * false. */
+static void jrpc_latency_each(bool (*fn)(const jrpc_latency_entry_t *,
+                                         void *),
+                              void *user_data) {
+  for (jrpc_stats_block_t *block =
+           __atomic_load_n(&jrpc_stats_blocks, __ATOMIC_ACQUIRE);
+       block; block = block->next) {
+    if (!fn(&block->none, user_data)) {
+      return;
+    }
+    for (size_t i = 0; i < JRPC_LATENCY_METHODS; ++i) {
+      const jrpc_latency_entry_t *entry =
+          __atomic_load_n(&block->methods[i], __ATOMIC_ACQUIRE);
+      if (entry && !fn(entry, user_data)) {
+        return;
+      }
+    }
   }
+}
 
-  switch (kind) {
-  case JESENRPC_MESSAGE_REQUEST_SINGLE:
-    err = jrpc_parse_request_node(root, &out->as.request);
-    break;
-  case JESENRPC_MESSAGE_REQUEST_BATCH:
-    err = jrpc_parse_request_batch_from_node(root, &out->as.request_batch);
-    break;
-  case JESENRPC_MESSAGE_RESPONSE_SINGLE:
-    err = jrpc_parse_response_node(root, &out->as.response);
-    break;
-  case JESENRPC_MESSAGE_RESPONSE_BATCH:
-    err = jrpc_parse_response_batch_from_node(root, &out->as.response_batch);
-    break;
-  default:
-    err = JESENRPC_ERR_VALIDATION;
-    break;
+typedef struct {
+  jesenrpc_latency_stage_t stage;
+  const char *method;
+  jesenrpc_histogram_t *out;
+} jrpc_latency_gather_t;
+
+static bool jrpc_latency_gather(const jrpc_latency_entry_t *entry,
+                                void *user_data) {
+  jrpc_latency_gather_t *gather = (jrpc_latency_gather_t *)user_data;
+  if (jrpc_latency_named(entry, gather->method)) {
+    jrpc_latency_merge_live(gather->out, &entry->stages[gather->stage]);
   }
+  return true;
+}
 
-  jesen_destroy(root);
-  if (err != JESENRPC_ERR_NONE) {
-    memset(out, 0, sizeof(*out));
-    out->kind = JESENRPC_MESSAGE_UNKNOWN;
-    return err;
+typedef struct {
+  const jrpc_latency_entry_t *entry;
+  bool first;
+} jrpc_latency_first_t;
+
+/* Finds whether an entry is the first one with its name. */
+static bool jrpc_latency_find_first(const jrpc_latency_entry_t *entry,
+                                    void *user_data) {
+  jrpc_latency_first_t *first = (jrpc_latency_first_t *)user_data;
+  if (entry == first->entry) {
+    first->first = true;
+    return false;
   }
+  return !jrpc_latency_named(entry, first->entry->name);
+}
 
-  out->kind = kind;
-  return JESENRPC_ERR_NONE;
+typedef struct {
+  jrpc_writer_t *w;
+  jesenrpc_latency_stage_t stage;
+  bool comma;
+} jrpc_latency_export_t;
+
+static bool jrpc_latency_export_entry(const jrpc_latency_entry_t *entry,
+                                      void *user_data) {
+  jrpc_latency_export_t *state = (jrpc_latency_export_t *)user_data;
+  jrpc_latency_first_t first = {entry, false};
+  jrpc_latency_each(jrpc_latency_find_first, &first);
+  if (!first.first) {
+    return true;
+  }
+  jesenrpc_histogram_t h;
+  memset(&h, 0, sizeof(h));
+  jrpc_latency_gather_t gather = {state->stage, entry->name, &h};
+  jrpc_latency_each(jrpc_latency_gather, &gather);
+  if (h.count == 0) {
+    return true;
+  }
+
+  static const struct {
+    const char *key;
+    double percentile;
+  } points[] = {{",\"p50\":", 50.0},
+                {",\"p90\":", 90.0},
+                {",\"p99\":", 99.0},
+                {",\"p999\":", 99.9}};
+  jrpc_writer_t *w = state->w;
+  if (state->comma) {
+    jrpc_writer_append_char(w, ',');
+  }
+  state->comma = true;
+  jrpc_writer_append_string(w, entry->name, strlen(entry->name));
+  JRPC_WRITER_APPEND_LITERAL(w, ":{\"count\":");
+  jrpc_writer_append_int64(w, (int64_t)h.count);
+  JRPC_WRITER_APPEND_LITERAL(w, ",\"min\":");
+  jrpc_writer_append_int64(w, (int64_t)h.min);
+  JRPC_WRITER_APPEND_LITERAL(w, ",\"mean\":");
+  jrpc_writer_append_int64(w, (int64_t)(h.sum / h.count));
+  for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); ++i) {
+    uint64_t value = 0;
+    jesenrpc_histogram_percentile(&h, points[i].percentile, &value);
+    jrpc_writer_append(w, points[i].key, strlen(points[i].key));
+    jrpc_writer_append_int64(w, (int64_t)value);
+  }
+  JRPC_WRITER_APPEND_LITERAL(w, ",\"max\":");
+  jrpc_writer_append_int64(w, (int64_t)h.max);
+  jrpc_writer_append_char(w, '}');
+  return true;
 }
+#endif
 
-jesenrpc_err_t jesenrpc_message_destroy(jesenrpc_message_t *message) {
-  if (!message) {
+jesenrpc_err_t jesenrpc_latency_snapshot(jesenrpc_latency_stage_t stage,
+                                         const char *method_name,
+                                         jesenrpc_histogram_t *out) {
+  if (!out || (unsigned)stage >= JESENRPC_LATENCY_STAGES) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  memset(out, 0, sizeof(*out));
+#ifdef JESENRPC_ENABLE_STATS
+  jrpc_latency_gather_t gather = {stage, method_name, out};
+  jrpc_latency_each(jrpc_latency_gather, &gather);
+#else
+  (void)method_name;
+#endif
+  return JESENRPC_ERR_NONE;
+}
 
-  jesenrpc_err_t err = JESENRPC_ERR_NONE;
-  switch (message->kind) {
-  case JESENRPC_MESSAGE_REQUEST_SINGLE:
-    err = jesenrpc_request_destroy(message->as.request);
-    break;
-  case JESENRPC_MESSAGE_REQUEST_BATCH:
-    err = jesenrpc_request_batch_destroy(&message->as.request_batch);
-    break;
-  case JESENRPC_MESSAGE_RESPONSE_SINGLE:
-    err = jesenrpc_response_destroy(message->as.response);
-    break;
-  case JESENRPC_MESSAGE_RESPONSE_BATCH:
-    err = jesenrpc_response_batch_destroy(&message->as.response_batch);
-    break;
-  default:
+jesenrpc_err_t jesenrpc_latency_export(jesenrpc_buf_t *out) {
+  if (!out) {
     return JESENRPC_ERR_INVALID_ARGS;
   }
+  static const char *const stage_keys[JESENRPC_LATENCY_STAGES] = {
+      "{\"parse\":{", "},\"dispatch\":{", "},\"serialize\":{"};
+  size_t start_len = out->len;
+  jrpc_writer_t w;
+  jrpc_writer_init_buf(&w, out);
+  for (size_t stage = 0; stage < JESENRPC_LATENCY_STAGES; ++stage) {
+    jrpc_writer_append(&w, stage_keys[stage], strlen(stage_keys[stage]));
+#ifdef JESENRPC_ENABLE_STATS
+    jrpc_latency_export_t state = {&w, (jesenrpc_latency_stage_t)stage,
+                                   false};
+    jrpc_latency_each(jrpc_latency_export_entry, &state);
+#endif
+  }
+  JRPC_WRITER_APPEND_LITERAL(&w, "}}");
+  return jrpc_writer_complete_buf(&w, JESENRPC_ERR_NONE, start_len);
+}
 
-  if (err == JESENRPC_ERR_NONE) {
-    memset(message, 0, sizeof(*message));
-    message->kind = JESENRPC_MESSAGE_UNKNOWN;
-  }
+/* Hooks */
 
-  return err;
+jesenrpc_err_t jesenrpc_set_hooks(const jesenrpc_hooks_t *hooks) {
+#ifdef JESENRPC_ENABLE_HOOKS
+  jrpc_hooks = hooks;
+  return JESENRPC_ERR_NONE;
+#else
+  (void)hooks;
+  return JESENRPC_ERR_INVALID_ARGS;
+#endif
 }
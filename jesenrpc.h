@@ -50,6 +50,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #include "jesen.h"
 
 // clang-format off
@@ -117,6 +121,15 @@ typedef int32_t jesenrpc_err_t;
 /** Memory allocation failed. */
 #define JESENRPC_ERR_ALLOC (JESENRPC_ERR_BASE + 3)
 
+/** Output buffer too small; the required length is reported separately. */
+#define JESENRPC_ERR_BUFFER_TOO_SMALL (JESENRPC_ERR_BASE + 4)
+
+/** Input is not well-formed JSON. */
+#define JESENRPC_ERR_PARSE (JESENRPC_ERR_BASE + 5)
+
+/** A system call failed; errno holds the cause. Used by jesenrpc_server. */
+#define JESENRPC_ERR_IO (JESENRPC_ERR_BASE + 6)
+
 /** @} */
 
 /**
@@ -153,6 +166,75 @@ typedef int32_t jesenrpc_err_t;
  * @{
  */
 
+/**
+ * @brief Memory allocator used for jesenrpc's own allocations.
+ *
+ * Installed globally with jesenrpc_set_allocator(), or given to a single
+ * arena or output buffer. Allocations made by jesen for params, result and
+ * data trees are not covered.
+ */
+typedef struct jesenrpc_allocator {
+  /** Allocates size bytes, suitably aligned for any type. */
+  void *(*malloc_fn)(size_t size, void *context);
+  /** Resizes an allocation like realloc(). ptr may be NULL. */
+  void *(*realloc_fn)(void *ptr, size_t size, void *context);
+  /** Frees an allocation. Never called with NULL. */
+  void (*free_fn)(void *ptr, void *context);
+  void *context; /**< Passed to every call. */
+} jesenrpc_allocator_t;
+
+/**
+ * @brief Bump allocator for parsed messages.
+ *
+ * Structures parsed with an arena (see jesenrpc_parse_options_t) are carved out
+ * of a few large blocks and released together by jesenrpc_arena_reset(),
+ * including their params/result/data trees. Calling the matching *_destroy()
+ * function on such a structure is a no-op. Reset keeps one block, so a warm
+ * arena parses subsequent messages without allocating for jesenrpc's own
+ * structures. Fields are internal; use jesenrpc_arena_init().
+ */
+typedef struct jesenrpc_arena {
+  struct jesenrpc_arena_block *blocks;     /**< Internal: block list. */
+  struct jesenrpc_arena_cleanup *cleanups; /**< Internal: deferred releases. */
+  size_t block_size; /**< Size of newly allocated blocks. */
+  /** Source of blocks, or NULL for the global allocator. */
+  const jesenrpc_allocator_t *allocator;
+} jesenrpc_arena_t;
+
+/**
+ * @brief Parse flag: decode the envelope in place instead of copying strings.
+ *
+ * Method names, string IDs and error messages are unescaped inside the input
+ * buffer and NUL-terminated there, so the parsed structures point into the
+ * buffer and the buffer is modified. Keep it alive and unchanged for as long
+ * as the parsed message is used. Only params, result and error data are still
+ * built as jesen trees.
+ */
+#define JESENRPC_PARSE_IN_SITU (1u << 0)
+
+/**
+ * @brief Parse flag: keep request params as unparsed JSON text.
+ *
+ * Parsed requests leave params NULL and record the params bytes in
+ * raw_params instead, pointing into the input buffer. The bytes are checked
+ * to be a well-formed array or object but no jesen tree is built until
+ * jesenrpc_request_get_params() is called, so handlers that ignore or forward
+ * params skip that cost. Keep the buffer alive and unchanged for as long as
+ * the request is used.
+ */
+#define JESENRPC_PARSE_LAZY_PARAMS (1u << 1)
+
+/**
+ * @brief Optional settings for the *_parse_ex() functions.
+ *
+ * Zero-initialize and set only the fields you need. Passing NULL options is
+ * equivalent to the plain parse functions.
+ */
+typedef struct jesenrpc_parse_options {
+  jesenrpc_arena_t *arena; /**< Allocate parsed structures here. May be NULL. */
+  uint32_t flags;          /**< Bitwise OR of JESENRPC_PARSE_* flags. */
+} jesenrpc_parse_options_t;
+
 /**
  * @brief Represents the type of a JSON-RPC request/response ID.
  *
@@ -176,12 +258,21 @@ typedef struct jesenrpc_id {
   union {
     int64_t number; /**< Integer ID value (when kind == JESENRPC_ID_NUMBER). */
     struct {
-      char *data; /**< String ID data (when kind == JESENRPC_ID_STRING). */
-      size_t len; /**< Length of string ID. */
+      char *data;    /**< String ID data (when kind == JESENRPC_ID_STRING). */
+      size_t len;    /**< Length of string ID. */
+      bool borrowed; /**< data is owned elsewhere (e.g. an arena). */
     } string;
   } value;
 } jesenrpc_id_t;
 
+/**
+ * @brief A JSON value kept as encoded text.
+ */
+typedef struct jesenrpc_raw_json {
+  const char *data; /**< First byte of the value, or NULL when absent. */
+  size_t len;       /**< Length of the value in bytes. */
+} jesenrpc_raw_json_t;
+
 /**
  * @brief Represents a JSON-RPC error object.
  *
@@ -192,6 +283,10 @@ typedef struct jesenrpc_error_object {
   int32_t code;  /**< Error code (use JESENRPC_JSONRPC_ERROR_* constants). */
   char *message; /**< Human-readable error description. */
   jesen_node_t *data; /**< Optional additional error data. May be NULL. */
+  jesenrpc_arena_t *arena; /**< Owning arena, or NULL if heap-allocated. */
+  bool borrowed; /**< message points into memory owned elsewhere. */
+  jesenrpc_raw_json_t raw_data; /**< Pre-encoded data, used when data is
+                                     NULL. */
 } jesenrpc_error_object_t;
 
 /**
@@ -207,6 +302,10 @@ typedef struct jesenrpc_request {
   char *method_name;   /**< Method name to invoke. */
   jesen_node_t
       *params; /**< Method parameters. May be NULL. Must be array or object. */
+  jesenrpc_arena_t *arena; /**< Owning arena, or NULL if heap-allocated. */
+  bool borrowed; /**< method_name points into memory owned elsewhere. */
+  jesenrpc_raw_json_t raw_params; /**< Unparsed params when parsed with
+                                       JESENRPC_PARSE_LAZY_PARAMS. */
 } jesenrpc_request_t;
 
 /**
@@ -221,6 +320,12 @@ typedef struct jesenrpc_response {
   jesenrpc_id_t id;               /**< Response ID (must match request ID). */
   jesen_node_t *result;           /**< Result value. NULL when error is set. */
   jesenrpc_error_object_t *error; /**< Error object. NULL when result is set. */
+  jesenrpc_arena_t *arena; /**< Owning arena, or NULL if heap-allocated. */
+  jesenrpc_raw_json_t raw_result; /**< Pre-encoded result, used when result
+                                       is NULL. */
+  /** Internal: method name the response's serialization is timed under,
+   * set by jesenrpc_dispatcher_dispatch() while timing is on. */
+  const char *latency_method;
 } jesenrpc_response_t;
 
 /**
@@ -231,6 +336,7 @@ typedef struct jesenrpc_response {
 typedef struct jesenrpc_request_batch {
   jesenrpc_request_t **items; /**< Array of request pointers. */
   size_t count;               /**< Number of requests in the batch. */
+  jesenrpc_arena_t *arena;    /**< Owning arena, or NULL if heap-allocated. */
 } jesenrpc_request_batch_t;
 
 /**
@@ -241,6 +347,7 @@ typedef struct jesenrpc_request_batch {
 typedef struct jesenrpc_response_batch {
   jesenrpc_response_t **items; /**< Array of response pointers. */
   size_t count;                /**< Number of responses in the batch. */
+  jesenrpc_arena_t *arena;     /**< Owning arena, or NULL if heap-allocated. */
 } jesenrpc_response_batch_t;
 
 /**
@@ -268,6 +375,424 @@ typedef struct jesenrpc_message {
   } as;
 } jesenrpc_message_t;
 
+/**
+ * @brief Method handler invoked by a dispatcher.
+ *
+ * For requests with an ID, response is pre-created with the request's ID and
+ * the handler sets either a result or an error on it. For notifications,
+ * response is NULL. Returning an error code, or returning without setting a
+ * result or error, makes the dispatcher reply with
+ * JESENRPC_JSONRPC_ERROR_INTERNAL.
+ */
+typedef jesenrpc_err_t (*jesenrpc_method_handler_t)(
+    const jesenrpc_request_t *request, jesenrpc_response_t *response,
+    void *user_data);
+
+/**
+ * @brief Routes requests to handlers by method name.
+ *
+ * Methods are registered first, then jesenrpc_dispatcher_freeze() builds a
+ * collision-free hash table over them, so a lookup costs one hash of the name
+ * and a single string compare. A frozen dispatcher is read-only and can be
+ * shared between threads. Fields are internal; use jesenrpc_dispatcher_init().
+ */
+typedef struct jesenrpc_dispatcher {
+  struct jesenrpc_dispatcher_entry *entries; /**< Internal: methods. */
+  size_t count;       /**< Number of registered methods. */
+  size_t capacity;    /**< Internal: allocated entries. */
+  uint32_t *slots;    /**< Internal: entry index per table slot. */
+  uint32_t *displace; /**< Internal: per-bucket hash displacement. */
+  size_t slot_mask;   /**< Internal: table size minus one. */
+  size_t bucket_count; /**< Internal: number of displacement buckets. */
+  uint64_t hash_seed;  /**< Internal: seed chosen at freeze time. */
+  bool frozen;         /**< True once jesenrpc_dispatcher_freeze() succeeded. */
+} jesenrpc_dispatcher_t;
+
+/**
+ * @brief Callback invoked when a pending call completes.
+ * @param response The matching response. Owned by the caller of the
+ * completing function; copy what you need before returning.
+ * @param user_data The pointer passed to jesenrpc_client_track().
+ */
+typedef void (*jesenrpc_response_callback_t)(
+    const jesenrpc_response_t *response, void *user_data);
+
+/**
+ * @brief Correlates responses with the calls that are still waiting for them.
+ *
+ * Pending calls live in an open-addressing hash table keyed by request ID,
+ * with a direct integer hash for numeric IDs. Call records are pooled, so
+ * once the table has grown to the peak number of in-flight calls, tracking
+ * and completing calls does not allocate. Calls with a timeout sit on a
+ * hierarchical timer wheel driven by jesenrpc_client_advance(). Not
+ * thread-safe. Fields are internal; use jesenrpc_client_init().
+ */
+typedef struct jesenrpc_client {
+  struct jesenrpc_client_call *calls; /**< Internal: call record pool. */
+  size_t call_capacity;  /**< Internal: allocated call records. */
+  uint32_t free_call;    /**< Internal: head of the free record list. */
+  uint64_t *slots;       /**< Internal: hash tag and record per slot. */
+  size_t slot_mask;      /**< Internal: table size minus one. */
+  size_t pending;        /**< Number of calls awaiting a response. */
+  int64_t next_id;       /**< Internal: next generated request ID. */
+  uint32_t *timer_heads; /**< Internal: timer wheel slot lists. */
+  size_t timers;         /**< Internal: calls with a pending timeout. */
+  uint64_t now;          /**< Time of the last jesenrpc_client_advance(). */
+} jesenrpc_client_t;
+
+/**
+ * @brief Worker pool that dispatches the entries of a batch concurrently.
+ *
+ * Opaque; create with jesenrpc_executor_create(). Handlers run on several
+ * threads at once and must be thread-safe. Without thread support in the
+ * build, batches are dispatched on the calling thread.
+ */
+typedef struct jesenrpc_executor jesenrpc_executor_t;
+
+/**
+ * @brief Growable output buffer for serialization.
+ *
+ * Serializers append to the buffer and keep it NUL-terminated. Clearing the
+ * buffer keeps its capacity, so a warm buffer can be reused across messages
+ * without reallocating. Zero-initialize or call jesenrpc_buf_init() before use.
+ */
+typedef struct jesenrpc_buf {
+  char *data; /**< Serialized bytes. NULL until the first append. */
+  size_t len; /**< Number of bytes in data, excluding the terminator. */
+  size_t cap; /**< Allocated capacity of data. */
+  /** Source of data, or NULL for the global allocator. */
+  const jesenrpc_allocator_t *allocator;
+} jesenrpc_buf_t;
+
+#ifndef _WIN32
+/**
+ * @brief One output segment for scatter/gather serialization.
+ *
+ * This is struct iovec, so arrays can be passed to writev() or sendmsg()
+ * as they are.
+ */
+typedef struct iovec jesenrpc_iovec_t;
+#else
+typedef struct jesenrpc_iovec {
+  void *iov_base; /**< Start of the segment. */
+  size_t iov_len; /**< Length of the segment in bytes. */
+} jesenrpc_iovec_t;
+#endif
+
+/**
+ * @brief Incremental decoder for a stream of concatenated JSON-RPC messages.
+ *
+ * Bytes are pushed in arbitrary chunks with jesenrpc_stream_decoder_feed().
+ * The decoder tracks object/array nesting and string state across chunk
+ * boundaries, so every byte is scanned once, and yields each message as soon
+ * as its top-level value closes. Fields are internal; use
+ * jesenrpc_stream_decoder_init().
+ */
+typedef struct jesenrpc_stream_decoder {
+  jesenrpc_buf_t buf;               /**< Internal: buffered stream bytes. */
+  size_t value_start;               /**< Internal: start of current value. */
+  size_t scan_pos;                  /**< Internal: next byte to scan. */
+  size_t depth;                     /**< Internal: nesting depth. */
+  bool in_string;                   /**< Internal: inside a string literal. */
+  bool escape;                      /**< Internal: after a backslash. */
+  bool discarding;                  /**< Internal: value over the limit. */
+  size_t max_message_len;           /**< Largest accepted message, or 0. */
+  jesenrpc_parse_options_t options; /**< Options used to parse messages. */
+} jesenrpc_stream_decoder_t;
+
+/**
+ * @brief Incremental decoder for Content-Length framed messages, as used by
+ * the Language Server Protocol over stdio.
+ *
+ * Each message is preceded by header lines such as "Content-Length: 42",
+ * ended by an empty line. Header bytes are scanned once, across chunk
+ * boundaries; the body is then parsed where it lies in the decoder's buffer.
+ * Fields are internal; use jesenrpc_frame_decoder_init().
+ */
+typedef struct jesenrpc_frame_decoder {
+  jesenrpc_buf_t buf;               /**< Internal: buffered stream bytes. */
+  size_t line_start;                /**< Internal: start of current line. */
+  size_t scan_pos;                  /**< Internal: next byte to scan. */
+  size_t header_len;                /**< Internal: header bytes so far. */
+  size_t body_len;                  /**< Internal: current Content-Length. */
+  size_t skip;                      /**< Internal: body bytes to drop. */
+  bool have_length;                 /**< Internal: Content-Length seen. */
+  bool bad_header;                  /**< Internal: malformed header seen. */
+  bool in_body;                     /**< Internal: headers complete. */
+  size_t max_message_len;           /**< Largest accepted body, or 0. */
+  jesenrpc_parse_options_t options; /**< Options used to parse messages. */
+} jesenrpc_frame_decoder_t;
+
+/**
+ * @brief Incremental decoder for newline-delimited JSON (NDJSON), one message
+ * per line.
+ *
+ * Fields are internal; use jesenrpc_ndjson_decoder_init().
+ */
+typedef struct jesenrpc_ndjson_decoder {
+  jesenrpc_buf_t buf;               /**< Internal: buffered stream bytes. */
+  size_t line_start;                /**< Internal: start of current line. */
+  size_t scan_pos;                  /**< Internal: next byte to scan. */
+  bool discarding;                  /**< Internal: line over the limit. */
+  size_t max_message_len;           /**< Largest accepted line, or 0. */
+  jesenrpc_parse_options_t options; /**< Options used to parse messages. */
+} jesenrpc_ndjson_decoder_t;
+
+/** Slots in the per-kind counters, indexed by jesenrpc_message_kind_t. */
+#define JESENRPC_STATS_KINDS 5
+
+/**
+ * Slots in the per-error counters. Slot (code - JESENRPC_ERR_BASE) counts
+ * each jesenrpc error code; slot 0 counts any other code, such as a jesen
+ * error passed through.
+ */
+#define JESENRPC_STATS_ERRORS 8
+
+/**
+ * @brief Codec counters. See jesenrpc_stats_snapshot().
+ *
+ * Messages count once per call, so a batch counts as one message of a batch
+ * kind. Allocations are those made by jesenrpc itself, not by jesen.
+ */
+typedef struct jesenrpc_stats {
+  /** Messages parsed successfully, by kind. */
+  uint64_t parsed[JESENRPC_STATS_KINDS];
+  /** Messages serialized successfully, by kind. Pure size queries are not
+   * counted. */
+  uint64_t serialized[JESENRPC_STATS_KINDS];
+  /** Failed parse calls, by error code. */
+  uint64_t parse_failures[JESENRPC_STATS_ERRORS];
+  /** Failed *_validate() calls, by error code. */
+  uint64_t validation_failures[JESENRPC_STATS_ERRORS];
+  uint64_t bytes_in;        /**< Bytes handed to the parsers. */
+  uint64_t bytes_out;       /**< Bytes produced by the serializers. */
+  uint64_t allocations;     /**< Calls to malloc, calloc and realloc. */
+  uint64_t allocated_bytes; /**< Bytes requested by those calls. */
+} jesenrpc_stats_t;
+
+/**
+ * Linear sub-buckets per power of two, as log2. A recorded value is kept to
+ * within 1/16 of itself.
+ */
+#define JESENRPC_HISTOGRAM_SUB_BITS 4
+
+/** Values of 2^36 (about 69 s in nanoseconds) or more share the top bucket. */
+#define JESENRPC_HISTOGRAM_MAX_BITS 36
+
+/** Number of buckets in a jesenrpc_histogram_t. */
+#define JESENRPC_HISTOGRAM_BUCKETS                                             \
+  ((JESENRPC_HISTOGRAM_MAX_BITS - JESENRPC_HISTOGRAM_SUB_BITS + 1)             \
+   << JESENRPC_HISTOGRAM_SUB_BITS)
+
+/**
+ * @brief Log-bucketed histogram of unsigned values, in the style of
+ * HdrHistogram.
+ *
+ * Values below 16 get a bucket each; every power of two above that is split
+ * into 16 equal buckets. Zero-initialize or call jesenrpc_histogram_reset()
+ * before use.
+ */
+typedef struct jesenrpc_histogram {
+  uint64_t count; /**< Values recorded. */
+  uint64_t sum;   /**< Sum of the recorded values. */
+  uint64_t min;   /**< Smallest value recorded, when count > 0. */
+  uint64_t max;   /**< Largest value recorded. */
+  uint64_t buckets[JESENRPC_HISTOGRAM_BUCKETS]; /**< Counts per bucket. */
+} jesenrpc_histogram_t;
+
+/**
+ * @brief Codec stages timed by jesenrpc_latency_enable().
+ */
+typedef enum jesenrpc_latency_stage {
+  JESENRPC_LATENCY_PARSE = 0, /**< Parsing a message. */
+  JESENRPC_LATENCY_DISPATCH,  /**< Running a method handler. */
+  JESENRPC_LATENCY_SERIALIZE  /**< Serializing a message. */
+} jesenrpc_latency_stage_t;
+
+/** Number of jesenrpc_latency_stage_t values. */
+#define JESENRPC_LATENCY_STAGES 3
+
+/**
+ * @brief Library operations reported to jesenrpc_hooks_t.
+ */
+typedef enum jesenrpc_hook_op {
+  JESENRPC_HOOK_PARSE = 0,  /**< A request, response or message parse. */
+  JESENRPC_HOOK_VALIDATE,   /**< A jesenrpc_*_validate() call. */
+  JESENRPC_HOOK_SERIALIZE   /**< A request, response or batch serializer. */
+} jesenrpc_hook_op_t;
+
+/**
+ * @brief What a hook is told about an operation.
+ *
+ * Pointers are only valid during the callback.
+ */
+typedef struct jesenrpc_hook_event {
+  jesenrpc_hook_op_t op; /**< The operation. */
+  /** Message kind. On parse entry, the kind asked for (UNKNOWN for
+   * jesenrpc_message_parse()); on parse exit, the kind found, or UNKNOWN
+   * after a failure. UNKNOWN when validating an error object. */
+  jesenrpc_message_kind_t kind;
+  /** Method of a single request. NULL for other kinds, and on parse entry. */
+  const char *method_name;
+  /** ID of a single request or response. NULL for other kinds, and on parse
+   * entry. */
+  const jesenrpc_id_t *id;
+  /** Parse: input length. Serialize: 0 on entry; on exit the bytes written
+   * (or required, for a size query). Validate: 0. */
+  size_t bytes;
+  jesenrpc_err_t err; /**< Result, on exit. JESENRPC_ERR_NONE on entry. */
+} jesenrpc_hook_event_t;
+
+/**
+ * @brief Callbacks run on entry to and exit from codec operations.
+ *
+ * Install with jesenrpc_set_hooks(). Either callback may be NULL.
+ * Serializers validate their input, so their events enclose validate
+ * events; failed calls report exit too.
+ */
+typedef struct jesenrpc_hooks {
+  /** Called before the operation starts. */
+  void (*on_enter)(const jesenrpc_hook_event_t *event, void *user_data);
+  /** Called after the operation finished. */
+  void (*on_exit)(const jesenrpc_hook_event_t *event, void *user_data);
+  void *user_data; /**< Passed to both callbacks. */
+} jesenrpc_hooks_t;
+
+/** @} */
+
+/**
+ * @defgroup allocator_functions Allocator Functions
+ * @brief Routing jesenrpc's allocations to your own allocator.
+ * @{
+ */
+
+/**
+ * @brief Replaces the global allocator.
+ * @param allocator The allocator, copied. NULL restores malloc(), realloc()
+ * and free().
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS if a
+ *         function is missing.
+ * @note Memory is freed through the allocator it came from, so install the
+ * allocator before anything is allocated, while no other thread uses the
+ * library, and do not switch while objects allocated earlier are alive.
+ * Structs pooled by other threads (see jesenrpc_pool_trim()) are still freed
+ * through the outgoing allocator, so keep it usable until every thread that
+ * used the library has called jesenrpc_pool_trim() or exited.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_set_allocator(const jesenrpc_allocator_t *allocator);
+
+/**
+ * @brief Frees the calling thread's pooled request, response and error
+ * object structs, and those in the shared depot.
+ * @return JESENRPC_ERR_NONE.
+ * @note Destroyed structs are kept for reuse when built with
+ * JESENRPC_WITH_POOLS: up to 64 per struct and thread, and 512 per struct in
+ * a depot shared by all threads. jesenrpc_set_allocator() trims first, but
+ * only the calling thread's cache: every other thread must trim or exit
+ * before the outgoing allocator goes away.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_pool_trim(void);
+
+/** @} */
+
+/**
+ * @defgroup buf_functions Output Buffer Functions
+ * @brief Functions for managing growable serialization buffers.
+ * @{
+ */
+
+/**
+ * @brief Initializes an empty output buffer.
+ * @param buf The buffer to initialize.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_buf_init(jesenrpc_buf_t *buf);
+
+/**
+ * @brief Initializes an empty output buffer that allocates from allocator.
+ * @param buf The buffer to initialize.
+ * @param allocator The allocator, or NULL for the global one. Not copied: it
+ * must outlive the buffer's memory.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_buf_init_ex(jesenrpc_buf_t *buf,
+                     const jesenrpc_allocator_t *allocator);
+
+/**
+ * @brief Ensures the buffer can hold at least capacity bytes.
+ * @param buf The buffer to grow.
+ * @param capacity Minimum capacity, including the terminator.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_buf_reserve(jesenrpc_buf_t *buf,
+                                                 size_t capacity);
+
+/**
+ * @brief Empties the buffer while keeping its capacity for reuse.
+ * @param buf The buffer to clear.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_buf_clear(jesenrpc_buf_t *buf);
+
+/**
+ * @brief Frees the memory held by a buffer.
+ * @param buf The buffer to destroy. It is left empty, keeps its allocator and
+ * may be reused.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_buf_destroy(jesenrpc_buf_t *buf);
+
+/** @} */
+
+/**
+ * @defgroup arena_functions Arena Functions
+ * @brief Functions for managing per-message parse arenas.
+ * @{
+ */
+
+/**
+ * @brief Initializes an empty arena.
+ * @param arena The arena to initialize.
+ * @param block_size Size of each allocated block, or 0 for the default (4 KiB).
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note No memory is allocated until the first parse.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_arena_init(jesenrpc_arena_t *arena,
+                                                size_t block_size);
+
+/**
+ * @brief Initializes an empty arena that takes its blocks from allocator.
+ * @param arena The arena to initialize.
+ * @param block_size Size of each allocated block, or 0 for the default (4 KiB).
+ * @param allocator The allocator, or NULL for the global one. Not copied: it
+ * must outlive the arena.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note Parsing with such an arena routes every jesenrpc allocation of that
+ * call to allocator.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_arena_init_ex(jesenrpc_arena_t *arena, size_t block_size,
+                       const jesenrpc_allocator_t *allocator);
+
+/**
+ * @brief Releases everything parsed into the arena.
+ * @param arena The arena to reset.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note Destroys the params/result/data trees of all structures parsed into
+ *       the arena and keeps one block for reuse. Pointers into the arena are
+ *       invalid afterwards.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_arena_reset(jesenrpc_arena_t *arena);
+
+/**
+ * @brief Resets the arena and frees all of its memory.
+ * @param arena The arena to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_arena_destroy(jesenrpc_arena_t *arena);
+
 /** @} */
 
 /**
@@ -370,6 +895,34 @@ JESENRPC_API jesenrpc_err_t jesenrpc_request_set_id(jesenrpc_request_t *request,
 JESENRPC_API jesenrpc_err_t
 jesenrpc_request_set_params(jesenrpc_request_t *request, jesen_node_t *params);
 
+/**
+ * @brief Gets the request parameters, building them from raw_params first if
+ * they were parsed lazily.
+ * @param request The request.
+ * @param out_params Receives the params, or NULL if the request has none. The
+ * request keeps ownership.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note The first call builds the tree from a copy of raw_params, which is
+ * left unchanged, and caches it in request->params. Threads sharing the
+ * request may call it at once: each gets the same cached tree.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_get_params(
+    const jesenrpc_request_t *request, jesen_node_t **out_params);
+
+/**
+ * @brief Sets request parameters from already encoded JSON text.
+ * @param request The request to modify.
+ * @param json A JSON array or object. Not copied: keep it alive and unchanged
+ * for as long as the request is used.
+ * @param json_len Length of json in bytes.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_PARSE if json is not
+ *         well-formed, JESENRPC_ERR_VALIDATION if it is not an array or
+ *         object, or another error code.
+ * @note Replaces any params set before. Serialization copies json verbatim.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_set_params_raw(
+    jesenrpc_request_t *request, const char *json, size_t json_len);
+
 /**
  * @brief Checks if a request is a notification.
  * @param request The request to check.
@@ -388,6 +941,49 @@ jesenrpc_request_is_notification(const jesenrpc_request_t *request);
 JESENRPC_API jesenrpc_err_t jesenrpc_request_serialize(
     const jesenrpc_request_t *request, char *out_buf, size_t out_buf_len);
 
+/**
+ * @brief Serializes a request and reports the serialized length.
+ * @param request The request to serialize.
+ * @param out_buf Buffer to write the JSON string. May be NULL if out_buf_len
+ * is 0.
+ * @param out_buf_len Size of the output buffer.
+ * @param out_len Optional output for the length excluding the terminator.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if the
+ *         buffer is too small, or another error code.
+ * @note Like snprintf(), *out_len receives the required length when the
+ *       buffer is too small. Passing NULL and 0 queries the length only and
+ *       returns JESENRPC_ERR_NONE.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_serialize_len(
+    const jesenrpc_request_t *request, char *out_buf, size_t out_buf_len,
+    size_t *out_len);
+
+/**
+ * @brief Appends a serialized request to a growable buffer.
+ * @param request The request to serialize.
+ * @param buf The buffer to append to. Grown as needed.
+ * @return JESENRPC_ERR_NONE on success, or an error code. On failure the
+ *         buffer contents are left as they were.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_serialize_to_buf(
+    const jesenrpc_request_t *request, jesenrpc_buf_t *buf);
+
+/**
+ * @brief Serializes a request as a list of segments for writev() or sendmsg().
+ * @param request The request to serialize.
+ * @param scratch Buffer that receives the envelope bytes.
+ * @param iov Array that receives the segments. May be NULL if iov_cap is 0.
+ * @param iov_cap Number of entries in iov.
+ * @param out_iov_count Optional output for the number of segments.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if more
+ *         than iov_cap segments are needed, or another error code.
+ * @note See jesenrpc_response_serialize_iov(). Large raw params get their
+ * own segment.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_serialize_iov(
+    const jesenrpc_request_t *request, jesenrpc_buf_t *scratch,
+    jesenrpc_iovec_t *iov, size_t iov_cap, size_t *out_iov_count);
+
 /**
  * @brief Validates a request structure.
  * @param request The request to validate.
@@ -408,6 +1004,19 @@ jesenrpc_request_validate(const jesenrpc_request_t *request);
 JESENRPC_API jesenrpc_err_t jesenrpc_request_parse(char *buf, size_t buf_len,
                                                    jesenrpc_request_t **out);
 
+/**
+ * @brief Parses a JSON string into a request structure with options.
+ * @param buf The JSON string buffer (may be modified during parsing).
+ * @param buf_len Length of the JSON string.
+ * @param options Parse options. May be NULL.
+ * @param out Output pointer to receive the parsed request.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note With an arena the request is released by jesenrpc_arena_reset().
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_parse_ex(
+    char *buf, size_t buf_len, const jesenrpc_parse_options_t *options,
+    jesenrpc_request_t **out);
+
 /**
  * @brief Frees a request and all associated resources.
  * @param request The request to destroy.
@@ -464,6 +1073,21 @@ jesenrpc_response_create(int32_t request_id, jesenrpc_response_t **response);
 JESENRPC_API jesenrpc_err_t jesenrpc_response_set_result(
     jesenrpc_response_t *response, jesen_node_t *result);
 
+/**
+ * @brief Sets the result from already encoded JSON text, e.g. a cached or
+ * proxied result, without parsing it into a tree.
+ * @param response The response to modify.
+ * @param json A single JSON value. Not copied: keep it alive and unchanged for
+ * as long as the response is used.
+ * @param json_len Length of json in bytes.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_PARSE if json is not one
+ *         well-formed JSON value, or JESENRPC_ERR_INVALID_ARGS if result/error
+ *         is already set.
+ * @note Serialization copies json verbatim.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_set_result_raw(
+    jesenrpc_response_t *response, const char *json, size_t json_len);
+
 /**
  * @brief Sets the error object for a failed response.
  * @param response The response to modify.
@@ -485,6 +1109,55 @@ JESENRPC_API jesenrpc_err_t jesenrpc_response_set_error(
 JESENRPC_API jesenrpc_err_t jesenrpc_response_serialize(
     const jesenrpc_response_t *response, char *out_buf, size_t out_buf_len);
 
+/**
+ * @brief Serializes a response and reports the serialized length.
+ * @param response The response to serialize.
+ * @param out_buf Buffer to write the JSON string. May be NULL if out_buf_len
+ * is 0.
+ * @param out_buf_len Size of the output buffer.
+ * @param out_len Optional output for the length excluding the terminator.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if the
+ *         buffer is too small, or another error code.
+ * @note See jesenrpc_request_serialize_len() for the length semantics.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_serialize_len(
+    const jesenrpc_response_t *response, char *out_buf, size_t out_buf_len,
+    size_t *out_len);
+
+/**
+ * @brief Appends a serialized response to a growable buffer.
+ * @param response The response to serialize.
+ * @param buf The buffer to append to. Grown as needed.
+ * @return JESENRPC_ERR_NONE on success, or an error code. On failure the
+ *         buffer contents are left as they were.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_serialize_to_buf(
+    const jesenrpc_response_t *response, jesenrpc_buf_t *buf);
+
+/**
+ * @brief Serializes a response as a list of segments for writev() or sendmsg().
+ *
+ * The envelope is written to scratch, which is cleared first. Raw values set
+ * with the *_raw() setters are not copied when they are large: they get a
+ * segment of their own pointing at the caller's bytes. Small raw values and
+ * jesen trees are serialized into scratch like the other serializers do.
+ *
+ * @param response The response to serialize.
+ * @param scratch Buffer that receives the envelope bytes. Keep it unchanged
+ * while the segments are in use.
+ * @param iov Array that receives the segments. May be NULL if iov_cap is 0.
+ * @param iov_cap Number of entries in iov.
+ * @param out_iov_count Optional output for the number of segments, which is
+ * always odd. Also set when iov was too small.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if more
+ *         than iov_cap segments are needed, or another error code.
+ * @note The segments are not NUL-terminated. Segments pointing at raw values
+ * are valid only while those bytes are.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_serialize_iov(
+    const jesenrpc_response_t *response, jesenrpc_buf_t *scratch,
+    jesenrpc_iovec_t *iov, size_t iov_cap, size_t *out_iov_count);
+
 /**
  * @brief Validates a response structure.
  * @param response The response to validate.
@@ -505,6 +1178,19 @@ jesenrpc_response_validate(const jesenrpc_response_t *response);
 JESENRPC_API jesenrpc_err_t jesenrpc_response_parse(char *buf, size_t buf_len,
                                                     jesenrpc_response_t **out);
 
+/**
+ * @brief Parses a JSON string into a response structure with options.
+ * @param buf The JSON string buffer (may be modified during parsing).
+ * @param buf_len Length of the JSON string.
+ * @param options Parse options. May be NULL.
+ * @param out Output pointer to receive the parsed response.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note With an arena the response is released by jesenrpc_arena_reset().
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_parse_ex(
+    char *buf, size_t buf_len, const jesenrpc_parse_options_t *options,
+    jesenrpc_response_t **out);
+
 /**
  * @brief Frees a response and all associated resources.
  * @param response The response to destroy.
@@ -541,6 +1227,19 @@ JESENRPC_API jesenrpc_err_t jesenrpc_error_object_create(
 JESENRPC_API jesenrpc_err_t jesenrpc_error_object_set_data(
     jesenrpc_error_object_t *error, jesen_node_t *data);
 
+/**
+ * @brief Sets additional error data from already encoded JSON text.
+ * @param error The error object to modify.
+ * @param json A single JSON value. Not copied: keep it alive and unchanged for
+ * as long as the error object is used.
+ * @param json_len Length of json in bytes.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_PARSE if json is not one
+ *         well-formed JSON value, or another error code.
+ * @note Replaces any data set before.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_error_object_set_data_raw(
+    jesenrpc_error_object_t *error, const char *json, size_t json_len);
+
 /**
  * @brief Validates an error object structure.
  * @param error The error object to validate.
@@ -589,6 +1288,78 @@ JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_serialize(
     jesenrpc_response_t *const *responses, size_t response_count, char *out_buf,
     size_t out_buf_len);
 
+/**
+ * @brief Serializes a request batch and reports the serialized length.
+ * @param requests Array of request pointers to serialize.
+ * @param request_count Number of requests in the array.
+ * @param out_buf Buffer to write the JSON array string. May be NULL if
+ * out_buf_len is 0.
+ * @param out_buf_len Size of the output buffer.
+ * @param out_len Optional output for the length excluding the terminator.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if the
+ *         buffer is too small, or another error code.
+ * @note See jesenrpc_request_serialize_len() for the length semantics.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_batch_serialize_len(
+    jesenrpc_request_t *const *requests, size_t request_count, char *out_buf,
+    size_t out_buf_len, size_t *out_len);
+
+/**
+ * @brief Appends a serialized request batch to a growable buffer.
+ * @param requests Array of request pointers to serialize.
+ * @param request_count Number of requests in the array.
+ * @param buf The buffer to append to. Grown as needed.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_request_batch_serialize_to_buf(
+    jesenrpc_request_t *const *requests, size_t request_count,
+    jesenrpc_buf_t *buf);
+
+/**
+ * @brief Serializes a response batch and reports the serialized length.
+ * @param responses Array of response pointers to serialize.
+ * @param response_count Number of responses in the array.
+ * @param out_buf Buffer to write the JSON array string. May be NULL if
+ * out_buf_len is 0.
+ * @param out_buf_len Size of the output buffer.
+ * @param out_len Optional output for the length excluding the terminator.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if the
+ *         buffer is too small, or another error code.
+ * @note See jesenrpc_request_serialize_len() for the length semantics.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_serialize_len(
+    jesenrpc_response_t *const *responses, size_t response_count, char *out_buf,
+    size_t out_buf_len, size_t *out_len);
+
+/**
+ * @brief Appends a serialized response batch to a growable buffer.
+ * @param responses Array of response pointers to serialize.
+ * @param response_count Number of responses in the array.
+ * @param buf The buffer to append to. Grown as needed.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_serialize_to_buf(
+    jesenrpc_response_t *const *responses, size_t response_count,
+    jesenrpc_buf_t *buf);
+
+/**
+ * @brief Serializes a response batch as a list of segments.
+ * @param responses Array of response pointers to serialize.
+ * @param response_count Number of responses in the array.
+ * @param scratch Buffer that receives the envelope bytes.
+ * @param iov Array that receives the segments. May be NULL if iov_cap is 0.
+ * @param iov_cap Number of entries in iov.
+ * @param out_iov_count Optional output for the number of segments.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_BUFFER_TOO_SMALL if more
+ *         than iov_cap segments are needed, or another error code.
+ * @note See jesenrpc_response_serialize_iov(). Each large raw value adds two
+ * segments.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_serialize_iov(
+    jesenrpc_response_t *const *responses, size_t response_count,
+    jesenrpc_buf_t *scratch, jesenrpc_iovec_t *iov, size_t iov_cap,
+    size_t *out_iov_count);
+
 /**
  * @brief Parses a JSON array into a batch of requests.
  * @param buf The JSON array string (may be modified during parsing).
@@ -614,11 +1385,35 @@ JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_parse(
     char *buf, size_t buf_len, jesenrpc_response_batch_t *out);
 
 /**
- * @brief Frees a request batch and all contained requests.
- * @param batch The batch to destroy.
+ * @brief Parses a JSON array into a batch of requests with options.
+ * @param buf The JSON array string (may be modified during parsing).
+ * @param buf_len Length of the JSON string.
+ * @param options Parse options. May be NULL.
+ * @param out Output structure to receive the parsed requests.
  * @return JESENRPC_ERR_NONE on success, or an error code.
  */
-JESENRPC_API jesenrpc_err_t
+JESENRPC_API jesenrpc_err_t jesenrpc_request_batch_parse_ex(
+    char *buf, size_t buf_len, const jesenrpc_parse_options_t *options,
+    jesenrpc_request_batch_t *out);
+
+/**
+ * @brief Parses a JSON array into a batch of responses with options.
+ * @param buf The JSON array string (may be modified during parsing).
+ * @param buf_len Length of the JSON string.
+ * @param options Parse options. May be NULL.
+ * @param out Output structure to receive the parsed responses.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_response_batch_parse_ex(
+    char *buf, size_t buf_len, const jesenrpc_parse_options_t *options,
+    jesenrpc_response_batch_t *out);
+
+/**
+ * @brief Frees a request batch and all contained requests.
+ * @param batch The batch to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
 jesenrpc_request_batch_destroy(jesenrpc_request_batch_t *batch);
 
 /**
@@ -650,12 +1445,31 @@ JESENRPC_API jesenrpc_err_t jesenrpc_message_parse(char *buf, size_t buf_len,
                                                    jesenrpc_message_t *out);
 
 /**
- * @brief Determines the message kind without fully materializing it.
+ * @brief Parses any JSON-RPC message with options.
  * @param buf The JSON string buffer (may be modified during parsing).
  * @param buf_len Length of the JSON string.
- * @param kind Output to receive the detected kind.
+ * @param options Parse options. May be NULL.
+ * @param out Output structure to receive the parsed message.
  * @return JESENRPC_ERR_NONE on success, or an error code.
  */
+JESENRPC_API jesenrpc_err_t jesenrpc_message_parse_ex(
+    char *buf, size_t buf_len, const jesenrpc_parse_options_t *options,
+    jesenrpc_message_t *out);
+
+/**
+ * @brief Determines the message kind without fully materializing it.
+ *
+ * Only the top-level keys (for a batch, those of the first element) are
+ * scanned, up to the first "method", "result" or "error" key. No memory is
+ * allocated and the rest of the message is not validated; use
+ * jesenrpc_message_parse() for that.
+ *
+ * @param buf The JSON string buffer. Not modified.
+ * @param buf_len Length of the JSON string.
+ * @param kind Output to receive the detected kind.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_VALIDATION if the
+ *         envelope is not a request or response, or another error code.
+ */
 JESENRPC_API jesenrpc_err_t jesenrpc_message_peek_kind(
     char *buf, size_t buf_len, jesenrpc_message_kind_t *kind);
 
@@ -669,6 +1483,703 @@ jesenrpc_message_destroy(jesenrpc_message_t *message);
 
 /** @} */
 
+/**
+ * @defgroup stream_functions Stream Decoder Functions
+ * @brief Functions for decoding messages from a byte stream.
+ * @{
+ */
+
+/**
+ * @brief Initializes a stream decoder.
+ * @param decoder The decoder to initialize.
+ * @param options Options for parsing each message (copied). May be NULL.
+ * @param max_message_len Largest message in bytes, or 0 for no limit.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note With JESENRPC_PARSE_IN_SITU or JESENRPC_PARSE_LAZY_PARAMS, decoded
+ * messages point into the decoder's buffer and stay valid only until the next
+ * call to jesenrpc_stream_decoder_feed().
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stream_decoder_init(
+    jesenrpc_stream_decoder_t *decoder,
+    const jesenrpc_parse_options_t *options, size_t max_message_len);
+
+/**
+ * @brief Appends bytes read from the stream.
+ * @param decoder The decoder.
+ * @param data The received bytes.
+ * @param len Number of bytes.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stream_decoder_feed(
+    jesenrpc_stream_decoder_t *decoder, const char *data, size_t len);
+
+/**
+ * @brief Decodes the next complete message, if one is buffered.
+ * @param decoder The decoder.
+ * @param out Receives the message. Its kind is JESENRPC_MESSAGE_UNKNOWN when
+ * more bytes are needed.
+ * @return JESENRPC_ERR_NONE on success, or the parse error of the message that
+ *         just closed. Failed messages are dropped, so decoding can continue
+ *         with the next call. JESENRPC_ERR_PARSE is also returned for stray
+ *         bytes between messages, and JESENRPC_ERR_VALIDATION for a message
+ *         longer than max_message_len, after which buffered bytes are
+ *         discarded.
+ * @note Call repeatedly until the kind is JESENRPC_MESSAGE_UNKNOWN. Caller is
+ * responsible for calling jesenrpc_message_destroy() on each message.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stream_decoder_next(
+    jesenrpc_stream_decoder_t *decoder, jesenrpc_message_t *out);
+
+/**
+ * @brief Discards all buffered bytes and scanning state.
+ * @param decoder The decoder.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_stream_decoder_reset(jesenrpc_stream_decoder_t *decoder);
+
+/**
+ * @brief Frees the decoder's buffer.
+ * @param decoder The decoder to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_stream_decoder_destroy(jesenrpc_stream_decoder_t *decoder);
+
+/** @} */
+
+/**
+ * @defgroup frame_functions Content-Length Framing Functions
+ * @brief Functions for LSP-style "Content-Length:" framed streams.
+ * @{
+ */
+
+/**
+ * @brief Bytes reserved for the header by jesenrpc_frame_begin().
+ *
+ * The header is "Content-Length: " followed by the body length padded with
+ * leading zeros to 10 digits, and an empty line. The fixed width lets the
+ * header be written in front of a body that is already in place.
+ */
+#define JESENRPC_FRAME_HEADER_LEN 30
+
+/**
+ * @brief Initializes a Content-Length frame decoder.
+ * @param decoder The decoder to initialize.
+ * @param options Options for parsing each message (copied). May be NULL.
+ * @param max_message_len Largest body in bytes, or 0 for no limit.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note See jesenrpc_stream_decoder_init() for how long decoded messages may
+ * borrow the decoder's buffer.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_frame_decoder_init(
+    jesenrpc_frame_decoder_t *decoder,
+    const jesenrpc_parse_options_t *options, size_t max_message_len);
+
+/**
+ * @brief Appends bytes read from the stream.
+ * @param decoder The decoder.
+ * @param data The received bytes.
+ * @param len Number of bytes.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_frame_decoder_feed(
+    jesenrpc_frame_decoder_t *decoder, const char *data, size_t len);
+
+/**
+ * @brief Decodes the next complete message, if one is buffered.
+ *
+ * Header names are matched case-insensitively and headers other than
+ * Content-Length, such as Content-Type, are ignored. Lines may end in "\r\n"
+ * or "\n".
+ *
+ * @param decoder The decoder.
+ * @param out Receives the message. Its kind is JESENRPC_MESSAGE_UNKNOWN when
+ * more bytes are needed.
+ * @return JESENRPC_ERR_NONE on success, or the parse error of the body that
+ *         just completed. JESENRPC_ERR_PARSE is also returned for a header
+ *         block without a valid Content-Length, and JESENRPC_ERR_VALIDATION
+ *         for a body longer than max_message_len, which is then skipped
+ *         without being buffered. Decoding continues with the next call.
+ * @note Call repeatedly until the kind is JESENRPC_MESSAGE_UNKNOWN. Caller is
+ * responsible for calling jesenrpc_message_destroy() on each message.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_frame_decoder_next(
+    jesenrpc_frame_decoder_t *decoder, jesenrpc_message_t *out);
+
+/**
+ * @brief Discards all buffered bytes and header state.
+ * @param decoder The decoder.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_frame_decoder_reset(jesenrpc_frame_decoder_t *decoder);
+
+/**
+ * @brief Frees the decoder's buffer.
+ * @param decoder The decoder to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_frame_decoder_destroy(jesenrpc_frame_decoder_t *decoder);
+
+/**
+ * @brief Starts a framed message at the end of a buffer.
+ *
+ * Reserves JESENRPC_FRAME_HEADER_LEN bytes for the header. Append the body
+ * with any *_serialize_to_buf() function, then call jesenrpc_frame_end(), so
+ * the frame is written without copying the body.
+ *
+ * @param buf The buffer to append to. Grown as needed.
+ * @param out_mark Receives the offset of the frame, for jesenrpc_frame_end().
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_frame_begin(jesenrpc_buf_t *buf,
+                                                 size_t *out_mark);
+
+/**
+ * @brief Writes the header of a frame whose body has been appended.
+ * @param buf The buffer passed to jesenrpc_frame_begin().
+ * @param mark The offset returned by jesenrpc_frame_begin(). Everything
+ * appended after the reserved header is the body.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_INVALID_ARGS if mark
+ *         does not fit the buffer, or JESENRPC_ERR_VALIDATION if the body is
+ *         too long for 10 digits.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_frame_end(jesenrpc_buf_t *buf,
+                                               size_t mark);
+
+/** @} */
+
+/**
+ * @defgroup ndjson_functions NDJSON Functions
+ * @brief Functions for newline-delimited streams and files.
+ *
+ * Lines may end in "\n" or "\r\n", and blank lines are skipped. JSON
+ * strings cannot contain a raw line feed, so every line feed in valid input
+ * ends a message and lines are found with a vectorized memchr() rather than
+ * by tracking quotes.
+ * @{
+ */
+
+/**
+ * @brief Parses the next line of a buffer in place.
+ *
+ * Meant for replaying large captures, such as a file mapped with
+ * MAP_PRIVATE: nothing is copied, and the final line needs no line feed.
+ *
+ * @param buf The NDJSON text (may be modified during parsing).
+ * @param buf_len Length of the text.
+ * @param offset Offset of the next line, 0 to start. Advanced past the line
+ * that was parsed, or to buf_len at the end.
+ * @param options Parse options. May be NULL.
+ * @param out Receives the message. Its kind is JESENRPC_MESSAGE_UNKNOWN at the
+ * end of the buffer.
+ * @return JESENRPC_ERR_NONE on success, or the parse error of the line, after
+ *         which the next call continues with the following line.
+ * @note Caller is responsible for calling jesenrpc_message_destroy() on each
+ * message.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_ndjson_parse_next(
+    char *buf, size_t buf_len, size_t *offset,
+    const jesenrpc_parse_options_t *options, jesenrpc_message_t *out);
+
+/**
+ * @brief Initializes an NDJSON decoder.
+ * @param decoder The decoder to initialize.
+ * @param options Options for parsing each message (copied). May be NULL.
+ * @param max_message_len Longest line in bytes, or 0 for no limit.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note See jesenrpc_stream_decoder_init() for how long decoded messages may
+ * borrow the decoder's buffer.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_ndjson_decoder_init(
+    jesenrpc_ndjson_decoder_t *decoder,
+    const jesenrpc_parse_options_t *options, size_t max_message_len);
+
+/**
+ * @brief Appends bytes read from the stream.
+ * @param decoder The decoder.
+ * @param data The received bytes.
+ * @param len Number of bytes.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_ndjson_decoder_feed(
+    jesenrpc_ndjson_decoder_t *decoder, const char *data, size_t len);
+
+/**
+ * @brief Decodes the next complete line, if one is buffered.
+ * @param decoder The decoder.
+ * @param out Receives the message. Its kind is JESENRPC_MESSAGE_UNKNOWN when
+ * more bytes are needed.
+ * @return JESENRPC_ERR_NONE on success, or the parse error of the line that
+ *         just ended. JESENRPC_ERR_VALIDATION is returned once for a line
+ *         longer than max_message_len, whose bytes are then dropped up to its
+ *         line feed. Decoding continues with the next call.
+ * @note A final line without a line feed stays buffered. Call repeatedly
+ * until the kind is JESENRPC_MESSAGE_UNKNOWN. Caller is responsible for
+ * calling jesenrpc_message_destroy() on each message.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_ndjson_decoder_next(
+    jesenrpc_ndjson_decoder_t *decoder, jesenrpc_message_t *out);
+
+/**
+ * @brief Discards all buffered bytes.
+ * @param decoder The decoder.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_ndjson_decoder_reset(jesenrpc_ndjson_decoder_t *decoder);
+
+/**
+ * @brief Frees the decoder's buffer.
+ * @param decoder The decoder to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_ndjson_decoder_destroy(jesenrpc_ndjson_decoder_t *decoder);
+
+/** @} */
+
+/**
+ * @defgroup dispatcher_functions Dispatcher Functions
+ * @brief Functions for routing parsed requests to method handlers.
+ * @{
+ */
+
+/**
+ * @brief Initializes an empty dispatcher.
+ * @param dispatcher The dispatcher to initialize.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_dispatcher_init(jesenrpc_dispatcher_t *dispatcher);
+
+/**
+ * @brief Registers a handler for a method name.
+ * @param dispatcher The dispatcher (must not be frozen yet).
+ * @param method_name Method name (copied internally, max
+ * JESENRPC_METHOD_NAME_MAX_LEN chars).
+ * @param handler Handler to invoke for the method.
+ * @param user_data Opaque pointer passed to the handler.
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS if the
+ *         dispatcher is frozen or the name is already registered.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_dispatcher_register(
+    jesenrpc_dispatcher_t *dispatcher, const char *method_name,
+    jesenrpc_method_handler_t handler, void *user_data);
+
+/**
+ * @brief Builds the perfect-hash method table and freezes the dispatcher.
+ * @param dispatcher The dispatcher to freeze.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note No methods can be registered afterwards.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_dispatcher_freeze(jesenrpc_dispatcher_t *dispatcher);
+
+/**
+ * @brief Looks up the handler registered for a method name.
+ * @param dispatcher A frozen dispatcher.
+ * @param method_name The method name to look up.
+ * @param out_handler Receives the handler. May be NULL.
+ * @param out_user_data Receives the handler's user data. May be NULL.
+ * @return true if the method is registered, false otherwise.
+ */
+JESENRPC_API bool jesenrpc_dispatcher_lookup(
+    const jesenrpc_dispatcher_t *dispatcher, const char *method_name,
+    jesenrpc_method_handler_t *out_handler, void **out_user_data);
+
+/**
+ * @brief Invokes the handler for a request and builds its response.
+ * @param dispatcher A frozen dispatcher.
+ * @param request The request to dispatch.
+ * @param out_response Receives the response, or NULL for notifications.
+ * Unknown methods yield a JESENRPC_JSONRPC_ERROR_METHOD_NOT_FOUND response.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note Caller is responsible for calling jesenrpc_response_destroy() on the
+ * response.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_dispatcher_dispatch(
+    const jesenrpc_dispatcher_t *dispatcher, const jesenrpc_request_t *request,
+    jesenrpc_response_t **out_response);
+
+/**
+ * @brief Dispatches a parsed request message (single or batch).
+ * @param dispatcher A frozen dispatcher.
+ * @param message A request message from jesenrpc_message_parse().
+ * @param out_reply Receives a single response or a response batch. Its kind is
+ * JESENRPC_MESSAGE_UNKNOWN when nothing must be sent back (notifications
+ * only).
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS for
+ *         response messages.
+ * @note Caller is responsible for calling jesenrpc_message_destroy() on a
+ * reply whose kind is not JESENRPC_MESSAGE_UNKNOWN.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_dispatcher_dispatch_message(
+    const jesenrpc_dispatcher_t *dispatcher, const jesenrpc_message_t *message,
+    jesenrpc_message_t *out_reply);
+
+/**
+ * @brief Frees all memory owned by a dispatcher.
+ * @param dispatcher The dispatcher to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_dispatcher_destroy(jesenrpc_dispatcher_t *dispatcher);
+
+/** @} */
+
+/**
+ * @defgroup executor_functions Batch Executor Functions
+ * @brief Functions for dispatching batches on a worker thread pool.
+ * @{
+ */
+
+/**
+ * @brief Creates an executor with a fixed number of worker threads.
+ * @param thread_count Number of workers. The submitting thread also works on
+ * each batch, so one less than the number of cores is a good choice. 0 runs
+ * batches on the calling thread only.
+ * @param out_executor Output pointer to receive the executor.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_executor_create(
+    size_t thread_count, jesenrpc_executor_t **out_executor);
+
+/**
+ * @brief Dispatches all entries of a batch concurrently.
+ * @param executor The executor.
+ * @param dispatcher A frozen dispatcher.
+ * @param batch The request batch (must not be empty).
+ * @param out Receives responses in request order, without entries for
+ * notifications. count is 0 when the batch held only notifications.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_VALIDATION for an empty
+ *         batch, or an error code.
+ * @note Caller is responsible for calling jesenrpc_response_batch_destroy() on
+ * the result.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_executor_dispatch_batch(
+    jesenrpc_executor_t *executor, const jesenrpc_dispatcher_t *dispatcher,
+    const jesenrpc_request_batch_t *batch, jesenrpc_response_batch_t *out);
+
+/**
+ * @brief Like jesenrpc_dispatcher_dispatch_message(), with batches fanned out
+ * to the executor's workers.
+ * @param executor The executor.
+ * @param dispatcher A frozen dispatcher.
+ * @param message A request message from jesenrpc_message_parse().
+ * @param out_reply Receives the reply; see
+ * jesenrpc_dispatcher_dispatch_message().
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_executor_dispatch_message(
+    jesenrpc_executor_t *executor, const jesenrpc_dispatcher_t *dispatcher,
+    const jesenrpc_message_t *message, jesenrpc_message_t *out_reply);
+
+/**
+ * @brief Stops the workers and frees the executor.
+ * @param executor The executor to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_executor_destroy(jesenrpc_executor_t *executor);
+
+/** @} */
+
+/**
+ * @defgroup client_functions Client Functions
+ * @brief Functions for matching responses to outstanding calls.
+ * @{
+ */
+
+/**
+ * @brief Initializes a client with no pending calls.
+ * @param client The client to initialize.
+ * @param expected_in_flight Number of concurrent calls to size the table for
+ * up front. The table still grows past it. May be 0.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_init(jesenrpc_client_t *client,
+                                                 size_t expected_in_flight);
+
+/**
+ * @brief Generates the next request ID.
+ * @param client The client.
+ * @param out_id Receives a numeric ID, increasing from 1. Needs no cleanup.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_next_id(jesenrpc_client_t *client,
+                                                    jesenrpc_id_t *out_id);
+
+/**
+ * @brief Registers a call that waits for the response with the given ID.
+ * @param client The client.
+ * @param id The request ID (number or string). String ID bytes are not
+ * copied: keep them alive until the call completes or is cancelled.
+ * @param callback Invoked once with the matching response.
+ * @param user_data Passed to the callback.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_INVALID_ARGS if a call
+ *         with the same ID is already pending, or another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_track(
+    jesenrpc_client_t *client, const jesenrpc_id_t *id,
+    jesenrpc_response_callback_t callback, void *user_data);
+
+/**
+ * @brief Like jesenrpc_client_track(), but the call fails if no response
+ * arrives in time.
+ *
+ * When the deadline passes, jesenrpc_client_advance() removes the call and
+ * invokes its callback with a synthesized response: same ID, error code
+ * JESENRPC_JSONRPC_ERROR_INTERNAL and message "Request timed out".
+ *
+ * @param client The client.
+ * @param id The request ID; see jesenrpc_client_track().
+ * @param timeout Ticks from the client's current time (see
+ * jesenrpc_client_advance()) until the call expires. 0 counts as 1.
+ * @param callback Invoked once with the response or the timeout error.
+ * @param user_data Passed to the callback.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_INVALID_ARGS if a call
+ *         with the same ID is already pending, or another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_track_timeout(
+    jesenrpc_client_t *client, const jesenrpc_id_t *id, uint64_t timeout,
+    jesenrpc_response_callback_t callback, void *user_data);
+
+/**
+ * @brief Moves the client's clock forward and expires overdue calls.
+ *
+ * Ticks are in whatever unit the caller uses consistently, typically
+ * milliseconds of a monotonic clock. Call it once after
+ * jesenrpc_client_init() to set the starting time, then regularly, e.g.
+ * after each poll. Inserting and cancelling timeouts is O(1); advancing costs
+ * O(1) per elapsed tick plus the work of moving timers between levels.
+ *
+ * @param client The client.
+ * @param now The current time. Earlier times than the last call are ignored.
+ * @param out_expired Optional output for the number of calls that expired.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_advance(jesenrpc_client_t *client,
+                                                    uint64_t now,
+                                                    size_t *out_expired);
+
+/**
+ * @brief Removes a pending call without invoking its callback.
+ * @param client The client.
+ * @param id The request ID.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_VALIDATION if no call
+ *         with that ID is pending, or another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_cancel(jesenrpc_client_t *client,
+                                                   const jesenrpc_id_t *id);
+
+/**
+ * @brief Completes the pending call a response belongs to.
+ *
+ * The call is removed before its callback runs, so the callback may track
+ * new calls on the same client.
+ *
+ * @param client The client.
+ * @param response The received response.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_VALIDATION if no call
+ *         with the response's ID is pending, or another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_complete(
+    jesenrpc_client_t *client, const jesenrpc_response_t *response);
+
+/**
+ * @brief Completes the pending calls for every response in a batch.
+ * @param client The client.
+ * @param batch The received response batch.
+ * @param out_unmatched Optional output for the number of responses that had
+ * no pending call.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_complete_batch(
+    jesenrpc_client_t *client, const jesenrpc_response_batch_t *batch,
+    size_t *out_unmatched);
+
+/**
+ * @brief Frees client memory. Pending callbacks are not invoked.
+ * @param client The client to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_client_destroy(jesenrpc_client_t *client);
+
+/** @} */
+
+/**
+ * @defgroup stats_functions Statistics Functions
+ * @brief Process-wide codec counters.
+ *
+ * Counting is off until jesenrpc_stats_enable() is called; until then each
+ * counting point costs one predictable branch. Each thread counts into a
+ * cache-line aligned block of its own, so counting never contends. Blocks
+ * of exited threads are handed to new threads, and their totals are kept.
+ * Built only with JESENRPC_WITH_STATS; otherwise the counters stay zero.
+ * @{
+ */
+
+/**
+ * @brief Turns counting on or off for all threads.
+ * @param enabled Whether to count.
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS when
+ *         the library was built without statistics.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stats_enable(bool enabled);
+
+/**
+ * @brief Sums the counters of all threads.
+ * @param out Receives the totals since the process started.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note Counters are read while other threads update them, so the totals
+ * are not an atomic cut across counters. Subtract two snapshots with
+ * jesenrpc_stats_diff() to get rates.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stats_snapshot(jesenrpc_stats_t *out);
+
+/**
+ * @brief Copies the counters of the calling thread.
+ * @param out Receives the thread's counters, including counts inherited
+ * from an exited thread whose block it reuses.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_stats_thread_snapshot(jesenrpc_stats_t *out);
+
+/**
+ * @brief Adds every counter of one block to another.
+ * @param total The block to add to, e.g. when aggregating over processes.
+ * @param stats The counters to add.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stats_merge(jesenrpc_stats_t *total,
+                                                 const jesenrpc_stats_t *stats);
+
+/**
+ * @brief Computes the counts between two snapshots.
+ * @param later The later snapshot.
+ * @param earlier The earlier snapshot.
+ * @param out Receives later - earlier. May alias either input.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_stats_diff(const jesenrpc_stats_t *later,
+                                                const jesenrpc_stats_t *earlier,
+                                                jesenrpc_stats_t *out);
+
+/** @} */
+
+/**
+ * @defgroup latency_functions Latency Histogram Functions
+ * @brief Histograms, and per-method timing of the codec stages.
+ *
+ * Timing is off until jesenrpc_latency_enable() is called. Then parsing,
+ * handler dispatch and serialization are timed in nanoseconds and recorded
+ * per method name into histograms owned by the calling thread, without
+ * locks. A parsed or serialized single request is charged to its method,
+ * and a serialized single response to the method it was dispatched to.
+ * Batches, other responses, and methods beyond the first 64 names a thread
+ * sees are recorded under the empty name. Built only with
+ * JESENRPC_WITH_STATS; the histogram functions themselves are always
+ * available.
+ * @{
+ */
+
+/**
+ * @brief Empties a histogram.
+ * @param histogram The histogram to reset.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_histogram_reset(jesenrpc_histogram_t *histogram);
+
+/**
+ * @brief Records one value.
+ * @param histogram The histogram. Not thread-safe; use one per thread and
+ * merge them.
+ * @param value The value to record.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_histogram_record(jesenrpc_histogram_t *histogram, uint64_t value);
+
+/**
+ * @brief Adds every value of one histogram to another.
+ * @param total The histogram to add to.
+ * @param histogram The values to add.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_histogram_merge(jesenrpc_histogram_t *total,
+                         const jesenrpc_histogram_t *histogram);
+
+/**
+ * @brief Finds the value at a percentile.
+ * @param histogram The histogram.
+ * @param percentile Percentile between 0 and 100, e.g. 99.9.
+ * @param out_value Receives the highest value that falls in the same bucket
+ * as the percentile, capped at the largest value recorded. 0 when the
+ * histogram is empty.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_histogram_percentile(const jesenrpc_histogram_t *histogram,
+                              double percentile, uint64_t *out_value);
+
+/**
+ * @brief Turns stage timing on or off for all threads.
+ * @param enabled Whether to time.
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS when
+ *         the library was built without statistics.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_latency_enable(bool enabled);
+
+/**
+ * @brief Merges the histograms of all threads for one stage and method.
+ * @param stage The stage.
+ * @param method_name The method, "" for the values recorded without one, or
+ * NULL for all methods together.
+ * @param out Receives the merged histogram.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_latency_snapshot(jesenrpc_latency_stage_t stage,
+                          const char *method_name, jesenrpc_histogram_t *out);
+
+/**
+ * @brief Appends a JSON summary of every timed method to a buffer.
+ * @param out The buffer to append to.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note The summary maps each stage ("parse", "dispatch", "serialize") to an
+ * object keyed by method name, whose values hold count, min, mean, p50, p90,
+ * p99, p999 and max in nanoseconds.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_latency_export(jesenrpc_buf_t *out);
+
+/** @} */
+
+/**
+ * @defgroup hook_functions Hook Functions
+ * @brief Tracing callbacks around parsing, validation and serialization.
+ * @{
+ */
+
+/**
+ * @brief Installs process-wide hooks, or removes them.
+ * @param hooks The hook table, or NULL to remove the current one. Not
+ * copied: it must stay valid until it is replaced or removed.
+ * @return JESENRPC_ERR_NONE on success, or JESENRPC_ERR_INVALID_ARGS when
+ *         the library was built without hooks (JESENRPC_WITH_HOOKS=OFF).
+ * @note Not synchronized with running operations: install hooks before
+ * other threads use the library, and remove them after. Without hooks each
+ * operation pays one branch.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_set_hooks(const jesenrpc_hooks_t *hooks);
+
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
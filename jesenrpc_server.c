@@ -0,0 +1,1339 @@
+#define _GNU_SOURCE
+#include "jesenrpc_server.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef JESENRPC_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/* Bytes read per recv(). The buffer is shared by all connections, since the
+ * loop handles one connection at a time. */
+#define JRPC_SERVER_READ_SIZE (64 * 1024)
+/* recv() calls per readiness event, so one busy peer cannot starve the rest
+ * of the loop. */
+#define JRPC_SERVER_READS_PER_EVENT 4
+#define JRPC_SERVER_MAX_EVENTS 64
+/* How long listeners rest after running out of file descriptors when no
+ * connection closes in the meantime. */
+#define JRPC_SERVER_ACCEPT_RETRY_MS 100
+
+typedef enum jrpc_server_fd_kind {
+  JRPC_SERVER_FD_WAKE,
+  JRPC_SERVER_FD_LISTENER,
+  JRPC_SERVER_FD_CONNECTION
+} jrpc_server_fd_kind_t;
+
+/* First member of everything registered with epoll, which stores a pointer
+ * to it. */
+typedef struct jrpc_server_fd {
+  int fd;
+  jrpc_server_fd_kind_t kind;
+} jrpc_server_fd_t;
+
+typedef struct jrpc_listener {
+  jrpc_server_fd_t base;
+  char *unix_path; /* Removed on destroy; NULL for TCP. */
+  bool armed;      /* io_uring: a multishot accept is outstanding. */
+  struct jrpc_listener *next;
+} jrpc_listener_t;
+
+typedef struct jrpc_connection {
+  jrpc_server_fd_t base;
+  jesenrpc_stream_decoder_t decoder;
+  jesenrpc_buf_t out; /* Replies not yet written, from out_pos on. */
+  size_t out_pos;
+  uint32_t events;  /* epoll: current interest. */
+  bool peer_closed; /* Flush the remaining replies, then close. */
+  struct jrpc_connection *prev;
+  struct jrpc_connection *next;
+#ifdef JESENRPC_HAVE_IO_URING
+  /* The kernel reads from sending while new replies collect in out. */
+  jesenrpc_buf_t sending;
+  size_t send_pos;
+  unsigned inflight; /* Operations whose final completion is outstanding. */
+  bool recv_armed;
+  bool send_armed;
+  bool cancel_sent; /* Asked the kernel to stop the multishot recv. */
+  bool closing;     /* Shut down; freed once inflight reaches 0. */
+  bool dirty;
+  struct jrpc_connection *dirty_next;
+#endif
+} jrpc_connection_t;
+
+#ifdef JESENRPC_HAVE_IO_URING
+#define JRPC_URING_ENTRIES 256
+#define JRPC_URING_CQ_ENTRIES 4096
+/* Provided receive buffers. The kernel picks one per completion of a
+ * multishot recv, so idle connections do not pin any memory. */
+#define JRPC_URING_BUFFERS 128
+#define JRPC_URING_BUFFER_SIZE (16 * 1024)
+#define JRPC_URING_BUFFER_GROUP 0
+
+/* user_data carries an object pointer with the operation in the low bits;
+ * all objects come from calloc() and are at least 8-byte aligned. */
+enum {
+  JRPC_URING_OP_ACCEPT = 1,
+  JRPC_URING_OP_RECV,
+  JRPC_URING_OP_SEND,
+  JRPC_URING_OP_WAKE,
+  JRPC_URING_OP_CANCEL
+};
+#define JRPC_URING_OP_MASK 7u
+
+typedef struct jrpc_uring {
+  int fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_local_tail;
+  unsigned to_submit;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  unsigned short buf_tail;
+  char *buffers;
+  uint64_t wake_value;
+  jrpc_connection_t *dirty; /* Connections to settle after a round. */
+} jrpc_uring_t;
+#endif
+
+struct jesenrpc_server {
+  const jesenrpc_dispatcher_t *dispatcher;
+  jesenrpc_executor_t *executor;
+  jesenrpc_parse_options_t parse_options;
+  jesenrpc_server_backend_t backend;
+  size_t max_message_len;
+  size_t max_connections;
+  size_t write_high_water;
+  int epoll_fd;
+  jrpc_server_fd_t wake; /* eventfd written by jesenrpc_server_stop(). */
+  jrpc_listener_t *listeners;
+  jrpc_connection_t *connections;
+  size_t connection_count;
+  bool accepting; /* Listeners are waiting for connections. */
+  /* CLOCK_MONOTONIC ms at which to resume accepting after running out of
+   * file descriptors, or 0. */
+  uint64_t accept_retry_at;
+  bool stopped;
+  char *read_buf;
+#ifdef JESENRPC_HAVE_IO_URING
+  jrpc_uring_t uring;
+#endif
+};
+
+/* Protocol handling shared by the backends: bytes in, replies out. */
+
+static size_t jrpc_connection_pending(const jrpc_connection_t *conn) {
+  return conn->out.len - conn->out_pos;
+}
+
+static jesenrpc_err_t jrpc_connection_end_reply(jrpc_connection_t *conn) {
+  jesenrpc_err_t err = jesenrpc_buf_reserve(&conn->out, conn->out.len + 2);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  conn->out.data[conn->out.len++] = '\n';
+  conn->out.data[conn->out.len] = '\0';
+  return JESENRPC_ERR_NONE;
+}
+
+/* Answers a message the decoder rejected, with a null ID as the
+ * specification asks when the request ID cannot be determined. */
+static jesenrpc_err_t jrpc_connection_reply_error(jrpc_connection_t *conn,
+                                                  jesenrpc_err_t decode_err) {
+  static char parse_message[] = "Parse error";
+  static char invalid_message[] = "Invalid Request";
+  jesenrpc_error_object_t error;
+  memset(&error, 0, sizeof(error));
+  error.borrowed = true;
+  if (decode_err == JESENRPC_ERR_PARSE) {
+    error.code = JESENRPC_JSONRPC_ERROR_PARSE;
+    error.message = parse_message;
+  } else {
+    error.code = JESENRPC_JSONRPC_ERROR_INVALID_REQUEST;
+    error.message = invalid_message;
+  }
+  jesenrpc_response_t response;
+  memset(&response, 0, sizeof(response));
+  response.jsonrpc = JESENRPC_JSONRPC_VERSION;
+  response.id.kind = JESENRPC_ID_NULL;
+  response.error = &error;
+
+  jesenrpc_err_t err =
+      jesenrpc_response_serialize_to_buf(&response, &conn->out);
+  return err == JESENRPC_ERR_NONE ? jrpc_connection_end_reply(conn) : err;
+}
+
+static jesenrpc_err_t jrpc_connection_reply(jesenrpc_server_t *server,
+                                            jrpc_connection_t *conn,
+                                            const jesenrpc_message_t *message) {
+  if (message->kind != JESENRPC_MESSAGE_REQUEST_SINGLE &&
+      message->kind != JESENRPC_MESSAGE_REQUEST_BATCH) {
+    return JESENRPC_ERR_NONE; /* Responses from the peer are not expected. */
+  }
+  jesenrpc_message_t reply;
+  jesenrpc_err_t err =
+      server->executor
+          ? jesenrpc_executor_dispatch_message(
+                server->executor, server->dispatcher, message, &reply)
+          : jesenrpc_dispatcher_dispatch_message(server->dispatcher, message,
+                                                 &reply);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (reply.kind == JESENRPC_MESSAGE_RESPONSE_SINGLE) {
+    err = jesenrpc_response_serialize_to_buf(reply.as.response, &conn->out);
+  } else if (reply.kind == JESENRPC_MESSAGE_RESPONSE_BATCH) {
+    err = jesenrpc_response_batch_serialize_to_buf(
+        reply.as.response_batch.items, reply.as.response_batch.count,
+        &conn->out);
+  } else {
+    return JESENRPC_ERR_NONE; /* Notifications only. */
+  }
+  jesenrpc_message_destroy(&reply);
+  return err == JESENRPC_ERR_NONE ? jrpc_connection_end_reply(conn) : err;
+}
+
+/* Feeds received bytes and dispatches every message they complete. */
+static jesenrpc_err_t jrpc_connection_consume(jesenrpc_server_t *server,
+                                              jrpc_connection_t *conn,
+                                              const char *data, size_t len) {
+  jesenrpc_err_t err = jesenrpc_stream_decoder_feed(&conn->decoder, data, len);
+  while (err == JESENRPC_ERR_NONE) {
+    jesenrpc_message_t message;
+    err = jesenrpc_stream_decoder_next(&conn->decoder, &message);
+    if (err == JESENRPC_ERR_PARSE || err == JESENRPC_ERR_VALIDATION) {
+      err = jrpc_connection_reply_error(conn, err);
+      continue;
+    }
+    if (err != JESENRPC_ERR_NONE ||
+        message.kind == JESENRPC_MESSAGE_UNKNOWN) {
+      break;
+    }
+    err = jrpc_connection_reply(server, conn, &message);
+    jesenrpc_message_destroy(&message);
+  }
+  if (server->parse_options.arena) {
+    jesenrpc_arena_reset(server->parse_options.arena);
+  }
+  return err;
+}
+
+static jrpc_connection_t *jrpc_connection_new(jesenrpc_server_t *server,
+                                              int fd) {
+  jrpc_connection_t *conn = (jrpc_connection_t *)calloc(1, sizeof(*conn));
+  if (!conn) {
+    return NULL;
+  }
+  conn->base.fd = fd;
+  conn->base.kind = JRPC_SERVER_FD_CONNECTION;
+  if (jesenrpc_stream_decoder_init(&conn->decoder, &server->parse_options,
+                                   server->max_message_len) !=
+      JESENRPC_ERR_NONE) {
+    free(conn);
+    return NULL;
+  }
+  return conn;
+}
+
+static void jrpc_connection_link(jesenrpc_server_t *server,
+                                 jrpc_connection_t *conn) {
+  conn->next = server->connections;
+  if (conn->next) {
+    conn->next->prev = conn;
+  }
+  server->connections = conn;
+  ++server->connection_count;
+}
+
+static void jrpc_server_set_accepting(jesenrpc_server_t *server, bool on);
+
+static uint64_t jrpc_server_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Out of file descriptors: the refused connection stays pending, so pause
+ * the listeners until a connection closes or the retry delay passes instead
+ * of being woken for it over and over. */
+static void jrpc_server_back_off(jesenrpc_server_t *server) {
+  jrpc_server_set_accepting(server, false);
+  server->accept_retry_at = jrpc_server_now_ms() + JRPC_SERVER_ACCEPT_RETRY_MS;
+}
+
+/* Unlinks, closes and frees a connection. */
+static void jrpc_connection_free(jesenrpc_server_t *server,
+                                 jrpc_connection_t *conn) {
+  close(conn->base.fd);
+  jesenrpc_stream_decoder_destroy(&conn->decoder);
+  jesenrpc_buf_destroy(&conn->out);
+#ifdef JESENRPC_HAVE_IO_URING
+  jesenrpc_buf_destroy(&conn->sending);
+#endif
+  if (conn->prev) {
+    conn->prev->next = conn->next;
+  } else {
+    server->connections = conn->next;
+  }
+  if (conn->next) {
+    conn->next->prev = conn->prev;
+  }
+  free(conn);
+  --server->connection_count;
+  jrpc_server_set_accepting(server, true);
+}
+
+/* Returns false when the connection must be refused. */
+static bool jrpc_server_admit(jesenrpc_server_t *server,
+                              const jrpc_listener_t *listener, int fd) {
+  if (server->max_connections != 0 &&
+      server->connection_count >= server->max_connections) {
+    return false;
+  }
+  if (!listener->unix_path) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return true;
+}
+
+/* epoll backend: level-triggered readiness, with reads and writes issued
+ * directly from the loop. */
+
+static jesenrpc_err_t jrpc_epoll_watch(jesenrpc_server_t *server, int op,
+                                       jrpc_server_fd_t *entry,
+                                       uint32_t events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = entry;
+  return epoll_ctl(server->epoll_fd, op, entry->fd, &ev) == 0
+             ? JESENRPC_ERR_NONE
+             : JESENRPC_ERR_IO;
+}
+
+/* Reads while replies can be buffered; writes while replies are pending. */
+static jesenrpc_err_t jrpc_epoll_update_events(jesenrpc_server_t *server,
+                                               jrpc_connection_t *conn) {
+  uint32_t events = 0;
+  if (!conn->peer_closed &&
+      jrpc_connection_pending(conn) < server->write_high_water) {
+    events |= EPOLLIN;
+  }
+  if (jrpc_connection_pending(conn) > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events == conn->events) {
+    return JESENRPC_ERR_NONE;
+  }
+  conn->events = events;
+  return jrpc_epoll_watch(server, EPOLL_CTL_MOD, &conn->base, events);
+}
+
+/* Returns JESENRPC_ERR_IO when the connection is broken. */
+static jesenrpc_err_t jrpc_epoll_flush(jrpc_connection_t *conn) {
+  while (jrpc_connection_pending(conn) > 0) {
+    ssize_t n = send(conn->base.fd, conn->out.data + conn->out_pos,
+                     jrpc_connection_pending(conn), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return JESENRPC_ERR_IO;
+    }
+    conn->out_pos += (size_t)n;
+  }
+  if (conn->out_pos == conn->out.len) {
+    jesenrpc_buf_clear(&conn->out);
+    conn->out_pos = 0;
+  } else if (conn->out_pos > conn->out.len / 2) {
+    /* Keep the unsent tail at the front so the buffer does not creep. */
+    size_t rest = jrpc_connection_pending(conn);
+    memmove(conn->out.data, conn->out.data + conn->out_pos, rest + 1);
+    conn->out.len = rest;
+    conn->out_pos = 0;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_epoll_read(jesenrpc_server_t *server,
+                                      jrpc_connection_t *conn) {
+  for (int i = 0; i < JRPC_SERVER_READS_PER_EVENT; ++i) {
+    if (jrpc_connection_pending(conn) >= server->write_high_water) {
+      break;
+    }
+    ssize_t n = recv(conn->base.fd, server->read_buf, JRPC_SERVER_READ_SIZE, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return JESENRPC_ERR_IO;
+    }
+    if (n == 0) {
+      conn->peer_closed = true;
+      break;
+    }
+    jesenrpc_err_t err =
+        jrpc_connection_consume(server, conn, server->read_buf, (size_t)n);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+    if ((size_t)n < JRPC_SERVER_READ_SIZE) {
+      break; /* Drained the socket; skip the EAGAIN round trip. */
+    }
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static void jrpc_epoll_handle(jesenrpc_server_t *server,
+                              jrpc_connection_t *conn, uint32_t events) {
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    err = jrpc_epoll_read(server, conn);
+  }
+  /* Write right away: most replies fit the socket buffer, which saves
+   * waiting for an EPOLLOUT round. */
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_epoll_flush(conn);
+  }
+  if (err == JESENRPC_ERR_NONE && conn->peer_closed &&
+      jrpc_connection_pending(conn) == 0) {
+    err = JESENRPC_ERR_IO; /* Done with this peer. */
+  }
+  if (err == JESENRPC_ERR_NONE) {
+    err = jrpc_epoll_update_events(server, conn);
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    jrpc_connection_free(server, conn); /* close() leaves the epoll set. */
+  }
+}
+
+static void jrpc_epoll_accept(jesenrpc_server_t *server,
+                              jrpc_listener_t *listener) {
+  while (server->accepting) {
+    if (server->max_connections != 0 &&
+        server->connection_count >= server->max_connections) {
+      jrpc_server_set_accepting(server, false);
+      return;
+    }
+    int fd = accept4(listener->base.fd, NULL, NULL,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno == EMFILE || errno == ENFILE) {
+        jrpc_server_back_off(server);
+      }
+      return;
+    }
+    jrpc_connection_t *conn = NULL;
+    if (jrpc_server_admit(server, listener, fd)) {
+      conn = jrpc_connection_new(server, fd);
+    }
+    if (conn) {
+      conn->events = EPOLLIN;
+      if (jrpc_epoll_watch(server, EPOLL_CTL_ADD, &conn->base,
+                           conn->events) != JESENRPC_ERR_NONE) {
+        jesenrpc_stream_decoder_destroy(&conn->decoder);
+        free(conn);
+        conn = NULL;
+      }
+    }
+    if (!conn) {
+      close(fd);
+      continue;
+    }
+    jrpc_connection_link(server, conn);
+  }
+}
+
+static jesenrpc_err_t jrpc_epoll_poll(jesenrpc_server_t *server,
+                                      int timeout_ms) {
+  struct epoll_event events[JRPC_SERVER_MAX_EVENTS];
+  int count =
+      epoll_wait(server->epoll_fd, events, JRPC_SERVER_MAX_EVENTS, timeout_ms);
+  if (count < 0) {
+    return errno == EINTR ? JESENRPC_ERR_NONE : JESENRPC_ERR_IO;
+  }
+  for (int i = 0; i < count; ++i) {
+    jrpc_server_fd_t *entry = (jrpc_server_fd_t *)events[i].data.ptr;
+    if (entry->kind == JRPC_SERVER_FD_WAKE) {
+      uint64_t value = 0;
+      if (read(entry->fd, &value, sizeof(value)) == sizeof(value)) {
+        server->stopped = true;
+      }
+    } else if (entry->kind == JRPC_SERVER_FD_LISTENER) {
+      jrpc_epoll_accept(server, (jrpc_listener_t *)entry);
+    } else {
+      /* A connection is only closed while handling its own event, and
+       * epoll reports each descriptor at most once per wait. */
+      jrpc_epoll_handle(server, (jrpc_connection_t *)entry, events[i].events);
+    }
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+#ifdef JESENRPC_HAVE_IO_URING
+/* io_uring backend: a multishot accept per listener and a multishot recv per
+ * connection drawing from a shared ring of provided buffers, so steady
+ * traffic costs no system call per message. Completions are handled in
+ * rounds; afterwards each connection touched in the round gets at most one
+ * send covering all its new replies, and everything queued goes to the
+ * kernel in a single io_uring_enter(). */
+
+static uint64_t jrpc_uring_data(const void *object, unsigned op) {
+  return (uint64_t)(uintptr_t)object | op;
+}
+
+static jesenrpc_err_t jrpc_uring_enter(jrpc_uring_t *ring, bool wait,
+                                       int timeout_ms) {
+  unsigned submit = ring->to_submit;
+  if (submit == 0 && !wait) {
+    return JESENRPC_ERR_NONE;
+  }
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  void *argp = NULL;
+  size_t argsz = 0;
+  if (wait && timeout_ms >= 0) {
+    memset(&ts, 0, sizeof(ts));
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+  long ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait ? 1 : 0,
+                     flags, argp, argsz);
+  if (ret < 0) {
+    /* Interrupted or timed out waiting; nothing was consumed. */
+    return errno == EINTR || errno == ETIME ? JESENRPC_ERR_NONE
+                                            : JESENRPC_ERR_IO;
+  }
+  ring->to_submit -= (unsigned)ret < submit ? (unsigned)ret : submit;
+  return JESENRPC_ERR_NONE;
+}
+
+static struct io_uring_sqe *jrpc_uring_sqe(jrpc_uring_t *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sq_local_tail - head > ring->sq_mask) {
+    jrpc_uring_enter(ring, false, 0); /* Full: hand the batch over. */
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head > ring->sq_mask) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* Publishes the entry returned by the last jrpc_uring_sqe(). */
+static void jrpc_uring_push(jrpc_uring_t *ring) {
+  ++ring->sq_local_tail;
+  ++ring->to_submit;
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static void jrpc_uring_recycle(jrpc_uring_t *ring, unsigned short bid) {
+  struct io_uring_buf *buf =
+      &ring->buf_ring->bufs[ring->buf_tail & (JRPC_URING_BUFFERS - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(ring->buffers +
+                                    (size_t)bid * JRPC_URING_BUFFER_SIZE);
+  buf->len = JRPC_URING_BUFFER_SIZE;
+  buf->bid = bid;
+  ++ring->buf_tail;
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static bool jrpc_uring_arm_accept(jesenrpc_server_t *server,
+                                  jrpc_listener_t *listener) {
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(&server->uring);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listener->base.fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = jrpc_uring_data(listener, JRPC_URING_OP_ACCEPT);
+  jrpc_uring_push(&server->uring);
+  listener->armed = true;
+  return true;
+}
+
+static bool jrpc_uring_arm_wake(jesenrpc_server_t *server) {
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(&server->uring);
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = server->wake.fd;
+  sqe->addr = (uint64_t)(uintptr_t)&server->uring.wake_value;
+  sqe->len = sizeof(server->uring.wake_value);
+  sqe->user_data = jrpc_uring_data(server, JRPC_URING_OP_WAKE);
+  jrpc_uring_push(&server->uring);
+  return true;
+}
+
+static void jrpc_uring_cancel(jesenrpc_server_t *server, uint64_t target) {
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(&server->uring);
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = JRPC_URING_OP_CANCEL;
+  jrpc_uring_push(&server->uring);
+}
+
+static void jrpc_uring_mark(jesenrpc_server_t *server,
+                            jrpc_connection_t *conn) {
+  if (!conn->dirty) {
+    conn->dirty = true;
+    conn->dirty_next = server->uring.dirty;
+    server->uring.dirty = conn;
+  }
+}
+
+static void jrpc_uring_close(jesenrpc_server_t *server,
+                             jrpc_connection_t *conn) {
+  if (!conn->closing) {
+    conn->closing = true;
+    /* Ends the outstanding recv and send, after which the record can go. */
+    shutdown(conn->base.fd, SHUT_RDWR);
+  }
+  jrpc_uring_mark(server, conn);
+}
+
+static size_t jrpc_uring_pending(const jrpc_connection_t *conn) {
+  return jrpc_connection_pending(conn) + conn->sending.len - conn->send_pos;
+}
+
+static void jrpc_uring_send(jesenrpc_server_t *server,
+                            jrpc_connection_t *conn) {
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(&server->uring);
+  if (!sqe) {
+    jrpc_uring_close(server, conn);
+    return;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = conn->base.fd;
+  sqe->addr = (uint64_t)(uintptr_t)(conn->sending.data + conn->send_pos);
+  sqe->len = (uint32_t)(conn->sending.len - conn->send_pos);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = jrpc_uring_data(conn, JRPC_URING_OP_SEND);
+  jrpc_uring_push(&server->uring);
+  conn->send_armed = true;
+  ++conn->inflight;
+}
+
+static void jrpc_uring_recv(jesenrpc_server_t *server,
+                            jrpc_connection_t *conn) {
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(&server->uring);
+  if (!sqe) {
+    jrpc_uring_close(server, conn);
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->base.fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = JRPC_URING_BUFFER_GROUP;
+  sqe->user_data = jrpc_uring_data(conn, JRPC_URING_OP_RECV);
+  jrpc_uring_push(&server->uring);
+  conn->recv_armed = true;
+  conn->cancel_sent = false;
+  ++conn->inflight;
+}
+
+/* Queues what a connection needs after a round of completions: the next
+ * send, a recv (re)arm or cancel for flow control, or its release. */
+static void jrpc_uring_settle(jesenrpc_server_t *server,
+                              jrpc_connection_t *conn) {
+  if (conn->closing) {
+    if (conn->inflight == 0) {
+      jrpc_connection_free(server, conn);
+    }
+    return;
+  }
+  if (!conn->send_armed && jrpc_connection_pending(conn) > 0) {
+    /* The drained send buffer collects the next round of replies. */
+    jesenrpc_buf_t next = conn->sending;
+    conn->sending = conn->out;
+    conn->send_pos = conn->out_pos;
+    conn->out = next;
+    conn->out_pos = 0;
+    jesenrpc_buf_clear(&conn->out);
+    jrpc_uring_send(server, conn);
+  }
+  size_t pending = jrpc_uring_pending(conn);
+  if (conn->closing) {
+    return;
+  }
+  if (conn->peer_closed) {
+    if (pending == 0 && !conn->send_armed) {
+      jrpc_uring_close(server, conn);
+    }
+  } else if (pending >= server->write_high_water) {
+    if (conn->recv_armed && !conn->cancel_sent) {
+      jrpc_uring_cancel(server, jrpc_uring_data(conn, JRPC_URING_OP_RECV));
+      conn->cancel_sent = true;
+    }
+  } else if (!conn->recv_armed) {
+    jrpc_uring_recv(server, conn);
+  }
+}
+
+static void jrpc_uring_on_accept(jesenrpc_server_t *server,
+                                 jrpc_listener_t *listener,
+                                 const struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    listener->armed = false;
+  }
+  if (cqe->res < 0) {
+    if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+      jrpc_server_back_off(server);
+    } else if (!listener->armed && server->accepting) {
+      jrpc_uring_arm_accept(server, listener);
+    }
+    return;
+  }
+  /* A multishot accept cannot leave connections in the backlog, so those
+   * racing a pause at max_connections are refused. */
+  int fd = cqe->res;
+  jrpc_connection_t *conn = NULL;
+  if (server->accepting && jrpc_server_admit(server, listener, fd)) {
+    conn = jrpc_connection_new(server, fd);
+  }
+  if (conn) {
+    jrpc_connection_link(server, conn);
+    jrpc_uring_mark(server, conn); /* Settling arms the first recv. */
+  } else {
+    close(fd);
+  }
+  if (server->max_connections != 0 &&
+      server->connection_count >= server->max_connections) {
+    jrpc_server_set_accepting(server, false);
+  } else if (!listener->armed && server->accepting) {
+    jrpc_uring_arm_accept(server, listener);
+  }
+}
+
+static void jrpc_uring_on_recv(jesenrpc_server_t *server,
+                               jrpc_connection_t *conn,
+                               const struct io_uring_cqe *cqe) {
+  jrpc_uring_mark(server, conn);
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    conn->recv_armed = false;
+    --conn->inflight;
+  }
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    unsigned short bid =
+        (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe->res > 0 && !conn->closing &&
+        jrpc_connection_consume(server, conn,
+                                server->uring.buffers +
+                                    (size_t)bid * JRPC_URING_BUFFER_SIZE,
+                                (size_t)cqe->res) != JESENRPC_ERR_NONE) {
+      jrpc_uring_close(server, conn);
+    }
+    jrpc_uring_recycle(&server->uring, bid);
+  } else if (cqe->res == 0) {
+    conn->peer_closed = true;
+  } else if (cqe->res < 0 && cqe->res != -ENOBUFS &&
+             cqe->res != -ECANCELED) {
+    /* Out of buffers or paused: settling re-arms once replies drain. */
+    jrpc_uring_close(server, conn);
+  }
+}
+
+static void jrpc_uring_on_send(jesenrpc_server_t *server,
+                               jrpc_connection_t *conn,
+                               const struct io_uring_cqe *cqe) {
+  jrpc_uring_mark(server, conn);
+  conn->send_armed = false;
+  --conn->inflight;
+  if (cqe->res < 0) {
+    jrpc_uring_close(server, conn);
+    return;
+  }
+  conn->send_pos += (size_t)cqe->res;
+  if (conn->send_pos < conn->sending.len) {
+    if (!conn->closing) {
+      jrpc_uring_send(server, conn); /* Short send: the rest. */
+    }
+    return;
+  }
+  jesenrpc_buf_clear(&conn->sending);
+  conn->send_pos = 0;
+}
+
+static jesenrpc_err_t jrpc_uring_poll(jesenrpc_server_t *server,
+                                      int timeout_ms) {
+  jrpc_uring_t *ring = &server->uring;
+  unsigned head = *ring->cq_head;
+  bool ready = head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  jesenrpc_err_t err =
+      jrpc_uring_enter(ring, !ready && timeout_ms != 0, timeout_ms);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    unsigned op = (unsigned)(cqe->user_data & JRPC_URING_OP_MASK);
+    void *object =
+        (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)JRPC_URING_OP_MASK);
+    if (op == JRPC_URING_OP_ACCEPT) {
+      jrpc_uring_on_accept(server, (jrpc_listener_t *)object, cqe);
+    } else if (op == JRPC_URING_OP_RECV) {
+      jrpc_uring_on_recv(server, (jrpc_connection_t *)object, cqe);
+    } else if (op == JRPC_URING_OP_SEND) {
+      jrpc_uring_on_send(server, (jrpc_connection_t *)object, cqe);
+    } else if (op == JRPC_URING_OP_WAKE) {
+      if (cqe->res == (int)sizeof(ring->wake_value)) {
+        server->stopped = true;
+      }
+      jrpc_uring_arm_wake(server);
+    }
+    /* Cancel completions carry nothing to act on. */
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  while (ring->dirty) {
+    jrpc_connection_t *conn = ring->dirty;
+    ring->dirty = conn->dirty_next;
+    conn->dirty = false;
+    jrpc_uring_settle(server, conn);
+  }
+  return jrpc_uring_enter(ring, false, 0);
+}
+
+static void jrpc_uring_teardown(jrpc_uring_t *ring) {
+  /* Closing the ring cancels everything in flight. */
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->buf_ring) {
+    munmap(ring->buf_ring, ring->buf_ring_size);
+  }
+  free(ring->buffers);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static void *jrpc_uring_map(int fd, size_t size, uint64_t offset) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, (off_t)offset);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* IORING_RECV_MULTISHOT arrived in Linux 6.0, after everything else used
+ * here, and a kernel without it only says so when a recv completes. Try one
+ * on a socketpair with a byte waiting and the read side shut down: it must
+ * deliver the byte and keep going until end of file. */
+static jesenrpc_err_t jrpc_uring_probe_recv(jrpc_uring_t *ring) {
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+    return JESENRPC_ERR_IO;
+  }
+  struct io_uring_sqe *sqe = jrpc_uring_sqe(ring);
+  if (!sqe || send(pair[1], "", 1, MSG_NOSIGNAL) != 1) {
+    close(pair[0]);
+    close(pair[1]);
+    return JESENRPC_ERR_IO;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = pair[0];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = JRPC_URING_BUFFER_GROUP;
+  sqe->user_data = JRPC_URING_OP_CANCEL; /* Ignored if seen by poll. */
+  jrpc_uring_push(ring);
+  shutdown(pair[0], SHUT_RD);
+
+  bool delivered = false;
+  int result = 0;
+  bool done = false;
+  while (!done) {
+    if (jrpc_uring_enter(ring, true, -1) != JESENRPC_ERR_NONE) {
+      break;
+    }
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && !done; ++head) {
+      const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+      if (cqe->flags & IORING_CQE_F_BUFFER) {
+        jrpc_uring_recycle(ring,
+                           (unsigned short)(cqe->flags >>
+                                            IORING_CQE_BUFFER_SHIFT));
+      }
+      if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE)) {
+        delivered = true;
+      }
+      result = cqe->res;
+      done = !(cqe->flags & IORING_CQE_F_MORE);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+  close(pair[0]);
+  close(pair[1]);
+  if (!done || !delivered) {
+    errno = result < 0 ? -result : ENOSYS;
+    return JESENRPC_ERR_IO;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+static jesenrpc_err_t jrpc_uring_setup(jesenrpc_server_t *server) {
+  jrpc_uring_t *ring = &server->uring;
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+                 IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = JRPC_URING_CQ_ENTRIES;
+  ring->fd = (int)syscall(__NR_io_uring_setup, JRPC_URING_ENTRIES, &params);
+  if (ring->fd < 0) {
+    return JESENRPC_ERR_IO;
+  }
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+  ring->sq_ring =
+      jrpc_uring_map(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  if (!ring->sq_ring) {
+    return JESENRPC_ERR_IO;
+  }
+  ring->cq_ring = single_mmap ? ring->sq_ring
+                              : jrpc_uring_map(ring->fd, ring->cq_ring_size,
+                                               IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)jrpc_uring_map(
+      ring->fd, ring->sqes_size, IORING_OFF_SQES);
+  if (!ring->cq_ring || !ring->sqes) {
+    return JESENRPC_ERR_IO;
+  }
+
+  char *sq = (char *)ring->sq_ring;
+  char *cq = (char *)ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_local_tail = *ring->sq_tail;
+  unsigned *array = (unsigned *)(sq + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; ++i) {
+    array[i] = i; /* Entries are used in ring order. */
+  }
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  ring->buf_ring_size = JRPC_URING_BUFFERS * sizeof(struct io_uring_buf);
+  void *buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring == MAP_FAILED) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  ring->buf_ring = (struct io_uring_buf_ring *)buf_ring;
+  ring->buffers =
+      (char *)malloc((size_t)JRPC_URING_BUFFERS * JRPC_URING_BUFFER_SIZE);
+  if (!ring->buffers) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  /* Provided buffer rings and multishot accept need Linux 5.19; multishot
+   * recv is probed for below. */
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+  reg.ring_entries = JRPC_URING_BUFFERS;
+  reg.bgid = JRPC_URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) != 0) {
+    return JESENRPC_ERR_IO;
+  }
+  for (unsigned short i = 0; i < JRPC_URING_BUFFERS; ++i) {
+    jrpc_uring_recycle(ring, i);
+  }
+  jesenrpc_err_t err = jrpc_uring_probe_recv(ring);
+  if (err != JESENRPC_ERR_NONE) {
+    return err;
+  }
+  if (!jrpc_uring_arm_wake(server)) {
+    return JESENRPC_ERR_IO;
+  }
+  return jrpc_uring_enter(ring, false, 0);
+}
+#endif /* JESENRPC_HAVE_IO_URING */
+
+/* Listeners stop taking connections while accepting is paused, either at
+ * max_connections or when the process is out of file descriptors, so a
+ * pending connection cannot keep waking the loop. */
+static void jrpc_server_set_accepting(jesenrpc_server_t *server, bool on) {
+  if (on) {
+    server->accept_retry_at = 0;
+  }
+  if (server->accepting == on) {
+    return;
+  }
+  server->accepting = on;
+  for (jrpc_listener_t *l = server->listeners; l; l = l->next) {
+#ifdef JESENRPC_HAVE_IO_URING
+    if (server->backend == JESENRPC_SERVER_BACKEND_IO_URING) {
+      if (on && !l->armed) {
+        jrpc_uring_arm_accept(server, l);
+      } else if (!on && l->armed) {
+        jrpc_uring_cancel(server, jrpc_uring_data(l, JRPC_URING_OP_ACCEPT));
+      }
+      continue;
+    }
+#endif
+    if (on) {
+      jrpc_epoll_watch(server, EPOLL_CTL_ADD, &l->base, EPOLLIN);
+    } else {
+      epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, l->base.fd, NULL);
+    }
+  }
+}
+
+static jesenrpc_err_t jrpc_server_add_listener(jesenrpc_server_t *server,
+                                               int fd, const char *unix_path) {
+  jrpc_listener_t *listener = (jrpc_listener_t *)calloc(1, sizeof(*listener));
+  if (!listener) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  listener->base.fd = fd;
+  listener->base.kind = JRPC_SERVER_FD_LISTENER;
+  if (unix_path) {
+    listener->unix_path = strdup(unix_path);
+    if (!listener->unix_path) {
+      free(listener);
+      return JESENRPC_ERR_ALLOC;
+    }
+  }
+  jesenrpc_err_t err =
+      listen(fd, SOMAXCONN) == 0 ? JESENRPC_ERR_NONE : JESENRPC_ERR_IO;
+  if (err == JESENRPC_ERR_NONE && server->accepting) {
+#ifdef JESENRPC_HAVE_IO_URING
+    if (server->backend == JESENRPC_SERVER_BACKEND_IO_URING) {
+      err = jrpc_uring_arm_accept(server, listener)
+                ? jrpc_uring_enter(&server->uring, false, 0)
+                : JESENRPC_ERR_IO;
+    } else
+#endif
+    {
+      err = jrpc_epoll_watch(server, EPOLL_CTL_ADD, &listener->base, EPOLLIN);
+    }
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    free(listener->unix_path);
+    free(listener);
+    return err;
+  }
+  listener->next = server->listeners;
+  server->listeners = listener;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_server_create(const jesenrpc_dispatcher_t *dispatcher,
+                                      const jesenrpc_server_options_t *options,
+                                      jesenrpc_server_t **out_server) {
+  if (!dispatcher || !dispatcher->frozen || !out_server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  jesenrpc_server_t *server =
+      (jesenrpc_server_t *)calloc(1, sizeof(*server));
+  if (!server) {
+    return JESENRPC_ERR_ALLOC;
+  }
+  server->dispatcher = dispatcher;
+  server->max_message_len = JESENRPC_SERVER_DEFAULT_MAX_MESSAGE;
+  server->write_high_water = JESENRPC_SERVER_DEFAULT_HIGH_WATER;
+  server->accepting = true;
+  server->epoll_fd = -1;
+  server->wake.fd = -1;
+  server->wake.kind = JRPC_SERVER_FD_WAKE;
+#ifdef JESENRPC_HAVE_IO_URING
+  server->uring.fd = -1;
+#endif
+  if (options) {
+    if (options->parse_options) {
+      server->parse_options = *options->parse_options;
+    }
+    server->executor = options->executor;
+    server->backend = options->backend;
+    server->max_connections = options->max_connections;
+    if (options->max_message_len != 0) {
+      server->max_message_len = options->max_message_len;
+    }
+    if (options->write_high_water != 0) {
+      server->write_high_water = options->write_high_water;
+    }
+  }
+
+  jesenrpc_err_t err = JESENRPC_ERR_NONE;
+  server->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (server->wake.fd < 0) {
+    err = JESENRPC_ERR_IO;
+  } else if (server->backend == JESENRPC_SERVER_BACKEND_IO_URING) {
+#ifdef JESENRPC_HAVE_IO_URING
+    err = jrpc_uring_setup(server);
+#else
+    errno = ENOSYS;
+    err = JESENRPC_ERR_IO;
+#endif
+  } else if (server->backend == JESENRPC_SERVER_BACKEND_EPOLL) {
+    server->read_buf = (char *)malloc(JRPC_SERVER_READ_SIZE);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!server->read_buf) {
+      err = JESENRPC_ERR_ALLOC;
+    } else if (server->epoll_fd < 0) {
+      err = JESENRPC_ERR_IO;
+    } else {
+      err = jrpc_epoll_watch(server, EPOLL_CTL_ADD, &server->wake, EPOLLIN);
+    }
+  } else {
+    err = JESENRPC_ERR_INVALID_ARGS;
+  }
+  if (err != JESENRPC_ERR_NONE) {
+    int saved = errno;
+    jesenrpc_server_destroy(server);
+    errno = saved;
+    return err;
+  }
+  *out_server = server;
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_server_listen_tcp(jesenrpc_server_t *server,
+                                          const char *host, uint16_t port,
+                                          uint16_t *out_port) {
+  if (!server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = host ? AF_UNSPEC : AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", (unsigned)port);
+  struct addrinfo *addrs = NULL;
+  if (getaddrinfo(host, service, &hints, &addrs) != 0) {
+    errno = EADDRNOTAVAIL;
+    return JESENRPC_ERR_IO;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *ai = addrs; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0) {
+    return JESENRPC_ERR_IO;
+  }
+
+  if (out_port) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+      close(fd);
+      return JESENRPC_ERR_IO;
+    }
+    *out_port = ntohs(addr.ss_family == AF_INET6
+                          ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                          : ((struct sockaddr_in *)&addr)->sin_port);
+  }
+  jesenrpc_err_t err = jrpc_server_add_listener(server, fd, NULL);
+  if (err != JESENRPC_ERR_NONE) {
+    close(fd);
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_server_listen_unix(jesenrpc_server_t *server,
+                                           const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  if (!server || !path || strlen(path) >= sizeof(addr.sun_path)) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path));
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return JESENRPC_ERR_IO;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return JESENRPC_ERR_IO;
+  }
+  jesenrpc_err_t err = jrpc_server_add_listener(server, fd, path);
+  if (err != JESENRPC_ERR_NONE) {
+    unlink(path);
+    close(fd);
+  }
+  return err;
+}
+
+static jesenrpc_err_t jrpc_server_poll_backend(jesenrpc_server_t *server,
+                                               int timeout_ms) {
+#ifdef JESENRPC_HAVE_IO_URING
+  if (server->backend == JESENRPC_SERVER_BACKEND_IO_URING) {
+    return jrpc_uring_poll(server, timeout_ms);
+  }
+#endif
+  return jrpc_epoll_poll(server, timeout_ms);
+}
+
+jesenrpc_err_t jesenrpc_server_poll(jesenrpc_server_t *server,
+                                    int timeout_ms) {
+  if (!server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  /* Wake up in time to resume accepting after backing off. */
+  if (server->accept_retry_at) {
+    uint64_t now = jrpc_server_now_ms();
+    int rest = now < server->accept_retry_at
+                   ? (int)(server->accept_retry_at - now)
+                   : 0;
+    if (timeout_ms < 0 || rest < timeout_ms) {
+      timeout_ms = rest;
+    }
+  }
+  jesenrpc_err_t err = jrpc_server_poll_backend(server, timeout_ms);
+  if (err == JESENRPC_ERR_NONE && server->accept_retry_at &&
+      jrpc_server_now_ms() >= server->accept_retry_at) {
+    jrpc_server_set_accepting(server, true);
+  }
+  return err;
+}
+
+jesenrpc_err_t jesenrpc_server_run(jesenrpc_server_t *server) {
+  if (!server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  server->stopped = false;
+  while (!server->stopped) {
+    jesenrpc_err_t err = jesenrpc_server_poll(server, -1);
+    if (err != JESENRPC_ERR_NONE) {
+      return err;
+    }
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_server_stop(jesenrpc_server_t *server) {
+  if (!server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  uint64_t one = 1;
+  /* EAGAIN means the counter is saturated, so a stop is already pending. */
+  if (write(server->wake.fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    return JESENRPC_ERR_IO;
+  }
+  return JESENRPC_ERR_NONE;
+}
+
+jesenrpc_err_t jesenrpc_server_destroy(jesenrpc_server_t *server) {
+  if (!server) {
+    return JESENRPC_ERR_INVALID_ARGS;
+  }
+  server->accepting = true; /* Nothing to resume while tearing down. */
+#ifdef JESENRPC_HAVE_IO_URING
+  /* Before freeing anything the kernel may still write to. */
+  jrpc_uring_teardown(&server->uring);
+#endif
+  while (server->connections) {
+    jrpc_connection_free(server, server->connections);
+  }
+  jrpc_listener_t *listener = server->listeners;
+  while (listener) {
+    jrpc_listener_t *next = listener->next;
+    close(listener->base.fd);
+    if (listener->unix_path) {
+      unlink(listener->unix_path);
+      free(listener->unix_path);
+    }
+    free(listener);
+    listener = next;
+  }
+  if (server->wake.fd >= 0) {
+    close(server->wake.fd);
+  }
+  if (server->epoll_fd >= 0) {
+    close(server->epoll_fd);
+  }
+  free(server->read_buf);
+  free(server);
+  return JESENRPC_ERR_NONE;
+}
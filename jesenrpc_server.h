@@ -0,0 +1,173 @@
+/**
+ * @file jesenrpc_server.h
+ * @brief Optional socket server that serves a jesenrpc dispatcher.
+ *
+ * The server runs a non-blocking, single-threaded event loop over TCP and Unix
+ * domain stream sockets, driven by epoll or, where the kernel supports it,
+ * io_uring (see jesenrpc_server_backend_t). Each connection carries a stream
+ * of JSON-RPC messages, one after another; whitespace between them (such as
+ * newlines) is ignored. Every request is parsed, dispatched and answered in
+ * arrival order, and each reply is followed by a newline. Linux only; built as
+ * the separate jesenrpc_server library when JESENRPC_BUILD_SERVER is enabled.
+ *
+ * ## Usage Example
+ *
+ * @code
+ * jesenrpc_server_t *server = NULL;
+ * jesenrpc_server_create(&dispatcher, NULL, &server);
+ * jesenrpc_server_listen_tcp(server, "127.0.0.1", 4000, NULL);
+ * jesenrpc_server_listen_unix(server, "/run/myservice.sock");
+ * jesenrpc_server_run(server); // until jesenrpc_server_stop()
+ * jesenrpc_server_destroy(server);
+ * @endcode
+ */
+
+#pragma once
+
+#include "jesenrpc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup server Socket Server
+ * @brief Serving a dispatcher over stream sockets.
+ * @{
+ */
+
+/** Default for jesenrpc_server_options_t::max_message_len. */
+#define JESENRPC_SERVER_DEFAULT_MAX_MESSAGE (16u * 1024u * 1024u)
+
+/** Default for jesenrpc_server_options_t::write_high_water. */
+#define JESENRPC_SERVER_DEFAULT_HIGH_WATER (1024u * 1024u)
+
+/**
+ * @brief Kernel interface driving the event loop.
+ */
+typedef enum jesenrpc_server_backend {
+  /** Readiness notification with epoll. Available everywhere. */
+  JESENRPC_SERVER_BACKEND_EPOLL = 0,
+  /** Completion-based io_uring with multishot accept and receive into
+   * kernel-selected buffers, and one system call per loop iteration for all
+   * sends. Needs Linux 6.0 or newer and a library built with io_uring
+   * support. */
+  JESENRPC_SERVER_BACKEND_IO_URING
+} jesenrpc_server_backend_t;
+
+/**
+ * @brief Optional settings for jesenrpc_server_create().
+ *
+ * Zero-initialize and set only the fields you need.
+ */
+typedef struct jesenrpc_server_options {
+  /** Options for parsing requests. With an arena, the server resets it after
+   * handling each chunk of received bytes. May be NULL. */
+  const jesenrpc_parse_options_t *parse_options;
+  /** Dispatches batches on worker threads. May be NULL. */
+  jesenrpc_executor_t *executor;
+  /** Largest request in bytes, or 0 for
+   * JESENRPC_SERVER_DEFAULT_MAX_MESSAGE. */
+  size_t max_message_len;
+  /** Open connections at which accepting pauses, or 0 for no limit. */
+  size_t max_connections;
+  /** Unsent reply bytes at which a connection stops reading, or 0 for
+   * JESENRPC_SERVER_DEFAULT_HIGH_WATER. */
+  size_t write_high_water;
+  /** Event loop implementation. */
+  jesenrpc_server_backend_t backend;
+} jesenrpc_server_options_t;
+
+/**
+ * @brief Event loop serving a dispatcher. Opaque; create with
+ * jesenrpc_server_create().
+ *
+ * Apart from jesenrpc_server_stop(), functions must be called from one
+ * thread at a time.
+ */
+typedef struct jesenrpc_server jesenrpc_server_t;
+
+/**
+ * @brief Creates a server without any listening sockets.
+ * @param dispatcher A frozen dispatcher. Must outlive the server.
+ * @param options Server settings (copied). May be NULL.
+ * @param out_server Output pointer to receive the server.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_IO if the event loop
+ *         could not be set up (errno holds the cause, such as ENOSYS when
+ *         io_uring is not compiled in or not supported by the kernel), or
+ *         another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_create(
+    const jesenrpc_dispatcher_t *dispatcher,
+    const jesenrpc_server_options_t *options, jesenrpc_server_t **out_server);
+
+/**
+ * @brief Listens for TCP connections.
+ * @param server The server.
+ * @param host Numeric address or host name to bind, or NULL for all IPv4
+ * interfaces.
+ * @param port Port to bind, or 0 to pick a free one.
+ * @param out_port Optional output for the bound port.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_IO if the socket could not
+ *         be bound (errno holds the cause), or another error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_listen_tcp(
+    jesenrpc_server_t *server, const char *host, uint16_t port,
+    uint16_t *out_port);
+
+/**
+ * @brief Listens for connections on a Unix domain socket.
+ * @param server The server.
+ * @param path Filesystem path of the socket. It must not exist yet; the server
+ * removes it again in jesenrpc_server_destroy().
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_IO if the socket could not
+ *         be bound (errno holds the cause), or another error code.
+ */
+JESENRPC_API jesenrpc_err_t
+jesenrpc_server_listen_unix(jesenrpc_server_t *server, const char *path);
+
+/**
+ * @brief Waits for socket activity once and handles it.
+ *
+ * Accepts connections, reads and dispatches requests, and writes replies.
+ * Use this to drive the server from an existing loop; jesenrpc_server_run()
+ * calls it repeatedly.
+ *
+ * @param server The server.
+ * @param timeout_ms Longest wait in milliseconds, 0 to not wait, or -1 to
+ * wait indefinitely.
+ * @return JESENRPC_ERR_NONE on success, JESENRPC_ERR_IO if waiting failed, or
+ *         another error code. Failures on a single connection only close that
+ *         connection.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_poll(jesenrpc_server_t *server,
+                                                 int timeout_ms);
+
+/**
+ * @brief Serves requests until jesenrpc_server_stop() is called.
+ * @param server The server.
+ * @return JESENRPC_ERR_NONE once stopped, or the error from
+ *         jesenrpc_server_poll().
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_run(jesenrpc_server_t *server);
+
+/**
+ * @brief Makes jesenrpc_server_run() return.
+ * @param server The server.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ * @note Safe to call from any thread and from signal handlers.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_stop(jesenrpc_server_t *server);
+
+/**
+ * @brief Closes all sockets and frees the server.
+ * @param server The server to destroy.
+ * @return JESENRPC_ERR_NONE on success, or an error code.
+ */
+JESENRPC_API jesenrpc_err_t jesenrpc_server_destroy(jesenrpc_server_t *server);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,11 @@
+/* The checks call the code under test, so keep them in Release builds. */
+#undef NDEBUG
+
 #include "../jesenrpc.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define EXPECT_OK(expr) assert((expr) == JESENRPC_ERR_NONE)
@@ -271,6 +275,163 @@ static void test_message_parse_response_batch(void) {
   EXPECT_OK(jesenrpc_response_destroy(resp2));
 }
 
+static void test_serialize_writes_envelope_directly(void) {
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_string(&id, "a\"b\\c\n", 6));
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create_with_id("sub\ttract", &id, &req));
+  EXPECT_OK(jesenrpc_id_destroy(&id));
+
+  char buf[128];
+  EXPECT_OK(jesenrpc_request_serialize(req, buf, sizeof buf));
+  assert(strcmp(buf, "{\"jsonrpc\":\"2.0\",\"id\":\"a\\\"b\\\\c\\n\","
+                     "\"method\":\"sub\\ttract\"}") == 0);
+
+  jesenrpc_request_t *parsed = NULL;
+  EXPECT_OK(jesenrpc_request_parse(buf, strlen(buf), &parsed));
+  assert(strcmp(parsed->method_name, "sub\ttract") == 0);
+  assert(parsed->id.value.string.len == 6);
+  assert(memcmp(parsed->id.value.string.data, "a\"b\\c\n", 6) == 0);
+  EXPECT_OK(jesenrpc_request_destroy(parsed));
+
+  char small[16];
+  assert(jesenrpc_request_serialize(req, small, sizeof small) ==
+         JESENRPC_ERR_INVALID_ARGS);
+  EXPECT_OK(jesenrpc_request_destroy(req));
+
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create(-3, &resp));
+  jesenrpc_error_object_t *err_obj = NULL;
+  EXPECT_OK(jesenrpc_error_object_create(JESENRPC_JSONRPC_ERROR_INTERNAL,
+                                         "boom", &err_obj));
+  EXPECT_OK(jesenrpc_response_set_error(resp, err_obj));
+  EXPECT_OK(jesenrpc_response_serialize(resp, buf, sizeof buf));
+  assert(strcmp(buf, "{\"jsonrpc\":\"2.0\",\"id\":-3,\"error\":{\"code\":-32603,"
+                     "\"message\":\"boom\"}}") == 0);
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+}
+
+static void test_serialize_len_and_growable_buf(void) {
+  jesen_node_t *params = NULL;
+  EXPECT_OK(jesen_array_create(&params));
+  for (int32_t i = 0; i < 200; ++i) {
+    EXPECT_OK(jesen_array_add_int32(params, i * 1000));
+  }
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("bulk", &req));
+  EXPECT_OK(jesenrpc_request_set_params(req, params));
+
+  size_t required = 0;
+  EXPECT_OK(jesenrpc_request_serialize_len(req, NULL, 0, &required));
+  assert(required > 200);
+
+  char small[64];
+  size_t reported = 0;
+  assert(jesenrpc_request_serialize_len(req, small, sizeof small, &reported) ==
+         JESENRPC_ERR_BUFFER_TOO_SMALL);
+  assert(reported == required);
+
+  jesenrpc_buf_t out;
+  EXPECT_OK(jesenrpc_buf_init(&out));
+  EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+  assert(out.len == required);
+  assert(strlen(out.data) == required);
+
+  size_t written = 0;
+  char *exact = (char *)malloc(required + 1);
+  EXPECT_OK(jesenrpc_request_serialize_len(req, exact, required + 1, &written));
+  assert(written == required);
+  assert(strcmp(exact, out.data) == 0);
+  free(exact);
+
+  char *warm_data = out.data;
+  size_t warm_cap = out.cap;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_OK(jesenrpc_buf_clear(&out));
+    EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+    assert(out.data == warm_data);
+    assert(out.cap == warm_cap);
+  }
+
+  jesenrpc_request_t *reqs[2] = {req, req};
+  EXPECT_OK(jesenrpc_request_batch_serialize_len(
+      (jesenrpc_request_t *const *)reqs, 2, NULL, 0, &required));
+  assert(required == 2 * out.len + 3);
+  EXPECT_OK(jesenrpc_buf_clear(&out));
+  EXPECT_OK(jesenrpc_request_batch_serialize_to_buf(
+      (jesenrpc_request_t *const *)reqs, 2, &out));
+  assert(out.len == required);
+
+  /* Trees of any size grow the buffer; there is no fixed ceiling. */
+  size_t huge_len = (size_t)17 << 20;
+  char *huge_text = (char *)malloc(huge_len);
+  memset(huge_text, 'x', huge_len);
+  jesen_node_t *huge = NULL;
+  EXPECT_OK(jesen_array_create(&huge));
+  EXPECT_OK(jesen_array_add_string(huge, huge_text, huge_len));
+  free(huge_text);
+  EXPECT_OK(jesenrpc_request_set_params(req, huge));
+  EXPECT_OK(jesenrpc_request_serialize_len(req, NULL, 0, &required));
+  assert(required > huge_len);
+  EXPECT_OK(jesenrpc_buf_clear(&out));
+  EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+  assert(out.len == required);
+
+  EXPECT_OK(jesenrpc_buf_destroy(&out));
+  EXPECT_OK(jesenrpc_request_destroy(req));
+}
+
+static void test_arena_parse_and_reset(void) {
+  jesenrpc_arena_t arena;
+  EXPECT_OK(jesenrpc_arena_init(&arena, 0));
+  jesenrpc_parse_options_t opts = {0};
+  opts.arena = &arena;
+
+  struct jesenrpc_arena_block *warm_block = NULL;
+  for (int round = 0; round < 3; ++round) {
+    char batch[] = "[{\"jsonrpc\":\"2.0\",\"id\":\"r1\",\"method\":\"add\","
+                   "\"params\":[1,2]},{\"jsonrpc\":\"2.0\",\"method\":\"log\"}]";
+    jesenrpc_message_t msg;
+    EXPECT_OK(jesenrpc_message_parse_ex(batch, strlen(batch), &opts, &msg));
+    assert(msg.kind == JESENRPC_MESSAGE_REQUEST_BATCH);
+    assert(msg.as.request_batch.count == 2);
+    jesenrpc_request_t *first = msg.as.request_batch.items[0];
+    assert(first->arena == &arena);
+    assert(strcmp(first->method_name, "add") == 0);
+    assert(first->id.value.string.borrowed);
+    assert(first->params != NULL);
+
+    /* Replacing an arena-owned ID must not free arena memory. */
+    jesenrpc_id_t id = {0};
+    EXPECT_OK(jesenrpc_id_set_number(&id, 5));
+    EXPECT_OK(jesenrpc_request_set_id(first, &id));
+
+    char resp_buf[] = "{\"jsonrpc\":\"2.0\",\"id\":\"x\",\"error\":{\"code\":-32000,"
+                      "\"message\":\"busy\",\"data\":{\"retry\":true}}}";
+    jesenrpc_response_t *resp = NULL;
+    EXPECT_OK(
+        jesenrpc_response_parse_ex(resp_buf, strlen(resp_buf), &opts, &resp));
+    assert(resp->error->arena == &arena);
+    assert(strcmp(resp->error->message, "busy") == 0);
+
+    /* Destroy is a no-op for arena-owned structures. */
+    EXPECT_OK(jesenrpc_response_destroy(resp));
+    EXPECT_OK(jesenrpc_message_destroy(&msg));
+
+    EXPECT_OK(jesenrpc_arena_reset(&arena));
+    assert(arena.blocks != NULL);
+    if (round == 1) {
+      warm_block = arena.blocks;
+    } else if (round > 1) {
+      /* Once warm the arena reuses the same single block. */
+      assert(arena.blocks == warm_block);
+    }
+  }
+
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+  assert(arena.blocks == NULL);
+}
+
 static void test_message_empty_batch_is_validation(void) {
   char buf[] = "[]";
   jesenrpc_message_t msg;
@@ -278,6 +439,1207 @@ static void test_message_empty_batch_is_validation(void) {
   assert(err == JESENRPC_ERR_VALIDATION);
 }
 
+static void test_in_situ_parse_borrows_input(void) {
+  jesenrpc_parse_options_t opts = {0};
+  opts.flags = JESENRPC_PARSE_IN_SITU;
+
+  char req_buf[] = "{\"method\":\"a\\/b\\u00e9\",\"params\":{\"x\":[1,{}]},"
+                   "\"id\":\"k\\\"1\",\"jsonrpc\":\"2.0\"}";
+  const char *begin = req_buf;
+  const char *end = req_buf + sizeof(req_buf);
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_parse_ex(req_buf, strlen(req_buf), &opts, &req));
+  assert(req->method_name >= begin && req->method_name < end);
+  assert(strcmp(req->method_name, "a/b\xc3\xa9") == 0);
+  assert(req->id.kind == JESENRPC_ID_STRING);
+  assert(req->id.value.string.data >= begin && req->id.value.string.data < end);
+  assert(req->id.value.string.len == 3);
+  assert(memcmp(req->id.value.string.data, "k\"1", 3) == 0);
+  assert(req->params != NULL);
+  EXPECT_OK(jesenrpc_request_validate(req));
+  EXPECT_OK(jesenrpc_request_destroy(req));
+
+  char resp_buf[] = " {\"jsonrpc\":\"2.0\",\"id\":-9007199254740993,"
+                    "\"error\":{\"code\":-32601,\"message\":\"no\\nsuch\"}} ";
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(
+      jesenrpc_response_parse_ex(resp_buf, strlen(resp_buf), &opts, &resp));
+  assert(resp->id.value.number == -9007199254740993LL);
+  assert(resp->error->code == -32601);
+  assert(strcmp(resp->error->message, "no\nsuch") == 0);
+  assert(resp->error->message > resp_buf &&
+         resp->error->message < resp_buf + sizeof(resp_buf));
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+
+  char batch_buf[] = "[{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[true]},"
+                     "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":"
+                     "{\"code\":-32700,\"message\":\"bad\"}}]";
+  jesenrpc_message_t msg;
+  EXPECT_OK(
+      jesenrpc_message_parse_ex(batch_buf, strlen(batch_buf), &opts, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_RESPONSE_BATCH);
+  assert(msg.as.response_batch.count == 2);
+  assert(msg.as.response_batch.items[1]->id.kind == JESENRPC_ID_NULL);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+
+  /* Views also work on top of an arena. */
+  jesenrpc_arena_t arena;
+  EXPECT_OK(jesenrpc_arena_init(&arena, 0));
+  opts.arena = &arena;
+  char notify_buf[] = "{\"jsonrpc\":\"2.0\",\"method\":\"tick\"}";
+  EXPECT_OK(
+      jesenrpc_message_parse_ex(notify_buf, strlen(notify_buf), &opts, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(msg.as.request->id.kind == JESENRPC_ID_NONE);
+  assert(msg.as.request->method_name == notify_buf + 27);
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+  opts.arena = NULL;
+
+  char trailing[] = "{\"jsonrpc\":\"2.0\",\"method\":\"m\"} x";
+  assert(jesenrpc_request_parse_ex(trailing, strlen(trailing), &opts, &req) ==
+         JESENRPC_ERR_PARSE);
+  char version[] = "{\"jsonrpc\":\"1.0\",\"method\":\"m\"}";
+  assert(jesenrpc_request_parse_ex(version, strlen(version), &opts, &req) ==
+         JESENRPC_ERR_VALIDATION);
+  char empty[] = " [ ] ";
+  assert(jesenrpc_message_parse_ex(empty, strlen(empty), &opts, &msg) ==
+         JESENRPC_ERR_VALIDATION);
+}
+
+static jesenrpc_err_t echo_index_handler(const jesenrpc_request_t *request,
+                                         jesenrpc_response_t *response,
+                                         void *user_data) {
+  (void)request;
+  int *calls = (int *)user_data;
+  ++calls[0];
+  if (!response) {
+    return JESENRPC_ERR_NONE;
+  }
+  jesen_node_t *result = NULL;
+  EXPECT_OK(jesen_object_create(&result));
+  EXPECT_OK(jesen_object_add_int32(result, "calls", calls[0]));
+  return jesenrpc_response_set_result(response, result);
+}
+
+static jesenrpc_err_t failing_handler(const jesenrpc_request_t *request,
+                                      jesenrpc_response_t *response,
+                                      void *user_data) {
+  (void)request;
+  (void)response;
+  (void)user_data;
+  return JESENRPC_ERR_VALIDATION;
+}
+
+static void test_dispatcher_routes_and_reports_unknown(void) {
+  enum { METHOD_COUNT = 300 };
+  static int calls[METHOD_COUNT];
+  jesenrpc_dispatcher_t dispatcher;
+  EXPECT_OK(jesenrpc_dispatcher_init(&dispatcher));
+  char name[32];
+  for (int i = 0; i < METHOD_COUNT; ++i) {
+    snprintf(name, sizeof(name), "service.method_%d", i);
+    EXPECT_OK(jesenrpc_dispatcher_register(&dispatcher, name,
+                                           echo_index_handler, &calls[i]));
+  }
+  assert(jesenrpc_dispatcher_register(&dispatcher, "service.method_7",
+                                      echo_index_handler, NULL) ==
+         JESENRPC_ERR_INVALID_ARGS);
+  EXPECT_OK(
+      jesenrpc_dispatcher_register(&dispatcher, "fails", failing_handler, NULL));
+  EXPECT_OK(jesenrpc_dispatcher_freeze(&dispatcher));
+  assert(jesenrpc_dispatcher_register(&dispatcher, "late", failing_handler,
+                                      NULL) == JESENRPC_ERR_INVALID_ARGS);
+
+  for (int i = 0; i < METHOD_COUNT; ++i) {
+    snprintf(name, sizeof(name), "service.method_%d", i);
+    void *user_data = NULL;
+    assert(jesenrpc_dispatcher_lookup(&dispatcher, name, NULL, &user_data));
+    assert(user_data == &calls[i]);
+  }
+  assert(!jesenrpc_dispatcher_lookup(&dispatcher, "service.method_300", NULL,
+                                     NULL));
+
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("service.method_42", &req));
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_number(&id, 9));
+  EXPECT_OK(jesenrpc_request_set_id(req, &id));
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_dispatcher_dispatch(&dispatcher, req, &resp));
+  assert(calls[42] == 1);
+  assert(resp->result != NULL && resp->id.value.number == 9);
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+  EXPECT_OK(jesenrpc_request_destroy(req));
+
+  char batch[] =
+      "[{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"service.method_0\"},"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"service.method_1\"},"
+      "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"nope\"},"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"nope\"},"
+      "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"fails\"}]";
+  jesenrpc_message_t msg;
+  EXPECT_OK(jesenrpc_message_parse(batch, strlen(batch), &msg));
+  jesenrpc_message_t reply;
+  EXPECT_OK(jesenrpc_dispatcher_dispatch_message(&dispatcher, &msg, &reply));
+  assert(reply.kind == JESENRPC_MESSAGE_RESPONSE_BATCH);
+  assert(reply.as.response_batch.count == 3);
+  assert(calls[0] == 1 && calls[1] == 1);
+  jesenrpc_response_t **items = reply.as.response_batch.items;
+  assert(items[0]->result != NULL);
+  assert(items[1]->error->code == JESENRPC_JSONRPC_ERROR_METHOD_NOT_FOUND);
+  assert(items[1]->id.value.number == 2);
+  assert(items[2]->error->code == JESENRPC_JSONRPC_ERROR_INTERNAL);
+  EXPECT_OK(jesenrpc_message_destroy(&reply));
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+
+  char notification[] = "{\"jsonrpc\":\"2.0\",\"method\":\"nope\"}";
+  EXPECT_OK(jesenrpc_message_parse(notification, strlen(notification), &msg));
+  EXPECT_OK(jesenrpc_dispatcher_dispatch_message(&dispatcher, &msg, &reply));
+  assert(reply.kind == JESENRPC_MESSAGE_UNKNOWN);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+}
+
+static void test_int64_ids_are_lossless(void) {
+  static const struct {
+    const char *text;
+    int64_t value;
+  } cases[] = {
+      {"9007199254740993", 9007199254740993LL},
+      {"-9007199254740993", -9007199254740993LL},
+      {"9223372036854775807", INT64_MAX},
+      {"-9223372036854775808", INT64_MIN},
+      {"1.5e3", 1500},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":0}",
+             cases[i].text);
+    jesenrpc_response_t *resp = NULL;
+    EXPECT_OK(jesenrpc_response_parse(buf, strlen(buf), &resp));
+    assert(resp->id.kind == JESENRPC_ID_NUMBER);
+    assert(resp->id.value.number == cases[i].value);
+    jesenrpc_response_destroy(resp);
+
+    jesenrpc_request_t *req = NULL;
+    jesenrpc_id_t id = {0};
+    EXPECT_OK(jesenrpc_id_set_number(&id, cases[i].value));
+    EXPECT_OK(jesenrpc_request_create_with_id("m", &id, &req));
+    char out[128];
+    EXPECT_OK(jesenrpc_request_serialize(req, out, sizeof out));
+    char expected[128];
+    snprintf(expected, sizeof(expected),
+             "{\"jsonrpc\":\"2.0\",\"id\":%lld,\"method\":\"m\"}",
+             (long long)cases[i].value);
+    assert(strcmp(out, expected) == 0);
+    EXPECT_OK(jesenrpc_request_destroy(req));
+  }
+
+  static const char *const rejected[] = {"9223372036854775808",
+                                         "-9223372036854775809", "1.5"};
+  for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); ++i) {
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "{\"jsonrpc\":\"2.0\",\"id\":%s,\"method\":\"m\"}", rejected[i]);
+    jesenrpc_request_t *req = NULL;
+    assert(jesenrpc_request_parse(buf, strlen(buf), &req) ==
+           JESENRPC_ERR_VALIDATION);
+  }
+}
+
+static void test_stream_decoder_handles_split_chunks(void) {
+  static const char stream[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"a}\\\"[\",\"params\":[{}]}\n"
+      "  [{\"jsonrpc\":\"2.0\",\"method\":\"n\"},"
+      "{\"jsonrpc\":\"2.0\",\"id\":\"x{\",\"method\":\"b\"}]"
+      "{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":{\"s\":\"]]\\\\\"}}";
+  static const jesenrpc_message_kind_t expected[] = {
+      JESENRPC_MESSAGE_REQUEST_SINGLE, JESENRPC_MESSAGE_REQUEST_BATCH,
+      JESENRPC_MESSAGE_RESPONSE_SINGLE};
+  size_t stream_len = strlen(stream);
+
+  /* Every chunk size, including one byte at a time. */
+  for (size_t chunk = 1; chunk <= stream_len; ++chunk) {
+    jesenrpc_stream_decoder_t decoder;
+    EXPECT_OK(jesenrpc_stream_decoder_init(&decoder, NULL, 0));
+    size_t seen = 0;
+    for (size_t off = 0; off < stream_len; off += chunk) {
+      size_t n = stream_len - off < chunk ? stream_len - off : chunk;
+      EXPECT_OK(jesenrpc_stream_decoder_feed(&decoder, stream + off, n));
+      jesenrpc_message_t msg;
+      for (;;) {
+        EXPECT_OK(jesenrpc_stream_decoder_next(&decoder, &msg));
+        if (msg.kind == JESENRPC_MESSAGE_UNKNOWN) {
+          break;
+        }
+        assert(seen < 3 && msg.kind == expected[seen]);
+        if (seen == 0) {
+          assert(strcmp(msg.as.request->method_name, "a}\"[") == 0);
+        }
+        ++seen;
+        EXPECT_OK(jesenrpc_message_destroy(&msg));
+      }
+    }
+    assert(seen == 3);
+    EXPECT_OK(jesenrpc_stream_decoder_destroy(&decoder));
+  }
+
+  /* Stray bytes and oversized values are reported without losing sync. */
+  jesenrpc_stream_decoder_t decoder;
+  EXPECT_OK(jesenrpc_stream_decoder_init(&decoder, NULL, 64));
+  static const char noisy[] =
+      "xx{\"jsonrpc\":\"2.0\",\"method\":\"big\",\"params\":"
+      "[\"0123456789012345678901234567890123456789\"]}"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"ok\"}";
+  EXPECT_OK(jesenrpc_stream_decoder_feed(&decoder, noisy, strlen(noisy)));
+  jesenrpc_message_t msg;
+  assert(jesenrpc_stream_decoder_next(&decoder, &msg) == JESENRPC_ERR_PARSE);
+  assert(jesenrpc_stream_decoder_next(&decoder, &msg) ==
+         JESENRPC_ERR_VALIDATION);
+  EXPECT_OK(jesenrpc_stream_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(strcmp(msg.as.request->method_name, "ok") == 0);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_stream_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_UNKNOWN);
+  EXPECT_OK(jesenrpc_stream_decoder_destroy(&decoder));
+}
+
+static void test_frame_decoder_handles_split_chunks(void) {
+  /* Framed by the encoder, then two hand-written frames with extra headers,
+   * other spellings and bare newlines. */
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("initialize", &req));
+  jesenrpc_buf_t stream;
+  EXPECT_OK(jesenrpc_buf_init(&stream));
+  size_t mark = 0;
+  EXPECT_OK(jesenrpc_frame_begin(&stream, &mark));
+  assert(mark == 0 && stream.len == JESENRPC_FRAME_HEADER_LEN);
+  EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &stream));
+  size_t body_len = stream.len - JESENRPC_FRAME_HEADER_LEN;
+  EXPECT_OK(jesenrpc_frame_end(&stream, mark));
+  char header[JESENRPC_FRAME_HEADER_LEN + 1];
+  snprintf(header, sizeof(header), "Content-Length: %010zu\r\n\r\n", body_len);
+  assert(memcmp(stream.data, header, JESENRPC_FRAME_HEADER_LEN) == 0);
+  EXPECT_OK(jesenrpc_request_destroy(req));
+
+  static const char tail[] =
+      "\r\ncontent-length:33\r\n"
+      "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n\r\n"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}\n"
+      "CONTENT-LENGTH: 38 \n\n"
+      "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":null}";
+  size_t tail_len = strlen(tail);
+  EXPECT_OK(jesenrpc_buf_reserve(&stream, stream.len + tail_len + 1));
+  memcpy(stream.data + stream.len, tail, tail_len + 1);
+  stream.len += tail_len;
+
+  static const jesenrpc_message_kind_t expected[] = {
+      JESENRPC_MESSAGE_REQUEST_SINGLE, JESENRPC_MESSAGE_REQUEST_SINGLE,
+      JESENRPC_MESSAGE_RESPONSE_SINGLE};
+  for (size_t chunk = 1; chunk <= stream.len; ++chunk) {
+    jesenrpc_frame_decoder_t decoder;
+    EXPECT_OK(jesenrpc_frame_decoder_init(&decoder, NULL, 0));
+    size_t seen = 0;
+    for (size_t off = 0; off < stream.len; off += chunk) {
+      size_t n = stream.len - off < chunk ? stream.len - off : chunk;
+      EXPECT_OK(jesenrpc_frame_decoder_feed(&decoder, stream.data + off, n));
+      jesenrpc_message_t msg;
+      for (;;) {
+        EXPECT_OK(jesenrpc_frame_decoder_next(&decoder, &msg));
+        if (msg.kind == JESENRPC_MESSAGE_UNKNOWN) {
+          break;
+        }
+        assert(seen < 3 && msg.kind == expected[seen]);
+        if (seen < 2) {
+          assert(strcmp(msg.as.request->method_name,
+                        seen == 0 ? "initialize" : "exit") == 0);
+        }
+        ++seen;
+        EXPECT_OK(jesenrpc_message_destroy(&msg));
+      }
+    }
+    assert(seen == 3);
+    EXPECT_OK(jesenrpc_frame_decoder_destroy(&decoder));
+  }
+  EXPECT_OK(jesenrpc_buf_destroy(&stream));
+
+  /* Bad headers and oversized bodies are reported without losing sync; the
+   * oversized body is skipped across feeds. */
+  jesenrpc_frame_decoder_t decoder;
+  EXPECT_OK(jesenrpc_frame_decoder_init(&decoder, NULL, 40));
+  static const char noisy[] =
+      "Content-Type: text/plain\r\n\r\n"
+      "Content-Length: 12x\r\n\r\n"
+      "Content-Length: 48\r\n\r\n"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"big\",";
+  static const char rest[] =
+      "\"params\":[1234]}"
+      "Content-Length: 31\r\n\r\n"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"ok\"}";
+  EXPECT_OK(jesenrpc_frame_decoder_feed(&decoder, noisy, strlen(noisy)));
+  jesenrpc_message_t msg;
+  assert(jesenrpc_frame_decoder_next(&decoder, &msg) == JESENRPC_ERR_PARSE);
+  assert(jesenrpc_frame_decoder_next(&decoder, &msg) == JESENRPC_ERR_PARSE);
+  assert(jesenrpc_frame_decoder_next(&decoder, &msg) ==
+         JESENRPC_ERR_VALIDATION);
+  EXPECT_OK(jesenrpc_frame_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_UNKNOWN);
+  EXPECT_OK(jesenrpc_frame_decoder_feed(&decoder, rest, strlen(rest)));
+  EXPECT_OK(jesenrpc_frame_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(strcmp(msg.as.request->method_name, "ok") == 0);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_frame_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_UNKNOWN);
+  EXPECT_OK(jesenrpc_frame_decoder_destroy(&decoder));
+}
+
+static void test_ndjson_splits_lines_in_place(void) {
+  char replay[] = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"a\\nb\"}\n"
+                  "\r\n  \n"
+                  "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":7}\r\n"
+                  "{oops}\n"
+                  "[{\"jsonrpc\":\"2.0\",\"method\":\"n\"}]";
+  size_t replay_len = strlen(replay);
+  jesenrpc_parse_options_t opts = {0};
+  opts.flags = JESENRPC_PARSE_IN_SITU;
+  size_t offset = 0;
+  jesenrpc_message_t msg;
+  EXPECT_OK(jesenrpc_ndjson_parse_next(replay, replay_len, &offset, &opts,
+                                       &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(msg.as.request->method_name > replay &&
+         msg.as.request->method_name < replay + replay_len);
+  assert(strcmp(msg.as.request->method_name, "a\nb") == 0);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_ndjson_parse_next(replay, replay_len, &offset, &opts,
+                                       &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_RESPONSE_SINGLE);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  assert(jesenrpc_ndjson_parse_next(replay, replay_len, &offset, &opts,
+                                    &msg) == JESENRPC_ERR_PARSE);
+  EXPECT_OK(jesenrpc_ndjson_parse_next(replay, replay_len, &offset, &opts,
+                                       &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_BATCH);
+  assert(offset == replay_len);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_ndjson_parse_next(replay, replay_len, &offset, &opts,
+                                       &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_UNKNOWN);
+
+  static const char stream[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"a\"}\n\n"
+      "{\"jsonrpc\":\"2.0\",\"id\":2,\"error\":{\"code\":1,\"message\":\"m\"}}"
+      "\r\n[{\"jsonrpc\":\"2.0\",\"method\":\"n\"}]\n";
+  size_t stream_len = strlen(stream);
+  for (size_t chunk = 1; chunk <= stream_len; ++chunk) {
+    jesenrpc_ndjson_decoder_t decoder;
+    EXPECT_OK(jesenrpc_ndjson_decoder_init(&decoder, NULL, 0));
+    size_t seen = 0;
+    for (size_t off = 0; off < stream_len; off += chunk) {
+      size_t n = stream_len - off < chunk ? stream_len - off : chunk;
+      EXPECT_OK(jesenrpc_ndjson_decoder_feed(&decoder, stream + off, n));
+      for (;;) {
+        EXPECT_OK(jesenrpc_ndjson_decoder_next(&decoder, &msg));
+        if (msg.kind == JESENRPC_MESSAGE_UNKNOWN) {
+          break;
+        }
+        ++seen;
+        EXPECT_OK(jesenrpc_message_destroy(&msg));
+      }
+    }
+    assert(seen == 3);
+    EXPECT_OK(jesenrpc_ndjson_decoder_destroy(&decoder));
+  }
+
+  /* A long line is reported once and dropped up to its line feed, even when
+   * it arrives in pieces. */
+  jesenrpc_ndjson_decoder_t decoder;
+  EXPECT_OK(jesenrpc_ndjson_decoder_init(&decoder, NULL, 40));
+  static const char big[] = "{\"jsonrpc\":\"2.0\",\"method\":\"big\",";
+  static const char rest[] = "\"params\":[1234]}\n"
+                             "{\"jsonrpc\":\"2.0\",\"method\":\"ok\"}\n";
+  EXPECT_OK(jesenrpc_ndjson_decoder_feed(&decoder, big, strlen(big)));
+  EXPECT_OK(jesenrpc_ndjson_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_UNKNOWN);
+  EXPECT_OK(jesenrpc_ndjson_decoder_feed(&decoder, big, strlen(big)));
+  assert(jesenrpc_ndjson_decoder_next(&decoder, &msg) ==
+         JESENRPC_ERR_VALIDATION);
+  assert(decoder.buf.len - decoder.line_start == 0);
+  EXPECT_OK(jesenrpc_ndjson_decoder_feed(&decoder, rest, strlen(rest)));
+  EXPECT_OK(jesenrpc_ndjson_decoder_next(&decoder, &msg));
+  assert(msg.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(strcmp(msg.as.request->method_name, "ok") == 0);
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_ndjson_decoder_destroy(&decoder));
+}
+
+static void test_stats_count_codec_activity(void) {
+  if (jesenrpc_stats_enable(true) != JESENRPC_ERR_NONE) {
+    printf("Skipping statistics test: built without JESENRPC_WITH_STATS\n");
+    return;
+  }
+  jesenrpc_stats_t before;
+  EXPECT_OK(jesenrpc_stats_snapshot(&before));
+
+  char good[] = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"m\"}";
+  char bad[] = "{\"jsonrpc\":\"2.0\",";
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_parse(good, strlen(good), &req));
+  jesenrpc_request_t *broken = NULL;
+  assert(jesenrpc_request_parse(bad, strlen(bad), &broken) ==
+         JESENRPC_ERR_PARSE);
+
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create_for_request(req, &resp));
+  EXPECT_OK(jesenrpc_response_set_result_raw(resp, "true", 4));
+  jesenrpc_buf_t out;
+  EXPECT_OK(jesenrpc_buf_init(&out));
+  EXPECT_OK(jesenrpc_response_serialize_to_buf(resp, &out));
+  size_t size_only = 0;
+  EXPECT_OK(jesenrpc_response_serialize_len(resp, NULL, 0, &size_only));
+  jesenrpc_error_object_t empty = {.code = 1, .message = ""};
+  assert(jesenrpc_error_object_validate(&empty) == JESENRPC_ERR_VALIDATION);
+
+  jesenrpc_stats_t after;
+  jesenrpc_stats_t delta;
+  EXPECT_OK(jesenrpc_stats_snapshot(&after));
+  EXPECT_OK(jesenrpc_stats_diff(&after, &before, &delta));
+  assert(delta.parsed[JESENRPC_MESSAGE_REQUEST_SINGLE] == 1);
+  assert(delta.parse_failures[JESENRPC_ERR_PARSE - (JESENRPC_ERR_BASE)] == 1);
+  assert(delta.bytes_in == strlen(good) + strlen(bad));
+  assert(delta.validation_failures[JESENRPC_ERR_VALIDATION -
+                                   (JESENRPC_ERR_BASE)] == 1);
+  /* The size query is not counted. */
+  assert(delta.serialized[JESENRPC_MESSAGE_RESPONSE_SINGLE] == 1);
+  assert(delta.bytes_out == out.len);
+  assert(delta.allocations > 0 && delta.allocated_bytes > 0);
+
+  /* Everything happened on this thread, so its block saw all of it. */
+  jesenrpc_stats_t mine;
+  EXPECT_OK(jesenrpc_stats_thread_snapshot(&mine));
+  assert(mine.parsed[JESENRPC_MESSAGE_REQUEST_SINGLE] >= 1);
+  assert(mine.bytes_out >= out.len);
+  EXPECT_OK(jesenrpc_stats_merge(&delta, &before));
+  assert(memcmp(&delta, &after, sizeof(after)) == 0);
+
+  EXPECT_OK(jesenrpc_stats_enable(false));
+  EXPECT_OK(jesenrpc_request_parse(good, strlen(good), &broken));
+  EXPECT_OK(jesenrpc_stats_snapshot(&before));
+  assert(before.parsed[JESENRPC_MESSAGE_REQUEST_SINGLE] ==
+         after.parsed[JESENRPC_MESSAGE_REQUEST_SINGLE]);
+
+  EXPECT_OK(jesenrpc_request_destroy(broken));
+  EXPECT_OK(jesenrpc_buf_destroy(&out));
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+  EXPECT_OK(jesenrpc_request_destroy(req));
+}
+
+static void test_latency_histograms_by_method(void) {
+  jesenrpc_histogram_t low;
+  jesenrpc_histogram_t high;
+  EXPECT_OK(jesenrpc_histogram_reset(&low));
+  EXPECT_OK(jesenrpc_histogram_reset(&high));
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    EXPECT_OK(jesenrpc_histogram_record(v <= 500 ? &low : &high, v));
+  }
+  EXPECT_OK(jesenrpc_histogram_record(&high, (uint64_t)1 << 40));
+  EXPECT_OK(jesenrpc_histogram_merge(&low, &high));
+  assert(low.count == 1001 && low.min == 1 && low.max == (uint64_t)1 << 40);
+  uint64_t value = 0;
+  EXPECT_OK(jesenrpc_histogram_percentile(&low, 50.0, &value));
+  /* Buckets hold values to within 1/16. */
+  assert(value >= 501 && value <= 501 + 501 / 16);
+  EXPECT_OK(jesenrpc_histogram_percentile(&low, 0.0, &value));
+  assert(value == 1);
+  EXPECT_OK(jesenrpc_histogram_percentile(&low, 100.0, &value));
+  assert(value == low.max);
+  assert(jesenrpc_histogram_percentile(&low, 101.0, &value) ==
+         JESENRPC_ERR_INVALID_ARGS);
+
+  if (jesenrpc_latency_enable(true) != JESENRPC_ERR_NONE) {
+    printf("Skipping latency test: built without JESENRPC_WITH_STATS\n");
+    return;
+  }
+  int calls = 0;
+  jesenrpc_dispatcher_t dispatcher;
+  EXPECT_OK(jesenrpc_dispatcher_init(&dispatcher));
+  EXPECT_OK(jesenrpc_dispatcher_register(&dispatcher, "timed.method",
+                                         echo_index_handler, &calls));
+  EXPECT_OK(jesenrpc_dispatcher_freeze(&dispatcher));
+
+  char json[] = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"timed.method\"}";
+  jesenrpc_message_t msg;
+  jesenrpc_message_t reply;
+  EXPECT_OK(jesenrpc_message_parse(json, strlen(json), &msg));
+  EXPECT_OK(jesenrpc_dispatcher_dispatch_message(&dispatcher, &msg, &reply));
+  jesenrpc_buf_t out;
+  EXPECT_OK(jesenrpc_buf_init(&out));
+
+  /* A reply dropped unserialized leaves nothing for the next response. */
+  jesenrpc_response_t *dropped = NULL;
+  EXPECT_OK(jesenrpc_dispatcher_dispatch(&dispatcher, msg.as.request,
+                                         &dropped));
+  EXPECT_OK(jesenrpc_response_destroy(dropped));
+  jesenrpc_response_t *manual = NULL;
+  jesenrpc_error_object_t *error = NULL;
+  EXPECT_OK(jesenrpc_response_create_for_request(msg.as.request, &manual));
+  EXPECT_OK(jesenrpc_error_object_create(-32000, "manual", &error));
+  EXPECT_OK(jesenrpc_response_set_error(manual, error));
+  EXPECT_OK(jesenrpc_response_serialize_to_buf(manual, &out));
+  EXPECT_OK(jesenrpc_response_destroy(manual));
+  /* The reply is still charged to its method once the dispatcher is gone. */
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+  EXPECT_OK(jesenrpc_response_serialize_to_buf(reply.as.response, &out));
+  EXPECT_OK(jesenrpc_latency_enable(false));
+
+  /* All three stages are charged to the request's method. */
+  jesenrpc_histogram_t h;
+  for (int stage = 0; stage < JESENRPC_LATENCY_STAGES; ++stage) {
+    EXPECT_OK(jesenrpc_latency_snapshot((jesenrpc_latency_stage_t)stage,
+                                        "timed.method", &h));
+    assert(h.count == (stage == JESENRPC_LATENCY_DISPATCH ? 2 : 1));
+  }
+  EXPECT_OK(jesenrpc_latency_snapshot(JESENRPC_LATENCY_PARSE, NULL, &h));
+  assert(h.count >= 1);
+
+  out.len = 0;
+  EXPECT_OK(jesenrpc_latency_export(&out));
+  assert(strncmp(out.data, "{\"parse\":{", 10) == 0);
+  assert(strstr(out.data, "\"timed.method\":{\"count\":1,\"min\":"));
+  assert(strstr(out.data, "\"serialize\":{"));
+
+  EXPECT_OK(jesenrpc_buf_destroy(&out));
+  EXPECT_OK(jesenrpc_message_destroy(&reply));
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+}
+
+typedef struct {
+  bool exit;
+  jesenrpc_hook_event_t event;
+} hook_record_t;
+
+typedef struct {
+  hook_record_t records[16];
+  size_t count;
+} hook_log_t;
+
+static void log_hook(bool exit, const jesenrpc_hook_event_t *event,
+                     void *user_data) {
+  hook_log_t *log = (hook_log_t *)user_data;
+  assert(log->count < sizeof(log->records) / sizeof(log->records[0]));
+  log->records[log->count].exit = exit;
+  log->records[log->count].event = *event;
+  ++log->count;
+}
+
+static void log_enter(const jesenrpc_hook_event_t *event, void *user_data) {
+  log_hook(false, event, user_data);
+}
+
+static void log_exit(const jesenrpc_hook_event_t *event, void *user_data) {
+  log_hook(true, event, user_data);
+}
+
+static void test_hooks_trace_codec_entry_points(void) {
+  hook_log_t log = {0};
+  jesenrpc_hooks_t hooks = {log_enter, log_exit, &log};
+  if (jesenrpc_set_hooks(&hooks) != JESENRPC_ERR_NONE) {
+    printf("Skipping hooks test: built without JESENRPC_WITH_HOOKS\n");
+    return;
+  }
+
+  char json[] = "{\"jsonrpc\":\"2.0\",\"id\":5,\"method\":\"traced\"}";
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_parse(json, strlen(json), &req));
+  assert(log.count == 2);
+  hook_record_t *r = log.records;
+  assert(!r[0].exit && r[0].event.op == JESENRPC_HOOK_PARSE);
+  assert(r[0].event.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(r[0].event.bytes == strlen(json) && !r[0].event.method_name);
+  assert(r[1].exit && r[1].event.err == JESENRPC_ERR_NONE);
+  /* Pointers are only valid during the callback; compare what they were. */
+  assert(r[1].event.method_name == req->method_name);
+  assert(r[1].event.id == &req->id);
+
+  /* Serializing encloses the validation of its input. */
+  log.count = 0;
+  jesenrpc_buf_t out;
+  EXPECT_OK(jesenrpc_buf_init(&out));
+  EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+  assert(log.count == 4);
+  assert(!r[0].exit && r[0].event.op == JESENRPC_HOOK_SERIALIZE);
+  assert(r[0].event.bytes == 0);
+  assert(!r[1].exit && r[1].event.op == JESENRPC_HOOK_VALIDATE);
+  assert(r[2].exit && r[2].event.op == JESENRPC_HOOK_VALIDATE);
+  assert(r[3].exit && r[3].event.op == JESENRPC_HOOK_SERIALIZE);
+  assert(r[3].event.kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  assert(r[3].event.bytes == out.len);
+
+  /* Failures report their error on exit. */
+  log.count = 0;
+  char bad[] = "{\"jsonrpc\":";
+  jesenrpc_message_t msg;
+  assert(jesenrpc_message_parse(bad, strlen(bad), &msg) ==
+         JESENRPC_ERR_PARSE);
+  assert(log.count == 2 && r[0].event.kind == JESENRPC_MESSAGE_UNKNOWN);
+  assert(r[1].event.err == JESENRPC_ERR_PARSE);
+  assert(r[1].event.kind == JESENRPC_MESSAGE_UNKNOWN);
+
+  EXPECT_OK(jesenrpc_set_hooks(NULL));
+  log.count = 0;
+  assert(jesenrpc_request_validate(req) == JESENRPC_ERR_NONE);
+  assert(log.count == 0);
+
+  EXPECT_OK(jesenrpc_buf_destroy(&out));
+  EXPECT_OK(jesenrpc_request_destroy(req));
+}
+
+typedef struct {
+  size_t allocs;
+  size_t frees;
+} alloc_counter_t;
+
+static void *counting_malloc(size_t size, void *context) {
+  ++((alloc_counter_t *)context)->allocs;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *context) {
+  if (!ptr) {
+    ++((alloc_counter_t *)context)->allocs;
+  }
+  return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *context) {
+  ++((alloc_counter_t *)context)->frees;
+  free(ptr);
+}
+
+static void test_allocator_routes_library_allocations(void) {
+  alloc_counter_t global = {0};
+  jesenrpc_allocator_t allocator = {counting_malloc, counting_realloc,
+                                    counting_free, &global};
+  allocator.free_fn = NULL;
+  assert(jesenrpc_set_allocator(&allocator) == JESENRPC_ERR_INVALID_ARGS);
+  allocator.free_fn = counting_free;
+  EXPECT_OK(jesenrpc_set_allocator(&allocator));
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("counted", &req));
+  assert(global.allocs >= 2); /* The struct and its method name. */
+  EXPECT_OK(jesenrpc_request_destroy(req));
+  /* Switching trims the pools, returning the struct. */
+  EXPECT_OK(jesenrpc_set_allocator(NULL));
+  assert(global.frees == global.allocs);
+
+  /* An arena routes the allocations of the calls that parse into it. */
+  alloc_counter_t local = {0};
+  jesenrpc_allocator_t scoped = {counting_malloc, counting_realloc,
+                                 counting_free, &local};
+  jesenrpc_arena_t arena;
+  EXPECT_OK(jesenrpc_arena_init_ex(&arena, 0, &scoped));
+  jesenrpc_parse_options_t opts = {0};
+  opts.arena = &arena;
+  char json[] = "{\"jsonrpc\":\"2.0\",\"id\":\"a\",\"method\":\"scoped\"}";
+  EXPECT_OK(jesenrpc_request_parse_ex(json, strlen(json), &opts, &req));
+  assert(local.allocs == 1 && local.frees == 0);
+
+  /* So does an output buffer; destroying it keeps the allocator. */
+  jesenrpc_buf_t out;
+  EXPECT_OK(jesenrpc_buf_init_ex(&out, &scoped));
+  EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+  assert(local.allocs == 2);
+  EXPECT_OK(jesenrpc_buf_destroy(&out));
+  assert(local.frees == 1 && out.allocator == &scoped);
+
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+  assert(local.frees == local.allocs);
+  assert(global.allocs == global.frees);
+}
+
+static void test_pools_reuse_destroyed_structs(void) {
+  alloc_counter_t counter = {0};
+  jesenrpc_allocator_t allocator = {counting_malloc, counting_realloc,
+                                    counting_free, &counter};
+  EXPECT_OK(jesenrpc_set_allocator(&allocator));
+
+  enum { ROUNDS = 1000 };
+  for (int i = 0; i < ROUNDS; ++i) {
+    jesenrpc_request_t *req = NULL;
+    EXPECT_OK(jesenrpc_request_create("churn", &req));
+    assert(!req->params && !req->arena && req->id.kind == JESENRPC_ID_NONE);
+    jesenrpc_id_t id = {0};
+    EXPECT_OK(jesenrpc_id_set_string(&id, "reused", 6));
+    EXPECT_OK(jesenrpc_request_set_id(req, &id));
+    EXPECT_OK(jesenrpc_id_destroy(&id));
+    jesenrpc_response_t *resp = NULL;
+    EXPECT_OK(jesenrpc_response_create_for_request(req, &resp));
+    assert(!resp->result && !resp->error);
+    jesenrpc_error_object_t *error = NULL;
+    EXPECT_OK(jesenrpc_error_object_create(-32000, "busy", &error));
+    assert(!error->data && error->code == -32000);
+    EXPECT_OK(jesenrpc_response_set_error(resp, error));
+    EXPECT_OK(jesenrpc_response_destroy(resp));
+    EXPECT_OK(jesenrpc_request_destroy(req));
+  }
+  /* Per round: the method name, three copies of the ID and the message. */
+  size_t strings = 5 * (size_t)ROUNDS;
+  if (counter.allocs > strings + 3) {
+    printf("Skipping pool reuse check: built without JESENRPC_WITH_POOLS\n");
+  } else {
+    assert(counter.allocs == strings + 3);
+    assert(counter.frees == strings);
+  }
+
+  EXPECT_OK(jesenrpc_pool_trim());
+  assert(counter.frees == counter.allocs);
+  EXPECT_OK(jesenrpc_set_allocator(NULL));
+}
+
+static jesenrpc_err_t double_id_handler(const jesenrpc_request_t *request,
+                                        jesenrpc_response_t *response,
+                                        void *user_data) {
+  (void)user_data;
+  if (!response) {
+    return JESENRPC_ERR_NONE;
+  }
+  jesen_node_t *result = NULL;
+  EXPECT_OK(jesen_object_create(&result));
+  EXPECT_OK(jesen_object_add_int32(result, "twice",
+                                   (int32_t)request->id.value.number * 2));
+  return jesenrpc_response_set_result(response, result);
+}
+
+static void test_executor_preserves_batch_order(void) {
+  enum { BATCH_SIZE = 1000 };
+  jesenrpc_dispatcher_t dispatcher;
+  EXPECT_OK(jesenrpc_dispatcher_init(&dispatcher));
+  EXPECT_OK(jesenrpc_dispatcher_register(&dispatcher, "double",
+                                         double_id_handler, NULL));
+  EXPECT_OK(jesenrpc_dispatcher_freeze(&dispatcher));
+
+  /* Every third entry is a notification and gets no response. */
+  jesenrpc_message_t msg = {.kind = JESENRPC_MESSAGE_REQUEST_BATCH};
+  jesenrpc_request_batch_t *batch = &msg.as.request_batch;
+  batch->items = (jesenrpc_request_t **)calloc(BATCH_SIZE, sizeof(void *));
+  assert(batch->items);
+  batch->count = BATCH_SIZE;
+  for (int i = 0; i < BATCH_SIZE; ++i) {
+    EXPECT_OK(jesenrpc_request_create("double", &batch->items[i]));
+    if (i % 3 != 0) {
+      jesenrpc_id_t id = {0};
+      EXPECT_OK(jesenrpc_id_set_number(&id, i));
+      EXPECT_OK(jesenrpc_request_set_id(batch->items[i], &id));
+    }
+  }
+
+  static const size_t thread_counts[] = {0, 4};
+  for (size_t t = 0; t < 2; ++t) {
+    jesenrpc_executor_t *executor = NULL;
+    EXPECT_OK(jesenrpc_executor_create(thread_counts[t], &executor));
+    jesenrpc_message_t reply;
+    EXPECT_OK(jesenrpc_executor_dispatch_message(executor, &dispatcher, &msg,
+                                                 &reply));
+    assert(reply.kind == JESENRPC_MESSAGE_RESPONSE_BATCH);
+    jesenrpc_response_batch_t *responses = &reply.as.response_batch;
+    size_t k = 0;
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+      if (i % 3 == 0) {
+        continue;
+      }
+      jesenrpc_response_t *resp = responses->items[k++];
+      assert(resp->id.value.number == i);
+      assert(!resp->error);
+      int32_t twice = 0;
+      EXPECT_OK(jesen_object_get_int32(resp->result, "twice", &twice));
+      assert(twice == 2 * i);
+    }
+    assert(k == responses->count);
+    EXPECT_OK(jesenrpc_message_destroy(&reply));
+
+    /* A batch of only notifications produces no reply at all. */
+    jesenrpc_request_batch_t silent = {.items = batch->items, .count = 1};
+    jesenrpc_response_batch_t none;
+    EXPECT_OK(jesenrpc_executor_dispatch_batch(executor, &dispatcher, &silent,
+                                               &none));
+    assert(none.count == 0 && none.items == NULL);
+    silent.count = 0;
+    assert(jesenrpc_executor_dispatch_batch(executor, &dispatcher, &silent,
+                                            &none) == JESENRPC_ERR_VALIDATION);
+    EXPECT_OK(jesenrpc_executor_destroy(executor));
+  }
+
+  EXPECT_OK(jesenrpc_message_destroy(&msg));
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+}
+
+static void test_peek_kind_scans_envelope_only(void) {
+  jesenrpc_message_kind_t kind = JESENRPC_MESSAGE_UNKNOWN;
+
+  /* Members before the deciding key are skipped, escapes included. */
+  char response[] = "{\"jsonrpc\":\"2.0\",\"id\":{\"nested\":[1,\"}\"]},"
+                    "\"res\\u0075lt\":[]}";
+  EXPECT_OK(jesenrpc_message_peek_kind(response, strlen(response), &kind));
+  assert(kind == JESENRPC_MESSAGE_RESPONSE_SINGLE);
+
+  /* Nothing after the method key or past the first batch element is read. */
+  char request[] = "{\"method\":\"m\",\"params\":[1,2,";
+  EXPECT_OK(jesenrpc_message_peek_kind(request, strlen(request), &kind));
+  assert(kind == JESENRPC_MESSAGE_REQUEST_SINGLE);
+  char batch[] = " [ {\"id\":1,\"error\":{}}, not json";
+  EXPECT_OK(jesenrpc_message_peek_kind(batch, strlen(batch), &kind));
+  assert(kind == JESENRPC_MESSAGE_RESPONSE_BATCH);
+
+  char no_kind[] = "{\"jsonrpc\":\"2.0\",\"id\":1}";
+  assert(jesenrpc_message_peek_kind(no_kind, strlen(no_kind), &kind) ==
+         JESENRPC_ERR_VALIDATION);
+  char empty_batch[] = "[]";
+  assert(jesenrpc_message_peek_kind(empty_batch, 2, &kind) ==
+         JESENRPC_ERR_VALIDATION);
+  char scalar[] = "42";
+  assert(jesenrpc_message_peek_kind(scalar, 2, &kind) ==
+         JESENRPC_ERR_VALIDATION);
+  char truncated[] = "{\"jsonrpc\":\"2.";
+  assert(jesenrpc_message_peek_kind(truncated, strlen(truncated), &kind) ==
+         JESENRPC_ERR_PARSE);
+}
+
+static void test_lazy_params_forward_verbatim(void) {
+  static const char input[] =
+      "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"proxy\","
+      "\"params\":{\"path\": [1, 2.50, \"a\\u00e9\"]}}";
+  static const char raw[] = "{\"path\": [1, 2.50, \"a\\u00e9\"]}";
+
+  jesenrpc_arena_t arena;
+  EXPECT_OK(jesenrpc_arena_init(&arena, 0));
+  for (int use_arena = 0; use_arena < 2; ++use_arena) {
+    char buf[sizeof input];
+    memcpy(buf, input, sizeof input);
+    jesenrpc_parse_options_t opts = {0};
+    opts.arena = use_arena ? &arena : NULL;
+    opts.flags = JESENRPC_PARSE_LAZY_PARAMS | JESENRPC_PARSE_IN_SITU;
+    jesenrpc_request_t *req = NULL;
+    EXPECT_OK(jesenrpc_request_parse_ex(buf, sizeof input - 1, &opts, &req));
+    assert(req->params == NULL);
+    assert(req->raw_params.len == strlen(raw));
+    assert(memcmp(req->raw_params.data, raw, req->raw_params.len) == 0);
+
+    /* Forwarding copies the original bytes, spacing and escapes included. */
+    jesenrpc_buf_t out;
+    EXPECT_OK(jesenrpc_buf_init(&out));
+    EXPECT_OK(jesenrpc_request_serialize_to_buf(req, &out));
+    assert(strstr(out.data, raw) != NULL);
+    EXPECT_OK(jesenrpc_buf_destroy(&out));
+
+    jesen_node_t *params = NULL;
+    EXPECT_OK(jesenrpc_request_get_params(req, &params));
+    assert(params && params == req->params);
+    jesen_node_t *again = NULL;
+    EXPECT_OK(jesenrpc_request_get_params(req, &again));
+    assert(again == params);
+    /* Building the tree leaves the forwarded bytes alone. */
+    assert(memcmp(req->raw_params.data, raw, req->raw_params.len) == 0);
+
+    if (use_arena) {
+      EXPECT_OK(jesenrpc_arena_reset(&arena));
+    } else {
+      EXPECT_OK(jesenrpc_request_destroy(req));
+    }
+  }
+  EXPECT_OK(jesenrpc_arena_destroy(&arena));
+
+  /* Invalid params are still rejected up front. */
+  char bad[] = "{\"jsonrpc\":\"2.0\",\"method\":\"m\",\"params\":[1,}";
+  jesenrpc_parse_options_t opts = {0};
+  opts.flags = JESENRPC_PARSE_LAZY_PARAMS;
+  jesenrpc_request_t *req = NULL;
+  assert(jesenrpc_request_parse_ex(bad, strlen(bad), &opts, &req) ==
+         JESENRPC_ERR_PARSE);
+  char scalar[] = "{\"jsonrpc\":\"2.0\",\"method\":\"m\",\"params\":7}";
+  assert(jesenrpc_request_parse_ex(scalar, strlen(scalar), &opts, &req) ==
+         JESENRPC_ERR_VALIDATION);
+}
+
+static void test_raw_json_is_spliced_verbatim(void) {
+  static const char cached[] = "{\"rows\":[1,2,3],\"next\":null}";
+  jesenrpc_id_t id = {0};
+  EXPECT_OK(jesenrpc_id_set_number(&id, 5));
+  jesenrpc_response_t *resp = NULL;
+  EXPECT_OK(jesenrpc_response_create_with_id(&id, &resp));
+  assert(jesenrpc_response_set_result_raw(resp, "{\"a\":", 5) ==
+         JESENRPC_ERR_PARSE);
+  assert(jesenrpc_response_set_result_raw(resp, "1 2", 3) ==
+         JESENRPC_ERR_PARSE);
+  EXPECT_OK(jesenrpc_response_set_result_raw(resp, cached, strlen(cached)));
+  jesen_node_t *node = NULL;
+  EXPECT_OK(jesen_object_create(&node));
+  assert(jesenrpc_response_set_result(resp, node) ==
+         JESENRPC_ERR_INVALID_ARGS);
+  jesen_destroy(node);
+
+  char buf[128];
+  EXPECT_OK(jesenrpc_response_serialize(resp, buf, sizeof(buf)));
+  assert(strcmp(buf, "{\"jsonrpc\":\"2.0\",\"id\":5,\"result\":"
+                     "{\"rows\":[1,2,3],\"next\":null}}") == 0);
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+
+  jesenrpc_error_object_t *err_obj = NULL;
+  EXPECT_OK(jesenrpc_error_object_create(-32000, "Upstream failed", &err_obj));
+  EXPECT_OK(jesenrpc_error_object_set_data_raw(err_obj, " \"timeout\" ", 11));
+  EXPECT_OK(jesenrpc_response_create_with_id(&id, &resp));
+  EXPECT_OK(jesenrpc_response_set_error(resp, err_obj));
+  EXPECT_OK(jesenrpc_response_serialize(resp, buf, sizeof(buf)));
+  assert(strcmp(buf, "{\"jsonrpc\":\"2.0\",\"id\":5,\"error\":"
+                     "{\"code\":-32000,\"message\":\"Upstream failed\","
+                     "\"data\": \"timeout\" }}") == 0);
+  EXPECT_OK(jesenrpc_response_destroy(resp));
+
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("sum", &req));
+  assert(jesenrpc_request_set_params_raw(req, "3", 1) ==
+         JESENRPC_ERR_VALIDATION);
+  EXPECT_OK(jesenrpc_request_set_params_raw(req, "[1,2]", 5));
+  EXPECT_OK(jesenrpc_request_serialize(req, buf, sizeof(buf)));
+  assert(strcmp(buf, "{\"jsonrpc\":\"2.0\",\"method\":\"sum\","
+                     "\"params\":[1,2]}") == 0);
+  jesen_node_t *params = NULL;
+  EXPECT_OK(jesenrpc_request_get_params(req, &params));
+  size_t count = 0;
+  EXPECT_OK(jesen_array_size(params, &count));
+  assert(count == 2);
+  EXPECT_OK(jesenrpc_request_destroy(req));
+}
+
+static size_t gather_iov(const jesenrpc_iovec_t *iov, size_t count, char *out) {
+  size_t len = 0;
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(out + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static void test_serialize_iov_references_large_raw_values(void) {
+  static char big[1024];
+  big[0] = '[';
+  for (size_t i = 1; i < sizeof(big) - 2; i += 2) {
+    big[i] = '7';
+    big[i + 1] = ',';
+  }
+  big[sizeof(big) - 3] = '7';
+  big[sizeof(big) - 2] = ']';
+  size_t big_len = sizeof(big) - 1;
+
+  jesenrpc_response_t *resps[2] = {NULL, NULL};
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_OK(jesenrpc_response_create(i + 1, &resps[i]));
+    EXPECT_OK(jesenrpc_response_set_result_raw(resps[i], big, big_len));
+  }
+
+  jesenrpc_buf_t flat;
+  jesenrpc_buf_t scratch;
+  EXPECT_OK(jesenrpc_buf_init(&flat));
+  EXPECT_OK(jesenrpc_buf_init(&scratch));
+  static char gathered[4096];
+
+  /* Prefix, the caller's bytes, suffix. */
+  jesenrpc_iovec_t iov[8];
+  size_t count = 0;
+  assert(jesenrpc_response_serialize_iov(resps[0], &scratch, iov, 1,
+                                         &count) ==
+         JESENRPC_ERR_BUFFER_TOO_SMALL);
+  assert(count == 3);
+  EXPECT_OK(
+      jesenrpc_response_serialize_iov(resps[0], &scratch, iov, 8, &count));
+  assert(count == 3 && iov[1].iov_base == (void *)big);
+  EXPECT_OK(jesenrpc_response_serialize_to_buf(resps[0], &flat));
+  assert(gather_iov(iov, count, gathered) == flat.len);
+  assert(strcmp(gathered, flat.data) == 0);
+
+  EXPECT_OK(jesenrpc_response_batch_serialize_iov(resps, 2, &scratch, iov, 8,
+                                                  &count));
+  assert(count == 5);
+  EXPECT_OK(jesenrpc_buf_clear(&flat));
+  EXPECT_OK(jesenrpc_response_batch_serialize_to_buf(resps, 2, &flat));
+  assert(gather_iov(iov, count, gathered) == flat.len);
+  assert(strcmp(gathered, flat.data) == 0);
+
+  /* Small raw values are cheaper to copy than to reference. */
+  jesenrpc_request_t *req = NULL;
+  EXPECT_OK(jesenrpc_request_create("sum", &req));
+  EXPECT_OK(jesenrpc_request_set_params_raw(req, "[1,2]", 5));
+  EXPECT_OK(jesenrpc_request_serialize_iov(req, &scratch, iov, 8, &count));
+  assert(count == 1);
+  gather_iov(iov, count, gathered);
+  assert(strcmp(gathered, "{\"jsonrpc\":\"2.0\",\"method\":\"sum\","
+                          "\"params\":[1,2]}") == 0);
+
+  EXPECT_OK(jesenrpc_request_destroy(req));
+  EXPECT_OK(jesenrpc_response_destroy(resps[0]));
+  EXPECT_OK(jesenrpc_response_destroy(resps[1]));
+  EXPECT_OK(jesenrpc_buf_destroy(&scratch));
+  EXPECT_OK(jesenrpc_buf_destroy(&flat));
+}
+
+static void count_completion(const jesenrpc_response_t *response,
+                             void *user_data) {
+  (void)response;
+  ++*(unsigned char *)user_data;
+}
+
+static void test_client_matches_100k_in_flight_calls(void) {
+  enum { CALLS = 100000, STRING_CALLS = 1000 };
+  static unsigned char hits[CALLS + STRING_CALLS];
+  static char names[STRING_CALLS][16];
+  jesenrpc_client_t client;
+  EXPECT_OK(jesenrpc_client_init(&client, 0)); /* Exercise growth too. */
+
+  for (size_t i = 0; i < CALLS; ++i) {
+    jesenrpc_id_t id;
+    EXPECT_OK(jesenrpc_client_next_id(&client, &id));
+    assert(id.value.number == (int64_t)i + 1);
+    EXPECT_OK(jesenrpc_client_track(&client, &id, count_completion, &hits[i]));
+  }
+  for (size_t i = 0; i < STRING_CALLS; ++i) {
+    int len = snprintf(names[i], sizeof(names[i]), "call-%zu", i);
+    jesenrpc_id_t id = {.kind = JESENRPC_ID_STRING};
+    id.value.string.data = names[i];
+    id.value.string.len = (size_t)len;
+    EXPECT_OK(jesenrpc_client_track(&client, &id, count_completion,
+                                    &hits[CALLS + i]));
+  }
+  assert(client.pending == CALLS + STRING_CALLS);
+
+  jesenrpc_id_t dup = {.kind = JESENRPC_ID_NUMBER, .value.number = 77};
+  assert(jesenrpc_client_track(&client, &dup, count_completion, NULL) ==
+         JESENRPC_ERR_INVALID_ARGS);
+  EXPECT_OK(jesenrpc_client_cancel(&client, &dup));
+  assert(jesenrpc_client_cancel(&client, &dup) == JESENRPC_ERR_VALIDATION);
+
+  /* Complete in a scattered order; 7919 is prime, so every ID comes up. */
+  jesenrpc_response_t resp = {.jsonrpc = JESENRPC_JSONRPC_VERSION};
+  resp.id.kind = JESENRPC_ID_NUMBER;
+  for (size_t i = 0; i < CALLS; ++i) {
+    resp.id.value.number = (int64_t)((i * 7919) % CALLS) + 1;
+    jesenrpc_err_t err = jesenrpc_client_complete(&client, &resp);
+    assert(err == (resp.id.value.number == 77 ? JESENRPC_ERR_VALIDATION
+                                              : JESENRPC_ERR_NONE));
+  }
+
+  /* String IDs arrive as a batch, with one stranger mixed in. */
+  static jesenrpc_response_t string_resps[STRING_CALLS + 1];
+  static jesenrpc_response_t *items[STRING_CALLS + 1];
+  static char copies[STRING_CALLS][16];
+  for (size_t i = 0; i <= STRING_CALLS; ++i) {
+    string_resps[i].id.kind = JESENRPC_ID_STRING;
+    if (i < STRING_CALLS) {
+      memcpy(copies[i], names[i], sizeof(copies[i]));
+      string_resps[i].id.value.string.data = copies[i];
+      string_resps[i].id.value.string.len = strlen(copies[i]);
+    } else {
+      string_resps[i].id.value.string.data = "unknown";
+      string_resps[i].id.value.string.len = 7;
+    }
+    items[i] = &string_resps[i];
+  }
+  jesenrpc_response_batch_t batch = {.items = items,
+                                     .count = STRING_CALLS + 1};
+  size_t unmatched = 0;
+  EXPECT_OK(jesenrpc_client_complete_batch(&client, &batch, &unmatched));
+  assert(unmatched == 1);
+
+  assert(client.pending == 0);
+  for (size_t i = 0; i < CALLS + STRING_CALLS; ++i) {
+    assert(hits[i] == (i == 76 ? 0 : 1));
+  }
+  EXPECT_OK(jesenrpc_client_destroy(&client));
+}
+
+typedef struct {
+  const jesenrpc_client_t *client;
+  uint64_t fired_at;
+  int32_t code;
+  int fired;
+} timeout_probe_t;
+
+static void record_timeout(const jesenrpc_response_t *response,
+                           void *user_data) {
+  timeout_probe_t *probe = (timeout_probe_t *)user_data;
+  probe->fired_at = probe->client->now;
+  probe->code = response->error ? response->error->code : 0;
+  ++probe->fired;
+}
+
+static void test_client_timeouts_fire_on_their_tick(void) {
+  enum { CALLS = 2000 };
+  static timeout_probe_t probes[CALLS];
+  static uint64_t deadlines[CALLS];
+  const uint64_t start = 1000003;
+  jesenrpc_client_t client;
+  EXPECT_OK(jesenrpc_client_init(&client, CALLS));
+  EXPECT_OK(jesenrpc_client_advance(&client, start, NULL));
+  assert(client.now == start);
+
+  /* Spread deadlines over every wheel level, plus one past the top. */
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < CALLS; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    uint64_t timeout = (seed >> 8) % ((uint64_t)1 << (6 * (i % 4 + 1)));
+    if (i == CALLS - 1) {
+      timeout = ((uint64_t)1 << 24) + 4321;
+    }
+    jesenrpc_id_t id = {.kind = JESENRPC_ID_NUMBER,
+                        .value.number = (int64_t)i};
+    probes[i].client = &client;
+    EXPECT_OK(jesenrpc_client_track_timeout(&client, &id, timeout,
+                                            record_timeout, &probes[i]));
+    deadlines[i] = start + (timeout ? timeout : 1);
+  }
+
+  /* Cancel or answer some calls before they expire. */
+  jesenrpc_response_t resp = {.jsonrpc = JESENRPC_JSONRPC_VERSION};
+  resp.id.kind = JESENRPC_ID_NUMBER;
+  for (size_t i = 0; i < CALLS; i += 5) {
+    resp.id.value.number = (int64_t)i;
+    if (i % 2 == 0) {
+      EXPECT_OK(jesenrpc_client_cancel(&client, &resp.id));
+    } else {
+      EXPECT_OK(jesenrpc_client_complete(&client, &resp));
+    }
+  }
+
+  /* Advance in uneven steps; every call must fire exactly at its deadline. */
+  size_t expired_total = 0;
+  uint64_t now = start;
+  while (client.pending > 0) {
+    now += 1 + (now % 977);
+    size_t expired = 0;
+    EXPECT_OK(jesenrpc_client_advance(&client, now, &expired));
+    expired_total += expired;
+  }
+  for (size_t i = 0; i < CALLS; ++i) {
+    if (i % 5 == 0) {
+      assert(probes[i].fired == (i % 2 == 0 ? 0 : 1));
+      assert(i % 2 == 0 || probes[i].code == 0);
+      continue;
+    }
+    assert(probes[i].fired == 1);
+    assert(probes[i].fired_at == deadlines[i]);
+    assert(probes[i].code == JESENRPC_JSONRPC_ERROR_INTERNAL);
+  }
+  assert(expired_total == CALLS - CALLS / 5);
+  assert(client.timers == 0);
+
+  /* A timed-out ID no longer matches a late response. */
+  resp.id.value.number = 1;
+  assert(jesenrpc_client_complete(&client, &resp) == JESENRPC_ERR_VALIDATION);
+  EXPECT_OK(jesenrpc_client_destroy(&client));
+}
+
 int main(void) {
   test_request_roundtrip_with_params();
   test_notification_roundtrip();
@@ -290,6 +1652,27 @@ int main(void) {
   test_message_parse_request_batch_and_peek();
   test_message_parse_response_batch();
   test_message_empty_batch_is_validation();
+  test_serialize_writes_envelope_directly();
+  test_serialize_len_and_growable_buf();
+  test_arena_parse_and_reset();
+  test_in_situ_parse_borrows_input();
+  test_dispatcher_routes_and_reports_unknown();
+  test_int64_ids_are_lossless();
+  test_stream_decoder_handles_split_chunks();
+  test_frame_decoder_handles_split_chunks();
+  test_ndjson_splits_lines_in_place();
+  test_executor_preserves_batch_order();
+  test_peek_kind_scans_envelope_only();
+  test_lazy_params_forward_verbatim();
+  test_raw_json_is_spliced_verbatim();
+  test_serialize_iov_references_large_raw_values();
+  test_client_matches_100k_in_flight_calls();
+  test_client_timeouts_fire_on_their_tick();
+  test_stats_count_codec_activity();
+  test_latency_histograms_by_method();
+  test_hooks_trace_codec_entry_points();
+  test_allocator_routes_library_allocations();
+  test_pools_reuse_destroyed_structs();
   printf("All jesenrpc tests passed\n");
   return 0;
 }
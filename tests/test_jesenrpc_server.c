@@ -0,0 +1,260 @@
+/* The checks call the code under test, so keep them in Release builds. */
+#undef NDEBUG
+
+#include "../jesenrpc_server.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXPECT_OK(expr) assert((expr) == JESENRPC_ERR_NONE)
+
+static jesenrpc_err_t ping_handler(const jesenrpc_request_t *request,
+                                   jesenrpc_response_t *response,
+                                   void *user_data) {
+  (void)request;
+  ++*(int *)user_data;
+  if (!response) {
+    return JESENRPC_ERR_NONE;
+  }
+  return jesenrpc_response_set_result_raw(response, "\"pong\"", 6);
+}
+
+static void setup_dispatcher(jesenrpc_dispatcher_t *dispatcher, int *calls) {
+  EXPECT_OK(jesenrpc_dispatcher_init(dispatcher));
+  EXPECT_OK(
+      jesenrpc_dispatcher_register(dispatcher, "ping", ping_handler, calls));
+  EXPECT_OK(jesenrpc_dispatcher_freeze(dispatcher));
+}
+
+static void connect_socket(int fd, uint16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  /* Completes from the listen backlog before the server accepts. */
+  assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+}
+
+static int connect_tcp(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  connect_socket(fd, port);
+  return fd;
+}
+
+static void send_all(int fd, const char *data) {
+  size_t len = strlen(data);
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, 0);
+    assert(n > 0);
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+/* Polls the server until lines newline-terminated replies have arrived. */
+static void expect_replies(jesenrpc_server_t *server, int fd, int lines,
+                           const char *expected) {
+  char buf[4096];
+  size_t len = 0;
+  int seen = 0;
+  for (int round = 0; seen < lines && round < 1000; ++round) {
+    EXPECT_OK(jesenrpc_server_poll(server, 10));
+    ssize_t n = recv(fd, buf + len, sizeof(buf) - 1 - len, MSG_DONTWAIT);
+    if (n <= 0) {
+      continue;
+    }
+    for (ssize_t i = 0; i < n; ++i) {
+      seen += buf[len + (size_t)i] == '\n';
+    }
+    len += (size_t)n;
+  }
+  buf[len] = '\0';
+  if (strcmp(buf, expected) != 0) {
+    fprintf(stderr, "expected:\n%sgot:\n%s", expected, buf);
+  }
+  assert(strcmp(buf, expected) == 0);
+}
+
+/* Returns false when the backend is not available on this kernel or
+ * build. */
+static bool create_server(const jesenrpc_dispatcher_t *dispatcher,
+                          jesenrpc_server_options_t *options,
+                          jesenrpc_server_backend_t backend,
+                          jesenrpc_server_t **out_server) {
+  options->backend = backend;
+  jesenrpc_err_t err = jesenrpc_server_create(dispatcher, options, out_server);
+  if (err == JESENRPC_ERR_IO && backend != JESENRPC_SERVER_BACKEND_EPOLL) {
+    printf("Skipping io_uring backend: not available\n");
+    return false;
+  }
+  EXPECT_OK(err);
+  return true;
+}
+
+static void test_server_tcp_loopback(jesenrpc_server_backend_t backend) {
+  int calls = 0;
+  jesenrpc_dispatcher_t dispatcher;
+  setup_dispatcher(&dispatcher, &calls);
+  jesenrpc_server_options_t options = {0};
+  jesenrpc_server_t *server = NULL;
+  if (!create_server(&dispatcher, &options, backend, &server)) {
+    EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+    return;
+  }
+  uint16_t port = 0;
+  EXPECT_OK(jesenrpc_server_listen_tcp(server, "127.0.0.1", 0, &port));
+  assert(port != 0);
+
+  int fd = connect_tcp(port);
+  send_all(fd, "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"ping\"}");
+  expect_replies(server, fd, 1,
+                 "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":\"pong\"}\n");
+
+  /* A request split across reads, pipelined behind a notification. */
+  send_all(fd, "{\"jsonrpc\":\"2.0\",\"method\":\"ping\"}\n"
+               "{\"jsonrpc\":\"2.0\",\"id\":\"a\",");
+  EXPECT_OK(jesenrpc_server_poll(server, 10));
+  send_all(fd, "\"method\":\"ping\"}\n");
+  expect_replies(server, fd, 1,
+                 "{\"jsonrpc\":\"2.0\",\"id\":\"a\",\"result\":\"pong\"}\n");
+
+  /* Batches, unknown methods and garbage all get answers. */
+  send_all(fd, "[{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"ping\"},"
+               "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"nope\"}]"
+               "{\"jsonrpc\":\"2.0\",\"id\":4,\"method\":1}"
+               "{\"jsonrpc\":\"2.0\",\"id\":5,\"method\":\"ping\"");
+  send_all(fd, ",}");
+  expect_replies(
+      server, fd, 3,
+      "[{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":\"pong\"},"
+      "{\"jsonrpc\":\"2.0\",\"id\":3,\"error\":{\"code\":-32601,"
+      "\"message\":\"Method not found\"}}]\n"
+      "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":-32600,"
+      "\"message\":\"Invalid Request\"}}\n"
+      "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":-32700,"
+      "\"message\":\"Parse error\"}}\n");
+  assert(calls == 4);
+
+  close(fd);
+  EXPECT_OK(jesenrpc_server_poll(server, 10)); /* Sees the hang-up. */
+  EXPECT_OK(jesenrpc_server_destroy(server));
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+}
+
+static void test_server_unix_loopback(jesenrpc_server_backend_t backend) {
+  int calls = 0;
+  jesenrpc_dispatcher_t dispatcher;
+  setup_dispatcher(&dispatcher, &calls);
+  jesenrpc_server_options_t options = {.max_connections = 1};
+  jesenrpc_server_t *server = NULL;
+  if (!create_server(&dispatcher, &options, backend, &server)) {
+    EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+    return;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/jesenrpc-test-%d.sock",
+           (int)getpid());
+  EXPECT_OK(jesenrpc_server_listen_unix(server, addr.sun_path));
+
+  /* With max_connections reached, the second peer waits in the backlog
+   * until the first one leaves. */
+  int first = socket(AF_UNIX, SOCK_STREAM, 0);
+  int second = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(connect(first, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  EXPECT_OK(jesenrpc_server_poll(server, 10));
+  assert(connect(second, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  send_all(second, "{\"jsonrpc\":\"2.0\",\"id\":7,\"method\":\"ping\"}");
+  send_all(first, "{\"jsonrpc\":\"2.0\",\"id\":6,\"method\":\"ping\"}");
+  expect_replies(server, first, 1,
+                 "{\"jsonrpc\":\"2.0\",\"id\":6,\"result\":\"pong\"}\n");
+  assert(calls == 1);
+  close(first);
+  expect_replies(server, second, 1,
+                 "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":\"pong\"}\n");
+  close(second);
+
+  /* stop() wakes run() even with no socket activity. */
+  EXPECT_OK(jesenrpc_server_stop(server));
+  EXPECT_OK(jesenrpc_server_run(server));
+
+  EXPECT_OK(jesenrpc_server_destroy(server));
+  assert(access(addr.sun_path, F_OK) != 0);
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* epoll only: io_uring accepts do not reliably fail on RLIMIT_NOFILE. */
+static void test_server_backs_off_without_descriptors(
+    jesenrpc_server_backend_t backend) {
+  int calls = 0;
+  jesenrpc_dispatcher_t dispatcher;
+  setup_dispatcher(&dispatcher, &calls);
+  jesenrpc_server_options_t options = {0};
+  jesenrpc_server_t *server = NULL;
+  if (!create_server(&dispatcher, &options, backend, &server)) {
+    EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+    return;
+  }
+  uint16_t port = 0;
+  EXPECT_OK(jesenrpc_server_listen_tcp(server, "127.0.0.1", 0, &port));
+
+  /* With no descriptor left for accept(), the pending connection must not
+   * keep waking the loop while no connection is open to free one. */
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  struct rlimit saved;
+  assert(getrlimit(RLIMIT_NOFILE, &saved) == 0);
+  int lowest_free = dup(fd);
+  assert(lowest_free >= 0);
+  close(lowest_free);
+  struct rlimit tight = saved;
+  tight.rlim_cur = (rlim_t)lowest_free;
+  assert(setrlimit(RLIMIT_NOFILE, &tight) == 0);
+  connect_socket(fd, port);
+  EXPECT_OK(jesenrpc_server_poll(server, 10)); /* Fails to accept. */
+  double start = now_ms();
+  int polls = 0;
+  while (now_ms() - start < 50) {
+    EXPECT_OK(jesenrpc_server_poll(server, 10));
+    ++polls;
+  }
+  assert(polls <= 6);
+  assert(setrlimit(RLIMIT_NOFILE, &saved) == 0);
+
+  /* Accepting resumes once the retry delay has passed. */
+  send_all(fd, "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"ping\"}");
+  expect_replies(server, fd, 1,
+                 "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":\"pong\"}\n");
+  close(fd);
+  EXPECT_OK(jesenrpc_server_destroy(server));
+  EXPECT_OK(jesenrpc_dispatcher_destroy(&dispatcher));
+}
+
+int main(void) {
+  test_server_tcp_loopback(JESENRPC_SERVER_BACKEND_EPOLL);
+  test_server_unix_loopback(JESENRPC_SERVER_BACKEND_EPOLL);
+  test_server_tcp_loopback(JESENRPC_SERVER_BACKEND_IO_URING);
+  test_server_unix_loopback(JESENRPC_SERVER_BACKEND_IO_URING);
+  test_server_backs_off_without_descriptors(JESENRPC_SERVER_BACKEND_EPOLL);
+  printf("All jesenrpc_server tests passed\n");
+  return 0;
+}